@@ -0,0 +1,98 @@
+#include "arena.h"
+#include <stdlib.h>
+
+// Usual size for a chunk of the arena.  Bigger allocations get a chunk
+// of their own.
+#define CHUNK_SIZE 65536
+
+// Every block is aligned to a multiple of this.
+#define ALIGNMENT 16
+
+/** One contiguous piece of memory owned by an arena. */
+typedef struct ChunkTag {
+  // Next chunk in the arena's list.
+  struct ChunkTag *next;
+
+  // Number of bytes available in data.
+  size_t size;
+
+  // Storage for allocations, right after the header.
+  unsigned char *data;
+} Chunk;
+
+// Size of a chunk's header, rounded up so its data is aligned.
+#define HEADER_SIZE \
+  ( ( sizeof( Chunk ) + ALIGNMENT - 1 ) & ~(size_t) ( ALIGNMENT - 1 ) )
+
+/** Hidden implementation of the arena, a list of chunks we allocate
+    from in order. */
+struct ArenaTag {
+  // First chunk in the list, kept across resets.
+  Chunk *head;
+
+  // Chunk we're currently allocating from.
+  Chunk *current;
+
+  // Number of bytes used in the current chunk.
+  size_t used;
+};
+
+/** Make a new chunk.
+    @param size number of bytes it should be able to hold.
+    @return the new chunk.
+*/
+static Chunk *makeChunk( size_t size )
+{
+  Chunk *chunk = (Chunk *) malloc( HEADER_SIZE + size );
+  chunk->data = (unsigned char *) chunk + HEADER_SIZE;
+  chunk->next = NULL;
+  chunk->size = size;
+  return chunk;
+}
+
+Arena *makeArena()
+{
+  Arena *arena = (Arena *) malloc( sizeof( Arena ) );
+  arena->head = arena->current = makeChunk( CHUNK_SIZE );
+  arena->used = 0;
+  return arena;
+}
+
+void *arenaAlloc( Arena *arena, size_t size )
+{
+  size = ( size + ALIGNMENT - 1 ) & ~(size_t) ( ALIGNMENT - 1 );
+
+  // Move on to the next chunk if this one is full, making a new one
+  // if we've used all the chunks we have, or the next one is too small.
+  if ( arena->used + size > arena->current->size ) {
+    Chunk *next = arena->current->next;
+    if ( !next || next->size < size ) {
+      Chunk *chunk = makeChunk( size > CHUNK_SIZE ? size : CHUNK_SIZE );
+      chunk->next = next;
+      arena->current->next = chunk;
+      next = chunk;
+    }
+    arena->current = next;
+    arena->used = 0;
+  }
+
+  void *block = arena->current->data + arena->used;
+  arena->used += size;
+  return block;
+}
+
+void resetArena( Arena *arena )
+{
+  arena->current = arena->head;
+  arena->used = 0;
+}
+
+void freeArena( Arena *arena )
+{
+  while ( arena->head ) {
+    Chunk *next = arena->head->next;
+    free( arena->head );
+    arena->head = next;
+  }
+  free( arena );
+}
@@ -0,0 +1,45 @@
+/**
+  @file arena.h
+
+  A simple region allocator.  The parser builds each statement in an
+  arena, so the whole tree can be freed at once by resetting it,
+  instead of freeing nodes one at a time.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/**
+   Short typename for the Arena structure.  Its representation is
+   private to the allocator.
+*/
+typedef struct ArenaTag Arena;
+
+/** Make a new, empty arena.
+    @return new arena.  The caller must eventually free this with
+    freeArena().
+*/
+Arena *makeArena();
+
+/** Allocate a block of memory from the arena.  The block is aligned
+    for any type, and it stays valid until the arena is reset or freed.
+    @param arena arena to allocate from.
+    @param size number of bytes needed.
+    @return pointer to the new block.
+*/
+void *arenaAlloc( Arena *arena, size_t size );
+
+/** Free everything allocated from the arena, all at once.  The arena
+    keeps its memory, so it can be reused without calling malloc again.
+    @param arena arena to reset.
+*/
+void resetArena( Arena *arena );
+
+/** Free the arena and all the memory it holds.
+    @param arena arena to free.
+*/
+void freeArena( Arena *arena );
+
+#endif
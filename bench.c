@@ -0,0 +1,586 @@
+/**
+  @file bench.c
+
+  Microbenchmarks for the interpreter's hot primitives, each timed in
+  isolation: reading and writing variables by name at several context
+  sizes, evaluating every kind of expression, calling a trivial
+  function, appending to a string, tokenizing, and running a tight
+  while loop.  Each benchmark runs a few warmup repetitions,
+  then times many more, and reports the cost per operation as the
+  minimum, median, percentiles, maximum and mean over the repetitions.
+  Number formatting and parsing are timed against sprintf( "%f" ) and
+  sscanf( "%lf" ), for comparison, and vector arithmetic is timed with
+  every set of kernels the CPU supports.
+
+  A table goes to standard error, and the results go to standard
+  output, or the file named on the command line, as JSON.  The JSON
+  layout is versioned by its "schema" field, so results can be
+  compared across changes.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "expr.h"
+#include "stmt.h"
+#include "lex.h"
+#include "jit.h"
+#include "num.h"
+#include "vec.h"
+
+// Version of the JSON layout.  This has to change whenever the
+// meaning or names of the fields do.
+#define SCHEMA 1
+
+// Repetitions run before timing starts, and repetitions timed.
+#define WARMUP 5
+#define REPS 31
+
+// Most results the driver can record.
+#define MAX_RESULTS 64
+
+// Operations in one repetition of each kind of benchmark.
+#define CTXT_OPS 100000
+#define EXPR_OPS 100000
+#define LOOP_OPS 100000
+#define FORMAT_OPS 100000
+#define APPEND_OPS 100000
+#define VECTOR_OPS 10000000
+
+// Number of different numbers to format, a power of two.
+#define FORMAT_COUNT 1024
+
+// Approximate size of the generated source for the tokenizer benchmark.
+#define SOURCE_LEN ( 1 << 20 )
+
+/** Summary of one benchmark, in nanoseconds per operation. */
+typedef struct {
+  char name[ 32 ];
+  int size;
+  long ops;
+  double min, median, p90, p99, max, mean;
+} Result;
+
+/** Everything a benchmark needs to run one repetition. */
+typedef struct {
+  Context *ctxt;
+
+  // Variable names, and the order to visit them in.
+  char (*names)[ MAX_IDENT_LEN + 1 ];
+  int *order;
+
+  // Expression or statement to run.
+  Expr *expr;
+  Stmt *stmt;
+  int counter;
+
+  // Source file for the tokenizer, and how many tokens it holds.
+  char const *path;
+  long tokens;
+
+  // Numbers to format, and text of numbers to parse, FORMAT_COUNT of
+  // each.
+  double *numbers;
+  char (*texts)[ MAX_FORMATTED + 1 ];
+
+  // Operands and result for vector arithmetic, VECTOR_OPS elements
+  // each.
+  double *left, *right, *result;
+} State;
+
+/** A benchmark body, which runs ops operations.
+    @param st state to run with.
+    @param ops number of operations to run.
+    @return something computed from the results, so the work can't be
+    optimized away.
+*/
+typedef double (*RunFunc)( State *st, long ops );
+
+// Every result recorded so far.
+static Result results[ MAX_RESULTS ];
+static int resultCount = 0;
+
+// Sum of everything the benchmarks return, printed if it's ever
+// negative, so the compiler can't throw their work away.
+static double sink = 0;
+
+/** Return the current time, in nanoseconds.
+    @return time from a monotonic clock.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Comparison function for sorting times. */
+static int compareTimes( void const *a, void const *b )
+{
+  double x = *(double const *) a, y = *(double const *) b;
+  return x < y ? -1 : x > y;
+}
+
+/** Return a percentile of sorted samples, by the nearest-rank method.
+    @param samples sorted samples.
+    @param n number of samples.
+    @param pct percentile to return, from 0 to 100.
+    @return the sample at that percentile.
+*/
+static double percentile( double const *samples, int n, double pct )
+{
+  int rank = (int) ( pct / 100 * n + 0.999999 );
+  if ( rank < 1 )
+    rank = 1;
+  return samples[ ( rank > n ? n : rank ) - 1 ];
+}
+
+/** Run a benchmark, and record its result.
+    @param name name of the benchmark.
+    @param size size parameter, like the number of variables, or zero.
+    @param run benchmark body.
+    @param st state to run it with.
+    @param ops number of operations in each repetition.
+*/
+static void measure( char const *name, int size, RunFunc run, State *st,
+                     long ops )
+{
+  for ( int i = 0; i < WARMUP; i++ )
+    sink += run( st, ops );
+
+  double samples[ REPS ];
+  double total = 0;
+  for ( int i = 0; i < REPS; i++ ) {
+    double start = now();
+    sink += run( st, ops );
+    samples[ i ] = ( now() - start ) / ops;
+    total += samples[ i ];
+  }
+  qsort( samples, REPS, sizeof( double ), compareTimes );
+
+  Result *r = &results[ resultCount++ ];
+  snprintf( r->name, sizeof( r->name ), "%s", name );
+  r->size = size;
+  r->ops = ops;
+  r->min = samples[ 0 ];
+  r->median = percentile( samples, REPS, 50 );
+  r->p90 = percentile( samples, REPS, 90 );
+  r->p99 = percentile( samples, REPS, 99 );
+  r->max = samples[ REPS - 1 ];
+  r->mean = total / REPS;
+
+  fprintf( stderr, "%-20s %8d %10.2f %10.2f %10.2f %10.2f\n", r->name,
+           r->size, r->min, r->median, r->p90, r->p99 );
+}
+
+/** Add two arrays of numbers, element by element. */
+static double runVectorAdd( State *st, long ops )
+{
+  applyVectorOp( VEC_ADD, st->result, st->left, 1, st->right, 1, ops );
+  return st->result[ ops - 1 ];
+}
+
+/** Add up an array of numbers. */
+static double runVectorSum( State *st, long ops )
+{
+  return sumVector( st->left, ops );
+}
+
+/** Read variables by name, in a scattered order. */
+static double runGetVariable( State *st, long ops )
+{
+  double len = 0;
+  for ( long i = 0; i < ops; i++ )
+    len += strlen( getVariable( st->ctxt, st->names[ st->order[ i ] ] ) );
+  return len;
+}
+
+/** Write variables by name, in a scattered order. */
+static double runSetVariable( State *st, long ops )
+{
+  static char *values[] = { "one", "two", "three", "four" };
+  for ( long i = 0; i < ops; i++ )
+    setVariable( st->ctxt, st->names[ st->order[ i ] ], values[ i & 3 ] );
+  return 0;
+}
+
+/** Evaluate an expression over and over. */
+static double runEval( State *st, long ops )
+{
+  double sum = 0;
+  for ( long i = 0; i < ops; i++ ) {
+    Value v = st->expr->eval( st->expr, st->ctxt );
+    sum += v.type == NUM_VAL ? v.num : v.as.truth;
+  }
+  return sum;
+}
+
+/** Tokenize the generated source, once per repetition.  The operation
+    count has to be the number of tokens in it. */
+static double runTokens( State *st, long ops )
+{
+  Lexer *lex = openLexer( st->path );
+  Token tok;
+  long count = 0;
+  while ( parseToken( &tok, lex ) )
+    count++;
+  closeLexer( lex );
+  return count;
+}
+
+/** Format numbers with formatNumber(). */
+static double runFormat( State *st, long ops )
+{
+  char buffer[ MAX_FORMATTED + 1 ];
+  double len = 0;
+  for ( long i = 0; i < ops; i++ )
+    len += formatNumber( st->numbers[ i & ( FORMAT_COUNT - 1 ) ], buffer );
+  return len;
+}
+
+/** Format the same numbers with sprintf(), for comparison. */
+static double runSprintf( State *st, long ops )
+{
+  char buffer[ MAX_FORMATTED + 1 ];
+  double len = 0;
+  for ( long i = 0; i < ops; i++ )
+    len += sprintf( buffer, "%f", st->numbers[ i & ( FORMAT_COUNT - 1 ) ] );
+  return len;
+}
+
+/** Parse numbers with scanNumber(). */
+static double runScan( State *st, long ops )
+{
+  double sum = 0, num;
+  for ( long i = 0; i < ops; i++ ) {
+    scanNumber( st->texts[ i & ( FORMAT_COUNT - 1 ) ], &num );
+    sum += num;
+  }
+  return sum;
+}
+
+/** Parse the same text with sscanf(), for comparison. */
+static double runSscanf( State *st, long ops )
+{
+  double sum = 0, num;
+  for ( long i = 0; i < ops; i++ ) {
+    sscanf( st->texts[ i & ( FORMAT_COUNT - 1 ) ], "%lf", &num );
+    sum += num;
+  }
+  return sum;
+}
+
+/** Run the counter loop, whose condition stops it after ops
+    iterations. */
+static double runCounter( State *st, long ops )
+{
+  setSlot( st->ctxt, st->counter, makeNumberValue( 0 ) );
+  st->stmt->execute( st->stmt, st->ctxt );
+  return getSlot( st->ctxt, st->counter ).num;
+}
+
+/** Run a statement over and over. */
+static double runStmt( State *st, long ops )
+{
+  for ( long i = 0; i < ops; i++ )
+    st->stmt->execute( st->stmt, st->ctxt );
+  return 0;
+}
+
+/** Time getVariable() and setVariable() on a context with the given
+    number of variables. */
+static void benchContext( int n )
+{
+  State st = { 0 };
+  st.ctxt = makeContext();
+  st.names = malloc( n * sizeof( *st.names ) );
+  for ( int i = 0; i < n; i++ ) {
+    sprintf( st.names[ i ], "c%d", i );
+    setVariable( st.ctxt, st.names[ i ], "value" );
+  }
+
+  // Visit variables in a scattered order, so we're not just measuring
+  // the cache.
+  st.order = malloc( CTXT_OPS * sizeof( int ) );
+  srand( n );
+  for ( int i = 0; i < CTXT_OPS; i++ )
+    st.order[ i ] = rand() % n;
+
+  measure( "getVariable", n, runGetVariable, &st, CTXT_OPS );
+  measure( "setVariable", n, runSetVariable, &st, CTXT_OPS );
+
+  freeContext( st.ctxt );
+  free( st.order );
+  free( st.names );
+}
+
+/** Time one evaluation of each kind of expression. */
+static void benchExpressions()
+{
+  Arena *arena = makeArena();
+  State st = { 0 };
+  st.ctxt = makeContext();
+
+  // Operands: a number and a string in variables, and literals.
+  int x = variableSlot( "x" );
+  int s = variableSlot( "s" );
+  setSlot( st.ctxt, x, makeNumberValue( 7 ) );
+  setVariable( st.ctxt, "s", "seven" );
+  Expr *num = makeLiteral( arena, "3", 1 );
+  Expr *empty = makeLiteral( arena, "", 0 );
+
+  struct {
+    char const *name;
+    Expr *expr;
+  } cases[] = {
+    { "evalLiteral", num },
+    { "evalVar", makeVariable( arena, x ) },
+    { "evalSum", makeSum( arena, makeVariable( arena, x ), num ) },
+    { "evalDiff", makeDifference( arena, makeVariable( arena, x ), num ) },
+    { "evalProd", makeProduct( arena, makeVariable( arena, x ), num ) },
+    { "evalQuot", makeQuotient( arena, makeVariable( arena, x ), num ) },
+    { "evalLess", makeLess( arena, makeVariable( arena, x ), num ) },
+    { "evalEqu", makeEquals( arena, makeVariable( arena, x ), num ) },
+    { "evalEqu/string", makeEquals( arena, makeVariable( arena, s ), num ) },
+    { "evalAnd", makeAnd( arena, makeVariable( arena, s ), empty ) },
+    { "evalOr", makeOr( arena, empty, makeVariable( arena, s ) ) },
+  };
+
+  for ( int i = 0; i < sizeof( cases ) / sizeof( cases[ 0 ] ); i++ ) {
+    st.expr = cases[ i ].expr;
+    measure( cases[ i ].name, 0, runEval, &st, EXPR_OPS );
+  }
+
+  freeContext( st.ctxt );
+  freeArena( arena );
+}
+
+/** Time a call to a function that just adds one to its parameter,
+    including evaluating the argument and the addition. */
+static void benchCall()
+{
+  Arena *arena = makeArena();
+  State st = { 0 };
+  st.ctxt = makeContext();
+
+  // function inc ( a ) { return a + 1 ; }
+  int fn = functionSlot( "inc" );
+  Stmt *body = makeReturn( arena, makeSum( arena, makeLocal( arena, 0 ),
+                                           makeLiteral( arena, "1", 1 ) ) );
+  Stmt *def = makeFunction( arena, fn, 1, body );
+  def->execute( def, st.ctxt );
+
+  int x = variableSlot( "x" );
+  setSlot( st.ctxt, x, makeNumberValue( 7 ) );
+  Expr *arg = makeVariable( arena, x );
+  st.expr = makeInvoke( arena, fn, &arg, 1 );
+  measure( "evalInvoke", 0, runEval, &st, EXPR_OPS );
+
+  freeContext( st.ctxt );
+  freeArena( arena );
+}
+
+/** Time appending a character to a string in a variable.  The string
+    keeps growing, to a few megabytes by the last repetition, and each
+    append should cost the same however long it gets. */
+static void benchAppend()
+{
+  Arena *arena = makeArena();
+  State st = { 0 };
+  st.ctxt = makeContext();
+
+  int s = variableSlot( "s" );
+  st.stmt = makeAssignment( arena, s,
+                            makeConcat( arena, makeVariable( arena, s ),
+                                        makeLiteral( arena, "x", 1 ) ) );
+  measure( "executeAssign/append", 0, runStmt, &st, APPEND_OPS );
+
+  freeContext( st.ctxt );
+  freeArena( arena );
+}
+
+/** Time the tokenizer on a generated program. */
+static void benchTokens()
+{
+  // Typical statements, repeated to fill the source.
+  static char const *lines[] = {
+    "i = i + 1 ;\n",
+    "while ( i < n * 2 ) { s = s + ( k * k - 1 ) / ( k + 2 ) ; }\n",
+    "if ( name == \"value\" && flag ) { print \"text\\n\" ; }\n",
+    "total = total - 12.5 ;\n",
+  };
+
+  char path[] = "/tmp/benchXXXXXX";
+  int fd = mkstemp( path );
+  FILE *fp = fd >= 0 ? fdopen( fd, "w" ) : NULL;
+  if ( !fp ) {
+    fprintf( stderr, "Can't make a source file for the tokenizer\n" );
+    return;
+  }
+  for ( long len = 0; len < SOURCE_LEN; )
+    for ( int i = 0; i < sizeof( lines ) / sizeof( lines[ 0 ] ); i++ )
+      len += fputs( lines[ i ], fp ) >= 0 ? strlen( lines[ i ] ) : 0;
+  fclose( fp );
+
+  State st = { 0 };
+  st.path = path;
+  st.tokens = (long) runTokens( &st, 0 );
+  measure( "parseToken", 0, runTokens, &st, st.tokens );
+  unlink( path );
+}
+
+/** Time formatting numbers the way print does, and parsing them back,
+    for numbers of the sizes programs usually compute. */
+static void benchFormat()
+{
+  State st = { 0 };
+  st.numbers = malloc( FORMAT_COUNT * sizeof( double ) );
+  st.texts = malloc( FORMAT_COUNT * sizeof( *st.texts ) );
+  srand( FORMAT_COUNT );
+  for ( int i = 0; i < FORMAT_COUNT; i++ ) {
+    // A mix of counters, sums of money and results of division.
+    switch ( i % 3 ) {
+    case 0:
+      st.numbers[ i ] = rand() % 100000;
+      break;
+    case 1:
+      st.numbers[ i ] = ( rand() % 10000000 - 5000000 ) / 100.0;
+      break;
+    default:
+      st.numbers[ i ] = (double) rand() / ( rand() % 1000 + 1 );
+    }
+    formatNumber( st.numbers[ i ], st.texts[ i ] );
+  }
+
+  measure( "formatNumber", 0, runFormat, &st, FORMAT_OPS );
+  measure( "sprintf %f", 0, runSprintf, &st, FORMAT_OPS );
+  measure( "scanNumber", 0, runScan, &st, FORMAT_OPS );
+  measure( "sscanf %lf", 0, runSscanf, &st, FORMAT_OPS );
+  free( st.texts );
+  free( st.numbers );
+}
+
+/** Time adding arrays too big for the cache, and adding up an array,
+    with each set of vector kernels the CPU supports. */
+static void benchVectors()
+{
+  State st = { 0 };
+  st.left = malloc( VECTOR_OPS * sizeof( double ) );
+  st.right = malloc( VECTOR_OPS * sizeof( double ) );
+  st.result = malloc( VECTOR_OPS * sizeof( double ) );
+  for ( int i = 0; i < VECTOR_OPS; i++ ) {
+    st.left[ i ] = i;
+    st.right[ i ] = i / 3.0;
+  }
+
+  static char const *const sets[] = { "scalar", "sse2", "avx2" };
+  for ( int i = 0; i < sizeof( sets ) / sizeof( sets[ 0 ] ); i++ ) {
+    if ( !selectVectorKernels( sets[ i ] ) )
+      continue;
+    char name[ 32 ];
+    snprintf( name, sizeof( name ), "vector add/%s", sets[ i ] );
+    measure( name, 0, runVectorAdd, &st, VECTOR_OPS );
+    snprintf( name, sizeof( name ), "vector sum/%s", sets[ i ] );
+    measure( name, 0, runVectorSum, &st, VECTOR_OPS );
+  }
+
+  free( st.result );
+  free( st.right );
+  free( st.left );
+}
+
+/** Time each iteration of while ( i < ops ) { i = i + 1 ; }.
+    @param name name of the benchmark.
+*/
+static void benchLoop( char const *name )
+{
+  Arena *arena = makeArena();
+  State st = { 0 };
+  st.ctxt = makeContext();
+  st.counter = variableSlot( "i" );
+
+  char bound[ 32 ];
+  int len = sprintf( bound, "%d", LOOP_OPS );
+  Expr *cond = makeLess( arena, makeVariable( arena, st.counter ),
+                         makeLiteral( arena, bound, len ) );
+  Stmt *body = makeAssignment( arena, st.counter,
+                               makeSum( arena,
+                                        makeVariable( arena, st.counter ),
+                                        makeLiteral( arena, "1", 1 ) ) );
+  st.stmt = makeWhile( arena, cond, body );
+
+  measure( name, 0, runCounter, &st, LOOP_OPS );
+
+  freeLoops();
+  freeContext( st.ctxt );
+  freeArena( arena );
+}
+
+/** Write every result as JSON.
+    @param fp stream to write to.
+*/
+static void writeJson( FILE *fp )
+{
+  fprintf( fp, "{\n  \"schema\": %d,\n  \"warmup\": %d,\n"
+           "  \"repetitions\": %d,\n  \"unit\": \"ns/op\",\n"
+           "  \"results\": [", SCHEMA, WARMUP, REPS );
+  for ( int i = 0; i < resultCount; i++ ) {
+    Result const *r = &results[ i ];
+    fprintf( fp, "%s\n    { \"name\": \"%s\", \"size\": %d, \"ops\": %ld, "
+             "\"min\": %.3f, \"median\": %.3f, \"p90\": %.3f, "
+             "\"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f }",
+             i ? "," : "", r->name, r->size, r->ops, r->min, r->median,
+             r->p90, r->p99, r->max, r->mean );
+  }
+  fprintf( fp, "\n  ]\n}\n" );
+}
+
+/**
+  Run every benchmark, then write the results.
+
+  @param argc the number of command line arguments
+  @param *argv an array of arguments, optionally naming the JSON file
+  @return EXIT_SUCCESS, or EXIT_FAILURE if the results can't be written
+*/
+int main( int argc, char *argv[] )
+{
+  if ( argc > 2 ) {
+    fprintf( stderr, "usage: bench [results-file]\n" );
+    return EXIT_FAILURE;
+  }
+
+  fprintf( stderr, "%-20s %8s %10s %10s %10s %10s\n", "benchmark", "size",
+           "min ns", "median ns", "p90 ns", "p99 ns" );
+
+  for ( int n = 10; n <= 100000; n *= 100 )
+    benchContext( n );
+  benchExpressions();
+  benchCall();
+  benchAppend();
+  benchTokens();
+  benchFormat();
+  benchVectors();
+
+  // Compiled first, since turning the code generator off is for good.
+  benchLoop( "executeWhile/jit" );
+  disableJit();
+  benchLoop( "executeWhile" );
+
+  FILE *fp = argc == 2 ? fopen( argv[ 1 ], "w" ) : stdout;
+  if ( !fp ) {
+    fprintf( stderr, "Can't write results: %s\n", argv[ 1 ] );
+    return EXIT_FAILURE;
+  }
+  writeJson( fp );
+  if ( fp != stdout )
+    fclose( fp );
+
+  if ( sink < 0 )
+    printf( "%f\n", sink );
+  return EXIT_SUCCESS;
+}
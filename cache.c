@@ -0,0 +1,954 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// First four bytes of every cache file, "IPC1" when read on a
+// little-endian machine.  On a machine with the other byte order, this
+// won't match, so we'll never load a cache with the wrong layout.
+#define CACHE_MAGIC 0x31435049u
+
+// Version of the cache layout.  This has to change whenever the layout
+// does, or the ExprKind or StmtKind enums change.
+#define CACHE_VERSION 6
+
+// Added to a statement's kind to get its node kind, to keep statement
+// nodes separate from expression nodes.
+#define STMT_NODE 0x100
+
+// Added to the source file name to get the cache file name.
+#define CACHE_SUFFIX ".cache"
+
+// Initial capacity for a growing buffer, and the string table.
+#define INITIAL_CAPACITY 64
+
+/** Start of a cache file.  It's followed by these sections, in order:
+    stringCount CacheString records, varCount CacheName records,
+    funcCount CacheName records, nodeCount CacheNode records, kidCount child node indices and
+    stmtCount top-level statements as node indices, then textLen
+    characters of text for the strings and names. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  // Hash and length of the source this cache was made from.
+  uint64_t sourceHash;
+  uint64_t sourceLen;
+
+  // Number of records in each section.
+  uint32_t stringCount;
+  uint32_t varCount;
+  uint32_t nodeCount;
+  uint32_t kidCount;
+  uint32_t stmtCount;
+  uint32_t textLen;
+
+  // Checksum of everything after the header.
+  uint32_t checksum;
+  uint32_t funcCount;
+} CacheHeader;
+
+/** A literal string, with its value as a number. */
+typedef struct {
+  double num;
+
+  // Location of the string in the text section.
+  uint32_t offset;
+  uint32_t len;
+} CacheString;
+
+/** Name of a variable or function, null-terminated in the text
+    section.  Variables and functions are numbered by their slot when
+    the cache was written. */
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+} CacheName;
+
+/** A node of the flattened tree.  Nodes come after the nodes they
+    refer to, so a program can be rebuilt in one pass.  What a and b
+    mean depends on the kind:
+    LITERAL_EXPR: a is a string index.
+    VAR_EXPR: a is a variable index.
+    LOCAL_EXPR: a is the index of the local in its frame.
+    Binary operators: a and b are the left and right operands.
+    CALL_EXPR: a is the index of the function in the kid section,
+    followed by the arguments, and b is the number of arguments.
+    INVOKE_EXPR: the same as CALL_EXPR, with a function index in place
+    of the builtin.
+    PRINT_STMT, RETURN_STMT: a is the argument.
+    ASSIGN_STMT: a is a variable index and b is the expression.
+    LOCAL_ASSIGN_STMT: a is a local index and b is the expression.
+    IF_STMT, WHILE_STMT: a is the condition and b is the body.
+    COMPOUND_STMT: a is the index of the first child in the kid section
+    and b is the number of children.
+    ASSIGN_KEY_STMT: a is the index of the key, followed by the value,
+    in the kid section and b is a variable index.
+    LOCAL_KEY_STMT: the same as ASSIGN_KEY_STMT, with a local index.
+    FUNCTION_STMT: a is the index of the function index in the kid
+    section, followed by the number of parameters and the body.
+    Every node also records the source line it came from. */
+typedef struct {
+  uint32_t kind;
+  uint32_t a;
+  uint32_t b;
+  uint32_t line;
+} CacheNode;
+
+/** A resizable block of bytes, for building one section of the cache. */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+/** Entry in the table for finding strings already in the cache. */
+typedef struct {
+  String *str;
+  uint32_t index;
+} StringEntry;
+
+/** Hidden representation for a cache writer. */
+struct CacheWriterTag {
+  // Contents of each section of the cache, except the variable names,
+  // which are only known at the end.
+  Buffer strings;
+  Buffer nodes;
+  Buffer kids;
+  Buffer stmts;
+  Buffer text;
+
+  // Open addressing hash table from interned strings to their index in
+  // the strings section, kept at most half full.
+  StringEntry *table;
+  int tableCap;
+
+  // True if we saw something we can't cache, so we shouldn't write
+  // anything.
+  bool failed;
+};
+
+/** Compute a 64-bit hash for the given text (FNV-1a).
+    @param data bytes to hash.
+    @param len number of bytes.
+    @return hash code for the data.
+*/
+static uint64_t hashSource( char const *data, size_t len )
+{
+  uint64_t h = 14695981039346656037ull;
+  for ( size_t i = 0; i < len; i++ ) {
+    h ^= (unsigned char) data[ i ];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+char *cachePath( char const *path )
+{
+  char *name = (char *) malloc( strlen( path ) + strlen( CACHE_SUFFIX ) + 1 );
+  return strcat( strcpy( name, path ), CACHE_SUFFIX );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Writing
+
+/** Add bytes to the end of a buffer, growing it if necessary.
+    @param buf buffer to add to.
+    @param data bytes to add.
+    @param size number of bytes.
+    @return offset in the buffer where the bytes were added.
+*/
+static size_t append( Buffer *buf, void const *data, size_t size )
+{
+  if ( size == 0 )
+    return buf->len;
+
+  if ( buf->len + size > buf->cap ) {
+    if ( buf->cap == 0 )
+      buf->cap = INITIAL_CAPACITY;
+    while ( buf->len + size > buf->cap )
+      buf->cap *= 2;
+    buf->data = (char *) realloc( buf->data, buf->cap );
+  }
+
+  memcpy( buf->data + buf->len, data, size );
+  buf->len += size;
+  return buf->len - size;
+}
+
+/** Add a node to the cache.
+    @param writer writer to add to.
+    @param kind kind of node.
+    @param a first operand.
+    @param b second operand.
+    @param line source line the node came from.
+    @return index of the new node.
+*/
+static uint32_t addNode( CacheWriter *writer, uint32_t kind, uint32_t a,
+                         uint32_t b, int line )
+{
+  CacheNode node = { kind, a, b, line };
+  return append( &writer->nodes, &node, sizeof( node ) ) / sizeof( node );
+}
+
+/** Double the capacity of the string table, rehashing everything in it.
+    @param writer writer with the table.
+*/
+static void growTable( CacheWriter *writer )
+{
+  int oldCap = writer->tableCap;
+  StringEntry *old = writer->table;
+
+  writer->tableCap = oldCap ? oldCap * 2 : INITIAL_CAPACITY;
+  writer->table = (StringEntry *) calloc( writer->tableCap,
+                                          sizeof( StringEntry ) );
+  for ( int i = 0; i < oldCap; i++ )
+    if ( old[ i ].str ) {
+      int h = old[ i ].str->hash & ( writer->tableCap - 1 );
+      while ( writer->table[ h ].str )
+        h = ( h + 1 ) & ( writer->tableCap - 1 );
+      writer->table[ h ] = old[ i ];
+    }
+
+  free( old );
+}
+
+/** Return the index of a literal in the strings section, adding it if
+    it isn't there yet.
+    @param writer writer to add to.
+    @param expr literal expression.
+    @return index of the literal's string.
+*/
+static uint32_t addString( CacheWriter *writer, Expr *expr )
+{
+  String *str = literalString( expr );
+  uint32_t count = writer->strings.len / sizeof( CacheString );
+  if ( 2 * ( count + 1 ) > writer->tableCap )
+    growTable( writer );
+
+  // Look for the string in the table, or the empty entry where it
+  // should go.
+  int h = str->hash & ( writer->tableCap - 1 );
+  while ( writer->table[ h ].str ) {
+    if ( writer->table[ h ].str == str )
+      return writer->table[ h ].index;
+    h = ( h + 1 ) & ( writer->tableCap - 1 );
+  }
+
+  CacheString rec;
+  rec.num = literalNumber( expr );
+  rec.offset = append( &writer->text, str->text, str->len );
+  rec.len = str->len;
+  append( &writer->strings, &rec, sizeof( rec ) );
+
+  writer->table[ h ].str = str;
+  writer->table[ h ].index = count;
+  return count;
+}
+
+/** Add an expression and its operands to the cache.
+    @param writer writer to add to.
+    @param expr expression to add.
+    @return index of the expression's node.
+*/
+static uint32_t writeExpr( CacheWriter *writer, Expr *expr )
+{
+  switch ( expr->kind ) {
+  case LITERAL_EXPR:
+    // Only string literals come from the parser.
+    if ( literalValue( expr ).type != STR_VAL )
+      break;
+    return addNode( writer, expr->kind, addString( writer, expr ), 0,
+                    expr->line );
+
+  case VAR_EXPR:
+  case LOCAL_EXPR:
+    return addNode( writer, expr->kind, variableExprSlot( expr ), 0,
+                    expr->line );
+
+  case SUM_EXPR:
+  case DIFF_EXPR:
+  case PROD_EXPR:
+  case QUOT_EXPR:
+  case LESS_EXPR:
+  case EQU_EXPR:
+  case AND_EXPR:
+  case OR_EXPR:
+  case CONCAT_EXPR:
+  case INDEX_EXPR: {
+    uint32_t left = writeExpr( writer, binaryLeft( expr ) );
+    uint32_t right = writeExpr( writer, binaryRight( expr ) );
+    return addNode( writer, expr->kind, left, right, expr->line );
+  }
+
+  case CALL_EXPR:
+  case INVOKE_EXPR: {
+    // Arguments have to be written before we can list them together.
+    int argc = callArgCount( expr );
+    uint32_t *list = (uint32_t *) malloc( ( argc + 1 ) * sizeof( uint32_t ) );
+    list[ 0 ] = expr->kind == CALL_EXPR ? callFunction( expr ) :
+      invokedFunction( expr );
+    for ( int i = 0; i < argc; i++ )
+      list[ i + 1 ] = writeExpr( writer, callArg( expr, i ) );
+
+    uint32_t first = writer->kids.len / sizeof( uint32_t );
+    append( &writer->kids, list, ( argc + 1 ) * sizeof( uint32_t ) );
+    free( list );
+    return addNode( writer, expr->kind, first, argc, expr->line );
+  }
+
+  default:
+    break;
+  }
+
+  // We don't know how to save this expression.
+  writer->failed = true;
+  return 0;
+}
+
+/** Add a statement, and everything it contains, to the cache.
+    @param writer writer to add to.
+    @param stmt statement to add.
+    @return index of the statement's node.
+*/
+static uint32_t writeStmt( CacheWriter *writer, Stmt *stmt )
+{
+  uint32_t kind = STMT_NODE + stmt->kind;
+
+  switch ( stmt->kind ) {
+  case PRINT_STMT:
+  case RETURN_STMT:
+    return addNode( writer, kind, writeExpr( writer, stmtExpr( stmt ) ), 0,
+                    stmt->line );
+
+  case ASSIGN_STMT:
+  case LOCAL_ASSIGN_STMT:
+    return addNode( writer, kind, assignSlot( stmt ),
+                    writeExpr( writer, stmtExpr( stmt ) ), stmt->line );
+
+  case ASSIGN_KEY_STMT:
+  case LOCAL_KEY_STMT: {
+    uint32_t pair[ 2 ] = { writeExpr( writer, assignKey( stmt ) ),
+                           writeExpr( writer, stmtExpr( stmt ) ) };
+    uint32_t first = writer->kids.len / sizeof( uint32_t );
+    append( &writer->kids, pair, sizeof( pair ) );
+    return addNode( writer, kind, first, assignSlot( stmt ), stmt->line );
+  }
+
+  case IF_STMT:
+  case WHILE_STMT: {
+    uint32_t cond = writeExpr( writer, stmtExpr( stmt ) );
+    uint32_t body = writeStmt( writer, stmtBody( stmt ) );
+    return addNode( writer, kind, cond, body, stmt->line );
+  }
+
+  case FUNCTION_STMT: {
+    uint32_t list[ 3 ] = { definedFunction( stmt ), functionParams( stmt ),
+                           writeStmt( writer, stmtBody( stmt ) ) };
+    uint32_t first = writer->kids.len / sizeof( uint32_t );
+    append( &writer->kids, list, sizeof( list ) );
+    return addNode( writer, kind, first, 0, stmt->line );
+  }
+
+  case COMPOUND_STMT: {
+    // Children have to be written before we can list them together.
+    int len = compoundLength( stmt );
+    uint32_t *list = (uint32_t *) malloc( ( len + 1 ) * sizeof( uint32_t ) );
+    for ( int i = 0; i < len; i++ )
+      list[ i ] = writeStmt( writer, compoundStmt( stmt, i ) );
+
+    uint32_t first = writer->kids.len / sizeof( uint32_t );
+    append( &writer->kids, list, len * sizeof( uint32_t ) );
+    free( list );
+    return addNode( writer, kind, first, len, stmt->line );
+  }
+
+  default:
+    writer->failed = true;
+    return 0;
+  }
+}
+
+CacheWriter *makeCacheWriter()
+{
+  return (CacheWriter *) calloc( 1, sizeof( CacheWriter ) );
+}
+
+void cacheStmt( CacheWriter *writer, Stmt *stmt )
+{
+  uint32_t index = writeStmt( writer, stmt );
+  append( &writer->stmts, &index, sizeof( index ) );
+}
+
+/** Add a name to a section of variable or function names.
+    @param writer writer holding the text section.
+    @param names section to add the name to.
+    @param name name to add.
+*/
+static void addName( CacheWriter *writer, Buffer *names, char const *name )
+{
+  CacheName rec;
+  rec.len = strlen( name );
+  rec.offset = append( &writer->text, name, rec.len + 1 );
+  append( names, &rec, sizeof( rec ) );
+}
+
+/** Compute a checksum over a block of bytes, continuing from the
+    checksum of whatever came before it (32-bit FNV-1a).
+    @param sum checksum so far.
+    @param data bytes to add.
+    @param len number of bytes.
+    @return checksum including data.
+*/
+static uint32_t checksum( uint32_t sum, void const *data, size_t len )
+{
+  unsigned char const *bytes = (unsigned char const *) data;
+  for ( size_t i = 0; i < len; i++ ) {
+    sum ^= bytes[ i ];
+    sum *= 16777619u;
+  }
+  return sum;
+}
+
+void writeCache( CacheWriter *writer, char const *path,
+                 char const *source, size_t len )
+{
+  if ( writer->failed )
+    return;
+
+  // Now that the whole program has been parsed, we know all the
+  // variable and function names.
+  Buffer names = { NULL, 0, 0 };
+  for ( int slot = 0; slot < slotCount(); slot++ )
+    addName( writer, &names, slotName( slot ) );
+  Buffer funcs = { NULL, 0, 0 };
+  for ( int fn = 0; fn < functionCount(); fn++ )
+    addName( writer, &funcs, functionName( fn ) );
+
+  Buffer const *sections[] = {
+    &writer->strings, &names, &funcs, &writer->nodes, &writer->kids,
+    &writer->stmts, &writer->text
+  };
+  int sectionCount = sizeof( sections ) / sizeof( sections[ 0 ] );
+
+  CacheHeader head;
+  memset( &head, 0, sizeof( head ) );
+  head.magic = CACHE_MAGIC;
+  head.version = CACHE_VERSION;
+  head.sourceHash = hashSource( source, len );
+  head.sourceLen = len;
+  head.stringCount = writer->strings.len / sizeof( CacheString );
+  head.varCount = names.len / sizeof( CacheName );
+  head.funcCount = funcs.len / sizeof( CacheName );
+  head.nodeCount = writer->nodes.len / sizeof( CacheNode );
+  head.kidCount = writer->kids.len / sizeof( uint32_t );
+  head.stmtCount = writer->stmts.len / sizeof( uint32_t );
+  head.textLen = writer->text.len;
+  head.checksum = 2166136261u;
+  for ( int i = 0; i < sectionCount; i++ )
+    head.checksum = checksum( head.checksum, sections[ i ]->data,
+                              sections[ i ]->len );
+
+  // Write to a temporary file, then rename it, so nothing ever sees a
+  // partly written cache.  Each writer gets a file of its own, so
+  // batch threads or other processes writing the same cache at once
+  // don't write over each other's.  mkstemp() makes the file private,
+  // but the cache is no more secret than the source.
+  char *temp = (char *) malloc( strlen( path ) + 8 );
+  strcat( strcpy( temp, path ), ".XXXXXX" );
+  int fd = mkstemp( temp );
+  FILE *fp = NULL;
+  if ( fd >= 0 ) {
+    fchmod( fd, 0644 );
+    fp = fdopen( fd, "wb" );
+    if ( !fp ) {
+      close( fd );
+      remove( temp );
+    }
+  }
+  if ( fp ) {
+    bool ok = fwrite( &head, sizeof( head ), 1, fp ) == 1;
+    for ( int i = 0; i < sectionCount; i++ )
+      if ( sections[ i ]->len )
+        ok = ok && fwrite( sections[ i ]->data, sections[ i ]->len, 1, fp ) == 1;
+    ok = fclose( fp ) == 0 && ok;
+
+    if ( !ok || rename( temp, path ) != 0 )
+      remove( temp );
+  }
+
+  free( temp );
+  free( names.data );
+  free( funcs.data );
+}
+
+void freeCacheWriter( CacheWriter *writer )
+{
+  free( writer->strings.data );
+  free( writer->nodes.data );
+  free( writer->kids.data );
+  free( writer->stmts.data );
+  free( writer->text.data );
+  free( writer->table );
+  free( writer );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loading
+
+/** Pointers to the sections of a mapped cache file. */
+typedef struct {
+  CacheHeader const *head;
+  CacheString const *strings;
+  CacheName const *names;
+  CacheName const *funcs;
+  CacheNode const *nodes;
+  uint32_t const *kids;
+  uint32_t const *stmts;
+  char const *text;
+} CacheFile;
+
+/** Find the sections of a cache file, and make sure it's the right
+    size for the counts in its header.
+    @param file sections of the file, filled in by this function.
+    @param data contents of the file.
+    @param size size of the file.
+    @return true if the file has a good header, and is the right size.
+*/
+static bool findSections( CacheFile *file, char const *data, size_t size )
+{
+  if ( size < sizeof( CacheHeader ) )
+    return false;
+  CacheHeader const *head = (CacheHeader const *) data;
+  if ( head->magic != CACHE_MAGIC || head->version != CACHE_VERSION )
+    return false;
+
+  // Add up the section sizes in 64 bits, so they can't overflow.
+  uint64_t pos = sizeof( CacheHeader );
+  file->head = head;
+  file->strings = (CacheString const *) ( data + pos );
+  pos += (uint64_t) head->stringCount * sizeof( CacheString );
+  file->names = (CacheName const *) ( data + pos );
+  pos += (uint64_t) head->varCount * sizeof( CacheName );
+  file->funcs = (CacheName const *) ( data + pos );
+  pos += (uint64_t) head->funcCount * sizeof( CacheName );
+  file->nodes = (CacheNode const *) ( data + pos );
+  pos += (uint64_t) head->nodeCount * sizeof( CacheNode );
+  file->kids = (uint32_t const *) ( data + pos );
+  pos += (uint64_t) head->kidCount * sizeof( uint32_t );
+  file->stmts = (uint32_t const *) ( data + pos );
+  pos += (uint64_t) head->stmtCount * sizeof( uint32_t );
+  file->text = data + pos;
+  pos += head->textLen;
+
+  return pos == size;
+}
+
+/** Return true if a node index refers to an earlier expression node.
+    @param file cache file to check.
+    @param ref node index to check.
+    @param limit index of the node making the reference.
+    @return true if ref is a good reference to an expression.
+*/
+static bool isExprRef( CacheFile const *file, uint32_t ref, uint32_t limit )
+{
+  return ref < limit && file->nodes[ ref ].kind < STMT_NODE;
+}
+
+/** Return true if a node index refers to an earlier statement node.
+    @param file cache file to check.
+    @param ref node index to check.
+    @param limit index of the node making the reference.
+    @return true if ref is a good reference to a statement.
+*/
+static bool isStmtRef( CacheFile const *file, uint32_t ref, uint32_t limit )
+{
+  return ref < limit && file->nodes[ ref ].kind >= STMT_NODE;
+}
+
+/** Return true if a name record holds a null-terminated name of a
+    legal length.
+    @param file cache file to check.
+    @param name record to check.
+    @return true if the name is good.
+*/
+static bool validName( CacheFile const *file, CacheName const *name )
+{
+  uint32_t textLen = file->head->textLen;
+  return name->len <= MAX_IDENT_LEN && name->offset < textLen &&
+    name->len < textLen - name->offset &&
+    memchr( file->text + name->offset, '\0', name->len + 1 ) ==
+    file->text + name->offset + name->len;
+}
+
+// Ways a node can be reached from the top-level statements, for
+// validScopes().
+#define AT_TOP 1
+#define OUTSIDE_FUNCTION 2
+#define INSIDE_FUNCTION 4
+
+/** Mark a child of a node with how it's reached.
+    @param where how each node is reached.
+    @param kid index of the child.
+    @param from how its parent is reached.
+*/
+static void markKid( unsigned char *where, uint32_t kid, unsigned char from )
+{
+  where[ kid ] |= ( from & INSIDE_FUNCTION ) |
+    ( from & ( AT_TOP | OUTSIDE_FUNCTION ) ? OUTSIDE_FUNCTION : 0 );
+}
+
+/** Make sure functions are only defined by top-level statements, and
+    that locals and returns only appear inside them, and global
+    assignments only outside them, the way the parser builds programs.
+    The records must already have been checked.
+    @param file cache file to check.
+    @return true if every node is used where it's allowed.
+*/
+static bool validScopes( CacheFile const *file )
+{
+  CacheHeader const *head = file->head;
+  unsigned char *where = (unsigned char *) calloc( head->nodeCount + 1, 1 );
+  for ( uint32_t i = 0; i < head->stmtCount; i++ )
+    where[ file->stmts[ i ] ] |= AT_TOP;
+
+  // Nodes only refer to nodes before them, so going backward reaches
+  // every parent before its children.
+  bool ok = true;
+  for ( uint32_t i = head->nodeCount; ok && i-- > 0; ) {
+    CacheNode const *node = &file->nodes[ i ];
+    unsigned char from = where[ i ];
+    switch ( node->kind ) {
+    case LITERAL_EXPR:
+    case VAR_EXPR:
+      break;
+    case LOCAL_EXPR:
+      ok = from == INSIDE_FUNCTION;
+      break;
+    case CALL_EXPR:
+    case INVOKE_EXPR:
+      for ( uint32_t k = 1; k <= node->b; k++ )
+        markKid( where, file->kids[ node->a + k ], from );
+      break;
+    case STMT_NODE + RETURN_STMT:
+      ok = from == INSIDE_FUNCTION;
+      markKid( where, node->a, from );
+      break;
+    case STMT_NODE + PRINT_STMT:
+      markKid( where, node->a, from );
+      break;
+    case STMT_NODE + LOCAL_ASSIGN_STMT:
+      ok = from == INSIDE_FUNCTION;
+      markKid( where, node->b, from );
+      break;
+    case STMT_NODE + ASSIGN_STMT:
+      ok = !( from & INSIDE_FUNCTION );
+      markKid( where, node->b, from );
+      break;
+    case STMT_NODE + LOCAL_KEY_STMT:
+    case STMT_NODE + ASSIGN_KEY_STMT:
+      ok = node->kind == STMT_NODE + LOCAL_KEY_STMT ?
+        from == INSIDE_FUNCTION : !( from & INSIDE_FUNCTION );
+      markKid( where, file->kids[ node->a ], from );
+      markKid( where, file->kids[ node->a + 1 ], from );
+      break;
+    case STMT_NODE + COMPOUND_STMT:
+      for ( uint32_t k = 0; k < node->b; k++ )
+        markKid( where, file->kids[ node->a + k ], from );
+      break;
+    case STMT_NODE + FUNCTION_STMT:
+      ok = from == AT_TOP;
+      where[ file->kids[ node->a + 2 ] ] |= INSIDE_FUNCTION;
+      break;
+    default:
+      // Binary operators, if and while all have two children.
+      markKid( where, node->a, from );
+      markKid( where, node->b, from );
+    }
+  }
+
+  free( where );
+  return ok;
+}
+
+/** Make sure every record in the cache is well-formed, and every
+    reference points somewhere it should.
+    @param file cache file to check.
+    @return true if the cache can be safely loaded.
+*/
+static bool validRecords( CacheFile const *file )
+{
+  CacheHeader const *head = file->head;
+
+  for ( uint32_t i = 0; i < head->stringCount; i++ )
+    if ( file->strings[ i ].offset > head->textLen ||
+         file->strings[ i ].len > head->textLen - file->strings[ i ].offset )
+      return false;
+
+  for ( uint32_t i = 0; i < head->varCount; i++ )
+    if ( !validName( file, &file->names[ i ] ) )
+      return false;
+  for ( uint32_t i = 0; i < head->funcCount; i++ )
+    if ( !validName( file, &file->funcs[ i ] ) )
+      return false;
+
+  for ( uint32_t i = 0; i < head->nodeCount; i++ ) {
+    CacheNode const *node = &file->nodes[ i ];
+    bool ok;
+    switch ( node->kind ) {
+    case LITERAL_EXPR:
+      ok = node->a < head->stringCount;
+      break;
+    case VAR_EXPR:
+      ok = node->a < head->varCount;
+      break;
+    case LOCAL_EXPR:
+      ok = node->a < MAX_LOCALS;
+      break;
+    case SUM_EXPR:
+    case DIFF_EXPR:
+    case PROD_EXPR:
+    case QUOT_EXPR:
+    case LESS_EXPR:
+    case EQU_EXPR:
+    case AND_EXPR:
+    case OR_EXPR:
+    case CONCAT_EXPR:
+    case INDEX_EXPR:
+      ok = isExprRef( file, node->a, i ) && isExprRef( file, node->b, i );
+      break;
+    case CALL_EXPR:
+      // Only a vector literal can have other than one argument.
+      ok = node->a < head->kidCount && node->b < head->kidCount - node->a &&
+        file->kids[ node->a ] <= MAX_FN &&
+        ( file->kids[ node->a ] == VECTOR_FN || node->b == 1 );
+      for ( uint32_t k = 1; ok && k <= node->b; k++ )
+        ok = isExprRef( file, file->kids[ node->a + k ], i );
+      break;
+    case INVOKE_EXPR:
+      ok = node->a < head->kidCount && node->b < head->kidCount - node->a &&
+        file->kids[ node->a ] < head->funcCount;
+      for ( uint32_t k = 1; ok && k <= node->b; k++ )
+        ok = isExprRef( file, file->kids[ node->a + k ], i );
+      break;
+    case STMT_NODE + PRINT_STMT:
+    case STMT_NODE + RETURN_STMT:
+      ok = isExprRef( file, node->a, i );
+      break;
+    case STMT_NODE + ASSIGN_STMT:
+      ok = node->a < head->varCount && isExprRef( file, node->b, i );
+      break;
+    case STMT_NODE + LOCAL_ASSIGN_STMT:
+      ok = node->a < MAX_LOCALS && isExprRef( file, node->b, i );
+      break;
+    case STMT_NODE + IF_STMT:
+    case STMT_NODE + WHILE_STMT:
+      ok = isExprRef( file, node->a, i ) && isStmtRef( file, node->b, i );
+      break;
+    case STMT_NODE + ASSIGN_KEY_STMT:
+    case STMT_NODE + LOCAL_KEY_STMT:
+      ok = node->b < ( node->kind == STMT_NODE + ASSIGN_KEY_STMT ?
+                       head->varCount : MAX_LOCALS ) &&
+        node->a <= head->kidCount &&
+        2 <= head->kidCount - node->a &&
+        isExprRef( file, file->kids[ node->a ], i ) &&
+        isExprRef( file, file->kids[ node->a + 1 ], i );
+      break;
+    case STMT_NODE + COMPOUND_STMT:
+      ok = node->a <= head->kidCount && node->b <= head->kidCount - node->a;
+      for ( uint32_t k = 0; ok && k < node->b; k++ )
+        ok = isStmtRef( file, file->kids[ node->a + k ], i );
+      break;
+    case STMT_NODE + FUNCTION_STMT:
+      ok = node->a <= head->kidCount && 3 <= head->kidCount - node->a &&
+        file->kids[ node->a ] < head->funcCount &&
+        file->kids[ node->a + 1 ] <= MAX_LOCALS &&
+        isStmtRef( file, file->kids[ node->a + 2 ], i );
+      break;
+    default:
+      ok = false;
+    }
+
+    if ( !ok )
+      return false;
+  }
+
+  for ( uint32_t i = 0; i < head->stmtCount; i++ )
+    if ( !isStmtRef( file, file->stmts[ i ], head->nodeCount ) )
+      return false;
+
+  return validScopes( file );
+}
+
+/** A node of the program as it's rebuilt, either kind. */
+typedef union {
+  Expr *expr;
+  Stmt *stmt;
+} Built;
+
+/** Rebuild the statements of a cached program.  The cache must already
+    have been validated.
+    @param file cache file to load.
+    @param arena arena to allocate the statements from.
+    @return list of top-level statements, allocated from arena.
+*/
+static Stmt **buildProgram( CacheFile const *file, Arena *arena )
+{
+  CacheHeader const *head = file->head;
+
+  // Intern all the strings, and find slots for all the variables.
+  String **strings = (String **) malloc( ( head->stringCount + 1 ) *
+                                         sizeof( String * ) );
+  for ( uint32_t i = 0; i < head->stringCount; i++ )
+    strings[ i ] = internString( file->text + file->strings[ i ].offset,
+                                 file->strings[ i ].len );
+
+  int *slots = (int *) malloc( ( head->varCount + 1 ) * sizeof( int ) );
+  for ( uint32_t i = 0; i < head->varCount; i++ )
+    slots[ i ] = variableSlot( file->text + file->names[ i ].offset );
+  int *funcs = (int *) malloc( ( head->funcCount + 1 ) * sizeof( int ) );
+  for ( uint32_t i = 0; i < head->funcCount; i++ )
+    funcs[ i ] = functionSlot( file->text + file->funcs[ i ].offset );
+
+  // Nodes only refer to nodes before them, so one pass builds everything.
+  Built *built = (Built *) malloc( ( head->nodeCount + 1 ) * sizeof( Built ) );
+  for ( uint32_t i = 0; i < head->nodeCount; i++ ) {
+    CacheNode const *node = &file->nodes[ i ];
+    switch ( node->kind ) {
+    case LITERAL_EXPR:
+      // Each literal holds its own reference to its string.
+      built[ i ].expr = makeDecodedLiteral( arena,
+                                            retainString( strings[ node->a ] ),
+                                            file->strings[ node->a ].num );
+      break;
+    case VAR_EXPR:
+      built[ i ].expr = makeVariable( arena, slots[ node->a ] );
+      break;
+    case LOCAL_EXPR:
+      built[ i ].expr = makeLocal( arena, node->a );
+      break;
+    case STMT_NODE + PRINT_STMT:
+      built[ i ].stmt = makePrint( arena, built[ node->a ].expr );
+      break;
+    case STMT_NODE + RETURN_STMT:
+      built[ i ].stmt = makeReturn( arena, built[ node->a ].expr );
+      break;
+    case STMT_NODE + LOCAL_ASSIGN_STMT:
+      built[ i ].stmt = makeLocalAssignment( arena, node->a,
+                                             built[ node->b ].expr );
+      break;
+    case STMT_NODE + LOCAL_KEY_STMT:
+      built[ i ].stmt =
+        makeLocalKeyAssignment( arena, node->b,
+                                built[ file->kids[ node->a ] ].expr,
+                                built[ file->kids[ node->a + 1 ] ].expr );
+      break;
+    case STMT_NODE + FUNCTION_STMT:
+      built[ i ].stmt = makeFunction( arena, funcs[ file->kids[ node->a ] ],
+                                      file->kids[ node->a + 1 ],
+                                      built[ file->kids[ node->a + 2 ] ].stmt );
+      break;
+    case STMT_NODE + ASSIGN_STMT:
+      built[ i ].stmt = makeAssignment( arena, slots[ node->a ],
+                                        built[ node->b ].expr );
+      break;
+    case STMT_NODE + ASSIGN_KEY_STMT:
+      built[ i ].stmt = makeKeyAssignment( arena, slots[ node->b ],
+                                           built[ file->kids[ node->a ] ].expr,
+                                           built[ file->kids[ node->a + 1 ] ].expr );
+      break;
+    case STMT_NODE + IF_STMT:
+      built[ i ].stmt = makeIf( arena, built[ node->a ].expr,
+                                built[ node->b ].stmt );
+      break;
+    case STMT_NODE + WHILE_STMT:
+      built[ i ].stmt = makeWhile( arena, built[ node->a ].expr,
+                                   built[ node->b ].stmt );
+      break;
+    case CALL_EXPR:
+    case INVOKE_EXPR: {
+      Expr **args = (Expr **) malloc( ( node->b + 1 ) * sizeof( Expr * ) );
+      for ( uint32_t k = 0; k < node->b; k++ )
+        args[ k ] = built[ file->kids[ node->a + k + 1 ] ].expr;
+      if ( node->kind == CALL_EXPR )
+        built[ i ].expr = makeCall( arena, file->kids[ node->a ], args,
+                                    node->b );
+      else
+        built[ i ].expr = makeInvoke( arena, funcs[ file->kids[ node->a ] ],
+                                      args, node->b );
+      free( args );
+      break;
+    }
+    case STMT_NODE + COMPOUND_STMT: {
+      Stmt **list = (Stmt **) arenaAlloc( arena, ( node->b + 1 ) *
+                                          sizeof( Stmt * ) );
+      for ( uint32_t k = 0; k < node->b; k++ )
+        list[ k ] = built[ file->kids[ node->a + k ] ].stmt;
+      built[ i ].stmt = makeCompound( arena, list, node->b );
+      break;
+    }
+    default:
+      built[ i ].expr = makeBinaryExpr( arena, node->kind,
+                                        built[ node->a ].expr,
+                                        built[ node->b ].expr );
+    }
+
+    if ( node->kind < STMT_NODE )
+      built[ i ].expr->line = node->line;
+    else
+      built[ i ].stmt->line = node->line;
+  }
+
+  Stmt **program = (Stmt **) arenaAlloc( arena, ( head->stmtCount + 1 ) *
+                                         sizeof( Stmt * ) );
+  for ( uint32_t i = 0; i < head->stmtCount; i++ )
+    program[ i ] = built[ file->stmts[ i ] ].stmt;
+
+  for ( uint32_t i = 0; i < head->stringCount; i++ )
+    releaseString( strings[ i ] );
+  free( strings );
+  free( slots );
+  free( funcs );
+  free( built );
+  return program;
+}
+
+Stmt **loadCache( char const *path, char const *source, size_t len,
+                  Arena *arena, int *count )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return NULL;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED )
+    return NULL;
+
+  // Check the cheap things first, then the checksum, then every record.
+  Stmt **program = NULL;
+  CacheFile file;
+  if ( findSections( &file, (char const *) map, st.st_size ) &&
+       file.head->sourceLen == len &&
+       file.head->sourceHash == hashSource( source, len ) &&
+       file.head->checksum ==
+       checksum( 2166136261u, file.strings,
+                 st.st_size - sizeof( CacheHeader ) ) &&
+       validRecords( &file ) ) {
+    program = buildProgram( &file, arena );
+    *count = file.head->stmtCount;
+  }
+
+  munmap( map, st.st_size );
+  return program;
+}
@@ -0,0 +1,79 @@
+/**
+  @file cache.h
+
+  Precompiled program cache.  After a program parses successfully, its
+  statements can be saved in a compact binary file next to the source,
+  holding the interned strings, the literals already decoded as
+  numbers, and the statement trees flattened into arrays.  Later runs
+  map the cache file and rebuild the statements from it directly,
+  skipping the tokenizer and parser.
+
+  Each cache records a hash of the source it came from, so a cache
+  for an older version of the program is ignored.  So is any cache that
+  fails validation, so a bad file just costs a normal parse.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "expr.h"
+#include "stmt.h"
+
+/**
+   Short typename for a cache writer, which collects statements as
+   they're parsed.  Its representation is private to the cache.
+*/
+typedef struct CacheWriterTag CacheWriter;
+
+/** Return the name of the cache file for a source file.
+    @param path name of the source file.
+    @return name for the cache.  The caller must free this.
+*/
+char *cachePath( char const *path );
+
+/** Load a program from its cache, if the cache is good.
+    @param path name of the cache file.
+    @param source text of the program the cache should match.
+    @param len number of characters in source.
+    @param arena arena to allocate the statements from.
+    @param count returns the number of top-level statements.
+    @return list of the program's top-level statements, in order,
+    allocated from arena, or NULL if the cache is missing, stale or
+    corrupt.
+*/
+Stmt **loadCache( char const *path, char const *source, size_t len,
+                  Arena *arena, int *count );
+
+/** Make a writer, for collecting a program to cache.
+    @return a new, empty cache writer.  The caller must eventually free
+    this with freeCacheWriter().
+*/
+CacheWriter *makeCacheWriter();
+
+/** Add the next top-level statement of the program to the cache.  The
+    statement is copied, so it can be freed as soon as this returns.
+    @param writer writer to add the statement to.
+    @param stmt statement to add.
+*/
+void cacheStmt( CacheWriter *writer, Stmt *stmt );
+
+/** Write a cache file for all the statements collected so far.  This
+    should only be called once the whole program has parsed.  Failing
+    to write the cache isn't an error; the next run just parses again.
+    @param writer writer holding the program.
+    @param path name of the cache file.
+    @param source text of the program.
+    @param len number of characters in source.
+*/
+void writeCache( CacheWriter *writer, char const *path,
+                 char const *source, size_t len );
+
+/** Free a cache writer, and everything it's collected.
+    @param writer writer to free.
+*/
+void freeCacheWriter( CacheWriter *writer );
+
+#endif
@@ -0,0 +1,478 @@
+#include "closure.h"
+#include "output.h"
+#include <stdlib.h>
+
+// Most arguments a call evaluates into an array on the stack.
+#define MAX_LOCAL_ARGS 16
+
+/** A closure record, for either an expression or a statement.  Only
+    one of eval or execute is set, depending on which it is.  The
+    children of a record are stored next to each other, in the same
+    block of memory as the rest of the statement's records. */
+struct ClosureTag {
+  /** Handler to evaluate an expression record. */
+  Value (*eval)( Closure *this, Context *ctxt );
+
+  /** Handler to execute a statement record. */
+  void (*execute)( Closure *this, Context *ctxt );
+
+  /** Child records: the operands of a binary operator, the arguments
+      of a call, the statements of a compound, the condition and body
+      of an if or while, or the key and value of an assignment to a
+      map. */
+  Closure *kids;
+
+  /** Number of child records. */
+  int len;
+
+  /** Slot for a variable or an assignment, or the function for a
+      call. */
+  int slot;
+
+  /** Line of a call to a function the program defines, for errors. */
+  int line;
+
+  /** Value of a literal, with its number already parsed.  Binary
+      operators with a literal on the right keep a copy of it here. */
+  Value val;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Expression handlers
+
+static Value evalLit( Closure *this, Context *ctxt )
+{
+  return this->val;
+}
+
+static Value evalVar( Closure *this, Context *ctxt )
+{
+  return getSlot( ctxt, this->slot );
+}
+
+/** Evaluate an operand.  Variables are common enough that they're read
+    directly, without calling through the handler.
+    @param kid record for the operand.
+    @param ctxt current values of all variables.
+    @return value of the operand.
+*/
+static inline Value operand( Closure *kid, Context *ctxt )
+{
+  return kid->eval == evalVar ? getSlot( ctxt, kid->slot ) :
+    kid->eval( kid, ctxt );
+}
+
+/** Define two handlers for a numeric binary operator, one for any
+    operands and one for when the right-hand operand is a literal whose
+    value is already in val.num.  Either one works element by element
+    if an operand is a vector.
+    @param name name for the general handler.
+    @param constName name for the handler with a literal right operand.
+    @param make function to make a value from the result.
+    @param op C operator to apply.
+    @param vop operator for vectors.
+*/
+#define NUMERIC_HANDLERS( name, constName, make, op, vop )              \
+  static Value name( Closure *this, Context *ctxt )                     \
+  {                                                                     \
+    Value a = operand( &this->kids[ 0 ], ctxt );                        \
+    Value b = operand( &this->kids[ 1 ], ctxt );                        \
+    if ( hasVector( &a, &b ) )                                          \
+      return vectorArith( ctxt, vop, &a, &b );                          \
+    return make( toNumber( &a ) op toNumber( &b ) );                    \
+  }                                                                     \
+                                                                        \
+  static Value constName( Closure *this, Context *ctxt )                \
+  {                                                                     \
+    Value a = operand( &this->kids[ 0 ], ctxt );                        \
+    if ( a.type == VEC_VAL )                                            \
+      return vectorArith( ctxt, vop, &a, &this->val );                  \
+    return make( toNumber( &a ) op this->val.num );                     \
+  }
+
+NUMERIC_HANDLERS( evalSum, evalSumConst, makeArithValue, +, VEC_ADD )
+NUMERIC_HANDLERS( evalDiff, evalDiffConst, makeArithValue, -, VEC_SUB )
+NUMERIC_HANDLERS( evalProd, evalProdConst, makeArithValue, *, VEC_MUL )
+NUMERIC_HANDLERS( evalQuot, evalQuotConst, makeArithValue, /, VEC_DIV )
+NUMERIC_HANDLERS( evalLess, evalLessConst, makeBoolValue, <, VEC_LESS )
+
+static Value evalEqu( Closure *this, Context *ctxt )
+{
+  Value left = this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt );
+  Value right = this->kids[ 1 ].eval( &this->kids[ 1 ], ctxt );
+  return makeBoolValue( valueEquals( &left, &right ) );
+}
+
+static Value evalConcat( Closure *this, Context *ctxt )
+{
+  Value left = this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt );
+  Value right = this->kids[ 1 ].eval( &this->kids[ 1 ], ctxt );
+  return concatValues( ctxt, &left, &right );
+}
+
+static Value evalIndex( Closure *this, Context *ctxt )
+{
+  Value map = this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt );
+  Value key = this->kids[ 1 ].eval( &this->kids[ 1 ], ctxt );
+  return lookupKey( &map, &key );
+}
+
+static Value evalCall( Closure *this, Context *ctxt )
+{
+  // A long vector literal gets its values on the heap instead of the
+  // stack.
+  Value local[ MAX_LOCAL_ARGS ];
+  Value *args = this->len <= MAX_LOCAL_ARGS ? local :
+    (Value *) malloc( this->len * sizeof( Value ) );
+  for ( int i = 0; i < this->len; i++ )
+    args[ i ] = this->kids[ i ].eval( &this->kids[ i ], ctxt );
+  Value result = callBuiltin( ctxt, this->slot, args, this->len );
+  if ( args != local )
+    free( args );
+  return result;
+}
+
+static Value evalInvoke( Closure *this, Context *ctxt )
+{
+  for ( int i = 0; i < this->len; i++ )
+    pushArgument( ctxt, this->kids[ i ].eval( &this->kids[ i ], ctxt ) );
+  return invokeFunction( ctxt, this->slot, this->len, this->line );
+}
+
+static Value evalAnd( Closure *this, Context *ctxt );
+static Value evalOr( Closure *this, Context *ctxt );
+
+/** Evaluate a condition record.  Less-than tests are done directly,
+    without making a boolean value, and logical operators only evaluate
+    their right operand if the left one doesn't decide the result.
+    Comparing a vector makes a vector, which is always true.
+    @param cond record for the condition.
+    @param ctxt current values of all variables.
+    @return true if the condition holds.
+*/
+static inline bool test( Closure *cond, Context *ctxt )
+{
+  if ( cond->eval == evalLessConst ) {
+    Value a = operand( &cond->kids[ 0 ], ctxt );
+    return a.type == VEC_VAL || toNumber( &a ) < cond->val.num;
+  }
+  if ( cond->eval == evalLess ) {
+    Value a = operand( &cond->kids[ 0 ], ctxt );
+    Value b = operand( &cond->kids[ 1 ], ctxt );
+    return hasVector( &a, &b ) || toNumber( &a ) < toNumber( &b );
+  }
+  if ( cond->eval == evalAnd )
+    return test( &cond->kids[ 0 ], ctxt ) && test( &cond->kids[ 1 ], ctxt );
+  if ( cond->eval == evalOr )
+    return test( &cond->kids[ 0 ], ctxt ) || test( &cond->kids[ 1 ], ctxt );
+
+  Value v = cond->eval( cond, ctxt );
+  return isTrue( &v );
+}
+
+static Value evalAnd( Closure *this, Context *ctxt )
+{
+  return makeBoolValue( test( &this->kids[ 0 ], ctxt ) &&
+                        test( &this->kids[ 1 ], ctxt ) );
+}
+
+static Value evalOr( Closure *this, Context *ctxt )
+{
+  return makeBoolValue( test( &this->kids[ 0 ], ctxt ) ||
+                        test( &this->kids[ 1 ], ctxt ) );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Statement handlers
+
+static void executePrint( Closure *this, Context *ctxt )
+{
+  Value result = this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt );
+  printValue( &result );
+}
+
+static void executeAssign( Closure *this, Context *ctxt )
+{
+  setSlot( ctxt, this->slot, this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt ) );
+}
+
+static void executeAssignKey( Closure *this, Context *ctxt )
+{
+  Value key = this->kids[ 0 ].eval( &this->kids[ 0 ], ctxt );
+  Value result = this->kids[ 1 ].eval( &this->kids[ 1 ], ctxt );
+  setSlotKey( ctxt, this->slot, &key, result );
+}
+
+static void executeCompound( Closure *this, Context *ctxt )
+{
+  for ( int i = 0; i < this->len; i++ )
+    this->kids[ i ].execute( &this->kids[ i ], ctxt );
+}
+
+static void executeIf( Closure *this, Context *ctxt )
+{
+  if ( test( &this->kids[ 0 ], ctxt ) )
+    this->kids[ 1 ].execute( &this->kids[ 1 ], ctxt );
+}
+
+static void executeWhile( Closure *this, Context *ctxt )
+{
+  // Arithmetic on vectors can make temporaries, even though the
+  // condition doesn't, so they're released after each iteration.
+  Closure *cond = &this->kids[ 0 ];
+  Closure *body = &this->kids[ 1 ];
+  int mark = temporaryMark( ctxt );
+  while ( test( cond, ctxt ) ) {
+    body->execute( body, ctxt );
+    releaseTemporaries( ctxt, mark );
+  }
+}
+
+// Statements whose expression makes temporaries get handlers that
+// release them once the expression's value has been used.
+
+static void executePrintTemps( Closure *this, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executePrint( this, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+static void executeAssignTemps( Closure *this, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeAssign( this, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+static void executeAssignKeyTemps( Closure *this, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeAssignKey( this, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+static void executeIfTemps( Closure *this, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  bool holds = test( &this->kids[ 0 ], ctxt );
+  releaseTemporaries( ctxt, mark );
+  if ( holds )
+    this->kids[ 1 ].execute( &this->kids[ 1 ], ctxt );
+}
+
+static void executeWhileTemps( Closure *this, Context *ctxt )
+{
+  Closure *cond = &this->kids[ 0 ];
+  Closure *body = &this->kids[ 1 ];
+  int mark = temporaryMark( ctxt );
+  for ( ;; ) {
+    bool holds = test( cond, ctxt );
+    releaseTemporaries( ctxt, mark );
+    if ( !holds )
+      break;
+    body->execute( body, ctxt );
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compilation
+
+/** Return the number of records needed for an expression.
+    @param expr expression to count.
+    @return number of nodes in the expression.
+*/
+static int countExpr( Expr *expr )
+{
+  if ( expr->kind == LITERAL_EXPR || expr->kind == VAR_EXPR )
+    return 1;
+  if ( expr->kind == CALL_EXPR || expr->kind == INVOKE_EXPR ) {
+    int n = 1;
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      n += countExpr( callArg( expr, i ) );
+    return n;
+  }
+  return 1 + countExpr( binaryLeft( expr ) ) + countExpr( binaryRight( expr ) );
+}
+
+/** Return the number of records needed for a statement.
+    @param stmt statement to count.
+    @return number of nodes in the statement and its expressions.
+*/
+static int countStmt( Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT: {
+    int n = 1;
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      n += countStmt( compoundStmt( stmt, i ) );
+    return n;
+  }
+  case IF_STMT:
+  case WHILE_STMT:
+    return 1 + countExpr( stmtExpr( stmt ) ) + countStmt( stmtBody( stmt ) );
+  case ASSIGN_KEY_STMT:
+    return 1 + countExpr( assignKey( stmt ) ) + countExpr( stmtExpr( stmt ) );
+  default:
+    return 1 + countExpr( stmtExpr( stmt ) );
+  }
+}
+
+/** Reserve a block of adjacent records for the children of a record.
+    @param this record that gets the children.
+    @param len number of children.
+    @param next pointer to the next unused record, advanced past the
+    new block.
+*/
+static void reserveKids( Closure *this, int len, Closure **next )
+{
+  this->kids = *next;
+  this->len = len;
+  *next += len;
+}
+
+/** Fill in the record for an expression, and its children.
+    @param this record to fill in.
+    @param expr expression it represents.
+    @param next pointer to the next unused record.
+*/
+static void fillExpr( Closure *this, Expr *expr, Closure **next )
+{
+  this->execute = NULL;
+  this->kids = NULL;
+  this->len = 0;
+
+  if ( expr->kind == LITERAL_EXPR ) {
+    this->eval = evalLit;
+    this->val = literalValue( expr );
+    return;
+  }
+
+  if ( expr->kind == VAR_EXPR ) {
+    this->eval = evalVar;
+    this->slot = variableExprSlot( expr );
+    return;
+  }
+
+  if ( expr->kind == CALL_EXPR || expr->kind == INVOKE_EXPR ) {
+    if ( expr->kind == CALL_EXPR ) {
+      this->eval = evalCall;
+      this->slot = callFunction( expr );
+    } else {
+      this->eval = evalInvoke;
+      this->slot = invokedFunction( expr );
+      this->line = expr->line;
+    }
+    reserveKids( this, callArgCount( expr ), next );
+    for ( int i = 0; i < this->len; i++ )
+      fillExpr( &this->kids[ i ], callArg( expr, i ), next );
+    return;
+  }
+
+  reserveKids( this, 2, next );
+  fillExpr( &this->kids[ 0 ], binaryLeft( expr ), next );
+  fillExpr( &this->kids[ 1 ], binaryRight( expr ), next );
+
+  // Pick a handler.  Numeric operators get a faster one if the right
+  // operand is a literal.
+  static struct {
+    Value (*eval)( Closure *, Context * );
+    Value (*evalConst)( Closure *, Context * );
+  } const handlers[] = {
+    [ SUM_EXPR ] = { evalSum, evalSumConst },
+    [ DIFF_EXPR ] = { evalDiff, evalDiffConst },
+    [ PROD_EXPR ] = { evalProd, evalProdConst },
+    [ QUOT_EXPR ] = { evalQuot, evalQuotConst },
+    [ LESS_EXPR ] = { evalLess, evalLessConst },
+    [ EQU_EXPR ] = { evalEqu, NULL },
+    [ AND_EXPR ] = { evalAnd, NULL },
+    [ OR_EXPR ] = { evalOr, NULL },
+    [ CONCAT_EXPR ] = { evalConcat, NULL },
+    [ INDEX_EXPR ] = { evalIndex, NULL },
+  };
+
+  this->eval = handlers[ expr->kind ].eval;
+  if ( handlers[ expr->kind ].evalConst && this->kids[ 1 ].eval == evalLit ) {
+    this->eval = handlers[ expr->kind ].evalConst;
+    this->val = this->kids[ 1 ].val;
+  }
+}
+
+/** Fill in the record for a statement, and its children.
+    @param this record to fill in.
+    @param stmt statement it represents.
+    @param next pointer to the next unused record.
+*/
+static void fillStmt( Closure *this, Stmt *stmt, Closure **next )
+{
+  this->eval = NULL;
+  bool temps = stmt->kind != COMPOUND_STMT &&
+    ( makesTemporaries( stmtExpr( stmt ) ) ||
+      ( stmt->kind == ASSIGN_KEY_STMT && makesTemporaries( assignKey( stmt ) ) ) );
+
+  switch ( stmt->kind ) {
+  case PRINT_STMT:
+    this->execute = temps ? executePrintTemps : executePrint;
+    reserveKids( this, 1, next );
+    fillExpr( &this->kids[ 0 ], stmtExpr( stmt ), next );
+    break;
+
+  case ASSIGN_STMT:
+    this->execute = temps ? executeAssignTemps : executeAssign;
+    this->slot = assignSlot( stmt );
+    reserveKids( this, 1, next );
+    fillExpr( &this->kids[ 0 ], stmtExpr( stmt ), next );
+    break;
+
+  case ASSIGN_KEY_STMT:
+    this->execute = temps ? executeAssignKeyTemps : executeAssignKey;
+    this->slot = assignSlot( stmt );
+    reserveKids( this, 2, next );
+    fillExpr( &this->kids[ 0 ], assignKey( stmt ), next );
+    fillExpr( &this->kids[ 1 ], stmtExpr( stmt ), next );
+    break;
+
+  case COMPOUND_STMT:
+    this->execute = executeCompound;
+    reserveKids( this, compoundLength( stmt ), next );
+    for ( int i = 0; i < this->len; i++ )
+      fillStmt( &this->kids[ i ], compoundStmt( stmt, i ), next );
+    break;
+
+  case IF_STMT:
+  case WHILE_STMT:
+    if ( stmt->kind == IF_STMT )
+      this->execute = temps ? executeIfTemps : executeIf;
+    else
+      this->execute = temps ? executeWhileTemps : executeWhile;
+    reserveKids( this, 2, next );
+    fillExpr( &this->kids[ 0 ], stmtExpr( stmt ), next );
+    fillStmt( &this->kids[ 1 ], stmtBody( stmt ), next );
+    break;
+
+  default:
+    // Function definitions are run by the tree-walking interpreter,
+    // and the statements in a function's body only run there.
+    break;
+  }
+}
+
+Closure *makeClosure( Stmt *stmt )
+{
+  // All the records for a statement go in one block, with the root
+  // record first.
+  Closure *block = (Closure *) malloc( countStmt( stmt ) * sizeof( Closure ) );
+  Closure *next = block + 1;
+  fillStmt( block, stmt, &next );
+  return block;
+}
+
+void runClosure( Closure *closure, Context *ctxt )
+{
+  closure->execute( closure, ctxt );
+}
+
+void freeClosure( Closure *closure )
+{
+  free( closure );
+}
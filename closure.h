@@ -0,0 +1,44 @@
+/**
+  @file closure.h
+
+  Closure compilation, a lighter-weight alternative to the bytecode
+  virtual machine.  Each statement and expression is turned into a
+  record holding a specialized handler function and its operands,
+  already decoded, so running it skips most of the work of walking
+  the original tree.
+*/
+
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#include "expr.h"
+#include "stmt.h"
+
+/**
+   Short typename for a closure record.  Its representation is private
+   to the closure compiler.
+*/
+typedef struct ClosureTag Closure;
+
+/** Compile the given statement into closure records.  The records
+    don't refer back to the statement, so it can be freed as soon as
+    this returns.
+    @param stmt statement to compile.
+    @return the closure for stmt.  The caller must eventually free this
+    with freeClosure().
+*/
+Closure *makeClosure( Stmt *stmt );
+
+/** Run a compiled statement, the same way the statement it was made
+    from would have executed.
+    @param closure closure returned by makeClosure().
+    @param ctxt current values of all variables.
+*/
+void runClosure( Closure *closure, Context *ctxt );
+
+/** Free a compiled statement, and all the records it contains.
+    @param closure closure returned by makeClosure().
+*/
+void freeClosure( Closure *closure );
+
+#endif
@@ -0,0 +1,101 @@
+/**
+  @file ctxbench.c
+
+  Scaling benchmark for the context.  Defines increasing numbers of
+  variables, from 10 up to a million, and reports the average cost of
+  reading and writing them, both by name and by slot.  The cost per
+  operation should stay about the same no matter how many variables
+  there are, until they no longer fit in cache.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "expr.h"
+
+// Number of reads (and writes) to time for each context size.
+#define OPS 2000000
+
+/** Return the current time, in nanoseconds.
+    @return time from a monotonic clock.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+  Time variable access for contexts of several sizes, and print a
+  table of the results.
+
+  @return EXIT_SUCCESS
+*/
+int main()
+{
+  printf( "%10s %12s %12s %12s %12s\n", "vars", "define ns", "get ns",
+          "set ns", "slot get ns" );
+
+  for ( int n = 10; n <= 1000000; n *= 10 ) {
+    // Make all the variable names ahead of time.
+    char (*names)[ MAX_IDENT_LEN + 1 ] = malloc( n * sizeof( *names ) );
+    for ( int i = 0; i < n; i++ )
+      sprintf( names[ i ], "v%d", i );
+
+    // Visit variables in a scattered order, so we're not just
+    // measuring the cache.
+    int *order = malloc( OPS * sizeof( int ) );
+    srand( n );
+    for ( int i = 0; i < OPS; i++ )
+      order[ i ] = rand() % n;
+
+    Context *ctxt = makeContext();
+
+    double start = now();
+    for ( int i = 0; i < n; i++ )
+      setValue( ctxt, names[ i ], makeNumberValue( i ) );
+    double define = ( now() - start ) / n;
+
+    double sum = 0;
+    start = now();
+    for ( int i = 0; i < OPS; i++ ) {
+      Value v = getValue( ctxt, names[ order[ i ] ] );
+      sum += v.num;
+    }
+    double get = ( now() - start ) / OPS;
+
+    start = now();
+    for ( int i = 0; i < OPS; i++ )
+      setValue( ctxt, names[ order[ i ] ], makeNumberValue( i ) );
+    double set = ( now() - start ) / OPS;
+
+    // Reading by slot is what variable expressions actually do.
+    int *slots = malloc( n * sizeof( int ) );
+    for ( int i = 0; i < n; i++ )
+      slots[ i ] = variableSlot( names[ i ] );
+    start = now();
+    for ( int i = 0; i < OPS; i++ ) {
+      Value v = getSlot( ctxt, slots[ order[ i ] ] );
+      sum += v.num;
+    }
+    double slotGet = ( now() - start ) / OPS;
+
+    printf( "%10d %12.1f %12.1f %12.1f %12.1f\n", n, define, get, set,
+            slotGet );
+
+    // Use the sum, so the reads can't be optimized away.
+    if ( sum < 0 )
+      printf( "%f\n", sum );
+
+    freeContext( ctxt );
+    free( slots );
+    free( order );
+    free( names );
+  }
+
+  return EXIT_SUCCESS;
+}
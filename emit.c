@@ -0,0 +1,2029 @@
+#include "emit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Initial capacity for the list of statements.
+#define INITIAL_CAPACITY 16
+
+/** Hidden representation for an emitter. */
+struct EmitterTag {
+  // Name of the source file.
+  char const *name;
+
+  // Top-level statements of the program, in order.
+  Stmt **stmts;
+  int len, cap;
+};
+
+/** Support code at the start of every generated program.  Values work
+    the same way they do in the interpreter: strings print as their
+    text, numbers with "%f", and comparisons as "t" or nothing.  String
+    literals have their number worked out when the program is
+    transpiled.  Concatenation builds ropes like the interpreter's, a
+    prefix of a shared buffer that the last rope can append to in
+    place.  Variables hold a reference to their rope's buffer, and
+    concatenation results are temporaries, released at the end of the
+    statement that made them.  Maps are a dense list of entries with an
+    open-addressing index, shared by reference counting and copied
+    before a shared one is changed, like the interpreter's.  Their keys
+    are copies of the key's text, so every kind of key is compared the
+    same way.  Vectors are counted and copied the same way, and their
+    arithmetic makes temporaries that can be overwritten by the next
+    operator.  Reductions add up elements in the interpreter's order, so
+    they give the same results. */
+static char const *const prelude[] = {
+  "#include <stdio.h>",
+  "#include <stdlib.h>",
+  "#include <string.h>",
+  "#include <limits.h>",
+  "#include <math.h>",
+  "",
+  "typedef enum {",
+  "  NUM_VAL, STR_VAL, BOOL_VAL, ROPE_VAL, MAP_VAL, VEC_VAL",
+  "} ValueType;",
+  "",
+  "typedef struct Map Map;",
+  "",
+  "typedef struct {",
+  "  int refs;",
+  "  int len;",
+  "  int cap;",
+  "  char *data;",
+  "} Buffer;",
+  "",
+  "typedef struct {",
+  "  int refs;",
+  "  int len;",
+  "  int cap;",
+  "  int temp;",
+  "  double *data;",
+  "} Vec;",
+  "",
+  "typedef struct {",
+  "  ValueType type;",
+  "  int truth;",
+  "  double num;",
+  "  char const *text;",
+  "  int len;",
+  "  Buffer *buf;",
+  "  Map *map;",
+  "  Vec *vec;",
+  "} Value;",
+  "",
+  "typedef struct {",
+  "  char *key;",
+  "  int len;",
+  "  unsigned hash;",
+  "  Value val;",
+  "} Entry;",
+  "",
+  "struct Map {",
+  "  int refs;",
+  "  int len;",
+  "  int cap;",
+  "  Entry *entries;",
+  "  int *index;",
+  "  unsigned mask;",
+  "};",
+  "",
+  "static inline Value num( double n )",
+  "{",
+  "  Value v = { NUM_VAL, 0, n, NULL, 0 };",
+  "  return v;",
+  "}",
+  "",
+  "static inline Value str( char const *text, int len, double n )",
+  "{",
+  "  Value v = { STR_VAL, 0, n, text, len };",
+  "  return v;",
+  "}",
+  "",
+  "static inline Value boolean( int truth )",
+  "{",
+  "  Value v = { BOOL_VAL, truth, 0.0, NULL, 0 };",
+  "  return v;",
+  "}",
+  "",
+  "/* Round the result of arithmetic to the six places it prints with.",
+  "   Small numbers not too near halfway round exactly when scaled. */",
+  "static double rounded( double n )",
+  "{",
+  "  if ( n - n != 0 || n >= 4503599627370496.0 ||",
+  "       n <= -4503599627370496.0 || (double) (long long) n == n )",
+  "    return n;",
+  "  double s = n * 1e6;",
+  "  if ( s < 1099511627776.0 && s > -1099511627776.0 ) {",
+  "    double w = ( s + 6755399441055744.0 ) - 6755399441055744.0;",
+  "    double d = s - w;",
+  "    if ( d < 0.5 - 1.0 / 4096 && d > 1.0 / 4096 - 0.5 )",
+  "      return w == 0 ? n * 0.0 : w / 1e6;",
+  "  }",
+  "  char buf[ 400 ];",
+  "  sprintf( buf, \"%f\", n );",
+  "  return strtod( buf, NULL );",
+  "}",
+  "",
+  "static inline double bits( unsigned long long b )",
+  "{",
+  "  /* Read through a volatile, so the compiler can't fold arithmetic",
+  "     on a NaN and get a different sign than the processor would. */",
+  "  volatile unsigned long long v = b;",
+  "  unsigned long long copy = v;",
+  "  double d;",
+  "  memcpy( &d, &copy, sizeof( d ) );",
+  "  return d;",
+  "}",
+  "",
+  "static inline char const *chars( Value v )",
+  "{",
+  "  return v.type == ROPE_VAL ? v.buf->data : v.text;",
+  "}",
+  "",
+  "static double ropeNumber( Value v )",
+  "{",
+  "  /* A rope is only null terminated at the end of its buffer. */",
+  "  char *copy = malloc( v.len + 1 );",
+  "  memcpy( copy, chars( v ), v.len );",
+  "  copy[ v.len ] = '\\0';",
+  "  double n;",
+  "  if ( sscanf( copy, \"%lf\", &n ) != 1 )",
+  "    n = 0.0;",
+  "  free( copy );",
+  "  return n;",
+  "}",
+  "",
+  "static inline double toNumber( Value v )",
+  "{",
+  "  if ( v.type == ROPE_VAL )",
+  "    return ropeNumber( v );",
+  "  if ( v.type == MAP_VAL )",
+  "    return v.map->len;",
+  "  if ( v.type == VEC_VAL )",
+  "    return v.vec->len;",
+  "  return v.type == BOOL_VAL ? 0.0 : v.num;",
+  "}",
+  "",
+  "static inline int isTrue( Value v )",
+  "{",
+  "  if ( v.type == BOOL_VAL )",
+  "    return v.truth;",
+  "  return v.type == NUM_VAL || v.type == MAP_VAL || v.type == VEC_VAL ||",
+  "    v.len > 0;",
+  "}",
+  "",
+  "static inline char const *text( Value v, char *buf, int *len )",
+  "{",
+  "  if ( v.type == NUM_VAL || v.type == MAP_VAL || v.type == VEC_VAL ) {",
+  "    *len = sprintf( buf, \"%f\", toNumber( v ) );",
+  "    return buf;",
+  "  }",
+  "  if ( v.type == BOOL_VAL ) {",
+  "    *len = v.truth;",
+  "    return v.truth ? \"t\" : \"\";",
+  "  }",
+  "  *len = v.len;",
+  "  return chars( v );",
+  "}",
+  "",
+  "static inline int equals( Value a, Value b )",
+  "{",
+  "  if ( a.type == NUM_VAL && b.type == NUM_VAL && a.num == b.num &&",
+  "       signbit( a.num ) == signbit( b.num ) )",
+  "    return 1;",
+  "  if ( a.type == STR_VAL && b.type == STR_VAL )",
+  "    return a.len == b.len && memcmp( a.text, b.text, a.len ) == 0;",
+  "  char abuf[ 400 ], bbuf[ 400 ];",
+  "  int alen, blen;",
+  "  char const *atext = text( a, abuf, &alen );",
+  "  char const *btext = text( b, bbuf, &blen );",
+  "  return alen == blen && memcmp( atext, btext, alen ) == 0;",
+  "}",
+  "",
+  "static inline void printNum( double n )",
+  "{",
+  "  printf( \"%f\", n );",
+  "}",
+  "",
+  "static inline void print( Value v )",
+  "{",
+  "  if ( v.type == NUM_VAL || v.type == MAP_VAL || v.type == VEC_VAL )",
+  "    printNum( toNumber( v ) );",
+  "  else if ( v.type != BOOL_VAL )",
+  "    fwrite( chars( v ), 1, v.len, stdout );",
+  "  else if ( v.truth )",
+  "    putchar( 't' );",
+  "}",
+  "",
+  "static inline void drop( Buffer *buf )",
+  "{",
+  "  if ( --buf->refs == 0 ) {",
+  "    free( buf->data );",
+  "    free( buf );",
+  "  }",
+  "}",
+  "",
+  "static inline void keep( Value v )",
+  "{",
+  "  if ( v.buf )",
+  "    v.buf->refs++;",
+  "  if ( v.map )",
+  "    v.map->refs++;",
+  "  if ( v.vec )",
+  "    v.vec->refs++;",
+  "}",
+  "",
+  "static void discard( Value v )",
+  "{",
+  "  if ( v.buf )",
+  "    drop( v.buf );",
+  "  if ( v.map && --v.map->refs == 0 ) {",
+  "    for ( int i = 0; i < v.map->len; i++ ) {",
+  "      free( v.map->entries[ i ].key );",
+  "      discard( v.map->entries[ i ].val );",
+  "    }",
+  "    free( v.map->entries );",
+  "    free( v.map->index );",
+  "    free( v.map );",
+  "  }",
+  "  if ( v.vec && --v.vec->refs == 0 ) {",
+  "    free( v.vec->data );",
+  "    free( v.vec );",
+  "  }",
+  "}",
+  "",
+  "static Value *temps;",
+  "static int ntemps, ctemps, tfloor;",
+  "",
+  "static Value hold( Value v )",
+  "{",
+  "  if ( ntemps >= ctemps ) {",
+  "    ctemps = ctemps ? ctemps * 2 : 16;",
+  "    temps = realloc( temps, ctemps * sizeof( Value ) );",
+  "  }",
+  "  temps[ ntemps++ ] = v;",
+  "  keep( v );",
+  "  return v;",
+  "}",
+  "",
+  "static inline void release( void )",
+  "{",
+  "  while ( ntemps > tfloor ) {",
+  "    Value v = temps[ --ntemps ];",
+  "    if ( v.vec )",
+  "      v.vec->temp = 0;",
+  "    discard( v );",
+  "  }",
+  "}",
+  "",
+  "static inline int settle( int truth )",
+  "{",
+  "  release();",
+  "  return truth;",
+  "}",
+  "",
+  "static inline void assign( Value *var, Value v )",
+  "{",
+  "  keep( v );",
+  "  discard( *var );",
+  "  *var = v;",
+  "}",
+  "",
+  "static void reserve( Buffer *buf, int len )",
+  "{",
+  "  if ( len <= buf->cap - buf->len )",
+  "    return;",
+  "  if ( len >= INT_MAX - buf->len ) {",
+  "    fflush( stdout );",
+  "    fprintf( stderr, \"string too long\\n\" );",
+  "    exit( 1 );",
+  "  }",
+  "  buf->cap = buf->cap < INT_MAX / 2 ? buf->cap * 2 : INT_MAX - 1;",
+  "  if ( buf->cap < buf->len + len )",
+  "    buf->cap = buf->len + len;",
+  "  buf->data = realloc( buf->data, buf->cap + 1 );",
+  "}",
+  "",
+  "static Value concat( Value a, Value b )",
+  "{",
+  "  /* Appending an empty value only changes the type, to text. */",
+  "  if ( !isTrue( b ) && ( a.type == STR_VAL || a.type == ROPE_VAL ) )",
+  "    return a;",
+  "  if ( !isTrue( a ) && ( b.type == STR_VAL || b.type == ROPE_VAL ) )",
+  "    return b;",
+  "  if ( !isTrue( a ) && !isTrue( b ) )",
+  "    return str( \"\", 0, 0.0 );",
+  "",
+  "  /* Append in place if nothing else uses the end of a's buffer. */",
+  "  char abuf[ 400 ], bbuf[ 400 ];",
+  "  int alen, blen;",
+  "  Buffer *buf = a.buf;",
+  "  if ( a.type == ROPE_VAL && ( a.len == buf->len || buf->refs == 1 ) )",
+  "    buf->len = a.len;",
+  "  else {",
+  "    char const *atext = text( a, abuf, &alen );",
+  "    buf = calloc( 1, sizeof( Buffer ) );",
+  "    reserve( buf, alen );",
+  "    memcpy( buf->data, atext, alen );",
+  "    buf->len = alen;",
+  "  }",
+  "",
+  "  /* b may be in the same buffer, which can move as it grows. */",
+  "  char const *btext = text( b, bbuf, &blen );",
+  "  reserve( buf, blen );",
+  "  if ( b.type == ROPE_VAL )",
+  "    btext = chars( b );",
+  "  memcpy( buf->data + buf->len, btext, blen );",
+  "  buf->len += blen;",
+  "  buf->data[ buf->len ] = '\\0';",
+  "",
+  "  Value v = { ROPE_VAL, 0, 0.0, NULL, buf->len, buf };",
+  "  return hold( v );",
+  "}",
+  "",
+  "static inline unsigned hash( char const *text, int len )",
+  "{",
+  "  unsigned h = 2166136261u;",
+  "  for ( int i = 0; i < len; i++ )",
+  "    h = ( h ^ (unsigned char) text[ i ] ) * 16777619u;",
+  "  return h;",
+  "}",
+  "",
+  "static unsigned probe( Map *m, char const *key, int len, unsigned h )",
+  "{",
+  "  for ( unsigned i = h & m->mask; ; i = ( i + 1 ) & m->mask ) {",
+  "    int e = m->index[ i ];",
+  "    if ( e < 0 || ( m->entries[ e ].hash == h &&",
+  "                    m->entries[ e ].len == len &&",
+  "                    memcmp( m->entries[ e ].key, key, len ) == 0 ) )",
+  "      return i;",
+  "  }",
+  "}",
+  "",
+  "static void reindex( Map *m, unsigned size )",
+  "{",
+  "  m->index = malloc( size * sizeof( int ) );",
+  "  memset( m->index, 0xFF, size * sizeof( int ) );",
+  "  m->mask = size - 1;",
+  "  m->cap = size * 2 / 3;",
+  "  m->entries = realloc( m->entries, m->cap * sizeof( Entry ) );",
+  "  for ( int i = 0; i < m->len; i++ ) {",
+  "    Entry *n = &m->entries[ i ];",
+  "    m->index[ probe( m, n->key, n->len, n->hash ) ] = i;",
+  "  }",
+  "}",
+  "",
+  "static Value lookup( Value m, Value k )",
+  "{",
+  "  Value none = { STR_VAL, 0, 0.0, \"\", 0 };",
+  "  if ( m.type == VEC_VAL ) {",
+  "    double i = toNumber( k );",
+  "    if ( i >= 0 && i < m.vec->len )",
+  "      return num( m.vec->data[ (int) i ] );",
+  "    return none;",
+  "  }",
+  "  if ( m.type != MAP_VAL )",
+  "    return none;",
+  "  char buf[ 400 ];",
+  "  int len;",
+  "  char const *key = text( k, buf, &len );",
+  "  int e = m.map->index[ probe( m.map, key, len, hash( key, len ) ) ];",
+  "  return e < 0 ? none : m.map->entries[ e ].val;",
+  "}",
+  "",
+  "static void tooLong( void )",
+  "{",
+  "  fflush( stdout );",
+  "  fprintf( stderr, \"vector too long\\n\" );",
+  "  exit( 1 );",
+  "}",
+  "",
+  "static Vec *newVec( long len )",
+  "{",
+  "  Vec *vec = calloc( 1, sizeof( Vec ) );",
+  "  if ( len > INT_MAX ||",
+  "       !( vec->data = malloc( ( len ? len : 1 ) * sizeof( double ) ) ) )",
+  "    tooLong();",
+  "  vec->len = vec->cap = len;",
+  "  return vec;",
+  "}",
+  "",
+  "static Value vecValue( Vec *vec )",
+  "{",
+  "  Value v = { VEC_VAL, 0, 0.0, NULL, 0, NULL, NULL, vec };",
+  "  return v;",
+  "}",
+  "",
+  "static void storeElement( Value *var, double i, double n )",
+  "{",
+  "  Vec *vec = var->vec;",
+  "  if ( !( i >= 0 && i < vec->len + 1 ) )",
+  "    return;",
+  "  if ( vec->refs > 1 ) {",
+  "    Vec *copy = newVec( vec->len + 1 );",
+  "    memcpy( copy->data, vec->data, vec->len * sizeof( double ) );",
+  "    copy->len = vec->len;",
+  "    assign( var, vecValue( copy ) );",
+  "    vec = copy;",
+  "  }",
+  "  if ( i < vec->len ) {",
+  "    vec->data[ (int) i ] = n;",
+  "    return;",
+  "  }",
+  "  if ( vec->len == vec->cap ) {",
+  "    if ( vec->cap == INT_MAX )",
+  "      tooLong();",
+  "    vec->cap = vec->cap < INT_MAX / 2 ? vec->cap * 2 + 1 : INT_MAX;",
+  "    vec->data = realloc( vec->data, vec->cap * sizeof( double ) );",
+  "  }",
+  "  vec->data[ vec->len++ ] = n;",
+  "}",
+  "",
+  "static void store( Value *var, Value k, Value v )",
+  "{",
+  "  if ( var->type == VEC_VAL ) {",
+  "    storeElement( var, toNumber( k ), toNumber( v ) );",
+  "    return;",
+  "  }",
+  "",
+  "  /* Copy the key and hold the value first, since either could",
+  "     belong to the variable's old value. */",
+  "  char buf[ 400 ];",
+  "  int len;",
+  "  char const *t = text( k, buf, &len );",
+  "  char *key = malloc( len + 1 );",
+  "  memcpy( key, t, len );",
+  "  unsigned h = hash( key, len );",
+  "  keep( v );",
+  "",
+  "  /* Give the variable a map of its own, if it doesn't have one. */",
+  "  Map *m = var->type == MAP_VAL ? var->map : NULL;",
+  "  if ( !m || m->refs > 1 ) {",
+  "    Map *copy = calloc( 1, sizeof( Map ) );",
+  "    if ( m ) {",
+  "      copy->len = m->len;",
+  "      copy->entries = malloc( m->len * sizeof( Entry ) );",
+  "      for ( int i = 0; i < m->len; i++ ) {",
+  "        Entry n = m->entries[ i ];",
+  "        n.key = malloc( n.len + 1 );",
+  "        memcpy( n.key, m->entries[ i ].key, n.len );",
+  "        keep( n.val );",
+  "        copy->entries[ i ] = n;",
+  "      }",
+  "    }",
+  "    reindex( copy, m ? m->mask + 1 : 8 );",
+  "    Value mv = { MAP_VAL, 0, 0.0, NULL, 0, NULL, copy };",
+  "    assign( var, mv );",
+  "    m = copy;",
+  "  }",
+  "",
+  "  unsigned pos = probe( m, key, len, h );",
+  "  int e = m->index[ pos ];",
+  "  if ( e >= 0 ) {",
+  "    free( key );",
+  "    discard( m->entries[ e ].val );",
+  "    m->entries[ e ].val = v;",
+  "    return;",
+  "  }",
+  "  if ( m->len >= m->cap ) {",
+  "    free( m->index );",
+  "    reindex( m, ( m->mask + 1 ) * 2 );",
+  "    pos = probe( m, key, len, h );",
+  "  }",
+  "  Entry n = { key, len, h, v };",
+  "  m->index[ pos ] = m->len;",
+  "  m->entries[ m->len++ ] = n;",
+  "}",
+  "",
+  "static inline double const *elements( Value *v, double *one, int *len )",
+  "{",
+  "  if ( v->type == VEC_VAL ) {",
+  "    *len = v->vec->len;",
+  "    return v->vec->data;",
+  "  }",
+  "  *one = toNumber( *v );",
+  "  *len = 1;",
+  "  return one;",
+  "}",
+  "",
+  "static Value join( int argc, Value *args )",
+  "{",
+  "  long total = 0;",
+  "  for ( int i = 0; i < argc; i++ )",
+  "    total += args[ i ].type == VEC_VAL ? args[ i ].vec->len : 1;",
+  "  Vec *vec = newVec( total );",
+  "  double *dst = vec->data;",
+  "  for ( int i = 0; i < argc; i++ ) {",
+  "    double one;",
+  "    int len;",
+  "    double const *src = elements( &args[ i ], &one, &len );",
+  "    memcpy( dst, src, len * sizeof( double ) );",
+  "    dst += len;",
+  "  }",
+  "  return hold( vecValue( vec ) );",
+  "}",
+  "",
+  "static Value range( Value v )",
+  "{",
+  "  double limit = toNumber( v );",
+  "  long len = 0;",
+  "  if ( limit > INT_MAX )",
+  "    len = INT_MAX + 1L;",
+  "  else if ( limit > 0 ) {",
+  "    len = (long) limit;",
+  "    if ( len < limit )",
+  "      len++;",
+  "  }",
+  "  Vec *vec = newVec( len );",
+  "  for ( int i = 0; i < len; i++ )",
+  "    vec->data[ i ] = i;",
+  "  return hold( vecValue( vec ) );",
+  "}",
+  "",
+  "enum { ADD, SUB, MUL, DIV, LESS, MIN, MAX };",
+  "",
+  "static inline double apply( int op, double x, double y )",
+  "{",
+  "  switch ( op ) {",
+  "  case ADD:",
+  "    return x + y;",
+  "  case SUB:",
+  "    return x - y;",
+  "  case MUL:",
+  "    return x * y;",
+  "  case DIV:",
+  "    return x / y;",
+  "  default:",
+  "    return x < y ? 1.0 : 0.0;",
+  "  }",
+  "}",
+  "",
+  "static Value arith( int op, Value a, Value b )",
+  "{",
+  "  if ( a.type != VEC_VAL && b.type != VEC_VAL ) {",
+  "    double x = toNumber( a ), y = toNumber( b );",
+  "    if ( op == LESS )",
+  "      return boolean( x < y );",
+  "    return num( rounded( apply( op, x, y ) ) );",
+  "  }",
+  "",
+  "  /* A single number is used with every element. */",
+  "  double x = 0.0, y = 0.0;",
+  "  double const *ad = &x, *bd = &y;",
+  "  int len = INT_MAX;",
+  "  if ( a.type == VEC_VAL ) {",
+  "    ad = a.vec->data;",
+  "    len = a.vec->len;",
+  "  } else",
+  "    x = toNumber( a );",
+  "  if ( b.type == VEC_VAL ) {",
+  "    bd = b.vec->data;",
+  "    if ( b.vec->len < len )",
+  "      len = b.vec->len;",
+  "  } else",
+  "    y = toNumber( b );",
+  "",
+  "  /* Write over a temporary operand nothing else refers to. */",
+  "  Value r;",
+  "  if ( a.type == VEC_VAL && a.vec->temp && a.vec->refs == 1 &&",
+  "       a.vec->len == len )",
+  "    r = a;",
+  "  else if ( b.type == VEC_VAL && b.vec->temp && b.vec->refs == 1 &&",
+  "            b.vec->len == len )",
+  "    r = b;",
+  "  else {",
+  "    Vec *vec = newVec( len );",
+  "    vec->temp = 1;",
+  "    r = hold( vecValue( vec ) );",
+  "  }",
+  "  int as = a.type == VEC_VAL, bs = b.type == VEC_VAL;",
+  "  double *dst = r.vec->data;",
+  "  for ( long i = 0; i < len; i++ )",
+  "    dst[ i ] = apply( op, ad[ i * as ], bd[ i * bs ] );",
+  "  return r;",
+  "}",
+  "",
+  "static inline double combine( int op, double x, double y )",
+  "{",
+  "  if ( op == ADD )",
+  "    return x + y;",
+  "  if ( op == MIN )",
+  "    return x < y ? x : y;",
+  "  return x > y ? x : y;",
+  "}",
+  "",
+  "static double reduce( int op, Value v, double start )",
+  "{",
+  "  /* Eight partial results, combined in a fixed order, then the last",
+  "     few elements one at a time. */",
+  "  double one, c[ 8 ];",
+  "  int len;",
+  "  double const *a = elements( &v, &one, &len );",
+  "  for ( int k = 0; k < 8; k++ )",
+  "    c[ k ] = start;",
+  "  int whole = len - len % 8;",
+  "  for ( int i = 0; i < whole; i += 8 )",
+  "    for ( int k = 0; k < 8; k++ )",
+  "      c[ k ] = combine( op, c[ k ], a[ i + k ] );",
+  "  double r = combine( op,",
+  "                      combine( op, combine( op, c[ 0 ], c[ 4 ] ),",
+  "                               combine( op, c[ 2 ], c[ 6 ] ) ),",
+  "                      combine( op, combine( op, c[ 1 ], c[ 5 ] ),",
+  "                               combine( op, c[ 3 ], c[ 7 ] ) ) );",
+  "  for ( int i = whole; i < len; i++ )",
+  "    r = combine( op, r, a[ i ] );",
+  "  return r;",
+  "}",
+  "",
+  "static inline double length( Value v )",
+  "{",
+  "  return v.type == VEC_VAL ? v.vec->len : 1;",
+  "}",
+  "",
+  NULL
+};
+
+/** Support code for programs with functions.  Every call runs in
+    invoke(), with its locals in a frame of a stack allocated once, at
+    the start of the program.  A tail call replaces the frame it's made
+    from and jumps back to the start of invoke(), so it uses no more of
+    either stack.  Temporaries made during a call are only released
+    down to where the call started, and the result becomes a
+    temporary of the caller, like the interpreter's. */
+static char const *const callPrelude[] = {
+  "static Value *frames;",
+  "static int depth;",
+  "",
+  "/* Defined at the end, once every frame has been written. */",
+  "static int frameSize;",
+  "",
+  "static void enter( Value *f, int argc, Value *args, int params,",
+  "                   int locals )",
+  "{",
+  "  int n = argc < params ? argc : params;",
+  "  memmove( f, args, n * sizeof( Value ) );",
+  "  for ( int i = 0; i < n; i++ )",
+  "    keep( f[ i ] );",
+  "  for ( int i = n; i < locals; i++ )",
+  "    f[ i ] = str( \"\", 0, 0.0 );",
+  "}",
+  "",
+  "static void leave( Value *f, int locals )",
+  "{",
+  "  for ( int i = 0; i < locals; i++ )",
+  "    discard( f[ i ] );",
+  "}",
+  "",
+  "static void tail( Value *f, int locals, int argc, Value *args )",
+  "{",
+  "  /* The arguments can belong to the old locals. */",
+  "  for ( int i = 0; i < argc; i++ )",
+  "    hold( args[ i ] );",
+  "  leave( f, locals );",
+  "  memmove( f, args, argc * sizeof( Value ) );",
+  "}",
+  "",
+  "static void callError( int line, char const *message, char const *name )",
+  "{",
+  "  fflush( stdout );",
+  "  fprintf( stderr, \"line %d: %s %s\\n\", line, message, name );",
+  "  exit( 1 );",
+  "}",
+  "",
+  NULL
+};
+
+Emitter *makeEmitter( char const *name )
+{
+  Emitter *em = (Emitter *) malloc( sizeof( Emitter ) );
+  em->name = name;
+  em->len = 0;
+  em->cap = INITIAL_CAPACITY;
+  em->stmts = (Stmt **) malloc( em->cap * sizeof( Stmt * ) );
+  return em;
+}
+
+void emitStmt( Emitter *em, Stmt *stmt )
+{
+  if ( em->len >= em->cap ) {
+    em->cap *= 2;
+    em->stmts = (Stmt **) realloc( em->stmts, em->cap * sizeof( Stmt * ) );
+  }
+  em->stmts[ em->len++ ] = stmt;
+}
+
+void freeEmitter( Emitter *em )
+{
+  free( em->stmts );
+  free( em );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Finding numeric variables
+
+/** Return true if an expression is an arithmetic operator, so its value
+    is a number unless an operand is a vector.
+    @param expr expression to check.
+    @return true if expr is arithmetic.
+*/
+static bool isArithmetic( Expr *expr )
+{
+  return expr->kind == SUM_EXPR || expr->kind == DIFF_EXPR ||
+    expr->kind == PROD_EXPR || expr->kind == QUOT_EXPR;
+}
+
+/** Return true if an expression is arithmetic or a call to a builtin
+    function that gives a number, like len() or sum().
+    @param expr expression to check.
+    @return true if expr gives a number, unless it works on vectors.
+*/
+static bool givesNumber( Expr *expr )
+{
+  if ( expr->kind == CALL_EXPR )
+    return callFunction( expr ) != VECTOR_FN &&
+      callFunction( expr ) != RANGE_FN;
+  return isArithmetic( expr );
+}
+
+/** Set of variable slots a statement uses, with a flag for each slot
+    and a list of the flags that are set, so it's quick to clear. */
+typedef struct {
+  // Flag for each slot, true if it's in the set.
+  bool *mark;
+
+  // Slots in the set.
+  int *list;
+  int len;
+} SlotSet;
+
+/** Add a slot to a set.
+    @param set set to add to.
+    @param slot slot to add.
+*/
+static void addSlot( SlotSet *set, int slot )
+{
+  if ( !set->mark[ slot ] ) {
+    set->mark[ slot ] = true;
+    set->list[ set->len++ ] = slot;
+  }
+}
+
+/** Remove every slot from a set.
+    @param set set to clear.
+*/
+static void clearSlots( SlotSet *set )
+{
+  for ( int i = 0; i < set->len; i++ )
+    set->mark[ set->list[ i ] ] = false;
+  set->len = 0;
+}
+
+/** Add every variable an expression reads to a set.
+    @param expr expression to check.
+    @param set set to add to.
+*/
+static void markReads( Expr *expr, SlotSet *set )
+{
+  if ( expr->kind == VAR_EXPR )
+    addSlot( set, variableExprSlot( expr ) );
+  else if ( expr->kind == CALL_EXPR || expr->kind == INVOKE_EXPR ) {
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      markReads( callArg( expr, i ), set );
+  } else if ( expr->kind != LITERAL_EXPR && expr->kind != LOCAL_EXPR ) {
+    markReads( binaryLeft( expr ), set );
+    markReads( binaryRight( expr ), set );
+  }
+}
+
+/** Add every variable a statement reads or assigns to a set, counting
+    the globals a function reads as used where it's defined.  Variables
+    assigned something other than arithmetic or a number from a builtin
+    are also marked as not numeric.
+    @param stmt statement to check.
+    @param set set to add to.
+    @param mixed flag for each slot, set for variables that can hold
+    something other than a number.
+*/
+static void markUses( Stmt *stmt, SlotSet *set, bool *mixed )
+{
+  switch ( stmt->kind ) {
+  case ASSIGN_STMT:
+    addSlot( set, assignSlot( stmt ) );
+    if ( !givesNumber( stmtExpr( stmt ) ) )
+      mixed[ assignSlot( stmt ) ] = true;
+    markReads( stmtExpr( stmt ), set );
+    break;
+
+  case ASSIGN_KEY_STMT:
+    addSlot( set, assignSlot( stmt ) );
+    mixed[ assignSlot( stmt ) ] = true;
+    markReads( assignKey( stmt ), set );
+    markReads( stmtExpr( stmt ), set );
+    break;
+
+  case LOCAL_KEY_STMT:
+    markReads( assignKey( stmt ), set );
+    markReads( stmtExpr( stmt ), set );
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      markUses( compoundStmt( stmt, i ), set, mixed );
+    break;
+
+  case FUNCTION_STMT:
+    markUses( stmtBody( stmt ), set, mixed );
+    break;
+
+  case IF_STMT:
+  case WHILE_STMT:
+    markReads( stmtExpr( stmt ), set );
+    markUses( stmtBody( stmt ), set, mixed );
+    break;
+
+  default:
+    markReads( stmtExpr( stmt ), set );
+    break;
+  }
+}
+
+/** Find variables that are read somewhere their value matters as more
+    than a number: printed, compared with ==, or used as a condition.
+    @param expr expression to check.
+    @param numeric true if expr is used as a number.
+    @param other flag for each slot, set for variables read that way.
+*/
+static void markOtherReads( Expr *expr, bool numeric, bool *other )
+{
+  switch ( expr->kind ) {
+  case LITERAL_EXPR:
+  case LOCAL_EXPR:
+    break;
+  case VAR_EXPR:
+    if ( !numeric )
+      other[ variableExprSlot( expr ) ] = true;
+    break;
+  case INVOKE_EXPR:
+    // The function gets the whole value of each argument.
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      markOtherReads( callArg( expr, i ), false, other );
+    break;
+  case CALL_EXPR:
+    // Only the numbers in the arguments matter, unless they're vectors.
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      markOtherReads( callArg( expr, i ), true, other );
+    break;
+  case EQU_EXPR:
+  case AND_EXPR:
+  case OR_EXPR:
+  case CONCAT_EXPR:
+  case INDEX_EXPR:
+    markOtherReads( binaryLeft( expr ), false, other );
+    markOtherReads( binaryRight( expr ), false, other );
+    break;
+  default:
+    markOtherReads( binaryLeft( expr ), true, other );
+    markOtherReads( binaryRight( expr ), true, other );
+    break;
+  }
+}
+
+/** Find variables read somewhere their value matters as more than a
+    number, in a statement.  Assignments that just copy a variable are
+    collected, since it depends on the variable being assigned.
+    @param stmt statement to check.
+    @param other flag for each slot, set for variables read that way.
+    @param copies list of copies, a target slot then a source slot.
+    @param len number of slots in copies.
+    @param cap capacity of copies.
+*/
+static void markStmtReads( Stmt *stmt, bool *other, int **copies, int *len,
+                           int *cap )
+{
+  switch ( stmt->kind ) {
+  case ASSIGN_STMT:
+    if ( stmtExpr( stmt )->kind == VAR_EXPR ) {
+      if ( *len + 2 > *cap ) {
+        *cap = *cap * 2 + 2;
+        *copies = (int *) realloc( *copies, *cap * sizeof( int ) );
+      }
+      ( *copies )[ ( *len )++ ] = assignSlot( stmt );
+      ( *copies )[ ( *len )++ ] = variableExprSlot( stmtExpr( stmt ) );
+    } else
+      markOtherReads( stmtExpr( stmt ), true, other );
+    break;
+
+  case ASSIGN_KEY_STMT:
+    // The map, the key and the value stored all matter as more than
+    // numbers.
+    other[ assignSlot( stmt ) ] = true;
+    markOtherReads( assignKey( stmt ), false, other );
+    markOtherReads( stmtExpr( stmt ), false, other );
+    break;
+
+  case LOCAL_KEY_STMT:
+    markOtherReads( assignKey( stmt ), false, other );
+    markOtherReads( stmtExpr( stmt ), false, other );
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      markStmtReads( compoundStmt( stmt, i ), other, copies, len, cap );
+    break;
+
+  case FUNCTION_STMT:
+    markStmtReads( stmtBody( stmt ), other, copies, len, cap );
+    break;
+
+  case IF_STMT:
+  case WHILE_STMT:
+    markOtherReads( stmtExpr( stmt ), false, other );
+    markStmtReads( stmtBody( stmt ), other, copies, len, cap );
+    break;
+
+  default:
+    markOtherReads( stmtExpr( stmt ), false, other );
+    break;
+  }
+}
+
+/** Variables and map elements that can hold vectors. */
+typedef struct {
+  // Flag for each slot, true if the variable can hold a vector.
+  bool *slot;
+
+  // True if a vector can be stored in a map.
+  bool inMaps;
+} VectorUse;
+
+/** Return true if an expression's value can be a vector.
+    @param expr expression to check.
+    @param vecs variables and map elements that can hold vectors.
+    @return true if expr can evaluate to a vector.
+*/
+static bool isVector( Expr *expr, VectorUse const *vecs )
+{
+  switch ( expr->kind ) {
+  case VAR_EXPR:
+    return vecs->slot[ variableExprSlot( expr ) ];
+  case LOCAL_EXPR:
+  case INVOKE_EXPR:
+    // Locals and results aren't tracked, so they could be anything.
+    return true;
+  case CALL_EXPR:
+    return callFunction( expr ) == VECTOR_FN ||
+      callFunction( expr ) == RANGE_FN;
+  case INDEX_EXPR:
+    return vecs->inMaps;
+  case SUM_EXPR:
+  case DIFF_EXPR:
+  case PROD_EXPR:
+  case QUOT_EXPR:
+  case LESS_EXPR:
+    return isVector( binaryLeft( expr ), vecs ) ||
+      isVector( binaryRight( expr ), vecs );
+  default:
+    return false;
+  }
+}
+
+/** Mark the variables a statement can assign a vector, and note if it
+    can store one in a map.
+    @param stmt statement to check.
+    @param vecs variables and map elements that can hold vectors.
+    @return true if anything new was marked.
+*/
+static bool markVectors( Stmt *stmt, VectorUse *vecs )
+{
+  bool changed = false;
+  switch ( stmt->kind ) {
+  case ASSIGN_STMT:
+    if ( !vecs->slot[ assignSlot( stmt ) ] &&
+         isVector( stmtExpr( stmt ), vecs ) ) {
+      vecs->slot[ assignSlot( stmt ) ] = true;
+      changed = true;
+    }
+    break;
+
+  case ASSIGN_KEY_STMT:
+  case LOCAL_KEY_STMT:
+    if ( !vecs->inMaps && isVector( stmtExpr( stmt ), vecs ) ) {
+      vecs->inMaps = true;
+      changed = true;
+    }
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      if ( markVectors( compoundStmt( stmt, i ), vecs ) )
+        changed = true;
+    break;
+
+  case IF_STMT:
+  case WHILE_STMT:
+  case FUNCTION_STMT:
+    changed = markVectors( stmtBody( stmt ), vecs );
+    break;
+
+  default:
+    break;
+  }
+  return changed;
+}
+
+/** Work out which variables and map elements can hold vectors.  A
+    variable can if it's assigned something that can be a vector,
+    including another variable that can hold one.
+    @param em emitter holding the program.
+    @param count number of variable slots.
+    @return what can hold vectors.  The caller must free its slot
+    array.
+*/
+static VectorUse findVectors( Emitter *em, int count )
+{
+  VectorUse vecs = { (bool *) calloc( count + 1, sizeof( bool ) ), false };
+  for ( bool changed = true; changed; ) {
+    changed = false;
+    for ( int i = 0; i < em->len; i++ )
+      if ( markVectors( em->stmts[ i ], &vecs ) )
+        changed = true;
+  }
+  return vecs;
+}
+
+/** Work out which variables can be C doubles.  That's true of a
+    variable that's only assigned arithmetic, if the first top-level
+    statement that uses it is an assignment that doesn't read it, so it
+    never has the value of an undefined variable.  It's also true of a
+    variable that's only ever read as a number, since then only the
+    number matters, whatever it's assigned.  Neither is true of a
+    variable that can hold a vector, since arithmetic on a vector works
+    on all its elements.
+    @param em emitter holding the program.
+    @param count number of variable slots.
+    @param vecs variables that can hold vectors.
+    @return flag for each slot, true if the variable is numeric.  The
+    caller must free this.
+*/
+static bool *findNumeric( Emitter *em, int count, VectorUse const *vecs )
+{
+  bool *always = (bool *) calloc( count + 1, sizeof( bool ) );
+  bool *seen = (bool *) calloc( count + 1, sizeof( bool ) );
+  bool *mixed = (bool *) calloc( count + 1, sizeof( bool ) );
+  SlotSet uses = { (bool *) calloc( count + 1, sizeof( bool ) ),
+                   (int *) malloc( ( count + 1 ) * sizeof( int ) ), 0 };
+  SlotSet reads = { (bool *) calloc( count + 1, sizeof( bool ) ),
+                    (int *) malloc( ( count + 1 ) * sizeof( int ) ), 0 };
+
+  // Find the variables that always hold a number.
+  for ( int i = 0; i < em->len; i++ ) {
+    Stmt *stmt = em->stmts[ i ];
+    markUses( stmt, &uses, mixed );
+
+    // A top-level assignment defines its variable, unless it reads it
+    // first.
+    int defined = -1;
+    if ( stmt->kind == ASSIGN_STMT ) {
+      markReads( stmtExpr( stmt ), &reads );
+      if ( !reads.mark[ assignSlot( stmt ) ] )
+        defined = assignSlot( stmt );
+      clearSlots( &reads );
+    }
+
+    // Check the variables this statement uses for the first time.
+    for ( int j = 0; j < uses.len; j++ ) {
+      int slot = uses.list[ j ];
+      if ( !seen[ slot ] ) {
+        seen[ slot ] = true;
+        always[ slot ] = slot == defined;
+      }
+    }
+    clearSlots( &uses );
+  }
+
+  for ( int slot = 0; slot < count; slot++ )
+    if ( mixed[ slot ] || vecs->slot[ slot ] )
+      always[ slot ] = false;
+
+  // Then, the ones only read as numbers.
+  bool *other = (bool *) calloc( count + 1, sizeof( bool ) );
+  int *copies = NULL;
+  int len = 0, cap = 0;
+  for ( int i = 0; i < em->len; i++ )
+    markStmtReads( em->stmts[ i ], other, &copies, &len, &cap );
+
+  bool *numeric = (bool *) calloc( count + 1, sizeof( bool ) );
+  for ( int slot = 0; slot < count; slot++ )
+    numeric[ slot ] = !vecs->slot[ slot ] &&
+      ( always[ slot ] || !other[ slot ] );
+
+  // Copying a variable into one that isn't numeric needs its whole
+  // value, which can make that variable not numeric either.
+  for ( bool changed = true; changed; ) {
+    changed = false;
+    for ( int i = 0; i < len; i += 2 ) {
+      int src = copies[ i + 1 ];
+      if ( !numeric[ copies[ i ] ] && numeric[ src ] && !always[ src ] ) {
+        numeric[ src ] = false;
+        changed = true;
+      }
+    }
+  }
+
+  free( always );
+  free( seen );
+  free( mixed );
+  free( other );
+  free( copies );
+  free( uses.mark );
+  free( uses.list );
+  free( reads.mark );
+  free( reads.list );
+  return numeric;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Writing C
+
+/** State for writing one program. */
+typedef struct {
+  // Stream we're writing to.
+  FILE *fp;
+
+  // Flag for each variable slot, true if it's a C double.
+  bool *numeric;
+
+  // Variables and map elements that can hold vectors.
+  VectorUse vecs;
+
+  // True if the program concatenates, makes vectors or stores in maps,
+  // so variables that aren't numeric can hold ropes, vectors or maps,
+  // and have to be assigned with assign().
+  bool counted;
+
+  // Number of locals in the frame of the function being written, or
+  // zero in main().  Spare slots for ordering calls come after them.
+  int locals;
+
+  // Number of spare slots the statement being written has used, and
+  // the size of the largest frame so far.
+  int spare;
+  int frameSize;
+
+  // Operands already evaluated into spare slots, and their slots.
+  Expr **held;
+  int *heldSlots;
+  int heldLen, heldCap;
+
+  // Number of function definitions written so far in main().
+  int defined;
+} Writer;
+
+/** Return true if an expression can do arithmetic on vectors, so it
+    has to be written as a call to arith().
+    @param w writer to use.
+    @param expr expression to check.
+    @return true if expr is an operator that can work on vectors.
+*/
+static bool isVectorArith( Writer *w, Expr *expr )
+{
+  return ( isArithmetic( expr ) || expr->kind == LESS_EXPR ) &&
+    isVector( expr, &w->vecs );
+}
+
+/** Return true if evaluating an expression can make temporaries in the
+    generated program.  That's like makesTemporaries(), but arithmetic
+    on vectors makes them too.
+    @param w writer to use.
+    @param expr expression to check.
+    @return true if expr needs its temporaries released.
+*/
+static bool holdsTemporaries( Writer *w, Expr *expr )
+{
+  if ( makesTemporaries( expr ) || isVectorArith( w, expr ) )
+    return true;
+  if ( expr->kind == LITERAL_EXPR || expr->kind == VAR_EXPR ||
+       expr->kind == LOCAL_EXPR )
+    return false;
+  if ( expr->kind == CALL_EXPR ) {
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      if ( holdsTemporaries( w, callArg( expr, i ) ) )
+        return true;
+    return false;
+  }
+  return holdsTemporaries( w, binaryLeft( expr ) ) ||
+    holdsTemporaries( w, binaryRight( expr ) );
+}
+
+/** Return true if a statement, or any statement inside it,
+    concatenates, makes vectors or stores in a map.  Any function can
+    return something counted.
+    @param w writer to use.
+    @param stmt statement to check.
+    @return true if stmt makes ropes, vectors or maps.
+*/
+static bool usesCounted( Writer *w, Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      if ( usesCounted( w, compoundStmt( stmt, i ) ) )
+        return true;
+    return false;
+  case IF_STMT:
+  case WHILE_STMT:
+    return holdsTemporaries( w, stmtExpr( stmt ) ) ||
+      usesCounted( w, stmtBody( stmt ) );
+  case ASSIGN_KEY_STMT:
+  case LOCAL_KEY_STMT:
+  case FUNCTION_STMT:
+    return true;
+  default:
+    return holdsTemporaries( w, stmtExpr( stmt ) );
+  }
+}
+
+/** Return true if an expression calls a function the program defines,
+    which can print or fail, so it has to be evaluated in order.
+    @param expr expression to check.
+    @return true if expr contains a call.
+*/
+static bool hasInvoke( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case INVOKE_EXPR:
+    return true;
+  case LITERAL_EXPR:
+  case VAR_EXPR:
+  case LOCAL_EXPR:
+    return false;
+  case CALL_EXPR:
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      if ( hasInvoke( callArg( expr, i ) ) )
+        return true;
+    return false;
+  default:
+    return hasInvoke( binaryLeft( expr ) ) || hasInvoke( binaryRight( expr ) );
+  }
+}
+
+/** Reserve spare slots in the frame for the statement being written.
+    @param w writer to use.
+    @param n number of slots.
+    @return index in the frame of the first slot.
+*/
+static int spareSlots( Writer *w, int n )
+{
+  int slot = w->locals + w->spare;
+  w->spare += n;
+  if ( w->locals + w->spare > w->frameSize )
+    w->frameSize = w->locals + w->spare;
+  return slot;
+}
+
+/** Return the spare slot an operand has already been evaluated into.
+    @param w writer to use.
+    @param expr operand to look for.
+    @return its slot, or -1 if it hasn't been evaluated yet.
+*/
+static int heldSlot( Writer *w, Expr *expr )
+{
+  for ( int i = 0; i < w->heldLen; i++ )
+    if ( w->held[ i ] == expr )
+      return w->heldSlots[ i ];
+  return -1;
+}
+
+/** Return the operands of an expression that call functions and
+    haven't been evaluated yet.  C doesn't say what order operands are
+    evaluated in, so if there's more than one, they have to be
+    evaluated into spare slots first.  The operands of && and || are
+    already in order.
+    @param w writer to use.
+    @param expr expression to check.
+    @param ops returns the operands, if list isn't NULL.
+    @return number of operands that need evaluating first.
+*/
+static int unorderedOperands( Writer *w, Expr *expr, Expr **ops )
+{
+  int n = 0;
+  if ( expr->kind == CALL_EXPR ) {
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      if ( hasInvoke( callArg( expr, i ) ) &&
+           heldSlot( w, callArg( expr, i ) ) < 0 ) {
+        if ( ops )
+          ops[ n ] = callArg( expr, i );
+        n++;
+      }
+  } else if ( expr->kind >= SUM_EXPR && expr->kind <= INDEX_EXPR &&
+              expr->kind != AND_EXPR && expr->kind != OR_EXPR ) {
+    Expr *pair[ 2 ] = { binaryLeft( expr ), binaryRight( expr ) };
+    for ( int i = 0; i < 2; i++ )
+      if ( hasInvoke( pair[ i ] ) && heldSlot( w, pair[ i ] ) < 0 ) {
+        if ( ops )
+          ops[ n ] = pair[ i ];
+        n++;
+      }
+  }
+  return n;
+}
+
+/** Return the number a literal has in arithmetic.
+    @param expr the literal.
+    @return its value as a number.
+*/
+static double literalNum( Expr *expr )
+{
+  Value val = literalValue( expr );
+  return toNumber( &val );
+}
+
+/** Write a double as a C constant, exactly.
+    @param w writer to use.
+    @param num value to write.
+*/
+static void writeConstant( Writer *w, double num )
+{
+  if ( isnan( num ) ) {
+    unsigned long long b;
+    memcpy( &b, &num, sizeof( b ) );
+    fprintf( w->fp, "bits( 0x%016llxULL )", b );
+  } else if ( isinf( num ) )
+    fprintf( w->fp, num < 0 ? "( -HUGE_VAL )" : "HUGE_VAL" );
+  else
+    fprintf( w->fp, "( %a )", num );
+}
+
+/** Write a literal's value, as a C Value.
+    @param w writer to use.
+    @param expr the literal.
+*/
+static void writeLiteral( Writer *w, Expr *expr )
+{
+  // Folded constants can hold a number or a comparison result.
+  Value val = literalValue( expr );
+  if ( val.type == NUM_VAL ) {
+    fprintf( w->fp, "num( " );
+    writeConstant( w, val.num );
+    fprintf( w->fp, " )" );
+    return;
+  }
+  if ( val.type == BOOL_VAL ) {
+    fprintf( w->fp, "boolean( %d )", val.as.truth );
+    return;
+  }
+
+  String *str = val.as.str;
+  fprintf( w->fp, "str( \"" );
+  for ( int i = 0; i < str->len; i++ ) {
+    unsigned char ch = str->text[ i ];
+    if ( ch == '"' || ch == '\\' || ch == '?' )
+      fprintf( w->fp, "\\%c", ch );
+    else if ( ch == '\n' )
+      fprintf( w->fp, "\\n" );
+    else if ( ch < ' ' || ch > '~' )
+      fprintf( w->fp, "\\%03o", ch );
+    else
+      fputc( ch, w->fp );
+  }
+  fprintf( w->fp, "\", %d, ", str->len );
+  writeConstant( w, literalNum( expr ) );
+  fprintf( w->fp, " )" );
+}
+
+static void writeNumber( Writer *w, Expr *expr );
+static void writeTruth( Writer *w, Expr *expr );
+static void writeValue( Writer *w, Expr *expr );
+
+/** Note that an operand has been evaluated into a spare slot, so it's
+    written as that slot until the expression using it is done.
+    @param w writer to use.
+    @param expr the operand.
+    @param slot slot holding its value.
+*/
+static void holdOperand( Writer *w, Expr *expr, int slot )
+{
+  if ( w->heldLen >= w->heldCap ) {
+    w->heldCap = w->heldCap ? w->heldCap * 2 : INITIAL_CAPACITY;
+    w->held = (Expr **) realloc( w->held, w->heldCap * sizeof( Expr * ) );
+    w->heldSlots = (int *) realloc( w->heldSlots,
+                                    w->heldCap * sizeof( int ) );
+  }
+  w->held[ w->heldLen ] = expr;
+  w->heldSlots[ w->heldLen++ ] = slot;
+}
+
+/** Write an expression with more than one operand that calls a
+    function.  Those operands are evaluated into spare slots first, in
+    order, with the comma operator.
+    @param w writer to use.
+    @param expr expression to write.
+    @param write function to write expr once its operands are held.
+*/
+static void writeInOrder( Writer *w, Expr *expr,
+                          void (*write)( Writer *w, Expr *expr ) )
+{
+  int argc = expr->kind == CALL_EXPR ? callArgCount( expr ) : 2;
+  Expr **ops = (Expr **) malloc( argc * sizeof( Expr * ) );
+  int n = unorderedOperands( w, expr, ops );
+  int first = spareSlots( w, n );
+  int mark = w->heldLen;
+
+  fprintf( w->fp, "( " );
+  for ( int i = 0; i < n; i++ ) {
+    fprintf( w->fp, "f[ %d ] = ", first + i );
+    writeValue( w, ops[ i ] );
+    fprintf( w->fp, ", " );
+    holdOperand( w, ops[ i ], first + i );
+  }
+  write( w, expr );
+  fprintf( w->fp, " )" );
+
+  w->heldLen = mark;
+  free( ops );
+}
+
+/** Write a call to a function the program defines, as a C Value.  The
+    arguments are evaluated in order into spare slots, where invoke()
+    finds them.
+    @param w writer to use.
+    @param expr expression of kind INVOKE_EXPR.
+*/
+static void writeInvoke( Writer *w, Expr *expr )
+{
+  int argc = callArgCount( expr );
+  fprintf( w->fp, "invoke( %d, %d, ", invokedFunction( expr ), argc );
+  if ( argc == 0 )
+    fprintf( w->fp, "NULL" );
+  else {
+    int first = spareSlots( w, argc );
+    fprintf( w->fp, "( " );
+    for ( int i = 0; i < argc; i++ ) {
+      fprintf( w->fp, "f[ %d ] = ", first + i );
+      writeValue( w, callArg( expr, i ) );
+      fprintf( w->fp, ", " );
+    }
+    fprintf( w->fp, "&f[ %d ] )", first );
+  }
+  fprintf( w->fp, ", %d )", expr->line );
+}
+
+/** Write a concatenation or a lookup in a map as a C Value, a call to
+    the prelude function that does it.
+    @param w writer to use.
+    @param expr expression of kind CONCAT_EXPR or INDEX_EXPR.
+*/
+static void writeCall( Writer *w, Expr *expr )
+{
+  fprintf( w->fp, expr->kind == CONCAT_EXPR ? "concat( " : "lookup( " );
+  writeValue( w, binaryLeft( expr ) );
+  fprintf( w->fp, ", " );
+  writeValue( w, binaryRight( expr ) );
+  fprintf( w->fp, " )" );
+}
+
+/** Write arithmetic that can work on vectors as a C Value, a call to
+    arith().
+    @param w writer to use.
+    @param expr arithmetic or comparison expression.
+*/
+static void writeArith( Writer *w, Expr *expr )
+{
+  static char const *const ops[] = {
+    [ SUM_EXPR ] = "ADD", [ DIFF_EXPR ] = "SUB", [ PROD_EXPR ] = "MUL",
+    [ QUOT_EXPR ] = "DIV", [ LESS_EXPR ] = "LESS"
+  };
+
+  fprintf( w->fp, "arith( %s, ", ops[ expr->kind ] );
+  writeValue( w, binaryLeft( expr ) );
+  fprintf( w->fp, ", " );
+  writeValue( w, binaryRight( expr ) );
+  fprintf( w->fp, " )" );
+}
+
+/** Write a call to a builtin function that makes a vector, as a C
+    Value.
+    @param w writer to use.
+    @param expr call to VECTOR_FN or RANGE_FN.
+*/
+static void writeVector( Writer *w, Expr *expr )
+{
+  if ( callFunction( expr ) == RANGE_FN ) {
+    fprintf( w->fp, "range( " );
+    writeValue( w, callArg( expr, 0 ) );
+    fprintf( w->fp, " )" );
+    return;
+  }
+
+  int argc = callArgCount( expr );
+  if ( argc == 0 ) {
+    fprintf( w->fp, "join( 0, NULL )" );
+    return;
+  }
+  fprintf( w->fp, "join( %d, (Value[]) { ", argc );
+  for ( int i = 0; i < argc; i++ ) {
+    if ( i > 0 )
+      fprintf( w->fp, ", " );
+    writeValue( w, callArg( expr, i ) );
+  }
+  fprintf( w->fp, " } )" );
+}
+
+/** Write a call to a builtin function that gives a number, as a C
+    double.
+    @param w writer to use.
+    @param expr call to LEN_FN, SUM_FN, MIN_FN or MAX_FN.
+*/
+static void writeReduction( Writer *w, Expr *expr )
+{
+  static char const *const calls[] = {
+    [ LEN_FN ] = "length( ", [ SUM_FN ] = "reduce( ADD, ",
+    [ MIN_FN ] = "reduce( MIN, ", [ MAX_FN ] = "reduce( MAX, "
+  };
+  static char const *const starts[] = {
+    [ LEN_FN ] = "", [ SUM_FN ] = ", 0.0",
+    [ MIN_FN ] = ", HUGE_VAL", [ MAX_FN ] = ", -HUGE_VAL"
+  };
+
+  Builtin fn = callFunction( expr );
+  fprintf( w->fp, "%s", calls[ fn ] );
+  writeValue( w, callArg( expr, 0 ) );
+  fprintf( w->fp, "%s )", starts[ fn ] );
+}
+
+/** Write an expression as a C Value.
+    @param w writer to use.
+    @param expr expression to write.
+*/
+static void writeValue( Writer *w, Expr *expr )
+{
+  int held = heldSlot( w, expr );
+  if ( held >= 0 )
+    fprintf( w->fp, "f[ %d ]", held );
+  else if ( unorderedOperands( w, expr, NULL ) > 1 )
+    writeInOrder( w, expr, writeValue );
+  else if ( expr->kind == LOCAL_EXPR )
+    fprintf( w->fp, "f[ %d ]", variableExprSlot( expr ) );
+  else if ( expr->kind == INVOKE_EXPR )
+    writeInvoke( w, expr );
+  else if ( expr->kind == LITERAL_EXPR )
+    writeLiteral( w, expr );
+  else if ( expr->kind == VAR_EXPR ) {
+    int slot = variableExprSlot( expr );
+    fprintf( w->fp, w->numeric[ slot ] ? "num( v_%s )" : "v_%s",
+             slotName( slot ) );
+  } else if ( isVectorArith( w, expr ) )
+    writeArith( w, expr );
+  else if ( expr->kind == CALL_EXPR && !givesNumber( expr ) )
+    writeVector( w, expr );
+  else if ( givesNumber( expr ) ) {
+    fprintf( w->fp, "num( " );
+    writeNumber( w, expr );
+    fprintf( w->fp, " )" );
+  } else if ( expr->kind == CONCAT_EXPR || expr->kind == INDEX_EXPR ) {
+    writeCall( w, expr );
+  } else {
+    fprintf( w->fp, "boolean( " );
+    writeTruth( w, expr );
+    fprintf( w->fp, " )" );
+  }
+}
+
+/** Write an expression as a C double.
+    @param w writer to use.
+    @param expr expression to write.
+*/
+static void writeNumber( Writer *w, Expr *expr )
+{
+  static char const *const ops[] = {
+    [ SUM_EXPR ] = "+", [ DIFF_EXPR ] = "-",
+    [ PROD_EXPR ] = "*", [ QUOT_EXPR ] = "/"
+  };
+
+  int held = heldSlot( w, expr );
+  if ( held >= 0 )
+    fprintf( w->fp, "toNumber( f[ %d ] )", held );
+  else if ( unorderedOperands( w, expr, NULL ) > 1 )
+    writeInOrder( w, expr, writeNumber );
+  else if ( expr->kind == LITERAL_EXPR )
+    writeConstant( w, literalNum( expr ) );
+  else if ( expr->kind == VAR_EXPR ) {
+    int slot = variableExprSlot( expr );
+    fprintf( w->fp, w->numeric[ slot ] ? "v_%s" : "toNumber( v_%s )",
+             slotName( slot ) );
+  } else if ( isVectorArith( w, expr ) || expr->kind == LOCAL_EXPR ||
+              expr->kind == INVOKE_EXPR ||
+              ( expr->kind == CALL_EXPR && !givesNumber( expr ) ) ) {
+    // A vector is used as its length.
+    fprintf( w->fp, "toNumber( " );
+    writeValue( w, expr );
+    fprintf( w->fp, " )" );
+  } else if ( expr->kind == CALL_EXPR )
+    writeReduction( w, expr );
+  else if ( isArithmetic( expr ) ) {
+    fprintf( w->fp, "rounded( " );
+    writeNumber( w, binaryLeft( expr ) );
+    fprintf( w->fp, " %s ", ops[ expr->kind ] );
+    writeNumber( w, binaryRight( expr ) );
+    fprintf( w->fp, " )" );
+  } else if ( expr->kind == CONCAT_EXPR || expr->kind == INDEX_EXPR ) {
+    fprintf( w->fp, "toNumber( " );
+    writeCall( w, expr );
+    fprintf( w->fp, " )" );
+  } else if ( hasInvoke( expr ) ) {
+    // Neither "t" nor "" parse as a number, but the functions it calls
+    // still have to run.
+    fprintf( w->fp, "( " );
+    writeTruth( w, expr );
+    fprintf( w->fp, ", 0.0 )" );
+  } else {
+    // Neither "t" nor "" parse as a number, and expressions without
+    // calls have no side effects, so there's no need to evaluate it.
+    fprintf( w->fp, "0.0" );
+  }
+}
+
+/** Write an expression as a C condition.
+    @param w writer to use.
+    @param expr expression to write.
+*/
+static void writeTruth( Writer *w, Expr *expr )
+{
+  int held = heldSlot( w, expr );
+  if ( held >= 0 ) {
+    fprintf( w->fp, "isTrue( f[ %d ] )", held );
+    return;
+  }
+  if ( unorderedOperands( w, expr, NULL ) > 1 ) {
+    writeInOrder( w, expr, writeTruth );
+    return;
+  }
+  if ( isVectorArith( w, expr ) || expr->kind == CALL_EXPR ||
+       expr->kind == LOCAL_EXPR || expr->kind == INVOKE_EXPR ) {
+    // Vectors and numbers are always true, but making a vector can
+    // still fail.
+    fprintf( w->fp, "isTrue( " );
+    writeValue( w, expr );
+    fprintf( w->fp, " )" );
+    return;
+  }
+
+  switch ( expr->kind ) {
+  case LITERAL_EXPR: {
+    Value val = literalValue( expr );
+    fprintf( w->fp, valueIsTrue( &val ) ? "1" : "0" );
+    break;
+  }
+
+  case VAR_EXPR: {
+    int slot = variableExprSlot( expr );
+    if ( w->numeric[ slot ] )
+      fprintf( w->fp, "1" );
+    else
+      fprintf( w->fp, "isTrue( v_%s )", slotName( slot ) );
+    break;
+  }
+
+  case LESS_EXPR:
+    fprintf( w->fp, "( " );
+    writeNumber( w, binaryLeft( expr ) );
+    fprintf( w->fp, " < " );
+    writeNumber( w, binaryRight( expr ) );
+    fprintf( w->fp, " )" );
+    break;
+
+  case EQU_EXPR:
+    fprintf( w->fp, "equals( " );
+    writeValue( w, binaryLeft( expr ) );
+    fprintf( w->fp, ", " );
+    writeValue( w, binaryRight( expr ) );
+    fprintf( w->fp, " )" );
+    break;
+
+  case AND_EXPR:
+  case OR_EXPR:
+    fprintf( w->fp, "( " );
+    writeTruth( w, binaryLeft( expr ) );
+    fprintf( w->fp, expr->kind == AND_EXPR ? " && " : " || " );
+    writeTruth( w, binaryRight( expr ) );
+    fprintf( w->fp, " )" );
+    break;
+
+  case CONCAT_EXPR:
+  case INDEX_EXPR:
+    fprintf( w->fp, "isTrue( " );
+    writeCall( w, expr );
+    fprintf( w->fp, " )" );
+    break;
+
+  default:
+    // Numbers never print as the empty string, but any functions they
+    // call still have to run.
+    if ( hasInvoke( expr ) ) {
+      fprintf( w->fp, "( " );
+      writeNumber( w, expr );
+      fprintf( w->fp, ", 1 )" );
+    } else
+      fprintf( w->fp, "1" );
+    break;
+  }
+}
+
+/** Write a call to release the temporaries a statement's expression
+    made, if it made any.
+    @param w writer to use.
+    @param expr expression the statement evaluated.
+    @param indent number of spaces to indent the call.
+*/
+static void writeRelease( Writer *w, Expr *expr, int indent )
+{
+  if ( holdsTemporaries( w, expr ) )
+    fprintf( w->fp, "%*srelease();\n", indent, "" );
+}
+
+/** Write a return from a function body that ends with a call.  The
+    call replaces the one that's running, so the arguments go into
+    this frame, and invoke() starts over.
+    @param w writer to use.
+    @param call expression of kind INVOKE_EXPR.
+    @param indent number of spaces to indent it.
+*/
+static void writeTailCall( Writer *w, Expr *call, int indent )
+{
+  int argc = callArgCount( call );
+  int first = spareSlots( w, argc );
+  for ( int i = 0; i < argc; i++ ) {
+    fprintf( w->fp, "%*sf[ %d ] = ", indent, "", first + i );
+    writeValue( w, callArg( call, i ) );
+    fprintf( w->fp, ";\n" );
+  }
+  fprintf( w->fp, "%*stail( f, %d, %d, &f[ %d ] );\n", indent, "",
+           w->locals, argc, first );
+  fprintf( w->fp, "%*sfn = %d;\n", indent, "", invokedFunction( call ) );
+  fprintf( w->fp, "%*sargc = %d;\n", indent, "", argc );
+  fprintf( w->fp, "%*sargs = f;\n", indent, "" );
+  fprintf( w->fp, "%*sline = %d;\n", indent, "", call->line );
+  fprintf( w->fp, "%*sgoto dispatch;\n", indent, "" );
+}
+
+/** Write a statement as C.
+    @param w writer to use.
+    @param stmt statement to write.
+    @param indent number of spaces to indent it.
+*/
+static void writeStmt( Writer *w, Stmt *stmt, int indent )
+{
+  // Spare slots only hold values until the statement that uses them
+  // is done.
+  w->spare = 0;
+
+  switch ( stmt->kind ) {
+  case PRINT_STMT: {
+    Expr *arg = stmtExpr( stmt );
+    fprintf( w->fp, "%*s", indent, "" );
+    if ( givesNumber( arg ) && !isVectorArith( w, arg ) ) {
+      fprintf( w->fp, "printNum( " );
+      writeNumber( w, arg );
+    } else {
+      fprintf( w->fp, "print( " );
+      writeValue( w, arg );
+    }
+    fprintf( w->fp, " );\n" );
+    writeRelease( w, arg, indent );
+    break;
+  }
+
+  case ASSIGN_STMT: {
+    int slot = assignSlot( stmt );
+    if ( w->numeric[ slot ] ) {
+      fprintf( w->fp, "%*sv_%s = ", indent, "", slotName( slot ) );
+      writeNumber( w, stmtExpr( stmt ) );
+    } else if ( w->counted ) {
+      fprintf( w->fp, "%*sassign( &v_%s, ", indent, "", slotName( slot ) );
+      writeValue( w, stmtExpr( stmt ) );
+      fprintf( w->fp, " )" );
+    } else {
+      fprintf( w->fp, "%*sv_%s = ", indent, "", slotName( slot ) );
+      writeValue( w, stmtExpr( stmt ) );
+    }
+    fprintf( w->fp, ";\n" );
+    writeRelease( w, stmtExpr( stmt ), indent );
+    break;
+  }
+
+  case LOCAL_ASSIGN_STMT:
+    fprintf( w->fp, "%*sassign( &f[ %d ], ", indent, "", assignSlot( stmt ) );
+    writeValue( w, stmtExpr( stmt ) );
+    fprintf( w->fp, " );\n" );
+    writeRelease( w, stmtExpr( stmt ), indent );
+    break;
+
+  case ASSIGN_KEY_STMT:
+  case LOCAL_KEY_STMT: {
+    // C doesn't say which argument to store() is evaluated first, so
+    // if both call functions, the key goes in a spare slot.
+    int mark = w->heldLen;
+    if ( hasInvoke( assignKey( stmt ) ) && hasInvoke( stmtExpr( stmt ) ) ) {
+      int slot = spareSlots( w, 1 );
+      fprintf( w->fp, "%*sf[ %d ] = ", indent, "", slot );
+      writeValue( w, assignKey( stmt ) );
+      fprintf( w->fp, ";\n" );
+      holdOperand( w, assignKey( stmt ), slot );
+    }
+
+    if ( stmt->kind == ASSIGN_KEY_STMT )
+      fprintf( w->fp, "%*sstore( &v_%s, ", indent, "",
+               slotName( assignSlot( stmt ) ) );
+    else
+      fprintf( w->fp, "%*sstore( &f[ %d ], ", indent, "",
+               assignSlot( stmt ) );
+    writeValue( w, assignKey( stmt ) );
+    fprintf( w->fp, ", " );
+    writeValue( w, stmtExpr( stmt ) );
+    fprintf( w->fp, " );\n" );
+    writeRelease( w, holdsTemporaries( w, assignKey( stmt ) ) ?
+                  assignKey( stmt ) : stmtExpr( stmt ), indent );
+    w->heldLen = mark;
+    break;
+  }
+
+  case RETURN_STMT:
+    if ( stmtExpr( stmt )->kind == INVOKE_EXPR ) {
+      writeTailCall( w, stmtExpr( stmt ), indent );
+      break;
+    }
+
+    // The result's temporaries are released on the way out.
+    fprintf( w->fp, "%*sresult = ", indent, "" );
+    writeValue( w, stmtExpr( stmt ) );
+    fprintf( w->fp, ";\n" );
+    fprintf( w->fp, "%*skeep( result );\n", indent, "" );
+    fprintf( w->fp, "%*sgoto done;\n", indent, "" );
+    break;
+
+  case FUNCTION_STMT:
+    // Definitions are numbered in the order invoke() lists them.
+    fprintf( w->fp, "%*sdefs[ %d ] = %d;\n", indent, "",
+             definedFunction( stmt ), ++w->defined );
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      writeStmt( w, compoundStmt( stmt, i ), indent );
+    break;
+
+  case IF_STMT:
+  case WHILE_STMT:
+    fprintf( w->fp, "%*s%s ( ", indent, "",
+             stmt->kind == IF_STMT ? "if" : "while" );
+    if ( holdsTemporaries( w, stmtExpr( stmt ) ) ) {
+      // Release the condition's temporaries once it's tested.
+      fprintf( w->fp, "settle( " );
+      writeTruth( w, stmtExpr( stmt ) );
+      fprintf( w->fp, " )" );
+    } else
+      writeTruth( w, stmtExpr( stmt ) );
+    fprintf( w->fp, " ) {\n" );
+    writeStmt( w, stmtBody( stmt ), indent + 2 );
+    fprintf( w->fp, "%*s}\n", indent, "" );
+    break;
+  }
+}
+
+/** Write invoke(), which runs every function the program defines.
+    Each definition has a case of its own, and the definitions that
+    have run say which case each function uses.
+    @param em emitter holding the program.
+    @param w writer to use.
+*/
+static void writeInvoker( Emitter *em, Writer *w )
+{
+  int count = functionCount();
+  fprintf( w->fp, "static char const *const names[] = {\n" );
+  for ( int fn = 0; fn < count; fn++ )
+    fprintf( w->fp, "  \"%s\"%s\n", functionName( fn ),
+             fn + 1 < count ? "," : "" );
+  fprintf( w->fp, "};\n\n" );
+  fprintf( w->fp, "/* Definition each function has, or 0 for none. */\n" );
+  fprintf( w->fp, "static int defs[ %d ];\n\n", count );
+
+  fprintf( w->fp, "static Value invoke( int fn, int argc, Value *args, "
+           "int line )\n{\n" );
+  fprintf( w->fp, "  if ( depth >= MAX_DEPTH )\n" );
+  fprintf( w->fp, "    callError( line, \"too many nested calls to\", "
+           "names[ fn ] );\n" );
+  fprintf( w->fp, "  depth++;\n" );
+  fprintf( w->fp, "  int saved = tfloor;\n" );
+  fprintf( w->fp, "  tfloor = ntemps;\n" );
+  fprintf( w->fp, "  Value *f = frames + depth * frameSize;\n" );
+  fprintf( w->fp, "  Value result = str( \"\", 0, 0.0 );\n" );
+  fprintf( w->fp, "  int locals = 0;\n\n" );
+  fprintf( w->fp, " dispatch:\n" );
+  fprintf( w->fp, "  switch ( defs[ fn ] ) {\n" );
+
+  int defined = 0;
+  for ( int i = 0; i < em->len; i++ ) {
+    Stmt *stmt = em->stmts[ i ];
+    if ( stmt->kind != FUNCTION_STMT )
+      continue;
+    w->locals = functionLocals( stmt );
+    if ( w->locals > w->frameSize )
+      w->frameSize = w->locals;
+    fprintf( w->fp, "  case %d:\n", ++defined );
+    fprintf( w->fp, "    /* %s, from line %d. */\n",
+             functionName( definedFunction( stmt ) ), stmt->line );
+    fprintf( w->fp, "    locals = %d;\n", w->locals );
+    fprintf( w->fp, "    enter( f, argc, args, %d, %d );\n",
+             functionParams( stmt ), w->locals );
+    fprintf( w->fp, "    release();\n" );
+    writeStmt( w, stmtBody( stmt ), 4 );
+    fprintf( w->fp, "    break;\n" );
+  }
+  w->locals = 0;
+
+  fprintf( w->fp, "  default:\n" );
+  fprintf( w->fp, "    callError( line, \"undefined function\", "
+           "names[ fn ] );\n" );
+  fprintf( w->fp, "  }\n\n" );
+  fprintf( w->fp, " done:\n" );
+  fprintf( w->fp, "  release();\n" );
+  fprintf( w->fp, "  leave( f, locals );\n" );
+  fprintf( w->fp, "  tfloor = saved;\n" );
+  fprintf( w->fp, "  depth--;\n" );
+  fprintf( w->fp, "\n  /* The caller gets the result's reference. */\n" );
+  fprintf( w->fp, "  hold( result );\n" );
+  fprintf( w->fp, "  discard( result );\n" );
+  fprintf( w->fp, "  return result;\n}\n\n" );
+}
+
+void writeProgram( Emitter *em, FILE *fp, int errorLine )
+{
+  int count = slotCount();
+  VectorUse vecs = findVectors( em, count );
+  Writer w = { fp, findNumeric( em, count, &vecs ), vecs, false };
+  for ( int i = 0; i < em->len; i++ )
+    if ( usesCounted( &w, em->stmts[ i ] ) )
+      w.counted = true;
+
+  // Programs that define or call functions need the code to run them.
+  bool calls = functionCount() > 0;
+
+  fprintf( fp, "/* Transpiled from %s. */\n\n", em->name );
+  for ( int i = 0; prelude[ i ]; i++ )
+    fprintf( fp, "%s\n", prelude[ i ] );
+  if ( calls ) {
+    fprintf( fp, "#define MAX_DEPTH %d\n\n", MAX_CALL_DEPTH );
+    for ( int i = 0; callPrelude[ i ]; i++ )
+      fprintf( fp, "%s\n", callPrelude[ i ] );
+  }
+
+  // Every variable the program uses, starting out with the value of an
+  // undefined one.
+  SlotSet uses = { (bool *) calloc( count + 1, sizeof( bool ) ),
+                   (int *) malloc( ( count + 1 ) * sizeof( int ) ), 0 };
+  bool *mixed = (bool *) calloc( count + 1, sizeof( bool ) );
+  for ( int i = 0; i < em->len; i++ )
+    markUses( em->stmts[ i ], &uses, mixed );
+  for ( int slot = 0; slot < count; slot++ ) {
+    if ( !uses.mark[ slot ] )
+      continue;
+    if ( w.numeric[ slot ] )
+      fprintf( fp, "static double v_%s;\n", slotName( slot ) );
+    else
+      fprintf( fp, "static Value v_%s = { STR_VAL, 0, 0.0, \"\", 0 };\n",
+               slotName( slot ) );
+  }
+
+  fprintf( fp, "\n" );
+  if ( calls )
+    writeInvoker( em, &w );
+
+  fprintf( fp, "int main( void )\n{\n" );
+  if ( calls ) {
+    fprintf( fp, "  frames = calloc( ( MAX_DEPTH + 1 ) * frameSize, "
+             "sizeof( Value ) );\n" );
+    fprintf( fp, "  Value *f = frames;\n" );
+  }
+  for ( int i = 0; i < em->len; i++ )
+    writeStmt( &w, em->stmts[ i ], 2 );
+
+  if ( errorLine ) {
+    fprintf( fp, "  fflush( stdout );\n" );
+    fprintf( fp, "  fprintf( stderr, \"line %d: syntax error\\n\" );\n",
+             errorLine );
+    fprintf( fp, "  return 1;\n" );
+  } else
+    fprintf( fp, "  return 0;\n" );
+  fprintf( fp, "}\n" );
+  if ( calls )
+    fprintf( fp, "\nstatic int frameSize = %d;\n",
+             w.frameSize ? w.frameSize : 1 );
+
+  free( w.numeric );
+  free( w.held );
+  free( w.heldSlots );
+  free( vecs.slot );
+  free( uses.mark );
+  free( uses.list );
+  free( mixed );
+}
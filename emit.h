@@ -0,0 +1,56 @@
+/**
+  @file emit.h
+
+  Transpiler from parsed statements to a standalone C program.  The
+  program behaves just like the interpreter would, printing exactly
+  the same output, so a script that runs often can be compiled once
+  with the system C compiler.  Variables that always hold numbers
+  become C doubles, and everything else uses a small value type in the
+  generated program.
+*/
+
+#ifndef _EMIT_H_
+#define _EMIT_H_
+
+#include <stdio.h>
+
+#include "expr.h"
+#include "stmt.h"
+
+/**
+   Short typename for an emitter, which collects a program's
+   statements as they're parsed.  Its representation is private to the
+   transpiler.
+*/
+typedef struct EmitterTag Emitter;
+
+/** Make an emitter, for collecting a program to transpile.
+    @param name name of the program's source file, for a comment in the
+    generated code.
+    @return a new, empty emitter.  The caller must eventually free this
+    with freeEmitter().
+*/
+Emitter *makeEmitter( char const *name );
+
+/** Add the next top-level statement of the program.  The statement
+    has to last until the program is written.
+    @param em emitter to add the statement to.
+    @param stmt statement to add.
+*/
+void emitStmt( Emitter *em, Stmt *stmt );
+
+/** Write a C program that runs all the statements collected so far.
+    @param em emitter holding the program.
+    @param fp stream to write the C source to.
+    @param errorLine if nonzero, the source has a syntax error on this
+    line after the statements, and the program should report it the
+    same way the interpreter does once the statements have run.
+*/
+void writeProgram( Emitter *em, FILE *fp, int errorLine );
+
+/** Free an emitter.  This doesn't free the statements it collected.
+    @param em emitter to free.
+*/
+void freeEmitter( Emitter *em );
+
+#endif
@@ -0,0 +1,64 @@
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+// Most recently set trap on this thread, or NULL if errors exit.
+static __thread ErrorTrap *trap;
+
+void catchErrors( ErrorTrap *newTrap )
+{
+  newTrap->message[ 0 ] = '\0';
+  newTrap->line = 0;
+  newTrap->outer = trap;
+  trap = newTrap;
+}
+
+void releaseErrors( ErrorTrap *oldTrap )
+{
+  trap = oldTrap->outer;
+}
+
+/** Report an error, for raiseError() and raiseErrorAt().
+    @param line line the error is on, or 0 for no line.
+    @param format printf-style format for the message.
+    @param args arguments for the format.
+*/
+static void report( int line, char const *format, va_list args )
+{
+  // Without a trap, the message just goes to standard error.
+  char message[ MAX_ERROR + 1 ];
+  ErrorTrap *caught = trap;
+  char *dest = caught ? caught->message : message;
+
+  int len = 0;
+  if ( line )
+    len = snprintf( dest, MAX_ERROR + 1, "line %d: ", line );
+  vsnprintf( dest + len, MAX_ERROR + 1 - len, format, args );
+
+  if ( !caught ) {
+    fprintf( stderr, "%s\n", message );
+    exit( EXIT_FAILURE );
+  }
+
+  // The trap is used up by jumping to it.
+  trap = caught->outer;
+  caught->line = line;
+  longjmp( caught->env, 1 );
+}
+
+void raiseError( char const *format, ... )
+{
+  va_list args;
+  va_start( args, format );
+  report( 0, format, args );
+  va_end( args );
+}
+
+void raiseErrorAt( int line, char const *format, ... )
+{
+  va_list args;
+  va_start( args, format );
+  report( line, format, args );
+  va_end( args );
+}
@@ -0,0 +1,66 @@
+/**
+  @file error.h
+
+  Reporting errors in the program being run, like a syntax error or a
+  call to an undefined function.  Normally an error is printed and the
+  interpreter exits.  A caller that wants to keep going, like the batch
+  runner, sets a trap first, and an error on the same thread jumps back
+  to it with the message saved instead.
+*/
+
+#ifndef _ERROR_H_
+#define _ERROR_H_
+
+#include <setjmp.h>
+
+// Longest error message that's kept, not counting the null terminator.
+#define MAX_ERROR 255
+
+/** Place to return to when there's an error.  The caller calls
+    catchErrors(), then setjmp() on env, which returns non-zero when an
+    error jumps back. */
+typedef struct ErrorTrap {
+  /** Where to jump on an error. */
+  jmp_buf env;
+
+  /** Message for the error that was caught. */
+  char message[ MAX_ERROR + 1 ];
+
+  /** Line of the program the error was on, or 0 if it isn't about a
+      particular line. */
+  int line;
+
+  /** Trap that was set before this one, or NULL. */
+  struct ErrorTrap *outer;
+} ErrorTrap;
+
+/** Make errors on this thread jump to the given trap, until it's
+    released or an error jumps there.
+    @param trap trap to set.  Its env must be filled in with setjmp()
+    right after this, before anything can report an error.
+*/
+void catchErrors( ErrorTrap *trap );
+
+/** Stop catching errors with a trap, going back to the one that was
+    set before it.  This isn't needed after an error jumps to the trap.
+    @param trap most recently set trap on this thread.
+*/
+void releaseErrors( ErrorTrap *trap );
+
+/** Report an error.  If there's a trap on this thread, the message is
+    saved in it and this jumps there.  Otherwise, the message is printed
+    to standard error and the interpreter exits unsuccessfully.  Either
+    way, this never returns.
+    @param format printf-style format for the message, without a
+    trailing newline.
+*/
+void raiseError( char const *format, ... );
+
+/** Report an error on a particular line of the program, like
+    raiseError().  The message starts with the line number.
+    @param line line the error is on.
+    @param format printf-style format for the rest of the message.
+*/
+void raiseErrorAt( int line, char const *format, ... );
+
+#endif
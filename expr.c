@@ -1,103 +1,1090 @@
 #include "expr.h"
+#include "num.h"
+#include "error.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+
+//////////////////////////////////////////////////////////////////////
+// Value
+
+Value makeStringValue( String *str )
+{
+  Value val = { .type = STR_VAL, .as.str = str };
+  return val;
+}
+
+Value makeRopeValue( Rope *rope )
+{
+  Value val = { .type = ROPE_VAL, .as.rope = rope };
+  return val;
+}
+
+Value makeBoolValue( bool truth )
+{
+  Value val = { .type = BOOL_VAL, .as.truth = truth };
+  return val;
+}
+
+/** Parse the given string as a double, the way the language converts
+    strings for arithmetic.
+    @param str string to parse.
+    @return the value of str, or zero if it doesn't parse.
+*/
+static double parseNumber( char const *str )
+{
+  double a;
+  if ( !scanNumber( str, &a ) )
+    a = 0.0;
+  return a;
+}
+
+double valueToNumber( Value const *val )
+{
+  switch ( val->type ) {
+  case NUM_VAL:
+    return val->num;
+  case STR_VAL:
+    return val->hasNum ? val->num : parseNumber( val->as.str->text );
+  case ROPE_VAL:
+    return parseNumber( flattenRope( val->as.rope )->text );
+  case MAP_VAL:
+    return mapSize( val->as.map );
+  case VEC_VAL:
+    return val->as.vec->len;
+  default:
+    // Neither "t" nor "" parse as a double.
+    return 0.0;
+  }
+}
+
+bool valueIsTrue( Value const *val )
+{
+  switch ( val->type ) {
+  case NUM_VAL:
+    // Numbers never print as the empty string.
+    return true;
+  case STR_VAL:
+    return val->as.str->len > 0;
+  case ROPE_VAL:
+  case MAP_VAL:
+  case VEC_VAL:
+    // Ropes are never empty, and maps and vectors act like numbers.
+    return true;
+  default:
+    return val->as.truth;
+  }
+}
+
+char const *valueToString( Value const *val, char *buffer )
+{
+  switch ( val->type ) {
+  case NUM_VAL:
+    formatNumber( val->num, buffer );
+    return buffer;
+  case STR_VAL:
+    return val->as.str->text;
+  case ROPE_VAL:
+    return flattenRope( val->as.rope )->text;
+  case MAP_VAL:
+    formatNumber( mapSize( val->as.map ), buffer );
+    return buffer;
+  case VEC_VAL:
+    formatNumber( val->as.vec->len, buffer );
+    return buffer;
+  default:
+    return val->as.truth ? "t" : "";
+  }
+}
+
+/** Return the text of a value and its length, without flattening a
+    rope.
+    @param val value to look at.
+    @param buffer storage for the text of numeric values, with room
+    for at least MAX_NUMBER characters.
+    @param len returns the length of the text.
+    @return the text of the value.  For a rope, this isn't null
+    terminated.
+*/
+static char const *valueText( Value const *val, char *buffer, int *len )
+{
+  switch ( val->type ) {
+  case NUM_VAL:
+    *len = formatNumber( val->num, buffer );
+    return buffer;
+  case STR_VAL:
+    *len = val->as.str->len;
+    return val->as.str->text;
+  case ROPE_VAL:
+    *len = val->as.rope->len;
+    return ropeText( val->as.rope );
+  case MAP_VAL:
+    *len = formatNumber( mapSize( val->as.map ), buffer );
+    return buffer;
+  case VEC_VAL:
+    *len = formatNumber( val->as.vec->len, buffer );
+    return buffer;
+  default:
+    *len = val->as.truth;
+    return val->as.truth ? "t" : "";
+  }
+}
+
+bool valueEquals( Value const *a, Value const *b )
+{
+  // Two numbers that are the same (and have the same sign, for zero)
+  // are sure to print the same way.
+  if ( a->type == NUM_VAL && b->type == NUM_VAL &&
+       a->num == b->num && signbit( a->num ) == signbit( b->num ) )
+    return true;
+
+  if ( a->type == STR_VAL && b->type == STR_VAL )
+    return stringEquals( a->as.str, b->as.str );
+
+  // Otherwise, fall back to comparing them as strings.
+  char abuf[ MAX_NUMBER + 1 ], bbuf[ MAX_NUMBER + 1 ];
+  int alen, blen;
+  char const *atext = valueText( a, abuf, &alen );
+  char const *btext = valueText( b, bbuf, &blen );
+  return alen == blen && memcmp( atext, btext, alen ) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Map
+
+// Number of positions in a new map's index.  This must be a power of
+// two.
+#define MAP_CAPACITY 8
+
+/** A key and its value, stored inline in a map's list of entries.
+    That's 32 bytes.  Besides the value itself, an entry costs the key
+    pointer and at most six bytes of index, well under the fixed
+    21-byte name a variable has. */
+typedef struct {
+  /** Interned text of the key.  The map holds a reference to it. */
+  String *key;
+
+  /** Value stored under the key.  The map holds a reference to any
+      string, rope or map it refers to. */
+  Value val;
+} MapEntry;
+
+/** Hidden representation for a map.  Entries are kept in a dense list,
+    in the order they were added, and an open-addressing index using
+    linear probing maps the hash of a key to its entry.  The index is
+    just an int per position, so it's cheap to keep sparse, and a
+    lookup only has to touch the entry it finds.  Keys are never
+    removed, so there's no need for tombstones. */
+struct MapTag {
+  // Number of references to this map.
+  int refs;
+
+  // Entries, the number of them and the capacity of the list.  The
+  // list only has room for as many entries as the index can hold.
+  MapEntry *entries;
+  int len, cap;
+
+  // Entry for each position in the index, or -1 if the position is
+  // unused.  The size of the index is always a power of two, and it's
+  // kept at most two thirds full, so probe sequences stay short.
+  int *index;
+  int mask;
+};
+
+/** Make a value holding a map.
+    @param map the map.  The value doesn't take a reference to it.
+    @return the new value.
+*/
+static Value makeMapValue( Map *map )
+{
+  Value val = { .type = MAP_VAL, .as.map = map };
+  return val;
+}
+
+/** Make an index for a map, with every position unused.
+    @param map map to give the index.
+    @param size number of positions, a power of two.
+*/
+static void makeMapIndex( Map *map, int size )
+{
+  map->index = (int *) malloc( size * sizeof( int ) );
+  for ( int i = 0; i < size; i++ )
+    map->index[ i ] = -1;
+  map->mask = size - 1;
+  map->cap = size * 2 / 3;
+}
+
+/** Make a new, empty map.
+    @return the map, with one reference.
+*/
+static Map *makeMap()
+{
+  Map *map = (Map *) malloc( sizeof( Map ) );
+  map->refs = 1;
+  makeMapIndex( map, MAP_CAPACITY );
+  map->entries = (MapEntry *) malloc( map->cap * sizeof( MapEntry ) );
+  map->len = 0;
+  return map;
+}
+
+/** Make a copy of a map, with its own references to every key and
+    value.
+    @param map map to copy.
+    @return the copy, with one reference.
+*/
+static Map *copyMap( Map const *map )
+{
+  Map *copy = (Map *) malloc( sizeof( Map ) );
+  copy->refs = 1;
+  copy->len = map->len;
+  copy->cap = map->cap;
+  copy->mask = map->mask;
+  copy->entries = (MapEntry *) malloc( map->cap * sizeof( MapEntry ) );
+  memcpy( copy->entries, map->entries, map->len * sizeof( MapEntry ) );
+  copy->index = (int *) malloc( ( map->mask + 1 ) * sizeof( int ) );
+  memcpy( copy->index, map->index, ( map->mask + 1 ) * sizeof( int ) );
+
+  for ( int i = 0; i < copy->len; i++ ) {
+    retainString( copy->entries[ i ].key );
+    retainValue( &copy->entries[ i ].val );
+  }
+  return copy;
+}
+
+Map *retainMap( Map *map )
+{
+  map->refs++;
+  return map;
+}
+
+void releaseMap( Map *map )
+{
+  if ( --map->refs > 0 )
+    return;
+
+  for ( int i = 0; i < map->len; i++ ) {
+    releaseString( map->entries[ i ].key );
+    releaseValue( &map->entries[ i ].val );
+  }
+  free( map->entries );
+  free( map->index );
+  free( map );
+}
+
+int mapSize( Map const *map )
+{
+  return map->len;
+}
+
+/** Return the position in a map's index for an interned key, either
+    the one for its entry, or the unused one where it should go.  Keys
+    are interned, so they can be compared by pointer.
+    @param map map to look in.
+    @param key key to look for.
+    @return position in the index.
+*/
+static int probeKey( Map const *map, String const *key )
+{
+  for ( unsigned int i = key->hash & map->mask; ;
+        i = ( i + 1 ) & map->mask ) {
+    int e = map->index[ i ];
+    if ( e < 0 || map->entries[ e ].key == key )
+      return i;
+  }
+}
+
+/** Same as probeKey(), for a key that isn't interned, like the text
+    of a number.
+    @param map map to look in.
+    @param text characters of the key.
+    @param len number of characters in text.
+    @return position in the index.
+*/
+static int probeText( Map const *map, char const *text, int len )
+{
+  unsigned int hash = hashString( text, len );
+  for ( unsigned int i = hash & map->mask; ; i = ( i + 1 ) & map->mask ) {
+    int e = map->index[ i ];
+    if ( e < 0 )
+      return i;
+    String const *key = map->entries[ e ].key;
+    if ( key->hash == hash && key->len == len &&
+         memcmp( key->text, text, len ) == 0 )
+      return i;
+  }
+}
+
+/** Double the size of a map's index, and make room for the entries
+    it can hold.
+    @param map map to grow.
+*/
+static void growMap( Map *map )
+{
+  free( map->index );
+  makeMapIndex( map, ( map->mask + 1 ) * 2 );
+  map->entries = (MapEntry *) realloc( map->entries,
+                                       map->cap * sizeof( MapEntry ) );
+  for ( int i = 0; i < map->len; i++ )
+    map->index[ probeKey( map, map->entries[ i ].key ) ] = i;
+}
+
+/** Return the interned text of a value, for using it as a key.
+    @param key value to convert.
+    @return a new reference to the text of key.
+*/
+static String *keyString( Value const *key )
+{
+  if ( key->type == STR_VAL )
+    return retainString( key->as.str );
+  if ( key->type == ROPE_VAL )
+    return retainString( flattenRope( key->as.rope ) );
+
+  char buffer[ MAX_NUMBER + 1 ];
+  int len;
+  char const *text = valueText( key, buffer, &len );
+  return internString( text, len );
+}
+
+/** Store a value under a key, in a map nothing else refers to.
+    @param map map to change.
+    @param key interned key.  The map takes over the caller's reference.
+    @param val value to store.  The map takes over the caller's
+    reference to anything it refers to.
+*/
+static void storeKey( Map *map, String *key, Value val )
+{
+  int pos = probeKey( map, key );
+  int e = map->index[ pos ];
+  if ( e >= 0 ) {
+    releaseString( key );
+    releaseValue( &map->entries[ e ].val );
+    map->entries[ e ].val = val;
+    return;
+  }
+
+  if ( map->len >= map->cap ) {
+    growMap( map );
+    pos = probeKey( map, key );
+  }
+  map->index[ pos ] = map->len;
+  map->entries[ map->len ].key = key;
+  map->entries[ map->len++ ].val = val;
+}
+
+/** Return the element of a vector a key refers to.
+    @param vec vector to look in.
+    @param key value for the number of the element, truncated to an
+    integer.
+    @return the number of the element, or -1 if there's no such
+    element.
+*/
+static int vectorIndex( Vector const *vec, Value const *key )
+{
+  double i = toNumber( key );
+  if ( i >= 0 && i < vec->len )
+    return (int) i;
+  return -1;
+}
+
+Value lookupKey( Value const *map, Value const *key )
+{
+  if ( map->type == VEC_VAL ) {
+    int i = vectorIndex( map->as.vec, key );
+    if ( i < 0 )
+      return makeStringValue( emptyString() );
+    return makeNumberValue( map->as.vec->data[ i ] );
+  }
+
+  if ( map->type != MAP_VAL )
+    return makeStringValue( emptyString() );
+
+  // Strings are already interned, so only other keys need to be
+  // turned into text and compared.
+  int pos;
+  if ( key->type == STR_VAL )
+    pos = probeKey( map->as.map, key->as.str );
+  else {
+    char buffer[ MAX_NUMBER + 1 ];
+    int len;
+    char const *text = valueText( key, buffer, &len );
+    pos = probeText( map->as.map, text, len );
+  }
+
+  int e = map->as.map->index[ pos ];
+  if ( e < 0 )
+    return makeStringValue( emptyString() );
+  return map->as.map->entries[ e ].val;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Symbol table
+
+// Initial number of entries in the symbol table's hash table.  This
+// must be a power of two.
+#define SYMBOL_CAPACITY 16
+
+/** Entry in a symbol table, mapping a name to its slot. */
+typedef struct {
+  /** Copy of the name, which stays put when the table grows, so it can
+      be used after the lock is released. */
+  char const *name;
+
+  /** Hash of the name, so probing and rehashing don't need to
+      recompute it.  Only meaningful if the entry is in use. */
+  unsigned int hash;
+
+  /** Slot assigned to this name, or -1 if the entry is unused. */
+  int slot;
+} SymRec;
+
+/** A symbol table is an open-addressing hash table of SymRec structs,
+    using linear probing.  Names are never removed, so there's no need
+    for tombstones. */
+typedef struct {
+  // Table of name/slot pairs, indexed by hash.
+  SymRec *table;
+
+  // Number of entries in the table, always a power of two.
+  int capacity;
+
+  // Names, indexed by slot.
+  char const **names;
+
+  // Number of slots assigned so far.
+  int len;
+} SymbolTable;
+
+// Slots for variable names, and numbers for function names.  These
+// are shared by every context, so a slot means the same variable no
+// matter which context it's used with.  Scripts can be parsed on more
+// than one thread, so both tables are only used with the lock held.
+static SymbolTable symbols, functions;
+static pthread_mutex_t symbolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Number of references made by retainSymbols() that haven't been
+// given up.
+static int symbolUsers = 0;
+
+/** Return the entry where the given name is stored, or the empty
+    entry where it should go if it doesn't have a slot yet.
+    @param syms symbol table to look in.
+    @param name name to find.
+    @param hash hash code for name.
+    @return entry for the name, or an unused entry.
+*/
+static SymRec *probe( SymbolTable *syms, char const *name, unsigned int hash )
+{
+  unsigned int mask = syms->capacity - 1;
+  for ( unsigned int i = hash & mask; ; i = ( i + 1 ) & mask ) {
+    SymRec *rec = &syms->table[ i ];
+    if ( rec->slot < 0 ||
+         ( rec->hash == hash && strcmp( rec->name, name ) == 0 ) )
+      return rec;
+  }
+}
+
+/** Make an empty hash table for the symbol table.
+    @param capacity number of entries in the new table.
+    @return the new table, with every entry marked as unused.
+*/
+static SymRec *makeSymbolTable( int capacity )
+{
+  SymRec *table = malloc( capacity * sizeof( SymRec ) );
+  for ( int i = 0; i < capacity; i++ )
+    table[ i ].slot = -1;
+  return table;
+}
+
+/** Double the size of a symbol table, moving every entry to its
+    position in the new table.
+    @param syms symbol table to grow.
+*/
+static void growSymbols( SymbolTable *syms )
+{
+  SymRec *old = syms->table;
+  int oldCap = syms->capacity;
+
+  syms->capacity *= 2;
+  syms->table = makeSymbolTable( syms->capacity );
+  for ( int i = 0; i < oldCap; i++ )
+    if ( old[ i ].slot >= 0 ) {
+      SymRec *rec = probe( syms, old[ i ].name, old[ i ].hash );
+      *rec = old[ i ];
+      syms->names[ rec->slot ] = rec->name;
+    }
+
+  free( old );
+}
+
+/** Return the slot for the given name, or -1 if it doesn't have one.
+    @param name name of the variable to look up.
+    @return slot for the name.
+*/
+static int findSlot( char const *name )
+{
+  pthread_mutex_lock( &symbolLock );
+  int slot = -1;
+  if ( symbols.table )
+    slot = probe( &symbols, name, hashString( name, strlen( name ) ) )->slot;
+  pthread_mutex_unlock( &symbolLock );
+  return slot;
+}
+
+/** Return the slot for a name in a symbol table, assigning the next
+    one if it doesn't have one yet.
+    @param syms symbol table to look in.
+    @param name name to look up.
+    @return slot for the name.
+*/
+static int addSymbol( SymbolTable *syms, char const *name )
+{
+  if ( !syms->table ) {
+    syms->capacity = SYMBOL_CAPACITY;
+    syms->table = makeSymbolTable( syms->capacity );
+  }
+
+  unsigned int hash = hashString( name, strlen( name ) );
+  SymRec *rec = probe( syms, name, hash );
+  if ( rec->slot >= 0 )
+    return rec->slot;
+
+  // Keep the table at most half full, so probe sequences stay short.
+  // The names list grows along with it, so it's always big enough.
+  if ( 2 * ( syms->len + 1 ) > syms->capacity ) {
+    syms->names = realloc( syms->names,
+                           syms->capacity * sizeof( char const * ) );
+    growSymbols( syms );
+    rec = probe( syms, name, hash );
+  } else if ( !syms->names ) {
+    syms->names = malloc( syms->capacity / 2 * sizeof( char const * ) );
+  }
+
+  char *copy = malloc( strlen( name ) + 1 );
+  rec->name = strcpy( copy, name );
+  rec->hash = hash;
+  rec->slot = syms->len++;
+  syms->names[ rec->slot ] = rec->name;
+  return rec->slot;
+}
+
+/** Return the slot for a name in a symbol table, like addSymbol(),
+    with the lock held.
+    @param syms symbol table to look in.
+    @param name name to look up.
+    @return slot for the name.
+*/
+static int lockedAdd( SymbolTable *syms, char const *name )
+{
+  pthread_mutex_lock( &symbolLock );
+  int slot = addSymbol( syms, name );
+  pthread_mutex_unlock( &symbolLock );
+  return slot;
+}
+
+/** Return the name for a slot in a symbol table, with the lock held.
+    @param syms symbol table to look in.
+    @param slot slot to look up.
+    @return name for the slot.
+*/
+static char const *lockedName( SymbolTable *syms, int slot )
+{
+  pthread_mutex_lock( &symbolLock );
+  char const *name = syms->names[ slot ];
+  pthread_mutex_unlock( &symbolLock );
+  return name;
+}
+
+/** Return the number of slots in a symbol table, with the lock held.
+    @param syms symbol table to check.
+    @return number of slots assigned so far.
+*/
+static int lockedCount( SymbolTable *syms )
+{
+  pthread_mutex_lock( &symbolLock );
+  int len = syms->len;
+  pthread_mutex_unlock( &symbolLock );
+  return len;
+}
+
+/** Free every name in a symbol table, and empty it.
+    @param syms symbol table to clear.
+*/
+static void clearSymbols( SymbolTable *syms )
+{
+  for ( int slot = 0; slot < syms->len; slot++ )
+    free( (char *) syms->names[ slot ] );
+  free( syms->names );
+  free( syms->table );
+  memset( syms, 0, sizeof( SymbolTable ) );
+}
+
+void retainSymbols( void )
+{
+  pthread_mutex_lock( &symbolLock );
+  symbolUsers++;
+  pthread_mutex_unlock( &symbolLock );
+}
+
+void releaseSymbols( void )
+{
+  pthread_mutex_lock( &symbolLock );
+  if ( --symbolUsers == 0 ) {
+    clearSymbols( &symbols );
+    clearSymbols( &functions );
+  }
+  pthread_mutex_unlock( &symbolLock );
+}
+
+int variableSlot( char const *name )
+{
+  return lockedAdd( &symbols, name );
+}
+
+char const *slotName( int slot )
+{
+  return lockedName( &symbols, slot );
+}
+
+int slotCount()
+{
+  return lockedCount( &symbols );
+}
+
+int functionSlot( char const *name )
+{
+  return lockedAdd( &functions, name );
+}
+
+char const *functionName( int fn )
+{
+  return lockedName( &functions, fn );
+}
+
+int functionCount()
+{
+  return lockedCount( &functions );
+}
 
 //////////////////////////////////////////////////////////////////////
 // Context
 
-/** Representation for a variable anme and its value. */
+// Initial number of slots in a context.
+#define CONTEXT_CAPACITY 16
+
+// Initial number of records in a context's stack of locals.
+#define STACK_CAPACITY 1024
+
+/** Representation for the value of a variable. */
 typedef struct {
-  char name[ MAX_IDENT_LEN + 1 ];
-  char *val;
+  /** True if this variable has been given a value. */
+  bool used;
+
+  /** Value of the variable.  If it's a string, the context owns a
+      dynamically allocated copy of it. */
+  Value val;
+
+  /** Text of a numeric or boolean value, made on demand by getVariable(). */
+  char *text;
 } VarRec;
 
-/** Hidden implementation of the context.  Really just a wrapper
-    around a resizable array of VarRec structs. */
+/** Hidden implementation of the context.  Variables are resolved to
+    slots when they're parsed, so this is just a resizable array of
+    VarRec structs indexed by slot.  Local variables of the functions
+    that are running are kept the same way, one frame after another on
+    a stack of VarRec structs. */
 struct ContextTag {
-  // List of all varname/value pairs.
+  // Values of all the variables, indexed by slot.
   VarRec *vlist;
 
-  // Number of name/value pairs.
-  int len;
-
-  // Capacity of the name/value list.
+  // Capacity of the value list.
   int capacity;
+
+  // Ropes made by concatenation and vectors made by operators that
+  // haven't been released yet, the number of them and the capacity of
+  // the list.
+  Value *temps;
+  int tlen, tcap;
+
+  // Locals of every call that's running, and arguments pushed for the
+  // next one.  The innermost frame starts at base, the next free
+  // record is at sp, and scap is the capacity of the stack.  Records
+  // are always found by index, so the stack can move when it grows.
+  VarRec *stack;
+  int base, sp, scap;
+
+  // Number of calls running.
+  int depth;
+
+  // Definition of each function, indexed by its number, or NULL if it
+  // hasn't been defined, and the capacity of the list.
+  Function const **funcs;
+  int fcap;
+
+  // True once a return statement has run, until its call finishes.
+  // A return gives a result, or for a call to another function, the
+  // function to call next, with its arguments on top of the stack.
+  bool returning;
+  Value result;
+  int tailFn, tailArgc, tailLine;
 };
 
 Context *makeContext()
 {
-  // You need to implement this.
   Context *c = malloc(sizeof(Context));
-  c->len = 0;
-  c->capacity = 1;
-  c->vlist = malloc(sizeof(VarRec) * c->capacity);
+  c->capacity = CONTEXT_CAPACITY;
+  if ( c->capacity < slotCount() )
+    c->capacity = slotCount();
+  c->vlist = calloc(c->capacity, sizeof(VarRec));
+  c->temps = NULL;
+  c->tlen = c->tcap = 0;
+
+  // The stack is allocated up front, so calls don't have to allocate
+  // anything until they nest deeper than they ever have.
+  c->scap = STACK_CAPACITY;
+  c->stack = malloc( c->scap * sizeof( VarRec ) );
+  c->base = c->sp = 0;
+  c->depth = 0;
+  c->funcs = NULL;
+  c->fcap = 0;
+  c->returning = false;
+  c->tailFn = -1;
   return c;
 }
 
-char const *getVariable( Context *ctxt, char const *name )
+/** Free any memory a variable record owns for its current value.
+    @param rec record to clear.
+*/
+static void clearVariable( VarRec *rec )
 {
-  for (int i = 0; i < ctxt->len; i++) {
-    if (strcmp(ctxt->vlist[i].name, name) == 0) {
-      return ctxt->vlist[i].val;
-    }
+  releaseValue( &rec->val );
+  if ( rec->text ) {
+    free( rec->text );
+    rec->text = NULL;
   }
-  return "";
 }
 
-void setVariable( Context *ctxt, char const *name, char *value )
+Value getSlot( Context *ctxt, int slot )
 {
-  for (int i = 0; i < ctxt->len; i++) {
-    if (strcmp(ctxt->vlist[i].name, name) == 0) {
-      free(ctxt->vlist[i].val);
-      ctxt->vlist[i].val = malloc(strlen(value)+1);
-      strcpy(ctxt->vlist[i].val, value);
+  if ( slot < ctxt->capacity && ctxt->vlist[ slot ].used )
+    return ctxt->vlist[ slot ].val;
+  return makeStringValue( emptyString() );
+}
+
+/** Return the record for the variable in the given slot, making room
+    for it if it's been parsed since the last time the context grew.
+    @param ctxt context holding the variable.
+    @param slot slot of the variable.
+    @return its record.
+*/
+static VarRec *slotRecord( Context *ctxt, int slot )
+{
+  if ( slot >= ctxt->capacity ) {
+    int cap = ctxt->capacity * 2;
+    if ( cap <= slot )
+      cap = slot + 1;
+    ctxt->vlist = realloc( ctxt->vlist, cap * sizeof( VarRec ) );
+    memset( ctxt->vlist + ctxt->capacity, 0,
+            ( cap - ctxt->capacity ) * sizeof( VarRec ) );
+    ctxt->capacity = cap;
+  }
+  return &ctxt->vlist[ slot ];
+}
+
+/** Store a value in a variable record, retaining its string if it has
+    one.
+    @param rec record of the variable.
+    @param value new value for the variable.
+*/
+static void setRecord( VarRec *rec, Value value )
+{
+  // Retain a string value before we release anything, in case it's
+  // this variable's old value.
+  retainValue( &value );
+  if ( rec->used )
+    clearVariable( rec );
+  rec->used = true;
+  rec->val = value;
+}
+
+void setSlot( Context *ctxt, int slot, Value value )
+{
+  // Replacing one number with another, the usual case in a loop, has
+  // nothing to retain or release.
+  if ( slot < ctxt->capacity ) {
+    VarRec *rec = &ctxt->vlist[ slot ];
+    if ( value.type == NUM_VAL && rec->used && rec->val.type == NUM_VAL &&
+         !rec->text ) {
+      rec->val = value;
       return;
     }
   }
-  //printf("after search\n");
-  if (ctxt->len == ctxt->capacity) {
-    VarRec *newlist = malloc(sizeof(VarRec) * ctxt->capacity * 2);
-    for (int i = 0; i < ctxt->len; i++) {
-      strcpy(newlist[i].name, ctxt->vlist[i].name);
-      newlist[i].val = ctxt->vlist[i].val;
+  setRecord( slotRecord( ctxt, slot ), value );
+}
+
+/** Store a number in an element of the vector held by a variable,
+    for storeInRecord().
+    @param rec record of the variable, which holds a vector.
+    @param key number of the element, or the length of the vector to
+    add an element.
+    @param num number to store.
+*/
+static void storeElement( VarRec *rec, Value const *key, double num )
+{
+  Vector *vec = rec->val.as.vec;
+  double i = toNumber( key );
+  if ( !( i >= 0 && i < vec->len + 1 ) )
+    return;
+
+  // Anything else holding the vector keeps the old elements.
+  if ( vec->refs > 1 ) {
+    Vector *copy = copyVector( vec );
+    Value val = { .type = VEC_VAL, .as.vec = copy };
+    setRecord( rec, val );
+    releaseVector( copy );
+    vec = copy;
+  }
+
+  if ( i < vec->len )
+    vec->data[ (int) i ] = num;
+  else {
+    // The vector's length changes, so any text made for it is out of
+    // date.
+    appendVector( vec, num );
+    if ( rec->text ) {
+      free( rec->text );
+      rec->text = NULL;
     }
-    free(ctxt->vlist);
-    ctxt->vlist = newlist;
-    ctxt->capacity = ctxt->capacity*2;
   }
-  //printf("after resize\n");
+}
 
-  // if (ctxt->len == ctxt->capacity) {
-  //   Context *c = malloc(sizeof(Context));
-  //   c->len = ctxt->len;
-  //   c->capacity = ctxt->capacity * 2;
-  //   c->vlist = malloc(sizeof(VarRec) * c->capacity);
+/** Store a value under a key in the map or vector held by a variable,
+    for setSlotKey() and setLocalKey().
+    @param rec record of the variable.
+    @param key key to store the value under.
+    @param value value to store.
+*/
+static void storeInRecord( VarRec *rec, Value const *key, Value value )
+{
+  if ( rec->used && rec->val.type == VEC_VAL ) {
+    storeElement( rec, key, toNumber( &value ) );
+    return;
+  }
 
-  //   for (int i = 0; i < ctxt->len; i++) {
-  //     strcpy(c->vlist[i].name, ctxt->vlist[i].name);
-  //     c->vlist[i].val = malloc(sizeof(ctxt->vlist[i].val)+1);
-  //     strcpy(c->vlist[i].val, ctxt->vlist[i].val);
-  //   }
-  //   freeContext(ctxt);
-  //   ctxt = c;
-  // }
+  // Take our own references to the key and value first, since either
+  // could belong to the variable's old value.  Holding the value also
+  // means a map stored in itself is copied before it's changed, so a
+  // map can never end up containing itself.
+  String *str = keyString( key );
+  retainValue( &value );
+
+  if ( rec->used && rec->val.type == MAP_VAL && rec->val.as.map->refs == 1 ) {
+    // The map is about to change size, so any text made for it is out
+    // of date.
+    if ( rec->text ) {
+      free( rec->text );
+      rec->text = NULL;
+    }
+  } else {
+    Map *map = rec->used && rec->val.type == MAP_VAL ?
+      copyMap( rec->val.as.map ) : makeMap();
+    setRecord( rec, makeMapValue( map ) );
+    releaseMap( map );
+  }
 
+  storeKey( rec->val.as.map, str, value );
+}
 
-  if (ctxt->len < ctxt->capacity) {
-    strcpy(ctxt->vlist[ctxt->len].name, name);
-    ctxt->vlist[ctxt->len].val = malloc(strlen(value)+1);
-    strcpy(ctxt->vlist[ctxt->len].val, value);
-    ctxt->len++;
+void setSlotKey( Context *ctxt, int slot, Value const *key, Value value )
+{
+  storeInRecord( slotRecord( ctxt, slot ), key, value );
+}
+
+char const *getVariable( Context *ctxt, char const *name )
+{
+  int slot = findSlot( name );
+  if ( slot < 0 || slot >= ctxt->capacity || !ctxt->vlist[ slot ].used )
+    return "";
+
+  VarRec *rec = &ctxt->vlist[ slot ];
+  if ( rec->val.type == STR_VAL )
+    return rec->val.as.str->text;
+  if ( rec->val.type == ROPE_VAL )
+    return flattenRope( rec->val.as.rope )->text;
+
+  // Numbers and booleans only get turned into strings when someone asks.
+  if ( !rec->text ) {
+    char buffer[ MAX_NUMBER + 1 ];
+    char const *str = valueToString( &rec->val, buffer );
+    rec->text = malloc( strlen( str ) + 1 );
+    strcpy( rec->text, str );
+  }
+  return rec->text;
+}
+
+Value getValue( Context *ctxt, char const *name )
+{
+  int slot = findSlot( name );
+  if ( slot < 0 )
+    return makeStringValue( emptyString() );
+  return getSlot( ctxt, slot );
+}
+
+void setValue( Context *ctxt, char const *name, Value value )
+{
+  setSlot( ctxt, variableSlot( name ), value );
+}
+
+void setVariable( Context *ctxt, char const *name, char *value )
+{
+  String *str = internString( value, strlen( value ) );
+  setValue( ctxt, name, makeStringValue( str ) );
+  releaseString( str );
+}
+
+/** Hold the result of an operator as a temporary, until it's
+    released by releaseTemporaries().
+    @param ctxt context to hold the value.
+    @param val a rope or vector.  The context takes over the caller's
+    reference to it.
+    @return val, for convenience.
+*/
+static Value addTemporary( Context *ctxt, Value val )
+{
+  if ( ctxt->tlen >= ctxt->tcap ) {
+    ctxt->tcap = ctxt->tcap ? ctxt->tcap * 2 : CONTEXT_CAPACITY;
+    ctxt->temps = realloc( ctxt->temps, ctxt->tcap * sizeof( Value ) );
+  }
+  if ( val.type == VEC_VAL )
+    val.as.vec->temp = true;
+  ctxt->temps[ ctxt->tlen++ ] = val;
+  return val;
+}
+
+/** Return a value as text, for the result of concatenating it with an
+    empty value.
+    @param ctxt context to hold a new string as a temporary.
+    @param val value to convert.
+    @return val itself if it's already text, or a string with its text.
+*/
+static Value concatText( Context *ctxt, Value const *val )
+{
+  if ( val->type == STR_VAL || val->type == ROPE_VAL )
+    return *val;
+  if ( !isTrue( val ) )
+    return makeStringValue( emptyString() );
+
+  char buffer[ MAX_NUMBER + 1 ];
+  int len;
+  char const *text = valueText( val, buffer, &len );
+  return addTemporary( ctxt, makeStringValue( internString( text, len ) ) );
+}
+
+Value concatValues( Context *ctxt, Value const *a, Value const *b )
+{
+  // Only empty values are false, so appending one changes nothing but
+  // the type.  The result is always text, like any other concatenation.
+  if ( !isTrue( b ) )
+    return concatText( ctxt, a );
+  if ( !isTrue( a ) )
+    return concatText( ctxt, b );
+
+  char abuf[ MAX_NUMBER + 1 ], bbuf[ MAX_NUMBER + 1 ];
+  int alen, blen;
+  char const *btext = valueText( b, bbuf, &blen );
+  Rope *rope;
+  if ( a->type == ROPE_VAL )
+    rope = appendRope( a->as.rope, btext, blen );
+  else {
+    char const *atext = valueText( a, abuf, &alen );
+    rope = joinText( atext, alen, btext, blen );
+  }
+
+  return addTemporary( ctxt, makeRopeValue( rope ) );
+}
+
+/** Return true if a value is a temporary vector that nothing else
+    refers to, so it can be overwritten with a result.
+    @param val value to check.
+    @return true if val's vector can be reused.
+*/
+static bool isLoneTemporary( Value const *val )
+{
+  return val->type == VEC_VAL && val->as.vec->temp && val->as.vec->refs == 1;
+}
+
+/** Make a new vector, held by the context as a temporary.
+    @param ctxt context to hold the vector.
+    @param len number of elements.
+    @return a value for the vector, whose elements aren't initialized.
+*/
+static Value makeTemporaryVector( Context *ctxt, long len )
+{
+  Value val = { .type = VEC_VAL, .as.vec = makeVector( len ) };
+  return addTemporary( ctxt, val );
+}
+
+Value vectorArith( Context *ctxt, VecOp op, Value const *a, Value const *b )
+{
+  // A single number is used with every element.
+  double anum = 0, bnum = 0;
+  double const *adata = &anum, *bdata = &bnum;
+  int len = INT_MAX;
+  if ( a->type == VEC_VAL ) {
+    adata = a->as.vec->data;
+    len = a->as.vec->len;
+  } else
+    anum = toNumber( a );
+  if ( b->type == VEC_VAL ) {
+    bdata = b->as.vec->data;
+    if ( b->as.vec->len < len )
+      len = b->as.vec->len;
+  } else
+    bnum = toNumber( b );
+
+  // Write over an operand if nothing else can see it, and it's the
+  // right length.
+  Value result;
+  if ( isLoneTemporary( a ) && a->as.vec->len == len )
+    result = *a;
+  else if ( isLoneTemporary( b ) && b->as.vec->len == len )
+    result = *b;
+  else
+    result = makeTemporaryVector( ctxt, len );
+
+  applyVectorOp( op, result.as.vec->data, adata, a->type == VEC_VAL, bdata,
+                 b->type == VEC_VAL, len );
+  return result;
+}
+
+int temporaryMark( Context *ctxt )
+{
+  return ctxt->tlen;
+}
+
+void releaseTemporaries( Context *ctxt, int mark )
+{
+  while ( ctxt->tlen > mark ) {
+    Value *val = &ctxt->temps[ --ctxt->tlen ];
+    if ( val->type == VEC_VAL )
+      val->as.vec->temp = false;
+    releaseValue( val );
   }
-  //printf("after insert\n");
 }
 
 void freeContext( Context *ctxt )
 {
-  for (int i = 0; i < ctxt->len; i++) {
-    free(ctxt->vlist[i].val);
+  releaseTemporaries( ctxt, 0 );
+  free( ctxt->temps );
+  abandonCalls( ctxt );
+  free( ctxt->stack );
+  free( ctxt->funcs );
+  for (int i = 0; i < ctxt->capacity; i++) {
+    if (ctxt->vlist[i].used)
+      clearVariable(&ctxt->vlist[i]);
   }
   free(ctxt->vlist);
   free(ctxt);
@@ -106,63 +1093,104 @@ void freeContext( Context *ctxt )
 //////////////////////////////////////////////////////////////////////
 // Literal
 
+/** Test function for expressions that don't have a faster way to
+    answer, evaluating the expression and checking the result.
+    @param expr expression to test.
+    @param ctxt current values of all variables.
+    @return true if the expression's value is true.
+*/
+static bool testValue( Expr *expr, Context *ctxt )
+{
+  Value val = expr->eval( expr, ctxt );
+  return isTrue( &val );
+}
+
 // Representation for a Literal expression, derived from Expr.
 typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  /** Literal value of this expression. */
-  char *val;
+  Value (*eval)( Expr *oper, Context *ctxt );
+  bool (*test)( Expr *oper, Context *ctxt );
+  ExprKind kind;
+  int line;
+
+  /** Value of this expression.  For a string, the literal holds a
+      reference that's never released, since there's no destroy
+      function for expressions.  That keeps every literal in the
+      program interned, so parsing the same literal again is cheap.
+      Strings also have their number parsed already, so arithmetic
+      doesn't have to parse it every time. */
+  Value val;
 } LiteralExpr;
 
 // Function to evaluate a literal expression.
-static char *evalLiteral( Expr *expr, Context *ctxt )
+static Value evalLiteral( Expr *expr, Context *ctxt )
 {
   // Cast the this pointer to a more specific type.
   LiteralExpr *this = (LiteralExpr *)expr;
 
-  // Make and return a copy of the value we contain.
-  char *result = (char *) malloc( strlen( this->val ) + 1 );
-  strcpy( result, this->val );
-  return result;
+  // Return the value we contain, along with its numeric value.
+  return this->val;
 }
 
-// Function to free a literal expression.
-static void destroyLiteral( Expr *expr )
+Expr *makeLiteral( Arena *arena, char const *text, int len )
 {
+  // Remember the literal string we contain, and what it's worth as a
+  // number.
+  String *val = internString( text, len );
+  return makeDecodedLiteral( arena, val, parseNumber( val->text ) );
+}
 
-  //printf("in destroy lit\n");
-
-  // Cast the this pointer to a more specific type.
-  LiteralExpr *this = (LiteralExpr *)expr;
-
-  // Free the value we contain and the literal object itself.
-  //printf("before free\n");
-  free( this->val );
-  //printf("after free1\n");
-  free( this );
-  //printf("after free2\n");
+Expr *makeDecodedLiteral( Arena *arena, String *val, double num )
+{
+  Value result = makeStringValue( val );
+  result.num = num;
+  result.hasNum = true;
+  Expr *lit = makeConstant( arena, result );
+
+  // The constant made its own reference, so we don't need the caller's.
+  releaseString( val );
+  return lit;
 }
 
-Expr *makeLiteral( char *val )
+Expr *makeConstant( Arena *arena, Value val )
 {
   // Allocate space for the LiteralExpr object
-  LiteralExpr *this = (LiteralExpr *) malloc( sizeof( LiteralExpr ) );
+  LiteralExpr *this = (LiteralExpr *) arenaAlloc( arena, sizeof( LiteralExpr ) );
 
   // Remember our virutal functions.
   this->eval = evalLiteral;
-  this->destroy = destroyLiteral;
-
-  // Remember the literal string we contain.
+  this->test = testValue;
+  this->kind = LITERAL_EXPR;
+  this->line = 0;
+
+  // Strings get their number parsed now, if it hasn't been already.
+  // A rope is flattened first, since the literal will outlive it.
+  if ( val.type == ROPE_VAL )
+    val = makeStringValue( flattenRope( val.as.rope ) );
   this->val = val;
+  if ( val.type == STR_VAL ) {
+    retainString( val.as.str );
+    this->val.num = valueToNumber( &val );
+    this->val.hasNum = true;
+  }
 
   // Return the result, as an instance of the base.
   return (Expr *) this;
 }
 
-// For double values, this should be the longest representation that could
-// get printed with %f, a large positive exponent and some fractional digits.
-#define MAX_NUMBER 400
+Value literalValue( Expr *expr )
+{
+  return ((LiteralExpr *)expr)->val;
+}
+
+String *literalString( Expr *expr )
+{
+  return ((LiteralExpr *)expr)->val.as.str;
+}
+
+double literalNumber( Expr *expr )
+{
+  return ((LiteralExpr *)expr)->val.num;
+}
 
 //////////////////////////////////////////////////////////////////////
 // Sum expressions
@@ -170,433 +1198,730 @@ Expr *makeLiteral( char *val )
 /** Representation for a sum expression.  This struct could probably
     be used to represent lots of different binary expressions. */
 typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
+  Value (*eval)( Expr *oper, Context *ctxt );
+  bool (*test)( Expr *oper, Context *ctxt );
+  ExprKind kind;
+  int line;
 
   // Two sub-expressions.
   Expr *leftExpr, *rightExpr;
 } SumExpr;
 
-// Destroy function for sum expression.
-static void destroySum( Expr *expr )
+/** Evaluate both operands of a binary expression.
+    @param this binary expression whose operands we need.
+    @param ctxt current values of all variables.
+    @param a storage for the value of the left operand.
+    @param b storage for the value of the right operand.
+*/
+static void evalOperands( SumExpr *this, Context *ctxt, Value *a, Value *b )
 {
-  SumExpr *this = (SumExpr *)expr;
+  *a = this->leftExpr->eval( this->leftExpr, ctxt );
+  *b = this->rightExpr->eval( this->rightExpr, ctxt );
+}
+
+/** Make a binary expression with the given eval and test functions.
+    @param arena arena to allocate the expression from.
+    @param eval function to evaluate the new expression.
+    @param test function to evaluate it as a condition.
+    @param kind what kind of expression it is.
+    @param leftExpr left-hand operand.
+    @param rightExpr right-hand operand.
+    @return pointer to a new SumExpr.
+*/
+static Expr *makeBinary( Arena *arena, Value (*eval)( Expr *, Context * ),
+                         bool (*test)( Expr *, Context * ),
+                         ExprKind kind, Expr *leftExpr, Expr *rightExpr )
+{
+  // Make an instance of SumExpr
+  SumExpr *this = (SumExpr *) arenaAlloc( arena, sizeof( SumExpr ) );
+  this->eval = eval;
+  this->test = test;
+  this->kind = kind;
+  this->line = 0;
+
+  // Remember the two sub-expressions.
+  this->leftExpr = leftExpr;
+  this->rightExpr = rightExpr;
 
-  // Free our operand subexpressions.
-  this->leftExpr->destroy( this->leftExpr );
-  this->rightExpr->destroy( this->rightExpr );
+  // Return the instance as if it's an Expr (which it sort of is)
+  return (Expr *) this;
+}
 
-  // Then the struct itself.
-  free( this );
+Expr *binaryLeft( Expr *expr )
+{
+  return ((SumExpr *)expr)->leftExpr;
 }
 
+Expr *binaryRight( Expr *expr )
+{
+  return ((SumExpr *)expr)->rightExpr;
+}
 
 // Eval function for a sum expression.
-static char *evalSum( Expr *expr, Context *ctxt )
+static Value evalSum( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
-  SumExpr *this = (SumExpr *)expr;
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  if ( hasVector( &a, &b ) )
+    return vectorArith( ctxt, VEC_ADD, &a, &b );
+  return makeArithValue( toNumber( &a ) + toNumber( &b ) );
+}
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
+Expr *makeSum( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalSum, testValue, SUM_EXPR, leftExpr, rightExpr );
+}
 
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  double a, b;
-  if ( sscanf( left, "%lf", &a ) != 1 )
-    a = 0.0;
+static Value evalDiff( Expr *expr, Context *ctxt )
+{
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  if ( hasVector( &a, &b ) )
+    return vectorArith( ctxt, VEC_SUB, &a, &b );
+  return makeArithValue( toNumber( &a ) - toNumber( &b ) );
+}
 
-  if ( sscanf( right, "%lf", &b ) != 1 )
-    b = 0.0;
+Expr *makeDifference( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalDiff, testValue, DIFF_EXPR, leftExpr, rightExpr );
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
+static Value evalProd( Expr *expr, Context *ctxt )
+{
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  if ( hasVector( &a, &b ) )
+    return vectorArith( ctxt, VEC_MUL, &a, &b );
+  return makeArithValue( toNumber( &a ) * toNumber( &b ) );
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%f", a + b );
-  return result;
+Expr *makeProduct( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalProd, testValue, PROD_EXPR, leftExpr, rightExpr );
 }
 
-Expr *makeSum( Expr *leftExpr, Expr *rightExpr )
+static Value evalQuot( Expr *expr, Context *ctxt )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalSum;
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  if ( hasVector( &a, &b ) )
+    return vectorArith( ctxt, VEC_DIV, &a, &b );
+  return makeArithValue( toNumber( &a ) / toNumber( &b ) );
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+Expr *makeQuotient( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalQuot, testValue, QUOT_EXPR, leftExpr, rightExpr );
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+static bool testLess( Expr *expr, Context *ctxt )
+{
+  // Comparing a vector gives a vector, which is always true.
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  return hasVector( &a, &b ) || toNumber( &a ) < toNumber( &b );
 }
 
-static char *evalDiff( Expr *expr, Context *ctxt )
+static Value evalLess( Expr *expr, Context *ctxt )
+{
+  Value a, b;
+  evalOperands( (SumExpr *)expr, ctxt, &a, &b );
+  if ( hasVector( &a, &b ) )
+    return vectorArith( ctxt, VEC_LESS, &a, &b );
+  return makeBoolValue( toNumber( &a ) < toNumber( &b ) );
+}
+
+Expr *makeLess( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalLess, testLess, LESS_EXPR, leftExpr,
+                     rightExpr );
+}
+
+static bool testEqu( Expr *expr, Context *ctxt )
 {
   // Get a pointer to the more specific type this function works with.
   SumExpr *this = (SumExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
+  // Equality is a comparison of the two values as strings.
+  Value left = this->leftExpr->eval( this->leftExpr, ctxt );
+  Value right = this->rightExpr->eval( this->rightExpr, ctxt );
+  return valueEquals( &left, &right );
+}
 
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  double a, b;
-  if ( sscanf( left, "%lf", &a ) != 1 )
-    a = 0.0;
+static Value evalEqu( Expr *expr, Context *ctxt )
+{
+  return makeBoolValue( testEqu( expr, ctxt ) );
+}
 
-  if ( sscanf( right, "%lf", &b ) != 1 )
-    b = 0.0;
+Expr *makeEquals( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalEqu, testEqu, EQU_EXPR, leftExpr, rightExpr );
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
+static bool testOr( Expr *expr, Context *ctxt )
+{
+  // Get a pointer to the more specific type this function works with.
+  SumExpr *this = (SumExpr *)expr;
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%f", a - b );
-  return result;
+  // Only evaluate the right operand if the left one is false.
+  return this->leftExpr->test( this->leftExpr, ctxt ) ||
+    this->rightExpr->test( this->rightExpr, ctxt );
 }
 
-Expr *makeDifference( Expr *leftExpr, Expr *rightExpr )
+static Value evalOr( Expr *expr, Context *ctxt )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalDiff;
-
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+  return makeBoolValue( testOr( expr, ctxt ) );
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+Expr *makeOr( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalOr, testOr, OR_EXPR, leftExpr, rightExpr );
 }
 
-static char *evalProd( Expr *expr, Context *ctxt )
+static bool testAnd( Expr *expr, Context *ctxt )
 {
   // Get a pointer to the more specific type this function works with.
   SumExpr *this = (SumExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
-
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  double a, b;
-  if ( sscanf( left, "%lf", &a ) != 1 )
-    a = 0.0;
-
-  if ( sscanf( right, "%lf", &b ) != 1 )
-    b = 0.0;
+  // Only evaluate the right operand if the left one is true.
+  return this->leftExpr->test( this->leftExpr, ctxt ) &&
+    this->rightExpr->test( this->rightExpr, ctxt );
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
+static Value evalAnd( Expr *expr, Context *ctxt )
+{
+  return makeBoolValue( testAnd( expr, ctxt ) );
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%f", a * b );
-  return result;
+Expr *makeAnd( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalAnd, testAnd, AND_EXPR, leftExpr, rightExpr );
 }
 
-Expr *makeProduct( Expr *leftExpr, Expr *rightExpr )
+static Value evalConcat( Expr *expr, Context *ctxt )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalProd;
+  // Get a pointer to the more specific type this function works with.
+  SumExpr *this = (SumExpr *)expr;
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+  Value left = this->leftExpr->eval( this->leftExpr, ctxt );
+  Value right = this->rightExpr->eval( this->rightExpr, ctxt );
+  return concatValues( ctxt, &left, &right );
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+Expr *makeConcat( Arena *arena, Expr *leftExpr, Expr *rightExpr )
+{
+  return makeBinary( arena, evalConcat, testValue, CONCAT_EXPR, leftExpr,
+                     rightExpr );
 }
 
-static char *evalQuot( Expr *expr, Context *ctxt )
+static Value evalIndex( Expr *expr, Context *ctxt )
 {
   // Get a pointer to the more specific type this function works with.
   SumExpr *this = (SumExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
-
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  double a, b;
-  if ( sscanf( left, "%lf", &a ) != 1 )
-    a = 0.0;
-
-  if ( sscanf( right, "%lf", &b ) != 1 )
-    b = 0.0;
+  Value map = this->leftExpr->eval( this->leftExpr, ctxt );
+  Value key = this->rightExpr->eval( this->rightExpr, ctxt );
+  return lookupKey( &map, &key );
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
+Expr *makeIndex( Arena *arena, Expr *mapExpr, Expr *keyExpr )
+{
+  return makeBinary( arena, evalIndex, testValue, INDEX_EXPR, mapExpr,
+                     keyExpr );
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%f", a / b );
-  return result;
+bool makesTemporaries( Expr *expr )
+{
+  if ( expr->kind == LITERAL_EXPR || expr->kind == VAR_EXPR ||
+       expr->kind == LOCAL_EXPR )
+    return false;
+  if ( expr->kind == INVOKE_EXPR )
+    return true;
+  if ( expr->kind == CALL_EXPR ) {
+    if ( callFunction( expr ) == VECTOR_FN || callFunction( expr ) == RANGE_FN )
+      return true;
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      if ( makesTemporaries( callArg( expr, i ) ) )
+        return true;
+    return false;
+  }
+  return expr->kind == CONCAT_EXPR || makesTemporaries( binaryLeft( expr ) ) ||
+    makesTemporaries( binaryRight( expr ) );
 }
 
-Expr *makeQuotient( Expr *leftExpr, Expr *rightExpr )
+Expr *makeBinaryExpr( Arena *arena, ExprKind kind, Expr *leftExpr,
+                      Expr *rightExpr )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalQuot;
+  static Expr *(*const make[])( Arena *, Expr *, Expr * ) = {
+    [ SUM_EXPR ] = makeSum,
+    [ DIFF_EXPR ] = makeDifference,
+    [ PROD_EXPR ] = makeProduct,
+    [ QUOT_EXPR ] = makeQuotient,
+    [ LESS_EXPR ] = makeLess,
+    [ EQU_EXPR ] = makeEquals,
+    [ AND_EXPR ] = makeAnd,
+    [ OR_EXPR ] = makeOr,
+    [ CONCAT_EXPR ] = makeConcat,
+    [ INDEX_EXPR ] = makeIndex,
+  };
+  return make[ kind ]( arena, leftExpr, rightExpr );
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+//////////////////////////////////////////////////////////////////////
+// Call
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+// Most arguments a call evaluates into an array on the stack.
+#define MAX_LOCAL_ARGS 16
+
+/** Representation for a call to a built-in function, derived from
+    Expr.  Calls to functions the program defines use it too. */
+typedef struct {
+  Value (*eval)( Expr *oper, Context *ctxt );
+  bool (*test)( Expr *oper, Context *ctxt );
+  ExprKind kind;
+  int line;
+
+  /** Function to call, a Builtin, or for INVOKE_EXPR, the number of a
+      function the program defines. */
+  int fn;
+
+  /** Number of arguments, and their expressions. */
+  int argc;
+  Expr *args[];
+} CallExpr;
+
+/** Names of the built-in functions, indexed by Builtin. */
+static char const *const builtinNames[] = {
+  [ VECTOR_FN ] = "[]",
+  [ RANGE_FN ] = "range",
+  [ LEN_FN ] = "len",
+  [ SUM_FN ] = "sum",
+  [ MIN_FN ] = "min",
+  [ MAX_FN ] = "max",
+};
+
+int findBuiltin( char const *name, int len )
+{
+  // Vector literals have their own syntax, so they can't be called by
+  // name.
+  for ( int fn = RANGE_FN; fn <= MAX_FN; fn++ )
+    if ( strlen( builtinNames[ fn ] ) == len &&
+         memcmp( builtinNames[ fn ], name, len ) == 0 )
+      return fn;
+  return -1;
 }
 
-static char *evalLess( Expr *expr, Context *ctxt )
+char const *builtinName( Builtin fn )
 {
-  // Get a pointer to the more specific type this function works with.
-  SumExpr *this = (SumExpr *)expr;
+  return builtinNames[ fn ];
+}
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
+/** Return the elements of a value, treating anything but a vector as a
+    vector of one number.
+    @param val value to look at.
+    @param one storage for the number, if val isn't a vector.
+    @param len returns the number of elements.
+    @return the elements.
+*/
+static double const *valueElements( Value const *val, double *one, int *len )
+{
+  if ( val->type == VEC_VAL ) {
+    *len = val->as.vec->len;
+    return val->as.vec->data;
+  }
+  *one = toNumber( val );
+  *len = 1;
+  return one;
+}
 
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  double a, b;
-  if ( sscanf( left, "%lf", &a ) != 1 )
-    a = 0.0;
+/** Make a vector holding the elements of a list of values, one after
+    another.
+    @param ctxt context to hold the result.
+    @param args values to join.
+    @param argc number of values.
+    @return the new vector.
+*/
+static Value joinVectors( Context *ctxt, Value const *args, int argc )
+{
+  long total = 0;
+  for ( int i = 0; i < argc; i++ )
+    total += args[ i ].type == VEC_VAL ? args[ i ].as.vec->len : 1;
+
+  Value result = makeTemporaryVector( ctxt, total );
+  double *dst = result.as.vec->data;
+  for ( int i = 0; i < argc; i++ ) {
+    double one;
+    int len;
+    double const *src = valueElements( &args[ i ], &one, &len );
+    memcpy( dst, src, len * sizeof( double ) );
+    dst += len;
+  }
+  return result;
+}
 
-  if ( sscanf( right, "%lf", &b ) != 1 )
-    b = 0.0;
+/** Make a vector counting up from zero.
+    @param ctxt context to hold the result.
+    @param limit the elements are every whole number from zero up to,
+    but not including, limit.
+    @return the new vector.
+*/
+static Value makeRange( Context *ctxt, double limit )
+{
+  // A fraction counts as one more element, and anything too big to
+  // make is left too big.
+  long len = 0;
+  if ( limit > INT_MAX )
+    len = INT_MAX + 1L;
+  else if ( limit > 0 ) {
+    len = (long) limit;
+    if ( len < limit )
+      len++;
+  }
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
+  Value result = makeTemporaryVector( ctxt, len );
+  for ( int i = 0; i < len; i++ )
+    result.as.vec->data[ i ] = i;
+  return result;
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if (a < b) {
-    strcpy(result, "t");
-  } else {
-    strcpy(result, "");
+Value callBuiltin( Context *ctxt, Builtin fn, Value const *args, int argc )
+{
+  if ( fn == VECTOR_FN )
+    return joinVectors( ctxt, args, argc );
+  if ( fn == RANGE_FN )
+    return makeRange( ctxt, toNumber( &args[ 0 ] ) );
+
+  double one;
+  int len;
+  double const *data = valueElements( &args[ 0 ], &one, &len );
+  switch ( fn ) {
+  case LEN_FN:
+    return makeNumberValue( len );
+  case SUM_FN:
+    return makeNumberValue( sumVector( data, len ) );
+  case MIN_FN:
+    return makeNumberValue( minVector( data, len ) );
+  default:
+    return makeNumberValue( maxVector( data, len ) );
   }
+}
+
+static Value evalCall( Expr *expr, Context *ctxt )
+{
+  // Cast the this pointer to a more specific type.
+  CallExpr *this = (CallExpr *)expr;
+
+  // Evaluate the arguments, then pass them to the function.  A long
+  // vector literal gets its values on the heap instead of the stack.
+  Value local[ MAX_LOCAL_ARGS ];
+  Value *args = this->argc <= MAX_LOCAL_ARGS ? local :
+    (Value *) malloc( this->argc * sizeof( Value ) );
+  for ( int i = 0; i < this->argc; i++ )
+    args[ i ] = this->args[ i ]->eval( this->args[ i ], ctxt );
+  Value result = callBuiltin( ctxt, this->fn, args, this->argc );
+  if ( args != local )
+    free( args );
   return result;
 }
 
-Expr *makeLess( Expr *leftExpr, Expr *rightExpr )
+Expr *makeCall( Arena *arena, Builtin fn, Expr **args, int argc )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalLess;
+  CallExpr *this = (CallExpr *) arenaAlloc( arena, sizeof( CallExpr ) +
+                                            argc * sizeof( Expr * ) );
+  this->eval = evalCall;
+  this->test = testValue;
+  this->kind = CALL_EXPR;
+  this->line = 0;
+
+  this->fn = fn;
+  this->argc = argc;
+  for ( int i = 0; i < argc; i++ )
+    this->args[ i ] = args[ i ];
+  return (Expr *) this;
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+Builtin callFunction( Expr *expr )
+{
+  return ((CallExpr *)expr)->fn;
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+int callArgCount( Expr *expr )
+{
+  return ((CallExpr *)expr)->argc;
 }
 
-static char *evalEqu( Expr *expr, Context *ctxt )
+Expr *callArg( Expr *expr, int i )
 {
-  // Get a pointer to the more specific type this function works with.
-  SumExpr *this = (SumExpr *)expr;
+  return ((CallExpr *)expr)->args[ i ];
+}
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
-
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if (strcmp(left, right)==0) {
-    strcpy(result, "t");
-  } else {
-    strcpy(result, "");
-  }
-  free( left );
-  free( right );
+//////////////////////////////////////////////////////////////////////
+// Function
+
+/** Report an error in a call.  This doesn't return.
+    @param line line the call is on.
+    @param message what went wrong.
+    @param fn function being called.
+*/
+static void callError( int line, char const *message, int fn )
+{
+  raiseErrorAt( line, "%s %s", message, functionName( fn ) );
+}
 
-  return result;
+void defineFunction( Context *ctxt, int fn, Function const *def )
+{
+  if ( fn >= ctxt->fcap ) {
+    int cap = ctxt->fcap ? ctxt->fcap * 2 : CONTEXT_CAPACITY;
+    if ( cap <= fn )
+      cap = fn + 1;
+    ctxt->funcs = realloc( ctxt->funcs, cap * sizeof( Function const * ) );
+    memset( ctxt->funcs + ctxt->fcap, 0,
+            ( cap - ctxt->fcap ) * sizeof( Function const * ) );
+    ctxt->fcap = cap;
+  }
+  ctxt->funcs[ fn ] = def;
 }
 
-Expr *makeEquals( Expr *leftExpr, Expr *rightExpr )
+/** Make sure there's room for more records on a context's stack.
+    @param ctxt context to check.
+    @param n number of records that have to fit above sp.
+*/
+static void reserveStack( Context *ctxt, int n )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalEqu;
+  if ( ctxt->sp + n > ctxt->scap ) {
+    while ( ctxt->sp + n > ctxt->scap )
+      ctxt->scap *= 2;
+    ctxt->stack = realloc( ctxt->stack, ctxt->scap * sizeof( VarRec ) );
+  }
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+void pushArgument( Context *ctxt, Value val )
+{
+  reserveStack( ctxt, 1 );
+  retainValue( &val );
+  VarRec *rec = &ctxt->stack[ ctxt->sp++ ];
+  rec->used = true;
+  rec->val = val;
+  rec->text = NULL;
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+/** Clear a run of records on a context's stack.
+    @param ctxt context holding the stack.
+    @param from index of the first record to clear.
+    @param to index just past the last one.
+*/
+static void clearRecords( Context *ctxt, int from, int to )
+{
+  for ( int i = from; i < to; i++ )
+    if ( ctxt->stack[ i ].used )
+      clearVariable( &ctxt->stack[ i ] );
 }
 
-static char *evalOr( Expr *expr, Context *ctxt )
+/** Turn the arguments on top of the stack into a frame for a
+    function, dropping any extra ones and clearing the rest of the
+    locals.
+    @param ctxt context to call the function in.
+    @param def function being called.
+    @param argc number of arguments above base.
+*/
+static void enterFrame( Context *ctxt, Function const *def, int argc )
 {
-  // Get a pointer to the more specific type this function works with.
-  SumExpr *this = (SumExpr *)expr;
+  if ( argc > def->params ) {
+    clearRecords( ctxt, ctxt->base + def->params, ctxt->sp );
+    ctxt->sp = ctxt->base + def->params;
+  }
+  reserveStack( ctxt, def->locals );
+  int top = ctxt->base + def->locals;
+  memset( ctxt->stack + ctxt->sp, 0, ( top - ctxt->sp ) * sizeof( VarRec ) );
+  ctxt->sp = top;
+}
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
+Value invokeFunction( Context *ctxt, int fn, int argc, int line )
+{
+  if ( ctxt->depth >= MAX_CALL_DEPTH )
+    callError( line, "too many nested calls to", fn );
+
+  // The arguments become the first locals of the new frame.
+  int saved = ctxt->base;
+  ctxt->base = ctxt->sp - argc;
+  ctxt->depth++;
+
+  for ( ;; ) {
+    Function const *def = fn < ctxt->fcap ? ctxt->funcs[ fn ] : NULL;
+    if ( !def )
+      callError( line, "undefined function", fn );
+    enterFrame( ctxt, def, argc );
+    def->run( def->body, ctxt );
+    if ( !ctxt->returning || ctxt->tailFn < 0 )
+      break;
+
+    // For a tail call, the new arguments replace this frame, so the
+    // stack doesn't grow.
+    fn = ctxt->tailFn;
+    argc = ctxt->tailArgc;
+    line = ctxt->tailLine;
+    ctxt->returning = false;
+    ctxt->tailFn = -1;
+    int args = ctxt->sp - argc;
+    clearRecords( ctxt, ctxt->base, args );
+    memmove( ctxt->stack + ctxt->base, ctxt->stack + args,
+             argc * sizeof( VarRec ) );
+    ctxt->sp = ctxt->base + argc;
+  }
 
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  int a, b;
-  if (strcmp(left, "") == 0)
-    a = 0;
-  else
-    a = 1;
-  if (strcmp(right, "") == 0)
-    b = 0;
-  else
-    b = 1;
-
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if (a || b) {
-    strcpy(result, "t");
+  // Falling off the end of the body gives an empty string, which needs
+  // a reference of its own, like a returned value has.
+  Value result;
+  if ( ctxt->returning ) {
+    result = ctxt->result;
+    ctxt->returning = false;
   } else {
-    strcpy(result, "");
+    result = makeStringValue( emptyString() );
+    retainValue( &result );
   }
-  return result;
+  clearRecords( ctxt, ctxt->base, ctxt->sp );
+  ctxt->sp = ctxt->base;
+  ctxt->base = saved;
+  ctxt->depth--;
+
+  // The result was retained when it was returned, so the caller gets
+  // that reference as a temporary.
+  if ( result.type == NUM_VAL || result.type == BOOL_VAL )
+    return result;
+  return addTemporary( ctxt, result );
 }
 
-Expr *makeOr( Expr *leftExpr, Expr *rightExpr )
+void abandonCalls( Context *ctxt )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalOr;
+  clearRecords( ctxt, 0, ctxt->sp );
+  ctxt->base = ctxt->sp = 0;
+  ctxt->depth = 0;
+  if ( ctxt->returning && ctxt->tailFn < 0 )
+    releaseValue( &ctxt->result );
+  ctxt->returning = false;
+  ctxt->tailFn = -1;
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+Value getLocal( Context *ctxt, int index )
+{
+  VarRec *rec = &ctxt->stack[ ctxt->base + index ];
+  if ( rec->used )
+    return rec->val;
+  return makeStringValue( emptyString() );
+}
 
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+void setLocal( Context *ctxt, int index, Value value )
+{
+  setRecord( &ctxt->stack[ ctxt->base + index ], value );
 }
 
-static char *evalAnd( Expr *expr, Context *ctxt )
+void setLocalKey( Context *ctxt, int index, Value const *key, Value value )
 {
-  // Get a pointer to the more specific type this function works with.
-  SumExpr *this = (SumExpr *)expr;
+  storeInRecord( &ctxt->stack[ ctxt->base + index ], key, value );
+}
 
-  // Evaluate our two operands
-  char *left = this->leftExpr->eval( this->leftExpr, ctxt );
-  char *right = this->rightExpr->eval( this->rightExpr, ctxt );
+void returnValue( Context *ctxt, Value val )
+{
+  retainValue( &val );
+  ctxt->result = val;
+  ctxt->returning = true;
+}
 
-  // Parse the left and right operands as doubles.  Set them
-  // to zero if they don't parse correctly.
-  int a, b;
-  if (strcmp(left, "") == 0)
-    a = 0;
-  else
-    a = 1;
-  if (strcmp(right, "") == 0)
-    b = 0;
-  else
-    b = 1;
-
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as doubles
-  free( left );
-  free( right );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if (a && b) {
-    strcpy(result, "t");
-  } else {
-    strcpy(result, "");
-  }
-  return result;
+void returnCall( Context *ctxt, Expr *call )
+{
+  CallExpr *this = (CallExpr *)call;
+  for ( int i = 0; i < this->argc; i++ )
+    pushArgument( ctxt, this->args[ i ]->eval( this->args[ i ], ctxt ) );
+  ctxt->tailFn = this->fn;
+  ctxt->tailArgc = this->argc;
+  ctxt->tailLine = this->line;
+  ctxt->returning = true;
 }
 
-Expr *makeAnd( Expr *leftExpr, Expr *rightExpr )
+bool isReturning( Context *ctxt )
 {
-  // Make an instance of SumExpr
-  SumExpr *this = (SumExpr *) malloc( sizeof( SumExpr ) );
-  this->destroy = destroySum;
-  this->eval = evalAnd;
+  return ctxt->returning;
+}
 
-  // Remember the two sub-expressions.
-  this->leftExpr = leftExpr;
-  this->rightExpr = rightExpr;
+// Function to evaluate a call to a function the program defines.
+static Value evalInvoke( Expr *expr, Context *ctxt )
+{
+  CallExpr *this = (CallExpr *)expr;
 
-  // Return the instance as if it's an Expr (which it sort of is)
+  // Arguments go right onto the stack, where they become locals.
+  for ( int i = 0; i < this->argc; i++ )
+    pushArgument( ctxt, this->args[ i ]->eval( this->args[ i ], ctxt ) );
+  return invokeFunction( ctxt, this->fn, this->argc, this->line );
+}
+
+Expr *makeInvoke( Arena *arena, int fn, Expr **args, int argc )
+{
+  CallExpr *this = (CallExpr *) makeCall( arena, fn, args, argc );
+  this->eval = evalInvoke;
+  this->kind = INVOKE_EXPR;
   return (Expr *) this;
 }
 
+int invokedFunction( Expr *expr )
+{
+  return ((CallExpr *)expr)->fn;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Variable
+
+// Representation for a variable reference, derived from Expr.
 typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
+  Value (*eval)( Expr *oper, Context *ctxt );
+  bool (*test)( Expr *oper, Context *ctxt );
+  ExprKind kind;
+  int line;
 
-  // Two sub-expressions.
-  char name[MAX_IDENT_LEN+1];
+  /** Slot of the variable we evaluate to. */
+  int slot;
 } VarExpr;
 
-static char *evalVar( Expr *expr, Context *ctxt ) {
+static Value evalVar( Expr *expr, Context *ctxt ) {
   VarExpr *this = (VarExpr *)expr;
-  char *result = (char *)malloc(MAX_NUMBER +1);
-  strcpy(result, getVariable(ctxt, this->name));
-  return result;
+  return getSlot(ctxt, this->slot);
 }
 
-static void destroyVariable( Expr *expr )
-{
+Expr *makeVariable (Arena *arena, int slot) {
 
-  // Cast the this pointer to a more specific type.
-  VarExpr *this = (VarExpr *)expr;
+  VarExpr *this = (VarExpr *) arenaAlloc(arena, sizeof(VarExpr));
+  this->eval = evalVar;
+  this->test = testValue;
+  this->kind = VAR_EXPR;
+  this->line = 0;
 
-  free( this );
+  this->slot = slot;
+  return (Expr *) this;
 }
 
-Expr *makeVariable (char const *vname) {
+int variableExprSlot( Expr *expr )
+{
+  return ((VarExpr *)expr)->slot;
+}
 
-  VarExpr *this = (VarExpr *) malloc(sizeof(VarExpr));
-  this->destroy = destroyVariable;
-  this->eval = evalVar;
+// Function to evaluate a local variable.  Locals share the
+// representation for global variables, with slot holding the index.
+static Value evalLocal( Expr *expr, Context *ctxt )
+{
+  VarExpr *this = (VarExpr *)expr;
+  return getLocal( ctxt, this->slot );
+}
 
-  strcpy(this->name, vname);
-  return (Expr *) this;
+Expr *makeLocal( Arena *arena, int index )
+{
+  Expr *expr = makeVariable( arena, index );
+  localizeVariable( expr, index );
+  return expr;
+}
+
+void localizeVariable( Expr *expr, int index )
+{
+  VarExpr *this = (VarExpr *)expr;
+  this->eval = evalLocal;
+  this->kind = LOCAL_EXPR;
+  this->slot = index;
 }
@@ -11,12 +11,281 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "arena.h"
+#include "str.h"
+#include "vec.h"
+#include "num.h"
+
+//////////////////////////////////////////////////////////////////////
+// Value
+
+// For double values, this should be the longest representation that could
+// get printed with %f, a large positive exponent and some fractional digits.
+#define MAX_NUMBER 400
+
+/** Types of values an expression can evaluate to. */
+typedef enum {
+  /** Result of arithmetic, printed with %f. */
+  NUM_VAL,
+  /** A string, either from a literal or stored in a variable. */
+  STR_VAL,
+  /** Result of a comparison or logical operator, printed as "t" or "". */
+  BOOL_VAL,
+  /** A string built by concatenation, held in a rope. */
+  ROPE_VAL,
+  /** A map from keys to values, built by assigning to m [ key ]. */
+  MAP_VAL,
+  /** A dense vector of numbers, from a literal like [ 1 2 3 ]. */
+  VEC_VAL
+} ValueType;
+
+/**
+   Short typename for the Map structure.  Its representation is private
+   to the context code.
+*/
+typedef struct MapTag Map;
+
+/** Result of evaluating an expression.  Values are small enough to
+    pass around by copy.  A string value refers to an interned String,
+    but doesn't hold a reference of its own.  The string belongs to a
+    literal or to the context, so the value is only good until the next
+    time the context is modified.  Anything that keeps a value around
+    (like the context) has to retain its string, with retainValue().
+    Rope values work the same way, but the result of a concatenation
+    belongs to the context as a temporary (see concatValues()).  Maps
+    are values too, shared by reference counting and copied the first
+    time one that's shared is changed, so assigning a map to another
+    variable behaves like a copy.  Vectors are shared the same way, and
+    the result of arithmetic on a vector is a temporary, like a
+    concatenation. */
+typedef struct {
+  /** What kind of value this is. */
+  ValueType type;
+
+  /** True if num holds the numeric value of a STR_VAL. */
+  bool hasNum;
+
+  /** Number for a NUM_VAL.  For a STR_VAL, this is the string parsed
+      as a double, if hasNum is true.  A literal needs its text and its
+      number both, so this isn't part of the union. */
+  double num;
+
+  /** What the value holds, depending on its type.  Sharing the space
+      keeps a value to 24 bytes, and an entry in a map to 32. */
+  union {
+    /** Truth value for a BOOL_VAL. */
+    bool truth;
+
+    /** String for a STR_VAL. */
+    String *str;
+
+    /** Rope for a ROPE_VAL. */
+    Rope *rope;
+
+    /** Map for a MAP_VAL. */
+    Map *map;
+
+    /** Vector for a VEC_VAL. */
+    Vector *vec;
+  } as;
+} Value;
+
+/** Make a value holding a number.
+    @param num number this value represents.
+    @return the new value.
+*/
+static inline Value makeNumberValue( double num )
+{
+  Value val = { .type = NUM_VAL, .num = num };
+  return val;
+}
+
+/** Make a value holding the result of arithmetic on numbers, rounded
+    to the six places after the point it would print with, so it's the
+    same number the language got when it kept every result as text.
+    @param num exact result of the operation.
+    @return the new value.
+*/
+static inline Value makeArithValue( double num )
+{
+  return makeNumberValue( roundNumber( num ) );
+}
+
+/** Make a value holding a string.
+    @param str the string.  The value doesn't take a reference to it.
+    @return the new value.
+*/
+Value makeStringValue( String *str );
+
+/** Make a value holding a string built by concatenation.
+    @param rope the rope.  The value doesn't take a reference to it.
+    @return the new value.
+*/
+Value makeRopeValue( Rope *rope );
+
+/** Make a boolean value, the result of a comparison or logical operator.
+    @param truth truth value it should represent.
+    @return the new value.
+*/
+Value makeBoolValue( bool truth );
+
+/** Return the given value as a double, the way the language does for
+    arithmetic.  Strings that don't parse as a double evaluate to zero.
+    @param val value to convert.
+    @return numeric value of val.
+*/
+double valueToNumber( Value const *val );
+
+/** Return a value as a double.  This is the same as valueToNumber(),
+    but handles the common cases inline, for the execution engines'
+    inner loops.
+    @param val value to convert.
+    @return numeric value of val.
+*/
+static inline double toNumber( Value const *val )
+{
+  if ( val->type == NUM_VAL || val->hasNum )
+    return val->num;
+  return valueToNumber( val );
+}
+
+/** Return true if the given value counts as true in a condition.
+    Only the empty string (or a false comparison) is false.
+    @param val value to test.
+    @return true if val is true.
+*/
+bool valueIsTrue( Value const *val );
+
+/** Same as valueIsTrue(), but handles booleans inline.
+    @param val value to test.
+    @return true if val is true.
+*/
+static inline bool isTrue( Value const *val )
+{
+  if ( val->type == BOOL_VAL )
+    return val->as.truth;
+  return valueIsTrue( val );
+}
+
+/** Return the text representation of the given value, the way it
+    would be printed.
+    @param val value to convert.
+    @param buffer storage for the text of numeric values, with room
+    for at least MAX_NUMBER characters.
+    @return the text of the value, either in buffer or pointing to the
+    storage for a string value.
+*/
+char const *valueToString( Value const *val, char *buffer );
+
+/** Return true if the given values are equal.  Equality is a string
+    comparison in this language, so two numbers are only equal if they
+    print the same way.  Two strings are compared by pointer first, since
+    they're interned.
+    @param a first value to compare.
+    @param b second value to compare.
+    @return true if the text of a and b is the same.
+*/
+bool valueEquals( Value const *a, Value const *b );
+
+/** Add a reference to a map.
+    @param map map to reference.
+    @return map, for convenience.
+*/
+Map *retainMap( Map *map );
+
+/** Give up a reference to a map.  The map is freed, along with its
+    references to its keys and values, when its last reference is
+    released.
+    @param map map to release.
+*/
+void releaseMap( Map *map );
+
+/** Return the number of keys in a map.  This is also what a map is
+    worth as a number, and how it prints.
+    @param map map to look at.
+    @return number of entries in the map.
+*/
+int mapSize( Map const *map );
+
+/** Return the value stored under a key in a map.  Keys are compared
+    by their text, so 1 and "1.000000" are the same key.  This takes
+    constant time for any kind of key.  A vector can be indexed too,
+    by the number of an element, counting from zero.
+    @param map value to look in.  If it's not a map or a vector,
+    there's nothing in it.
+    @param key key to look up.
+    @return the value for key, or an empty string if there isn't one.
+    Any string it refers to belongs to the map.
+*/
+Value lookupKey( Value const *map, Value const *key );
+
+/** Add a reference to the string, rope, map or vector a value refers
+    to, if it refers to one, so the value can be kept.
+    @param val value to retain.
+*/
+static inline void retainValue( Value const *val )
+{
+  if ( val->type == STR_VAL )
+    retainString( val->as.str );
+  else if ( val->type == ROPE_VAL )
+    retainRope( val->as.rope );
+  else if ( val->type == MAP_VAL )
+    retainMap( val->as.map );
+  else if ( val->type == VEC_VAL )
+    retainVector( val->as.vec );
+}
+
+/** Give up a reference made by retainValue().
+    @param val value to release.
+*/
+static inline void releaseValue( Value const *val )
+{
+  if ( val->type == STR_VAL )
+    releaseString( val->as.str );
+  else if ( val->type == ROPE_VAL )
+    releaseRope( val->as.rope );
+  else if ( val->type == MAP_VAL )
+    releaseMap( val->as.map );
+  else if ( val->type == VEC_VAL )
+    releaseVector( val->as.vec );
+}
+
+/** Return true if either operand of an operator is a vector, so the
+    operator has to work element by element.
+    @param a left operand.
+    @param b right operand.
+    @return true if a or b is a vector.
+*/
+static inline bool hasVector( Value const *a, Value const *b )
+{
+  return a->type == VEC_VAL || b->type == VEC_VAL;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Context
 
 // Maximum length of an identifier (variable) name.
 #define MAX_IDENT_LEN 20
 
+/** Return the slot number for the given variable name.  Slots are
+    small, dense integers assigned as names are first seen by the parser,
+    so a context can store variables in an array indexed by slot.
+    @param name name of the variable.
+    @return slot for the variable, assigning a new one if needed.
+*/
+int variableSlot( char const *name );
+
+/** Return the name of the variable using the given slot.
+    @param slot slot number returned by variableSlot().
+    @return name of the variable.
+*/
+char const *slotName( int slot );
+
+/** Return the number of slots that have been assigned.
+    @return number of distinct variable names seen so far.
+*/
+int slotCount();
+
 /**
    Short typename for the Context structure.  It's definition is an
    implementation detail of the language, not visible to client code.
@@ -42,15 +311,248 @@ Context *makeContext();
 char const *getVariable( Context *ctxt, char const *name );
 
 /** In the given context, set the named variable to store the given
-    value.  
+    value.  The context stores an interned copy of the string, so the
+    caller keeps ownership of value.
+    @param ctxt context in which to store the variable name / value.
+    @param name of the variable to set the value for.
+    @param value new value for this variable.
+*/
+void setVariable( Context *ctxt, char const *name, char *value );
 
-    Finish commenting this function based on how your context works.
+/** Return the value of the named variable, without converting it to a
+    string.  If the variable isn't defined, this returns an empty string.
+    @param ctxt context object in which to lookup the variable name.
+    @param name of the variable to look up.
+    @return the variable's value.  Any string it contains belongs to
+    the context.
+*/
+Value getValue( Context *ctxt, char const *name );
 
+/** Set the named variable to the given value, retaining its string if
+    it has one.  It's safe for value to be the variable's current value.
     @param ctxt context in which to store the variable name / value.
     @param name of the variable to set the value for.
     @param value new value for this variable.
 */
-void setVariable( Context *ctxt, char const *name, char *value );
+void setValue( Context *ctxt, char const *name, Value value );
+
+/** Return the value of the variable in the given slot.  This is the
+    fast path used by variable expressions.
+    @param ctxt context object to read from.
+    @param slot slot of the variable.
+    @return the variable's value, or an empty string if it's not defined.
+*/
+Value getSlot( Context *ctxt, int slot );
+
+/** Set the variable in the given slot to the given value, retaining
+    its string if it has one.
+    @param ctxt context in which to store the value.
+    @param slot slot of the variable.
+    @param value new value for this variable.
+*/
+void setSlot( Context *ctxt, int slot, Value value );
+
+/** Store a value under a key in the map held by the variable in the
+    given slot.  If the variable doesn't hold a map, it's given a new,
+    empty one first.  If its map is shared with anything else, the
+    variable gets its own copy before it's changed, so nothing else
+    sees the change.  If the variable holds a vector instead, the key
+    is the number of an element to change, or the length of the vector
+    to add a new element to the end.  Any other key leaves the vector
+    alone.
+    @param ctxt context holding the variable.
+    @param slot slot of the variable.
+    @param key key to store the value under.
+    @param value value to store.  The map retains it.
+*/
+void setSlotKey( Context *ctxt, int slot, Value const *key, Value value );
+
+//////////////////////////////////////////////////////////////////////
+// Function
+
+// Most parameters and local variables a function can have.
+#define MAX_LOCALS 256
+
+// Most calls that can be running at once.  Tail calls don't count,
+// since they replace the call that makes them.
+#define MAX_CALL_DEPTH 5000
+
+/** Return the number for the function with the given name.  Like
+    variable slots, these are small, dense integers assigned as names
+    are first seen, so a context can find a function by indexing an
+    array.  Functions have their own names, apart from variables.
+    @param name name of the function.
+    @return number for the function, assigning a new one if needed.
+*/
+int functionSlot( char const *name );
+
+/** Return the name of a function.
+    @param fn number returned by functionSlot().
+    @return name of the function.
+*/
+char const *functionName( int fn );
+
+/** Return the number of function names that have been seen.
+    @return number of distinct function names seen so far.
+*/
+int functionCount();
+
+/** Record that something depends on the variable and function numbers
+    assigned so far, like a parsed program or a context holding
+    variables.  The interpreter program never gives these up, so its
+    numbers last as long as it does.
+*/
+void retainSymbols( void );
+
+/** Give up a reference made by retainSymbols().  When the last one is
+    given up, every name is forgotten and its memory freed, and the
+    next name seen gets the first number again.
+*/
+void releaseSymbols( void );
+
+// Statements are declared in stmt.h.
+struct StmtTag;
+
+/** A function defined by the program, as the context sees it.  The
+    body is a statement, which expressions don't know about, so the
+    context runs it through a pointer to its execute function. */
+typedef struct {
+  /** Function to run the body. */
+  void (*run)( struct StmtTag *body, Context *ctxt );
+
+  /** Statement to run for a call. */
+  struct StmtTag *body;
+
+  /** Number of parameters, which are the first locals. */
+  int params;
+
+  /** Number of local variables, counting the parameters. */
+  int locals;
+} Function;
+
+/** Define a function in a context, replacing any definition it had.
+    @param ctxt context to define it in.
+    @param fn number of the function, from functionSlot().
+    @param def definition.  This has to last as long as the context
+    might call it.
+*/
+void defineFunction( Context *ctxt, int fn, Function const *def );
+
+/** Push the value of an argument for the next call to
+    invokeFunction().  Arguments go on the context's stack of frames,
+    so a call doesn't have to allocate anything.
+    @param ctxt context to call the function in.
+    @param val value of the argument.  The stack retains it.
+*/
+void pushArgument( Context *ctxt, Value val );
+
+/** Call a function with the last arguments pushed, which become its
+    first locals.  Extra arguments are dropped, and parameters without
+    one start out as the empty string, like any other local.  A return
+    statement that calls a function replaces the running call with the
+    new one, instead of nesting inside it, so tail recursion runs in
+    constant space.  Reports an error with raiseError() if the function
+    isn't defined, or if calls are nested more than MAX_CALL_DEPTH
+    deep.
+    @param ctxt context to call the function in.
+    @param fn number of the function.
+    @param argc number of arguments pushed.
+    @param line line the call is on, for errors.
+    @return the value the function returned, or the empty string if it
+    ended without a return.  A string, rope, map or vector it refers
+    to is held by the context as a temporary.
+*/
+Value invokeFunction( Context *ctxt, int fn, int argc, int line );
+
+/** Drop every call that's running, and its locals, after an error has
+    jumped out of them, so the context can be used again.
+    @param ctxt context the calls were running in.
+*/
+void abandonCalls( Context *ctxt );
+
+/** Return the value of a local variable of the function that's
+    running.
+    @param ctxt context running the function.
+    @param index index of the local, counting the parameters first.
+    @return the variable's value, or an empty string if it's not
+    defined.
+*/
+Value getLocal( Context *ctxt, int index );
+
+/** Same as setSlot(), for a local variable of the function that's
+    running.
+    @param ctxt context running the function.
+    @param index index of the local.
+    @param value new value for the variable.
+*/
+void setLocal( Context *ctxt, int index, Value value );
+
+/** Same as setSlotKey(), for a local variable of the function that's
+    running.
+    @param ctxt context running the function.
+    @param index index of the local.
+    @param key key to store the value under.
+    @param value value to store.
+*/
+void setLocalKey( Context *ctxt, int index, Value const *key, Value value );
+
+/** Finish the function that's running, returning a value.  The
+    statements running the body stop once they see isReturning().
+    @param ctxt context running the function.
+    @param val value to return.  The context retains it.
+*/
+void returnValue( Context *ctxt, Value val );
+
+/** Return true if the function that's running has returned, so the
+    rest of its body should be skipped.
+    @param ctxt context running the function.
+    @return true if a return statement has run.
+*/
+bool isReturning( Context *ctxt );
+
+/** Return the concatenation of two values, the text of a followed by
+    the text of b.  The result is always text.  If either one is empty,
+    it's the text of the other one, as a string or rope.  Otherwise,
+    it's a rope, appended to in place if a is already a rope, so a
+    loop that keeps appending to the same variable runs in linear time.
+    A new rope is held by the context as a temporary, until it's
+    released by releaseTemporaries().
+    @param ctxt context to hold the result.
+    @param a value for the start of the result.
+    @param b value to append to it.
+    @return the concatenation.
+*/
+Value concatValues( Context *ctxt, Value const *a, Value const *b );
+
+/** Apply an arithmetic operator or < element by element, where at
+    least one operand is a vector.  A number (or anything else that
+    isn't a vector) is used with every element of the other operand,
+    and two vectors only go as far as the shorter one.  Comparisons
+    give 1 or 0 for each element.  The result is held by the context as
+    a temporary.  If one of the operands is a temporary nothing else
+    refers to, its storage is reused for the result.
+    @param ctxt context to hold the result.
+    @param op operator to apply.
+    @param a left operand.
+    @param b right operand.
+    @return the resulting vector.
+*/
+Value vectorArith( Context *ctxt, VecOp op, Value const *a, Value const *b );
+
+/** Return a mark for the context's list of temporaries, so everything
+    made after it can be released at once.
+    @param ctxt context to look at.
+    @return the number of temporaries held by the context.
+*/
+int temporaryMark( Context *ctxt );
+
+/** Release every temporary the context has made since the given mark.
+    This must only be done once no value that could refer to them is
+    still in use, normally at the end of a statement.
+    @param ctxt context holding the temporaries.
+    @param mark mark from temporaryMark().
+*/
+void releaseTemporaries( Context *ctxt, int mark );
 
 /** Free all the memory associated with this context.
     @param ctxt context to free memory for.
@@ -63,121 +565,371 @@ void freeContext( Context *ctxt );
 /** A short name to use for the expression interface. */
 typedef struct ExprTag Expr;
 
+/** Kinds of expression, so passes over the tree (like the bytecode
+    compiler) can tell what type of expression they're looking at. */
+typedef enum {
+  LITERAL_EXPR,
+  VAR_EXPR,
+  SUM_EXPR,
+  DIFF_EXPR,
+  PROD_EXPR,
+  QUOT_EXPR,
+  LESS_EXPR,
+  EQU_EXPR,
+  AND_EXPR,
+  OR_EXPR,
+  CONCAT_EXPR,
+  INDEX_EXPR,
+  CALL_EXPR,
+  LOCAL_EXPR,
+  INVOKE_EXPR
+} ExprKind;
+
+/** Functions built into the language, called with CALL_EXPR. */
+typedef enum {
+  /** A vector literal, [ a b ... ], joining its arguments. */
+  VECTOR_FN,
+  /** range( n ), the vector 0, 1, ... up to n. */
+  RANGE_FN,
+  /** len( v ), the number of elements in a vector. */
+  LEN_FN,
+  /** sum( v ), the sum of its elements. */
+  SUM_FN,
+  /** min( v ), the smallest element. */
+  MIN_FN,
+  /** max( v ), the largest element. */
+  MAX_FN
+} Builtin;
+
 /** Representation for an Expr interface.  Classes implementing this
-    have these two fields as their first members.  They will set eval
+    have these fields as their first members.  They will set eval
     to point to appropriate functions to evaluate the type of
-    expression their class represents, and they will set destroy to
-    point to a function that frees memory for their type of expresson.
+    expression their class represents, and the kind field says what
+    class the expression is.
+
+    Expressions are allocated from an arena, along with the rest of the
+    statement they're part of, so there's no need for a function to
+    destroy them.  Resetting the arena frees the whole tree at once.
 */
 struct ExprTag {
   /** Pointer to a function to evaluate the given expression and
-      return the result as a dynamically allocated string.
+      return the result as a typed value.
+      @param expr expression to be evaluated.
+      @param ctxt current values of all variables.
+      @return the result.  Any string it refers to is owned by the
+      expression or the context.
+   */
+  Value (*eval)( Expr *expr, Context *ctxt );
+
+  /** Pointer to a function to evaluate the given expression as a
+      condition.  This gives the same answer as checking whether the
+      result of eval is true, but comparisons and logical operators
+      can answer directly, without making a value.
       @param expr expression to be evaluated.
       @param ctxt current values of all variables.
-      @return string respresentation of the result. The caller is responsible
-      for freeing this.
+      @return true if the expression's value is true.
    */
-  char *(*eval)( Expr *expr, Context *ctxt );
+  bool (*test)( Expr *expr, Context *ctxt );
+
+  /** What type of expression this is. */
+  ExprKind kind;
 
-  /** Free memory for this expression, including any subexpressions
-      it contains.
-      @param expr expression to free.
-  */
-  void (*destroy)( Expr *expr );
+  /** Line of the source the expression is on, or zero if it doesn't
+      come from the source. */
+  int line;
 };
 
 /** Make a literal expression that evaluates to the given string.
-    @param val value this expression evaluates to.  This should be a
-    dynamically allocated string that the expression will be
-    responsible for freeing.
-    @return a new expression that evaluates to a copy of the given value.
+    @param arena arena to allocate the expression from.
+    @param text characters of the value this expression evaluates to.
+    These are copied, so they don't need to be null-terminated or to
+    outlive the expression.
+    @param len number of characters in text.
+    @return a new expression that evaluates to the given value.
  */
-Expr *makeLiteral( char *val );
+Expr *makeLiteral( Arena *arena, char const *text, int len );
+
+/** Make a literal expression from a string that's already interned,
+    along with its value as a number, so nothing has to be parsed.
+    @param arena arena to allocate the expression from.
+    @param val value this expression evaluates to.  The expression
+    keeps the caller's reference to it.
+    @param num val, parsed as a number.
+    @return a new expression that evaluates to the given value.
+ */
+Expr *makeDecodedLiteral( Arena *arena, String *val, double num );
+
+/** Make a literal expression that evaluates to the given value, of any
+    type.  This is how the optimizer replaces an expression whose value
+    is known before the program runs.
+    @param arena arena to allocate the expression from.
+    @param val value this expression evaluates to.  If it's a string,
+    the expression makes its own reference to it.
+    @return a new expression that evaluates to val.
+ */
+Expr *makeConstant( Arena *arena, Value val );
 
 /** Make an expression that adds up the value of its two sub-expressions.
-    This expression object will take ownership of the memory pointed to
-    by its two sub-expressions and free them when it is destroyed.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression to add.
     @param rightExpr right-hand expression to add.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeSum( Expr *leftExpr, Expr *rightExpr );
+Expr *makeSum( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression that subtracts the value of one sub-expression from
-    the other, going from left to right. This expression object will take 
-    ownership of the memory pointed to by its two sub-expressions and free 
-    them when it is destroyed.
+    the other, going from left to right.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression from which the right-had expression
     is subtracted.
     @param rightExpr right-hand expression that is subtracted from the
     left-hand expression.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeDifference( Expr *leftExpr, Expr *rightExpr );
+Expr *makeDifference( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression calculates the product of the two operands or
-    sub-expressions. This expression object will take ownership of the 
-    memory pointed to by its two sub-expressions and free them when it is destroyed.
+    sub-expressions.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression for multiplication with right-hand expression.
     @param rightExpr right-hand expression for multiplication with left-hand expression.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeProduct( Expr *leftExpr, Expr *rightExpr );
+Expr *makeProduct( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
-/** Make an expression that adds up the value of its two sub-expressions.
-    This expression object will take ownership of the memory pointed to
-    by its two sub-expressions and free them when it is destroyed.
-    @param leftExpr left-hand expression to add.
-    @param rightExpr right-hand expression to add.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+/** Make an expression that divides the value of its left sub-expression
+    by the value of its right sub-expression.
+    @param arena arena to allocate the expression from.
+    @param leftExpr left-hand expression, the dividend.
+    @param rightExpr right-hand expression, the divisor.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeQuotient( Expr *leftExpr, Expr *rightExpr );
+Expr *makeQuotient( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression stating that the left-hand expression is less than
-    the right-hand expression. This expression object will take ownership 
-    of the memory pointed to by its two sub-expressions and free them 
-    when it is destroyed.
+    the right-hand expression.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression to compare with the right-hand expression.
     @param rightExpr right-hand expression to compare with the left-hand expression.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeLess( Expr *leftExpr, Expr *rightExpr );
+Expr *makeLess( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression that compares two expressions that are of equal value. 
-    This expression object will take ownership of the memory pointed to
-    by its two sub-expressions and free them when it is destroyed.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression to compare with the right-hand expression.
     @param rightExpr right-hand expression to compare with the left-hand expression.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeEquals( Expr *leftExpr, Expr *rightExpr );
+Expr *makeEquals( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression that evaluates to true or false based on whether at least
-    one of its sub-expressions are true. This expression object will take ownership 
-    of the memory pointed to by its two sub-expressions and free them when it is destroyed.
+    one of its sub-expressions are true.  This short-circuits: if the left-hand
+    expression is true, the right-hand one isn't evaluated at all, so any
+    function it calls doesn't run and any error it would raise isn't reported.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression that evaluate to true or false.
     @param rightExpr right-hand expression that evaluates to true or false.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeOr( Expr *leftExpr, Expr *rightExpr );
+Expr *makeOr( Arena *arena, Expr *leftExpr, Expr *rightExpr );
 
 /** Make an expression that evaluates to true or false based on whether or not both
-    of its sub-expressions are true. This expression object will take ownership 
-    of the memory pointed to by its two sub-expressions and free them when it is destroyed.
+    of its sub-expressions are true.  Like makeOr(), this short-circuits: if the
+    left-hand expression is false, the right-hand one isn't evaluated.
+    @param arena arena to allocate the expression from.
     @param leftExpr left-hand expression that evaluate to true or false.
     @param rightExpr right-hand expression that evaluates to true or false.
-    @return pointer to a new, dynamically allocated subclass of Expr.
+    @return pointer to a new subclass of Expr.
  */
-Expr *makeAnd( Expr *leftExpr, Expr *rightExpr );
+Expr *makeAnd( Arena *arena, Expr *leftExpr, Expr *rightExpr );
+
+/** Make an expression that concatenates the text of its two
+    sub-expressions.
+    @param arena arena to allocate the expression from.
+    @param leftExpr left-hand expression, for the start of the text.
+    @param rightExpr right-hand expression, appended to it.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeConcat( Arena *arena, Expr *leftExpr, Expr *rightExpr );
+
+/** Make an expression that looks up a key in a map.
+    @param arena arena to allocate the expression from.
+    @param mapExpr left-hand expression, for the map.
+    @param keyExpr right-hand expression, for the key to look up.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeIndex( Arena *arena, Expr *mapExpr, Expr *keyExpr );
+
+/** Make an expression that calls a built-in function.
+    @param arena arena to allocate the expression from.
+    @param fn function to call.
+    @param args expressions for the arguments.  These are copied, so
+    the array doesn't need to outlive the expression.
+    @param argc number of arguments.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeCall( Arena *arena, Builtin fn, Expr **args, int argc );
+
+/** Return the built-in function with the given name, for the parser.
+    @param name characters of the name.  This doesn't need to be null
+    terminated.
+    @param len number of characters in name.
+    @return the function, or -1 if there isn't one by that name.
+*/
+int findBuiltin( char const *name, int len );
+
+/** Return the name of a built-in function, the way it's spelled in a
+    program.
+    @param fn function to look up.
+    @return its name, or "[]" for a vector literal.
+*/
+char const *builtinName( Builtin fn );
+
+/** Call a built-in function with the values of its arguments.
+    Functions that take a vector treat any other value as a vector of
+    one number.  A vector literal joins its arguments together,
+    splicing in the elements of vectors.  A new vector is held by the
+    context as a temporary.
+    @param ctxt context to hold the result.
+    @param fn function to call.
+    @param args values of the arguments.
+    @param argc number of arguments.
+    @return the result.
+*/
+Value callBuiltin( Context *ctxt, Builtin fn, Value const *args, int argc );
+
+/** Make an expression that calls a function the program defines.
+    @param arena arena to allocate the expression from.
+    @param fn number of the function, from functionSlot().
+    @param args expressions for the arguments.  These are copied, so
+    the array doesn't need to outlive the expression.
+    @param argc number of arguments.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeInvoke( Arena *arena, int fn, Expr **args, int argc );
+
+/** Finish the function that's running by calling another one, which
+    takes its place.  This evaluates the arguments of the call, and
+    invokeFunction() makes the call once the body has stopped.
+    @param ctxt context running the function.
+    @param call expression of kind INVOKE_EXPR.
+*/
+void returnCall( Context *ctxt, Expr *call );
+
+/** Return the function called by an expression of kind INVOKE_EXPR.
+    Its arguments are available through callArgCount() and callArg(),
+    the same as for a built-in function.
+    @param expr expression of kind INVOKE_EXPR.
+    @return number of the function.
+*/
+int invokedFunction( Expr *expr );
+
+/** Return true if evaluating an expression can make temporaries in the
+    context, so whatever evaluates it has to release them afterward.
+    Arithmetic on vectors makes temporaries too, but that can't be
+    known until the program runs, so loops and top-level statements
+    release everything they make anyway.
+    @param expr expression to check.
+    @return true if expr contains a concatenation or a function that
+    makes a new vector.
+*/
+bool makesTemporaries( Expr *expr );
+
+/** Make a binary expression of the given kind, for code that rebuilds
+    expressions it has taken apart.
+    @param arena arena to allocate the expression from.
+    @param kind kind of expression, one of the binary operators.
+    @param leftExpr left-hand operand.
+    @param rightExpr right-hand operand.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeBinaryExpr( Arena *arena, ExprKind kind, Expr *leftExpr,
+                      Expr *rightExpr );
 
 /**
-  This function updates the context with the given value for the variable with the given name.
-  This expression object will take ownership of the memory pointed to by its two sub-expressions 
-  and free them when it is destroyed.
-  @param *vname a pointer to the name of the variable.
-  @return pointer to a new, dynamically allocated subclass of Expr.
+  Make an expression that evaluates to the current value of a variable.
+  @param arena arena to allocate the expression from.
+  @param slot slot of the variable, from variableSlot().
+  @return pointer to a new subclass of Expr.
  */
-Expr *makeVariable (char const *vname);
+Expr *makeVariable (Arena *arena, int slot);
 
-#endif
+/** Make an expression that evaluates to the current value of a local
+    variable of the function that's running.
+    @param arena arena to allocate the expression from.
+    @param index index of the local, counting the parameters first.
+    @return pointer to a new subclass of Expr.
+ */
+Expr *makeLocal( Arena *arena, int index );
+
+/** Turn a variable expression into one for a local variable, in
+    place.  The parser uses this for reads of a name it finds out is
+    local after it's already parsed them.
+    @param expr expression of kind VAR_EXPR.
+    @param index index of the local.
+*/
+void localizeVariable( Expr *expr, int index );
+
+/** Return the value of a literal expression, exactly what evaluating
+    it would return.
+    @param expr expression of kind LITERAL_EXPR.
+    @return the literal's value.  For a string, this includes its
+    value as a number, and the string is never released.
+*/
+Value literalValue( Expr *expr );
+
+/** Return the string for a string literal expression.
+    @param expr expression of kind LITERAL_EXPR, with a string value.
+    @return the literal's string.  This is never released, so it's safe
+    to use without retaining it.
+*/
+String *literalString( Expr *expr );
+
+/** Return the numeric value of a string literal expression.
+    @param expr expression of kind LITERAL_EXPR, with a string value.
+    @return the literal's string, parsed as a number.
+*/
+double literalNumber( Expr *expr );
+
+/** Return the slot referenced by a variable expression.
+    @param expr expression of kind VAR_EXPR, or LOCAL_EXPR for the
+    index of the local.
+    @return the variable's slot.
+*/
+int variableExprSlot( Expr *expr );
 
+/** Return the function called by a call expression.
+    @param expr expression of kind CALL_EXPR.
+    @return the function.
+*/
+Builtin callFunction( Expr *expr );
+
+/** Return the number of arguments in a call expression.
+    @param expr expression of kind CALL_EXPR or INVOKE_EXPR.
+    @return the number of arguments.
+*/
+int callArgCount( Expr *expr );
+
+/** Return one of the arguments of a call expression.
+    @param expr expression of kind CALL_EXPR or INVOKE_EXPR.
+    @param i index of the argument, from zero.
+    @return the argument's expression.
+*/
+Expr *callArg( Expr *expr, int i );
+
+/** Return the left-hand operand of a binary expression.
+    @param expr expression of one of the binary kinds, from SUM_EXPR to
+    INDEX_EXPR.
+    @return the left-hand sub-expression.
+*/
+Expr *binaryLeft( Expr *expr );
+
+/** Return the right-hand operand of a binary expression.
+    @param expr expression of one of the binary kinds, from SUM_EXPR to
+    INDEX_EXPR.
+    @return the right-hand sub-expression.
+*/
+Expr *binaryRight( Expr *expr );
+
+#endif
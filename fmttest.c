@@ -0,0 +1,105 @@
+/**
+  @file fmttest.c
+
+  Randomized test for formatNumber(), comparing its output against the
+  C library's sprintf( "%f" ) for millions of doubles.  Inputs are
+  drawn from every part of the range: random bit patterns, numbers of
+  everyday size, halfway cases for rounding the sixth digit, integers
+  near powers of two and ten, subnormals, and special values.
+
+  Exits unsuccessfully, after reporting the first few differences, if
+  any output doesn't match.
+*/
+
+#include <math.h>
+
+#include "num.h"
+#include "testutil.h"
+
+// Number of inputs to check from each random category, unless a count
+// is given on the command line.
+#define DEFAULT_COUNT 200000
+
+/** Check one number, and its negative, against sprintf.
+    @param num number to check.
+*/
+static void check( double num )
+{
+  for ( int i = 0; i < 2; i++, num = -num ) {
+    char expected[ MAX_FORMATTED + 1 ], actual[ MAX_FORMATTED + 1 ];
+    int elen = sprintf( expected, "%f", num );
+    int alen = formatNumber( num, actual );
+    if ( countCheck( elen == alen && strcmp( expected, actual ) == 0 ) )
+      printf( "%a: expected %s, got %s\n", num, expected, actual );
+  }
+}
+
+/**
+  Check every category of input, then report the results.
+
+  @param argc the number of command line arguments
+  @param *argv an array of arguments, optionally the count per category
+  @return EXIT_SUCCESS if every input matched
+*/
+int main( int argc, char *argv[] )
+{
+  long count = argc > 1 ? atol( argv[ 1 ] ) : DEFAULT_COUNT;
+
+  // Special values, zero and the ends of the subnormal and normal
+  // ranges.
+  check( 0.0 );
+  check( INFINITY );
+  check( NAN );
+  check( fromBits( 1 ) );
+  check( fromBits( 0x000fffffffffffffu ) );
+  check( fromBits( 0x0010000000000000u ) );
+  check( fromBits( 0x7fefffffffffffffu ) );
+
+  // Every power of two, and its neighbors.
+  for ( int e = -1074; e <= 1023; e++ ) {
+    double p = ldexp( 1.0, e );
+    check( p );
+    check( nextafter( p, 0 ) );
+    check( nextafter( p, INFINITY ) );
+  }
+
+  // Powers of ten and their neighbors, which sit right around carries.
+  for ( double p = 1; p < 1e308; p *= 10 ) {
+    check( p );
+    check( nextafter( p, 0 ) );
+    check( nextafter( p, INFINITY ) );
+  }
+
+  // Random bit patterns, covering the whole range of exponents.
+  for ( long i = 0; i < count; i++ )
+    check( fromBits( random64() ) );
+
+  // Numbers of the size programs usually print, where all six
+  // fractional digits matter.
+  for ( long i = 0; i < count; i++ ) {
+    int e = (int) ( random64() % 100 ) - 40;
+    double frac = (double) ( random64() >> 11 ) / ( (uint64_t) 1 << 53 );
+    check( ldexp( 1 + frac, e ) );
+  }
+
+  // Numbers close to halfway between two six-digit results, and exact
+  // halfway cases, which round to even.
+  for ( long i = 0; i < count; i++ ) {
+    double base = (double) ( random64() % 100000000000u ) + 0.5;
+    double near = base / 1e6;
+    check( near );
+    check( nextafter( near, 0 ) );
+    check( nextafter( near, INFINITY ) );
+    check( ldexp( (double) ( random64() % 1000000 ) * 2 + 1,
+                  -(int) ( random64() % 12 ) - 1 ) );
+  }
+
+  // Integers, around where they stop fitting in 64 bits.
+  for ( long i = 0; i < count; i++ ) {
+    double num = (double) ( random64() >> ( random64() % 64 ) );
+    check( num );
+    check( ldexp( num, random64() % 16 ) );
+  }
+
+  return finishChecks();
+}
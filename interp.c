@@ -0,0 +1,237 @@
+#include "interp.h"
+#include "parse.h"
+#include "output.h"
+#include "opt.h"
+#include "jit.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Initial capacity for a program's list of statements.
+#define INITIAL_CAPACITY 16
+
+/** Representation for an interpreter. */
+struct InterpreterTag {
+  /** Variables and function definitions programs see. */
+  Context *ctxt;
+
+  /** Function that takes printed output, and its argument, or NULL
+      for standard output. */
+  InterpreterOutput output;
+  void *outputData;
+
+  /** Message for the last error, or an empty string, and the line it
+      was on. */
+  char error[ MAX_ERROR + 1 ];
+  int errorLine;
+};
+
+/** Representation for a compiled program. */
+struct ProgramTag {
+  /** Arena holding every statement. */
+  Arena *arena;
+
+  /** Top-level statements, in order, and the number of them. */
+  Stmt **stmts;
+  int len;
+
+  /** Loops compiled from the statements on earlier runs, so later runs
+      can use them too. */
+  JitLoop *loops;
+};
+
+/** Record the error a trap caught, or clear the last error.
+    @param interp interpreter to record it in.
+    @param trap trap that caught the error, or NULL for no error.
+*/
+static void recordError( Interpreter *interp, ErrorTrap const *trap )
+{
+  strcpy( interp->error, trap ? trap->message : "" );
+  interp->errorLine = trap ? trap->line : 0;
+}
+
+Interpreter *makeInterpreter( void )
+{
+  Interpreter *interp = (Interpreter *) malloc( sizeof( Interpreter ) );
+
+  // Variables in the context are stored by slot, so the slots have to
+  // last as long as it does.
+  retainSymbols();
+  interp->ctxt = makeContext();
+  interp->output = NULL;
+  interp->outputData = NULL;
+  recordError( interp, NULL );
+  return interp;
+}
+
+void freeInterpreter( Interpreter *interp )
+{
+  // There are no exit handlers to write anything still buffered, so
+  // it's written now.
+  flushOutput();
+  freeContext( interp->ctxt );
+  free( interp );
+  releaseSymbols();
+}
+
+void resetInterpreter( Interpreter *interp )
+{
+  freeContext( interp->ctxt );
+  interp->ctxt = makeContext();
+}
+
+void setInterpreterOutput( Interpreter *interp, InterpreterOutput output,
+                           void *data )
+{
+  interp->output = output;
+  interp->outputData = data;
+}
+
+/** Parse every statement of a program, catching any syntax error.
+    This is separate from compileProgram(), so nothing local to it
+    changes between setjmp() and an error jumping back.
+    @param prog program to add the statements to.
+    @param lex lexer reading the source.
+    @param trap trap to catch errors with.
+    @return true if the whole program parsed.
+*/
+static bool parseCaught( Program *prog, Lexer *lex, ErrorTrap *trap )
+{
+  catchErrors( trap );
+  if ( setjmp( trap->env ) )
+    return false;
+
+  // Like a compound statement's list, the list lives in the arena and
+  // is left behind when it grows.
+  int cap = INITIAL_CAPACITY;
+  prog->stmts = (Stmt **) arenaAlloc( prog->arena, cap * sizeof( Stmt * ) );
+
+  Token tok;
+  int removed = 0;
+  while ( parseToken( &tok, lex ) ) {
+    if ( prog->len >= cap ) {
+      cap *= 2;
+      Stmt **bigger = (Stmt **) arenaAlloc( prog->arena,
+                                            cap * sizeof( Stmt * ) );
+      memcpy( bigger, prog->stmts, prog->len * sizeof( Stmt * ) );
+      prog->stmts = bigger;
+    }
+    Stmt *stmt = parseStmt( &tok, lex, prog->arena );
+    prog->stmts[ prog->len++ ] = optimizeStmt( stmt, prog->arena, &removed );
+  }
+
+  releaseErrors( trap );
+  return true;
+}
+
+Program *compileProgram( Interpreter *interp, char const *source,
+                         size_t len )
+{
+  Program *prog = (Program *) malloc( sizeof( Program ) );
+  retainSymbols();
+  prog->arena = makeArena();
+  prog->stmts = NULL;
+  prog->len = 0;
+  prog->loops = NULL;
+
+  Lexer *lex = openLexerText( source, len );
+  ErrorTrap trap;
+  bool ok = parseCaught( prog, lex, &trap );
+  closeLexer( lex );
+
+  recordError( interp, ok ? NULL : &trap );
+  if ( !ok ) {
+    freeProgram( prog );
+    return NULL;
+  }
+  return prog;
+}
+
+void freeProgram( Program *prog )
+{
+  freeLoopList( prog->loops );
+  freeArena( prog->arena );
+  free( prog );
+  releaseSymbols();
+}
+
+/** Run every statement of a program, catching any error.  This is
+    separate from runProgram(), so nothing local to it changes between
+    setjmp() and an error jumping back.
+    @param ctxt context to run the program in.
+    @param prog program to run.
+    @param trap trap to catch errors with.
+    @return true if the program ran to the end.
+*/
+static bool runCaught( Context *ctxt, Program *prog, ErrorTrap *trap )
+{
+  catchErrors( trap );
+  if ( setjmp( trap->env ) )
+    return false;
+
+  // Operators on vectors and ropes can leave temporaries behind, and
+  // they're done with once the statement is.
+  for ( int i = 0; i < prog->len; i++ ) {
+    int mark = temporaryMark( ctxt );
+    prog->stmts[ i ]->execute( prog->stmts[ i ], ctxt );
+    releaseTemporaries( ctxt, mark );
+  }
+
+  releaseErrors( trap );
+  return true;
+}
+
+bool runProgram( Interpreter *interp, Program *prog )
+{
+  redirectOutput( interp->output, interp->outputData );
+
+  ErrorTrap trap;
+  bool ok = runCaught( interp->ctxt, prog, &trap );
+  recordError( interp, ok ? NULL : &trap );
+  if ( !ok ) {
+    abandonCalls( interp->ctxt );
+    releaseTemporaries( interp->ctxt, 0 );
+  }
+
+  // Keep any loops compiled on this run, for the next one.
+  prog->loops = keepLoops( prog->loops );
+
+  flushOutput();
+  redirectOutput( NULL, NULL );
+  return ok;
+}
+
+void setInterpreterString( Interpreter *interp, char const *name,
+                           char const *text )
+{
+  String *str = internString( text, strlen( text ) );
+  setValue( interp->ctxt, name, makeStringValue( str ) );
+  releaseString( str );
+}
+
+void setInterpreterNumber( Interpreter *interp, char const *name,
+                           double num )
+{
+  setValue( interp->ctxt, name, makeNumberValue( num ) );
+}
+
+char const *getInterpreterVariable( Interpreter *interp, char const *name )
+{
+  return getVariable( interp->ctxt, name );
+}
+
+void freeInterpreterThread( void )
+{
+  freeStrings();
+  freeVectorCache();
+}
+
+char const *interpreterError( Interpreter *interp )
+{
+  return interp->error;
+}
+
+int interpreterErrorLine( Interpreter *interp )
+{
+  return interp->errorLine;
+}
@@ -0,0 +1,160 @@
+/**
+  @file interp.h
+
+  Interface for embedding the interpreter in another program, built as
+  libinterpreter.a and libinterpreter.so.  A program is compiled once,
+  from source in memory, and can then be run any number of times, by
+  any number of interpreters.  An interpreter holds the variables and
+  function definitions a program sees, sends printed output to a
+  function the caller supplies, and reports errors with their line
+  numbers instead of exiting.
+
+  Strings aren't shared between threads, so an interpreter, and the
+  programs it compiles and runs, must only be used on the thread that
+  made them.  Different threads can each have their own.  Each thread
+  that uses the library keeps strings and other values cached for it,
+  which freeInterpreterThread() frees.
+
+  Variable and function names are numbered as they're first seen, and
+  the numbers are shared by every interpreter and program, on every
+  thread.  The names are kept until the last interpreter and program
+  are freed, so a long-running program that compiles programs with
+  ever new names should free all of them now and then to reclaim the
+  names.
+*/
+
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Short typename for an interpreter.  Its representation is private
+    to the library. */
+typedef struct InterpreterTag Interpreter;
+
+/** Short typename for a compiled program.  Its representation is
+    private to the library. */
+typedef struct ProgramTag Program;
+
+/** Function that takes a program's printed output.
+    @param data pointer given to setInterpreterOutput().
+    @param text bytes of output, which aren't null-terminated.
+    @param len number of bytes.
+*/
+typedef void (*InterpreterOutput)( void *data, char const *text,
+                                   size_t len );
+
+/** Make a new interpreter, with no variables set and no functions
+    defined, printing to standard output.
+    @return new interpreter.  The caller must eventually free this with
+    freeInterpreter().
+*/
+Interpreter *makeInterpreter( void );
+
+/** Free an interpreter, and all its variables.
+    @param interp interpreter to free.
+*/
+void freeInterpreter( Interpreter *interp );
+
+/** Forget every variable and function definition, so the next program
+    runs in a fresh context.
+    @param interp interpreter to reset.
+*/
+void resetInterpreter( Interpreter *interp );
+
+/** Send everything programs print to a function.
+    @param interp interpreter to set the output for.
+    @param output function to call with each block of output, or NULL
+    for standard output.  Output is buffered, and all of it is handed
+    over before runProgram() returns.
+    @param data pointer to pass to output.
+*/
+void setInterpreterOutput( Interpreter *interp, InterpreterOutput output,
+                           void *data );
+
+/** Compile a program from source in memory.
+    @param interp interpreter to report a syntax error to.
+    @param source text of the program, which doesn't need to be
+    null-terminated, or to outlast this call.
+    @param len number of characters in source.
+    @return the compiled program, or NULL if there's an error, which
+    interpreterError() describes.  The caller must eventually free this
+    with freeProgram().
+*/
+Program *compileProgram( Interpreter *interp, char const *source,
+                         size_t len );
+
+/** Free a compiled program.  Any interpreter that has run it must be
+    reset or freed first, since it may still have the program's
+    functions defined.
+    @param prog program to free.
+*/
+void freeProgram( Program *prog );
+
+/** Run a compiled program, in the interpreter's current context, so
+    it sees any variables set and functions defined before.
+    @param interp interpreter to run the program with.
+    @param prog program to run.
+    @return true if the program ran to the end, or false if it stopped
+    with an error, which interpreterError() describes.  Variables keep
+    whatever values they had when it stopped.
+*/
+bool runProgram( Interpreter *interp, Program *prog );
+
+/** Set a variable to a string.
+    @param interp interpreter to set the variable in.
+    @param name name of the variable.
+    @param text new value, which the interpreter copies.
+*/
+void setInterpreterString( Interpreter *interp, char const *name,
+                           char const *text );
+
+/** Set a variable to a number.
+    @param interp interpreter to set the variable in.
+    @param name name of the variable.
+    @param num new value.
+*/
+void setInterpreterNumber( Interpreter *interp, char const *name,
+                           double num );
+
+/** Return the value of a variable as text, the way print would show it.
+    @param interp interpreter to look in.
+    @param name name of the variable.
+    @return the variable's value, or the empty string if it isn't set.
+    This belongs to the interpreter, and stays valid until the variable
+    changes.
+*/
+char const *getInterpreterVariable( Interpreter *interp, char const *name );
+
+/** Free the strings and vectors the library keeps for the calling
+    thread.  A thread that's used the library should call this before
+    it exits, or they're lost.  Every interpreter and program made on
+    the thread has to be freed first.  The thread can still use the
+    library afterward, starting over from nothing.
+*/
+void freeInterpreterThread( void );
+
+/** Return the message for the last error from compileProgram() or
+    runProgram(), like "line 3: syntax error".
+    @param interp interpreter that reported the error.
+    @return the message, or the empty string if the last call succeeded.
+*/
+char const *interpreterError( Interpreter *interp );
+
+/** Return the line of the program the last error was on.
+    @param interp interpreter that reported the error.
+    @return line number, starting from 1, or 0 if the last call
+    succeeded or the error wasn't about a particular line.
+*/
+int interpreterErrorLine( Interpreter *interp );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,61 +1,654 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "expr.h"
 #include "stmt.h"
 #include "parse.h"
+#include "vm.h"
+#include "closure.h"
+#include "output.h"
+#include "cache.h"
+#include "opt.h"
+#include "jit.h"
+#include "emit.h"
+#include "profile.h"
+#include "error.h"
+
+/** Ways the interpreter can run a statement. */
+typedef enum {
+  /** Walk the statement's tree. */
+  TREE_ENGINE,
+  /** Compile to bytecode and run it on the virtual machine. */
+  VM_ENGINE,
+  /** Compile to closure records and run those. */
+  CLOSURE_ENGINE
+} Engine;
+
+/** Options that apply to every program the interpreter runs. */
+typedef struct {
+  /** Engine to run statements with. */
+  Engine engine;
+
+  /** True if programs are run from a cache, and cached. */
+  bool useCache;
+
+  /** True if the optimizer moves invariant expressions out of loops. */
+  bool hoist;
+
+  /** True if statements are profiled. */
+  bool profile;
+
+  /** True if we report what the optimizer and compiler did. */
+  bool verbose;
+} Options;
+
+/** Everything needed to run one program.  It's kept together, so it
+    can all be freed even if the program stops with an error. */
+typedef struct {
+  /** Lexer reading the program's source. */
+  Lexer *lex;
+
+  /** Context, for storing variable values. */
+  Context *ctxt;
+
+  /** Arena for the statements we parse.  We reuse it for every
+      statement, so it only has to allocate memory once. */
+  Arena *arena;
+
+  /** Arena for function definitions, which have to last until the
+      end. */
+  Arena *defs;
+
+  /** Name of the program's cache file, if we're using one. */
+  char *cacheName;
+
+  /** Statements collected for a new cache, if we're making one. */
+  CacheWriter *writer;
+} Run;
 
 /** Print a usage message then exit unsuccessfully. */
 void usage()
 {
-  fprintf( stderr, "usage: interpreter <program-file>\n" );
+  fprintf( stderr, "usage: interpreter [--engine=tree|vm|closure] [--output-thread] [--cache] [--hoist] [--no-jit] [--emit-c] [--profile] [--verbose] <program-file>\n" );
+  fprintf( stderr, "       interpreter --batch [--jobs=N] [--output-dir=DIR] [--engine=tree|vm|closure] [--output-thread] [--cache] [--hoist] [--no-jit] <program-file>...\n" );
   exit( EXIT_FAILURE );
 }
 
+// Program being transpiled to C, for --emit-c.
+static Emitter *emitter = NULL;
+
+/** When transpiling, write the C program before the parser reports a
+    syntax error, so it reports the same error after running the
+    statements before it.
+    @param line line the syntax error is on.
+*/
+static void emitBeforeError( int line )
+{
+  writeProgram( emitter, stdout, line );
+}
+
+/** Transpile a whole program to C, and write it to standard output.
+    @param lex lexer to read the program from.
+    @param name name of the program's source file.
+*/
+static void transpile( Lexer *lex, char const *name )
+{
+  // Every statement has to last until the end, so they all stay in
+  // the arena.
+  Arena *arena = makeArena();
+  emitter = makeEmitter( name );
+  onSyntaxError( emitBeforeError );
+
+  Token tok;
+  int removed = 0;
+  while ( parseToken( &tok, lex ) ) {
+    Stmt *stmt = parseStmt( &tok, lex, arena );
+    emitStmt( emitter, optimizeStmt( stmt, arena, &removed ) );
+  }
+
+  writeProgram( emitter, stdout, 0 );
+  freeEmitter( emitter );
+  freeArena( arena );
+}
+
+/** Run a statement, with the given engine.
+    @param engine engine to run it with.
+    @param stmt statement to run.
+    @param ctxt current values of all variables.
+*/
+static void runStmt( Engine engine, Stmt *stmt, Context *ctxt )
+{
+  // A function definition just hands the function to the context, and
+  // calls run the body in the tree-walking interpreter, whatever
+  // engine makes them.
+  int mark = temporaryMark( ctxt );
+  if ( stmt->kind == FUNCTION_STMT )
+    stmt->execute( stmt, ctxt );
+  else if ( engine == VM_ENGINE ) {
+    Code *code = compileStmt( stmt );
+    runCode( code, ctxt );
+    freeCode( code );
+  } else if ( engine == CLOSURE_ENGINE ) {
+    Closure *closure = makeClosure( stmt );
+    runClosure( closure, ctxt );
+    freeClosure( closure );
+  } else
+    stmt->execute( stmt, ctxt );
+
+  // Arithmetic on vectors can leave temporaries behind, and they're
+  // done with once the statement is.
+  releaseTemporaries( ctxt, mark );
+}
+
+/** Parse and run a whole program.  Errors are reported with
+    raiseError(), so with an error trap, this can stop part way
+    through, and the run still has to be freed.
+    @param opts options to run the program with.
+    @param path name of the program's source file.
+    @param run lexer, context and arenas to run the program with.
+*/
+static void runProgram( Options const *opts, char const *path, Run *run )
+{
+  Engine engine = opts->engine;
+
+  // If there's a good cache for this program, run the statements from
+  // it and skip parsing.
+  Stmt **program = NULL;
+  int count = 0;
+  size_t sourceLen;
+  char const *source = lexerSource( run->lex, &sourceLen );
+
+  // Profiled statements only run in the tree-walking interpreter, and
+  // compiled loops would skip the statements we're measuring.
+  if ( opts->profile ) {
+    engine = TREE_ENGINE;
+    disableJit();
+    startProfile( path, source, sourceLen );
+  }
+
+  if ( opts->useCache ) {
+    run->cacheName = cachePath( path );
+    program = loadCache( run->cacheName, source, sourceLen, run->arena,
+                         &count );
+  }
+
+  // Number of tree nodes the optimizer has removed, and number of
+  // expressions it's moved out of loops.
+  int removed = 0;
+  int hoisted = 0;
+
+  if ( program ) {
+    for ( int i = 0; i < count; i++ ) {
+      Stmt *stmt = optimizeStmt( program[ i ], run->arena, &removed );
+      if ( opts->hoist )
+        stmt = hoistInvariants( stmt, run->arena, &hoisted );
+      if ( opts->profile )
+        stmt = profileStmt( stmt, run->arena );
+      runStmt( engine, stmt, run->ctxt );
+    }
+  } else {
+    // Collect the statements for a new cache as we parse them.
+    if ( opts->useCache )
+      run->writer = makeCacheWriter();
+
+    // Parse one statement at a time, then run the statement
+    // using the same context.
+    Token tok;
+
+    int counter = 0;
+    while ( parseToken( &tok, run->lex ) ) {
+      // Parse the next input statement.
+      Arena *owner = tokenIs( &tok, "function" ) ? run->defs : run->arena;
+      Stmt *stmt = parseStmt( &tok, run->lex, owner );
+      if ( run->writer )
+        cacheStmt( run->writer, stmt );
+
+      // Optimize it, then run it with whichever engine we're using.
+      stmt = optimizeStmt( stmt, owner, &removed );
+      if ( opts->hoist )
+        stmt = hoistInvariants( stmt, owner, &hoisted );
+      if ( opts->profile )
+        stmt = profileStmt( stmt, owner );
+      runStmt( engine, stmt, run->ctxt );
+
+      // Delete it, by freeing everything in the arena, and any loops
+      // compiled from it.
+      freeLoops();
+      resetArena( run->arena );
+
+      counter++;
+    }
+
+    // The whole program parsed, so it's safe to cache.
+    if ( run->writer )
+      writeCache( run->writer, run->cacheName, source, sourceLen );
+  }
+
+  if ( opts->verbose ) {
+    fprintf( stderr, "optimizer removed %d nodes\n", removed );
+    if ( opts->hoist )
+      fprintf( stderr, "optimizer hoisted %d expressions\n", hoisted );
+    fprintf( stderr, "jit compiled %d loops\n", compiledLoops() );
+  }
+}
+
+/** Get ready to run a program.
+    @param run storage for everything needed to run it.
+    @param lex lexer reading the program's source.
+*/
+static void startRun( Run *run, Lexer *lex )
+{
+  run->lex = lex;
+  run->ctxt = makeContext();
+  run->arena = makeArena();
+  run->defs = makeArena();
+  run->cacheName = NULL;
+  run->writer = NULL;
+}
+
+/** Free everything used to run a program, including its lexer and any
+    loops compiled from it.
+    @param run everything used to run the program.
+*/
+static void finishRun( Run *run )
+{
+  if ( run->writer )
+    freeCacheWriter( run->writer );
+  free( run->cacheName );
+  closeLexer( run->lex );
+  freeLoops();
+  freeArena( run->arena );
+  freeArena( run->defs );
+  freeContext( run->ctxt );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Batch
+
+/** One program for the batch runner to run. */
+typedef struct {
+  /** Name of the program's source file. */
+  char const *path;
+
+  /** Output, collected for standard output, its length and its
+      capacity. */
+  char *out;
+  size_t len, cap;
+
+  /** Name of the file the output goes to instead, if there's an output
+      directory, and the file once it's open. */
+  char *outName;
+  FILE *file;
+
+  /** True if the program stopped with an error, and the error. */
+  bool failed;
+  char error[ MAX_ERROR + 1 ];
+
+  /** True once the program has finished. */
+  bool done;
+} Job;
+
+/** State shared by the batch runner's threads. */
+typedef struct {
+  /** Options to run every program with. */
+  Options const *opts;
+
+  /** Directory each program's output is written to, or NULL to write
+      it all to standard output. */
+  char const *outputDir;
+
+  /** Programs to run, in the order they were given. */
+  Job *jobs;
+  int count;
+
+  /** Index of the next job to start, claimed with an atomic add. */
+  int next;
+
+  /** Lock and condition for waiting on a job to finish. */
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+} Batch;
+
+/** Output sink that collects a job's output in memory.
+    @param data job the output belongs to.
+    @param text bytes of output.
+    @param len number of bytes.
+*/
+static void collectOutput( void *data, char const *text, size_t len )
+{
+  Job *job = data;
+  if ( job->len + len > job->cap ) {
+    job->cap = job->cap ? job->cap * 2 : 1024;
+    if ( job->cap < job->len + len )
+      job->cap = job->len + len;
+    job->out = realloc( job->out, job->cap );
+  }
+  memcpy( job->out + job->len, text, len );
+  job->len += len;
+}
+
+/** Output sink that writes a job's output to its file.
+    @param data job the output belongs to.
+    @param text bytes of output.
+    @param len number of bytes.
+*/
+static void fileOutput( void *data, char const *text, size_t len )
+{
+  fwrite( text, 1, len, ((Job *)data)->file );
+}
+
+/** Run a program, catching any error it reports.  This is separate
+    from runJob(), so nothing local to it changes between setjmp() and
+    an error jumping back.
+    @param opts options to run the program with.
+    @param path name of the program's source file.
+    @param run lexer, context and arenas to run the program with.
+    @param trap trap to catch errors with.
+    @return true if the program ran without an error.
+*/
+static bool runCaught( Options const *opts, char const *path, Run *run,
+                       ErrorTrap *trap )
+{
+  catchErrors( trap );
+  if ( setjmp( trap->env ) )
+    return false;
+  runProgram( opts, path, run );
+  releaseErrors( trap );
+  return true;
+}
+
+/** Run one job on the current thread, with its output going to its
+    file or its buffer.
+    @param batch batch the job belongs to.
+    @param job job to run.
+*/
+static void runJob( Batch *batch, Job *job )
+{
+  Lexer *lex = openLexer( job->path );
+  if ( !lex ) {
+    job->failed = true;
+    snprintf( job->error, sizeof( job->error ), "Can't open file: %s",
+              job->path );
+    return;
+  }
+
+  if ( job->outName ) {
+    job->file = fopen( job->outName, "w" );
+    if ( !job->file ) {
+      job->failed = true;
+      snprintf( job->error, sizeof( job->error ), "Can't write file: %s",
+                job->outName );
+      closeLexer( lex );
+      return;
+    }
+  }
+  redirectOutput( job->file ? fileOutput : collectOutput, job );
+
+  Run run;
+  startRun( &run, lex );
+  ErrorTrap trap;
+  if ( !runCaught( batch->opts, job->path, &run, &trap ) ) {
+    job->failed = true;
+    strcpy( job->error, trap.message );
+  }
+  finishRun( &run );
+
+  flushOutput();
+  redirectOutput( NULL, NULL );
+  if ( job->file )
+    fclose( job->file );
+}
+
+/** Comparison function for sorting jobs by the name of their output
+    file.
+    @param a pointer to the first job's pointer.
+    @param b pointer to the second job's pointer.
+    @return negative, zero or positive, like strcmp().
+*/
+static int compareOutNames( void const *a, void const *b )
+{
+  return strcmp( (*(Job *const *) a)->outName, (*(Job *const *) b)->outName );
+}
+
+/** Name the file in the output directory each job writes, after the
+    last part of its path, and make sure no two jobs would write the
+    same one.
+    @param batch batch with the jobs to name files for.
+    @return true if every job has its own file, or false, after
+    reporting the programs that don't.
+*/
+static bool nameOutputFiles( Batch *batch )
+{
+  Job **sorted = malloc( batch->count * sizeof( Job * ) );
+  for ( int i = 0; i < batch->count; i++ ) {
+    Job *job = &batch->jobs[ i ];
+    char const *base = strrchr( job->path, '/' );
+    base = base ? base + 1 : job->path;
+    size_t size = strlen( batch->outputDir ) + strlen( base ) + 6;
+    job->outName = malloc( size );
+    snprintf( job->outName, size, "%s/%s.out", batch->outputDir, base );
+    sorted[ i ] = job;
+  }
+
+  // Once they're sorted, jobs with the same file are next to each
+  // other.
+  qsort( sorted, batch->count, sizeof( Job * ), compareOutNames );
+  bool ok = true;
+  for ( int i = 1; i < batch->count; i++ )
+    if ( strcmp( sorted[ i - 1 ]->outName, sorted[ i ]->outName ) == 0 ) {
+      fprintf( stderr, "%s and %s would both write %s\n",
+               sorted[ i - 1 ]->path, sorted[ i ]->path, sorted[ i ]->outName );
+      ok = false;
+    }
+  free( sorted );
+  return ok;
+}
+
+/** Body of each thread in the batch runner's pool.  Takes jobs in
+    order until there are none left.
+    @param arg the batch.
+    @return NULL
+*/
+static void *batchWorker( void *arg )
+{
+  Batch *batch = arg;
+  for ( ;; ) {
+    int i = __atomic_fetch_add( &batch->next, 1, __ATOMIC_RELAXED );
+    if ( i >= batch->count )
+      break;
+
+    runJob( batch, &batch->jobs[ i ] );
+
+    pthread_mutex_lock( &batch->lock );
+    batch->jobs[ i ].done = true;
+    pthread_cond_broadcast( &batch->finished );
+    pthread_mutex_unlock( &batch->lock );
+  }
+
+  // Strings and vectors cached by this thread would be lost when it
+  // exits.  If the batch is running on the main thread, it's done
+  // with them too.
+  freeStrings();
+  freeVectorCache();
+  return NULL;
+}
+
+/** Run a list of programs on a pool of threads, each with its own
+    context.  Output for each program goes to its own file, or to
+    standard output in the order the programs were given, followed by
+    any error it stopped with.  An error in one program doesn't stop
+    the others.  Nothing runs if two programs would write the same
+    output file.
+    @param opts options to run every program with.
+    @param paths names of the programs' source files.
+    @param count number of programs.
+    @param threads number of threads to run them on.
+    @param outputDir directory to write output files to, or NULL.
+    @return true if every program ran without an error.
+*/
+static bool runBatch( Options const *opts, char *paths[], int count,
+                      int threads, char const *outputDir )
+{
+  Batch batch = { .opts = opts, .outputDir = outputDir, .count = count };
+  batch.jobs = calloc( count, sizeof( Job ) );
+  for ( int i = 0; i < count; i++ )
+    batch.jobs[ i ].path = paths[ i ];
+  if ( outputDir && !nameOutputFiles( &batch ) ) {
+    for ( int i = 0; i < count; i++ )
+      free( batch.jobs[ i ].outName );
+    free( batch.jobs );
+    return false;
+  }
+  pthread_mutex_init( &batch.lock, NULL );
+  pthread_cond_init( &batch.finished, NULL );
+
+  // There's no point in more threads than programs.  If a thread
+  // can't be started, the ones that did start do all the work.
+  if ( threads > count )
+    threads = count;
+  pthread_t *pool = calloc( threads, sizeof( pthread_t ) );
+  int started = 0;
+  while ( started < threads &&
+          pthread_create( &pool[ started ], NULL, batchWorker, &batch ) == 0 )
+    started++;
+  if ( started == 0 )
+    batchWorker( &batch );
+
+  // Report each program as soon as it and everything before it is
+  // done.
+  bool ok = true;
+  for ( int i = 0; i < count; i++ ) {
+    Job *job = &batch.jobs[ i ];
+    pthread_mutex_lock( &batch.lock );
+    while ( !job->done )
+      pthread_cond_wait( &batch.finished, &batch.lock );
+    pthread_mutex_unlock( &batch.lock );
+
+    if ( job->len )
+      printText( job->out, job->len );
+    free( job->out );
+    free( job->outName );
+    if ( job->failed ) {
+      flushOutput();
+      fprintf( stderr, "%s: %s\n", job->path, job->error );
+      ok = false;
+    }
+  }
+
+  for ( int i = 0; i < started; i++ )
+    pthread_join( pool[ i ], NULL );
+  free( pool );
+  pthread_cond_destroy( &batch.finished );
+  pthread_mutex_destroy( &batch.lock );
+  free( batch.jobs );
+  return ok;
+}
+
 /**
   Uses the other components to parse and execute statements from the input program.
-  
+
   @param argc the number of command line arguments
   @param *argv an array of arguments as strings
   @return EXIT_SUCCESS successful program execution
 */
 int main( int argc, char *argv[] )
 {
+  // Errors exit right away, so output has to be written on the way
+  // out.
+  flushOutputAtExit();
+
+  // Look for options before the program name.
+  Options opts = { .engine = TREE_ENGINE };
+  bool writerThread = false;
+  bool emitC = false;
+  bool batch = false;
+  int threads = 0;
+  char const *outputDir = NULL;
+  int arg = 1;
+  for ( ; arg < argc && strncmp( argv[ arg ], "--", 2 ) == 0; arg++ ) {
+    if ( strcmp( argv[ arg ], "--engine=tree" ) == 0 )
+      opts.engine = TREE_ENGINE;
+    else if ( strcmp( argv[ arg ], "--engine=vm" ) == 0 )
+      opts.engine = VM_ENGINE;
+    else if ( strcmp( argv[ arg ], "--engine=closure" ) == 0 )
+      opts.engine = CLOSURE_ENGINE;
+    else if ( strcmp( argv[ arg ], "--output-thread" ) == 0 )
+      writerThread = true;
+    else if ( strcmp( argv[ arg ], "--cache" ) == 0 )
+      opts.useCache = true;
+    else if ( strcmp( argv[ arg ], "--hoist" ) == 0 )
+      opts.hoist = true;
+    else if ( strcmp( argv[ arg ], "--no-jit" ) == 0 )
+      disableJit();
+    else if ( strcmp( argv[ arg ], "--emit-c" ) == 0 )
+      emitC = true;
+    else if ( strcmp( argv[ arg ], "--profile" ) == 0 )
+      opts.profile = true;
+    else if ( strcmp( argv[ arg ], "--verbose" ) == 0 )
+      opts.verbose = true;
+    else if ( strcmp( argv[ arg ], "--batch" ) == 0 )
+      batch = true;
+    else if ( strncmp( argv[ arg ], "--jobs=", 7 ) == 0 ) {
+      threads = atoi( argv[ arg ] + 7 );
+      if ( threads < 1 )
+        usage();
+    } else if ( strncmp( argv[ arg ], "--output-dir=", 13 ) == 0 )
+      outputDir = argv[ arg ] + 13;
+    else
+      usage();
+  }
+
+  // A batch runs every program named after the options, on one thread
+  // per processor unless we're told otherwise.  The emitter and the
+  // profiler keep global state, and the verbose report would mix the
+  // programs together, so they only work with one program.
+  if ( batch ) {
+    if ( arg == argc || emitC || opts.profile || opts.verbose )
+      usage();
+    if ( threads == 0 ) {
+      long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+      threads = cpus > 0 ? cpus : 1;
+    }
+    if ( writerThread )
+      startWriterThread();
+    bool ok = runBatch( &opts, argv + arg, argc - arg, threads, outputDir );
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if ( threads || outputDir )
+    usage();
+
   // Open the program's source.
-  if ( argc != 2 )
+  if ( arg != argc - 1 )
     usage();
-  FILE *fp = fopen( argv[ 1 ], "r" );
-  if ( !fp ) {
-    fprintf( stderr, "Can't open file: %s\n", argv[ 1 ] );
+  Lexer *lex = openLexer( argv[ arg ] );
+  if ( !lex ) {
+    fprintf( stderr, "Can't open file: %s\n", argv[ arg ] );
     usage();
   }
 
-  // Context, for storing variable values.
-  Context *ctxt = makeContext();
-  
-  // Parse one statement at a time, then run the statement
-  // using the same context.
-  char tok[ MAX_TOKEN + 1 ];
-
-  int counter = 0;
-  while ( parseToken( tok, fp ) ) {
-    // Parse the next input statement.
-    Stmt *stmt = parseStmt( tok, fp );
+  // Just write the program as C, if asked.
+  if ( emitC ) {
+    transpile( lex, argv[ arg ] );
+    closeLexer( lex );
+    return EXIT_SUCCESS;
+  }
 
-    // Run it.
-    stmt->execute( stmt, ctxt );
-    // Delete it.
-    stmt->destroy( stmt );
+  // Let a background thread write our output, if asked.
+  if ( writerThread )
+    startWriterThread();
 
-    counter++;
-  }
-  
-  // We're done, close the input file and free the context.
-  fclose( fp );
-  freeContext( ctxt );
+  // Without an error trap, an error in the program reports itself and
+  // exits.
+  Run run;
+  startRun( &run, lex );
+  runProgram( &opts, argv[ arg ], &run );
+  finishRun( &run );
 
   return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,854 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "num.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( __x86_64__ )
+#include <sys/mman.h>
+#endif
+
+// Initial capacity for the code buffer and the loop's tables.
+#define INITIAL_CAPACITY 64
+
+// Number of SSE registers, which hold the intermediate results of
+// arithmetic.  Expressions that need more than this aren't compiled.
+#define XMM_REGISTERS 16
+
+/** What a variable in the slot array holds, recorded in a byte for
+    each variable as the compiled loop runs, so the right value can be
+    stored back in the context. */
+enum {
+  /** The variable hasn't been assigned, so the context is up to date. */
+  STATE_SAME = 0,
+  /** The variable holds the result of arithmetic. */
+  STATE_NUM = 1,
+  /** The variable holds another variable's value from when the loop
+      started.  This is added to the other variable's index. */
+  STATE_ENTRY = 2,
+  /** The variable holds a literal.  This is added to the literal's
+      index. */
+  STATE_LIT = 128
+};
+
+// Largest number of variables and literals a compiled loop can use,
+// so every state fits in a byte.
+#define MAX_VARS ( STATE_LIT - STATE_ENTRY )
+#define MAX_LITS ( 256 - STATE_LIT )
+
+/** Hidden representation for a compiled loop. */
+struct JitLoopTag {
+  // Native code for the loop, called with the slot array, the state
+  // of each variable, and the frame to pass to callbacks.
+  void (*code)( double *vals, unsigned char *state, void *frame );
+
+  // Memory mapped for the code, and its size.
+  void *mem;
+  size_t size;
+
+  // Context slot for each variable in the slot array.
+  int *slots;
+  int nvars, vcap;
+
+  // Values of literals assigned to variables.
+  Value *lits;
+  int nlits, lcap;
+
+  // Statements run by calling back into the interpreter.
+  Stmt **stmts;
+  int nstmts, scap;
+
+  // Conditions tested by calling back into the interpreter.
+  Expr **conds;
+  int nconds, ccap;
+
+  // Next loop in the list of every compiled loop.
+  JitLoop *next;
+};
+
+/** State for one run of a compiled loop, passed to its callbacks. */
+typedef struct {
+  // Loop that's running.
+  JitLoop *loop;
+
+  // Context the loop is running in.
+  Context *ctxt;
+
+  // Slot array, and the state of each variable in it.
+  double *vals;
+  unsigned char *state;
+
+  // Value of each variable when the loop started.  The frame holds a
+  // reference to every string and rope in here.
+  Value *entry;
+} JitFrame;
+
+// True if loops should never be compiled.
+static bool disabled = false;
+
+// List of every compiled loop, and how many there have been, on this
+// thread.
+static __thread JitLoop *loops = NULL;
+static __thread int compiled = 0;
+
+void disableJit( void )
+{
+  disabled = true;
+}
+
+int compiledLoops( void )
+{
+  return compiled;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Running compiled loops
+
+/** Store every variable the loop has changed back in the context, so
+    the interpreter sees the same values it would have if it had run
+    the loop itself.
+    @param frame state of the running loop.
+*/
+static void syncFrame( JitFrame *frame )
+{
+  JitLoop *loop = frame->loop;
+  for ( int i = 0; i < loop->nvars; i++ ) {
+    int state = frame->state[ i ];
+    if ( state == STATE_NUM )
+      setSlot( frame->ctxt, loop->slots[ i ], makeNumberValue( frame->vals[ i ] ) );
+    else if ( state >= STATE_LIT )
+      setSlot( frame->ctxt, loop->slots[ i ], loop->lits[ state - STATE_LIT ] );
+    else if ( state >= STATE_ENTRY )
+      setSlot( frame->ctxt, loop->slots[ i ], frame->entry[ state - STATE_ENTRY ] );
+  }
+}
+
+/** Callback from compiled code, to run a statement it doesn't handle.
+    The statement can't change any variable in the slot array, and
+    functions it calls only assign their own locals.
+    @param frame state of the running loop.
+    @param index index of the statement in the loop's list.
+*/
+static void jitExecute( JitFrame *frame, int index )
+{
+  syncFrame( frame );
+  Stmt *stmt = frame->loop->stmts[ index ];
+  // Arithmetic on vectors can leave temporaries behind, and nothing
+  // else is going to release them before the loop ends.
+  int mark = temporaryMark( frame->ctxt );
+  stmt->execute( stmt, frame->ctxt );
+  releaseTemporaries( frame->ctxt, mark );
+}
+
+/** Callback from compiled code, to test a condition it doesn't handle.
+    @param frame state of the running loop.
+    @param index index of the condition in the loop's list.
+    @return true if the condition is true.
+*/
+static bool jitTest( JitFrame *frame, int index )
+{
+  syncFrame( frame );
+  Expr *cond = frame->loop->conds[ index ];
+  // Any temporaries the condition makes are done with once it's tested.
+  int mark = temporaryMark( frame->ctxt );
+  bool holds = cond->test( cond, frame->ctxt );
+  releaseTemporaries( frame->ctxt, mark );
+  return holds;
+}
+
+bool runLoop( JitLoop *loop, Context *ctxt )
+{
+  // The native code only knows how to do arithmetic on numbers.
+  for ( int i = 0; i < loop->nvars; i++ )
+    if ( getSlot( ctxt, loop->slots[ i ] ).type == VEC_VAL )
+      return false;
+
+  // Copy the loop's variables into the slot array.
+  double vals[ loop->nvars + 1 ];
+  unsigned char state[ loop->nvars + 1 ];
+  Value entry[ loop->nvars + 1 ];
+  for ( int i = 0; i < loop->nvars; i++ ) {
+    entry[ i ] = getSlot( ctxt, loop->slots[ i ] );
+    retainValue( &entry[ i ] );
+    vals[ i ] = toNumber( &entry[ i ] );
+    state[ i ] = STATE_SAME;
+  }
+
+  JitFrame frame = { loop, ctxt, vals, state, entry };
+  loop->code( vals, state, &frame );
+  syncFrame( &frame );
+
+  for ( int i = 0; i < loop->nvars; i++ )
+    releaseValue( &entry[ i ] );
+  return true;
+}
+
+/** Free a compiled loop, and its code.
+    @param loop loop to free.
+*/
+static void freeLoop( JitLoop *loop )
+{
+#if defined( __x86_64__ )
+  if ( loop->mem )
+    munmap( loop->mem, loop->size );
+#endif
+  free( loop->slots );
+  free( loop->lits );
+  free( loop->stmts );
+  free( loop->conds );
+  free( loop );
+}
+
+void freeLoops( void )
+{
+  freeLoopList( loops );
+  loops = NULL;
+}
+
+JitLoop *keepLoops( JitLoop *list )
+{
+  // The new loops go on the front, so find the last of them.
+  if ( loops ) {
+    JitLoop *last = loops;
+    while ( last->next )
+      last = last->next;
+    last->next = list;
+    list = loops;
+    loops = NULL;
+  }
+  return list;
+}
+
+void freeLoopList( JitLoop *list )
+{
+  while ( list ) {
+    JitLoop *loop = list;
+    list = loop->next;
+    freeLoop( loop );
+  }
+}
+
+#if defined( __x86_64__ )
+
+//////////////////////////////////////////////////////////////////////
+// Code generation
+
+/** State for compiling one loop. */
+typedef struct {
+  // Machine code generated so far.
+  unsigned char *buf;
+  int len, cap;
+
+  // Loop being compiled, collecting its tables.
+  JitLoop *loop;
+
+  // Variables assigned by statements run with callbacks.
+  int *targets;
+  int ntargets, tcap;
+
+  // Number of SSE registers holding intermediate results.
+  int depth;
+
+  // True if the loop uses something we can't compile.
+  bool failed;
+} Gen;
+
+/** Add room for one more element to a growing list.
+    @param list pointer to the list.
+    @param len number of elements in the list.
+    @param cap pointer to the capacity of the list.
+    @param size size of each element.
+*/
+static void grow( void *list, int len, int *cap, size_t size )
+{
+  if ( len >= *cap ) {
+    *cap = *cap ? *cap * 2 : INITIAL_CAPACITY;
+    *(void **) list = realloc( *(void **) list, *cap * size );
+  }
+}
+
+/** Add a byte of machine code.
+    @param g code generator.
+    @param b byte to add.
+*/
+static void byte( Gen *g, int b )
+{
+  grow( &g->buf, g->len, &g->cap, 1 );
+  g->buf[ g->len++ ] = b;
+}
+
+/** Add a 32-bit value to the machine code.
+    @param g code generator.
+    @param val value to add.
+    @return offset where the value was stored.
+*/
+static int imm32( Gen *g, int32_t val )
+{
+  int pos = g->len;
+  for ( int i = 0; i < 4; i++ )
+    byte( g, ( (uint32_t) val >> ( 8 * i ) ) & 0xFF );
+  return pos;
+}
+
+/** Add a 64-bit value to the machine code.
+    @param g code generator.
+    @param val value to add.
+*/
+static void imm64( Gen *g, uint64_t val )
+{
+  for ( int i = 0; i < 8; i++ )
+    byte( g, ( val >> ( 8 * i ) ) & 0xFF );
+}
+
+/** Add an SSE instruction between two registers.
+    @param g code generator.
+    @param prefix mandatory prefix byte for the instruction.
+    @param op opcode, after the 0x0F escape.
+    @param reg register in the reg field of the instruction.
+    @param rm register in the r/m field of the instruction.
+*/
+static void sseReg( Gen *g, int prefix, int op, int reg, int rm )
+{
+  byte( g, prefix );
+  if ( reg >= 8 || rm >= 8 )
+    byte( g, 0x40 | ( reg >> 3 ) << 2 | rm >> 3 );
+  byte( g, 0x0F );
+  byte( g, op );
+  byte( g, 0xC0 | ( reg & 7 ) << 3 | ( rm & 7 ) );
+}
+
+/** Add an SSE instruction that loads or stores a variable in the slot
+    array, which rbx points to.
+    @param g code generator.
+    @param op opcode, after the 0x0F escape.
+    @param reg register to load or store.
+    @param index index of the variable.
+*/
+static void sseSlot( Gen *g, int op, int reg, int index )
+{
+  byte( g, 0xF2 );
+  if ( reg >= 8 )
+    byte( g, 0x44 );
+  byte( g, 0x0F );
+  byte( g, op );
+  byte( g, 0x80 | ( reg & 7 ) << 3 | 3 );
+  imm32( g, index * sizeof( double ) );
+}
+
+/** Add an SSE instruction that loads or stores a register on the
+    machine stack.
+    @param g code generator.
+    @param op opcode, after the 0x0F escape.
+    @param reg register to load or store.
+    @param offset offset from rsp.
+*/
+static void sseStack( Gen *g, int op, int reg, int offset )
+{
+  byte( g, 0xF2 );
+  if ( reg >= 8 )
+    byte( g, 0x44 );
+  byte( g, 0x0F );
+  byte( g, op );
+  byte( g, 0x84 | ( reg & 7 ) << 3 );
+  byte( g, 0x24 );
+  imm32( g, offset );
+}
+
+/** Add an instruction that uses a variable's state byte, which r12
+    points to the array of.
+    @param g code generator.
+    @param op opcode bytes, up to three, first in the low byte.
+    @param index index of the variable.
+*/
+static void stateOp( Gen *g, int op, int index )
+{
+  byte( g, 0x41 );
+  for ( ; op; op >>= 8 )
+    byte( g, op & 0xFF );
+  byte( g, 0x84 );
+  byte( g, 0x24 );
+  imm32( g, index );
+}
+
+/** Add a jump whose target isn't known yet, to a chain of jumps that
+    all go to the same place.  Until the chain is patched, each jump
+    holds the offset of the previous one, or -1 for the first.
+    @param g code generator.
+    @param cc condition code for the jump, or -1 for an unconditional
+    jump.
+    @param chain chain of jumps to add this one to.
+*/
+static void chainJump( Gen *g, int cc, int *chain )
+{
+  if ( cc < 0 )
+    byte( g, 0xE9 );
+  else {
+    byte( g, 0x0F );
+    byte( g, 0x80 | cc );
+  }
+  *chain = imm32( g, *chain );
+}
+
+/** Point every jump in a chain at the given offset.
+    @param g code generator.
+    @param chain chain of jumps to patch.
+    @param target offset they should jump to.
+*/
+static void patchChain( Gen *g, int chain, int target )
+{
+  while ( chain >= 0 ) {
+    int32_t next;
+    memcpy( &next, g->buf + chain, 4 );
+    int32_t rel = target - ( chain + 4 );
+    memcpy( g->buf + chain, &rel, 4 );
+    chain = next;
+  }
+}
+
+// Condition codes for jumps.
+#define CC_Z 0x4
+#define CC_NZ 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+
+/** Return the index of a variable in the slot array, adding it if it's
+    not there yet.
+    @param g code generator.
+    @param slot context slot of the variable.
+    @return index of the variable.
+*/
+static int varIndex( Gen *g, int slot )
+{
+  JitLoop *loop = g->loop;
+  for ( int i = 0; i < loop->nvars; i++ )
+    if ( loop->slots[ i ] == slot )
+      return i;
+
+  if ( loop->nvars >= MAX_VARS )
+    g->failed = true;
+  grow( &loop->slots, loop->nvars, &loop->vcap, sizeof( int ) );
+  loop->slots[ loop->nvars ] = slot;
+  return loop->nvars++;
+}
+
+/** Add a call back into the interpreter.  Afterward, al holds the
+    result, if there is one.
+    @param g code generator.
+    @param fn function to call, with the frame and index.
+    @param index index to pass to the function.
+*/
+static void callBack( Gen *g, void *fn, int index )
+{
+  // mov rdi, r13 ; mov esi, index
+  byte( g, 0x4C ); byte( g, 0x89 ); byte( g, 0xEF );
+  byte( g, 0xBE ); imm32( g, index );
+
+  // movabs rax, fn ; call rax
+  byte( g, 0x48 ); byte( g, 0xB8 ); imm64( g, (uint64_t) (uintptr_t) fn );
+  byte( g, 0xFF ); byte( g, 0xD0 );
+}
+
+/** Return true if an expression is arithmetic on literals and
+    variables, so it always has a number as its value.
+    @param expr expression to check.
+    @return true if expr can be compiled as arithmetic.
+*/
+static bool isArithmetic( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case LITERAL_EXPR:
+  case VAR_EXPR:
+    return true;
+  case SUM_EXPR:
+  case DIFF_EXPR:
+  case PROD_EXPR:
+  case QUOT_EXPR:
+    return isArithmetic( binaryLeft( expr ) ) && isArithmetic( binaryRight( expr ) );
+  default:
+    return false;
+  }
+}
+
+/** Round the result of arithmetic to six places, with a call to
+    roundNumber(), the way the interpreter does.  Registers holding
+    other intermediate results are saved on the stack around the call,
+    in 16-byte slots so the stack stays aligned.
+    @param g code generator.
+    @param reg register holding the result.
+*/
+static void genRound( Gen *g, int reg )
+{
+  // sub rsp, reg * 16 ; movsd [rsp + i * 16], xmm for each live one
+  if ( reg > 0 ) {
+    byte( g, 0x48 ); byte( g, 0x81 ); byte( g, 0xEC ); imm32( g, reg * 16 );
+    for ( int i = 0; i < reg; i++ )
+      sseStack( g, 0x11, i, i * 16 );
+
+    // movapd xmm0, xmm
+    sseReg( g, 0x66, 0x28, 0, reg );
+  }
+
+  // movabs rax, roundNumber ; call rax
+  byte( g, 0x48 ); byte( g, 0xB8 );
+  imm64( g, (uint64_t) (uintptr_t) roundNumber );
+  byte( g, 0xFF ); byte( g, 0xD0 );
+
+  // movapd xmm, xmm0 ; movsd xmm, [rsp + i * 16] ; add rsp, reg * 16
+  if ( reg > 0 ) {
+    sseReg( g, 0x66, 0x28, reg, 0 );
+    for ( int i = 0; i < reg; i++ )
+      sseStack( g, 0x10, i, i * 16 );
+    byte( g, 0x48 ); byte( g, 0x81 ); byte( g, 0xC4 ); imm32( g, reg * 16 );
+  }
+}
+
+/** Load a double constant into an SSE register.
+    @param g code generator.
+    @param reg register to load.
+    @param num value to load.
+*/
+static void loadNumber( Gen *g, int reg, double num )
+{
+  uint64_t bits;
+  memcpy( &bits, &num, sizeof( bits ) );
+
+  // movabs rax, bits ; movq xmm, rax
+  byte( g, 0x48 ); byte( g, 0xB8 ); imm64( g, bits );
+  byte( g, 0x66 );
+  byte( g, 0x48 | ( reg >> 3 ) << 2 );
+  byte( g, 0x0F ); byte( g, 0x6E );
+  byte( g, 0xC0 | ( reg & 7 ) << 3 );
+}
+
+/** Compile arithmetic, leaving its value in the next free SSE
+    register.
+    @param g code generator.
+    @param expr expression to compile.  This must be arithmetic.
+*/
+static void genNumber( Gen *g, Expr *expr )
+{
+  if ( g->depth >= XMM_REGISTERS ) {
+    g->failed = true;
+    return;
+  }
+
+  int reg = g->depth;
+  switch ( expr->kind ) {
+  case LITERAL_EXPR: {
+    Value val = literalValue( expr );
+    loadNumber( g, reg, toNumber( &val ) );
+    g->depth++;
+    return;
+  }
+
+  case VAR_EXPR:
+    // movsd xmm, [rbx + index * 8]
+    sseSlot( g, 0x10, reg, varIndex( g, variableExprSlot( expr ) ) );
+    g->depth++;
+    return;
+
+  default: {
+    static int const ops[] = {
+      [ SUM_EXPR ] = 0x58, [ DIFF_EXPR ] = 0x5C,
+      [ PROD_EXPR ] = 0x59, [ QUOT_EXPR ] = 0x5E
+    };
+    genNumber( g, binaryLeft( expr ) );
+    genNumber( g, binaryRight( expr ) );
+    sseReg( g, 0xF2, ops[ expr->kind ], reg, reg + 1 );
+    genRound( g, reg );
+    g->depth--;
+    return;
+  }
+  }
+}
+
+/** Compile a condition, jumping if its truth matches the one given.
+    Comparisons of arithmetic are done natively, and other conditions
+    call back into the interpreter.
+    @param g code generator.
+    @param cond condition to compile.
+    @param when jump if the condition is true, or if it's false.
+    @param chain chain of jumps to add the new jumps to.
+*/
+static void genCond( Gen *g, Expr *cond, bool when, int *chain )
+{
+  switch ( cond->kind ) {
+  case AND_EXPR:
+  case OR_EXPR: {
+    // If the left operand alone decides the result, jump or skip the
+    // right operand; otherwise, the right operand decides.
+    bool decides = cond->kind == OR_EXPR;
+    if ( decides == when ) {
+      genCond( g, binaryLeft( cond ), when, chain );
+      genCond( g, binaryRight( cond ), when, chain );
+    } else {
+      int skip = -1;
+      genCond( g, binaryLeft( cond ), decides, &skip );
+      genCond( g, binaryRight( cond ), when, chain );
+      patchChain( g, skip, g->len );
+    }
+    return;
+  }
+
+  case LITERAL_EXPR: {
+    Value val = literalValue( cond );
+    if ( valueIsTrue( &val ) == when )
+      chainJump( g, -1, chain );
+    return;
+  }
+
+  case LESS_EXPR:
+    if ( isArithmetic( binaryLeft( cond ) ) && isArithmetic( binaryRight( cond ) ) ) {
+      int reg = g->depth;
+      genNumber( g, binaryLeft( cond ) );
+      genNumber( g, binaryRight( cond ) );
+
+      // ucomisd right, left.  Unordered compares aren't above.
+      sseReg( g, 0x66, 0x2E, reg + 1, reg );
+      g->depth -= 2;
+      chainJump( g, when ? CC_A : CC_BE, chain );
+      return;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  // Let the interpreter test anything else, then test al.
+  JitLoop *loop = g->loop;
+  grow( &loop->conds, loop->nconds, &loop->ccap, sizeof( Expr * ) );
+  loop->conds[ loop->nconds ] = cond;
+  callBack( g, jitTest, loop->nconds++ );
+  byte( g, 0x84 ); byte( g, 0xC0 );
+  chainJump( g, when ? CC_NZ : CC_Z, chain );
+}
+
+/** Compile a statement to call back into the interpreter.
+    @param g code generator.
+    @param stmt statement to compile.
+*/
+static void genCallBack( Gen *g, Stmt *stmt )
+{
+  JitLoop *loop = g->loop;
+  grow( &loop->stmts, loop->nstmts, &loop->scap, sizeof( Stmt * ) );
+  loop->stmts[ loop->nstmts ] = stmt;
+  callBack( g, jitExecute, loop->nstmts++ );
+}
+
+/** Compile an assignment.  Arithmetic, literals and copies of other
+    variables are done natively, and anything else calls back into the
+    interpreter.
+    @param g code generator.
+    @param stmt assignment to compile.
+*/
+static void genAssign( Gen *g, Stmt *stmt )
+{
+  Expr *expr = stmtExpr( stmt );
+  int slot = assignSlot( stmt );
+
+  switch ( expr->kind ) {
+  case LITERAL_EXPR: {
+    // The variable gets the literal's value, string and all.
+    JitLoop *loop = g->loop;
+    if ( loop->nlits >= MAX_LITS ) {
+      g->failed = true;
+      return;
+    }
+    grow( &loop->lits, loop->nlits, &loop->lcap, sizeof( Value ) );
+    loop->lits[ loop->nlits ] = literalValue( expr );
+    int index = varIndex( g, slot );
+    genNumber( g, expr );
+    sseSlot( g, 0x11, 0, index );
+    g->depth = 0;
+
+    // mov byte [r12 + index], STATE_LIT + literal
+    stateOp( g, 0xC6, index );
+    byte( g, STATE_LIT + loop->nlits++ );
+    return;
+  }
+
+  case VAR_EXPR: {
+    int index = varIndex( g, slot );
+    int from = varIndex( g, variableExprSlot( expr ) );
+    if ( from == index )
+      return;
+    sseSlot( g, 0x10, 0, from );
+    sseSlot( g, 0x11, 0, index );
+
+    // Copy the other variable's state, or if it hasn't changed, note
+    // that this one has its value from when the loop started.
+    // movzx eax, byte [r12 + from] ; test al, al ; jnz +2 ;
+    // mov al, STATE_ENTRY + from ; mov [r12 + index], al
+    stateOp( g, 0xB60F, from );
+    byte( g, 0x84 ); byte( g, 0xC0 );
+    byte( g, 0x75 ); byte( g, 0x02 );
+    byte( g, 0xB0 ); byte( g, STATE_ENTRY + from );
+    stateOp( g, 0x88, index );
+    return;
+  }
+
+  default:
+    if ( isArithmetic( expr ) ) {
+      int index = varIndex( g, slot );
+      genNumber( g, expr );
+      sseSlot( g, 0x11, 0, index );
+      g->depth = 0;
+
+      // mov byte [r12 + index], STATE_NUM
+      stateOp( g, 0xC6, index );
+      byte( g, STATE_NUM );
+      return;
+    }
+
+    // The interpreter can assign anything else, as long as the
+    // variable isn't also in the slot array.  We check that once
+    // we've seen the whole loop.
+    grow( &g->targets, g->ntargets, &g->tcap, sizeof( int ) );
+    g->targets[ g->ntargets++ ] = slot;
+    genCallBack( g, stmt );
+    return;
+  }
+}
+
+/** Compile a statement.
+    @param g code generator.
+    @param stmt statement to compile.
+*/
+static void genStmt( Gen *g, Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case PRINT_STMT:
+    genCallBack( g, stmt );
+    break;
+
+  case ASSIGN_STMT:
+    genAssign( g, stmt );
+    break;
+
+  case ASSIGN_KEY_STMT:
+    // Maps are only changed by the interpreter, so the variable
+    // holding one can't be in the slot array.
+    grow( &g->targets, g->ntargets, &g->tcap, sizeof( int ) );
+    g->targets[ g->ntargets++ ] = assignSlot( stmt );
+    genCallBack( g, stmt );
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      genStmt( g, compoundStmt( stmt, i ) );
+    break;
+
+  case IF_STMT: {
+    int exit = -1;
+    genCond( g, stmtExpr( stmt ), false, &exit );
+    genStmt( g, stmtBody( stmt ) );
+    patchChain( g, exit, g->len );
+    break;
+  }
+
+  case WHILE_STMT: {
+    int top = g->len;
+    int exit = -1;
+    genCond( g, stmtExpr( stmt ), false, &exit );
+    genStmt( g, stmtBody( stmt ) );
+
+    // jmp top
+    byte( g, 0xE9 );
+    imm32( g, top - ( g->len + 4 ) );
+    patchChain( g, exit, g->len );
+    break;
+  }
+
+  default:
+    // Functions are only defined at the top level, and the other
+    // statements only appear in a function's body, where loops aren't
+    // compiled.
+    g->failed = true;
+    break;
+  }
+}
+
+/** Copy generated code into executable memory.
+    @param g code generator holding the code.
+    @return true if the code is ready to run.
+*/
+static bool install( Gen *g )
+{
+  JitLoop *loop = g->loop;
+  loop->size = g->len;
+  loop->mem = mmap( NULL, loop->size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( loop->mem == MAP_FAILED ) {
+    loop->mem = NULL;
+    return false;
+  }
+
+  memcpy( loop->mem, g->buf, g->len );
+  if ( mprotect( loop->mem, loop->size, PROT_READ | PROT_EXEC ) != 0 ) {
+    munmap( loop->mem, loop->size );
+    loop->mem = NULL;
+    return false;
+  }
+
+  loop->code = (void (*)( double *, unsigned char *, void * )) loop->mem;
+  return true;
+}
+
+JitLoop *compileLoop( Stmt *stmt )
+{
+  if ( disabled )
+    return NULL;
+
+  Gen g = { .loop = (JitLoop *) calloc( 1, sizeof( JitLoop ) ) };
+
+  // push rbp ; mov rbp, rsp ; push rbx ; push r12 ; push r13 ; push r14
+  static unsigned char const prologue[] = {
+    0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56,
+    // mov rbx, rdi ; mov r12, rsi ; mov r13, rdx
+    0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5
+  };
+  for ( int i = 0; i < sizeof( prologue ); i++ )
+    byte( &g, prologue[ i ] );
+
+  genStmt( &g, stmt );
+
+  // pop r14 ; pop r13 ; pop r12 ; pop rbx ; pop rbp ; ret
+  static unsigned char const epilogue[] = {
+    0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D, 0xC3
+  };
+  for ( int i = 0; i < sizeof( epilogue ); i++ )
+    byte( &g, epilogue[ i ] );
+
+  // Variables the interpreter assigns can't also be in the slot array,
+  // or the two copies would disagree.
+  for ( int i = 0; i < g.ntargets; i++ )
+    for ( int j = 0; j < g.loop->nvars; j++ )
+      if ( g.targets[ i ] == g.loop->slots[ j ] )
+        g.failed = true;
+
+  JitLoop *loop = g.loop;
+  bool ok = !g.failed && install( &g );
+  free( g.buf );
+  free( g.targets );
+  if ( !ok ) {
+    freeLoop( loop );
+    return NULL;
+  }
+
+  loop->next = loops;
+  loops = loop;
+  compiled++;
+  return loop;
+}
+
+#else
+
+JitLoop *compileLoop( Stmt *stmt )
+{
+  return NULL;
+}
+
+#endif
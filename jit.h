@@ -0,0 +1,77 @@
+/**
+  @file jit.h
+
+  Native code generator for hot while loops.  Once a loop has run
+  enough iterations in the tree-walking interpreter, it's compiled to
+  x86-64 machine code, which runs the rest of it.  Variables the loop
+  uses in arithmetic or comparisons live in a slot array of doubles
+  while it runs, and everything else, like printing and string
+  operations, calls back into the interpreter.
+
+  Loops the generator can't handle, and every loop on other
+  processors, just keep running in the interpreter.
+*/
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "expr.h"
+#include "stmt.h"
+
+// Number of iterations a while loop runs before it's compiled.
+#define JIT_THRESHOLD 100
+
+/**
+   Short typename for a compiled loop.  Its representation is private
+   to the code generator.
+*/
+typedef struct JitLoopTag JitLoop;
+
+/** Turn off the code generator, so every loop stays in the
+    interpreter. */
+void disableJit( void );
+
+/** Compile a while statement to native code.  The compiled loop refers
+    back to parts of the statement, so the statement has to last until
+    the loop is freed.
+    @param stmt while statement to compile.
+    @return the compiled loop, or NULL if the code generator is
+    disabled or can't handle this loop.
+*/
+JitLoop *compileLoop( Stmt *stmt );
+
+/** Run a compiled loop, from its condition to when the condition is
+    false, the same way the statement it was compiled from would have.
+    @param loop loop to run.
+    @param ctxt current values of all variables.
+    @return false, without running anything, if a variable the native
+    code does arithmetic on holds a vector.  The caller has to
+    interpret the loop instead.
+*/
+bool runLoop( JitLoop *loop, Context *ctxt );
+
+/** Return the number of loops compiled so far on this thread.
+    @return number of loops compiled.
+*/
+int compiledLoops( void );
+
+/** Free every loop compiled on this thread.  This should be called
+    before freeing the statements they were compiled from.
+*/
+void freeLoops( void );
+
+/** Take every loop compiled on this thread since the last call to
+    freeLoops() or keepLoops(), so they can last as long as the
+    statements they were compiled from, instead of being freed by the
+    next call to freeLoops().
+    @param list loops taken before, to add the new ones to, or NULL.
+    @return list of all the loops, to free with freeLoopList().
+*/
+JitLoop *keepLoops( JitLoop *list );
+
+/** Free a list of loops taken with keepLoops().
+    @param list loops to free.
+*/
+void freeLoopList( JitLoop *list );
+
+#endif
@@ -0,0 +1,475 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "lex.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Size of the blocks we read, for sources that can't be mapped.
+#define READ_SIZE 65536
+
+// Number of characters we check one at a time, before scanning a
+// block at a time.
+#define SHORT_RUN 16
+
+/** State for reading tokens from one source. */
+struct LexerTag {
+  /** All the text of the source. */
+  char const *text;
+
+  /** Number of characters in text. */
+  size_t len;
+
+  /** Index of the next character to tokenize. */
+  size_t pos;
+
+  /** True if text is mapped from the file, false if we read it into
+      a heap block. */
+  bool mapped;
+
+  /** Current line we're parsing, starting from 1 like most editors. */
+  int line;
+
+  /** Token put back by ungetToken(), if hasPending is true. */
+  Token pending;
+  bool hasPending;
+
+  /** Storage for string literals with escape sequences, which can't
+      be used directly from the source. */
+  char scratch[ MAX_TOKEN + 1 ];
+};
+
+/** Report an error about the token we're reading, with a line
+    number.  This doesn't return.
+    @param lex lexer reporting the error.
+    @param msg description of the error.
+*/
+static void lexError( Lexer const *lex, char const *msg )
+{
+  raiseErrorAt( lex->line, "%s", msg );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Character scanning
+
+// Character classes, for the table below.
+#define SPACE_CHAR 0x01
+#define WORD_END 0x02
+#define STRING_STOP 0x04
+
+/** Classes for each character.  Whitespace is the same as isspace() in
+    the C locale. */
+static unsigned char const charClass[ 256 ] = {
+  [ ' ' ] = SPACE_CHAR | WORD_END,
+  [ '\t' ] = SPACE_CHAR | WORD_END,
+  [ '\n' ] = SPACE_CHAR | WORD_END | STRING_STOP,
+  [ '\v' ] = SPACE_CHAR | WORD_END,
+  [ '\f' ] = SPACE_CHAR | WORD_END,
+  [ '\r' ] = SPACE_CHAR | WORD_END,
+  [ '{' ] = WORD_END,
+  [ '}' ] = WORD_END,
+  [ '#' ] = WORD_END,
+  [ '"' ] = WORD_END | STRING_STOP,
+  [ '\\' ] = STRING_STOP,
+};
+
+/** Return true if a character is in the given class.
+    @param ch character to check.
+    @param cls class, or classes, to check for.
+    @return true if ch is in cls.
+*/
+static inline bool inClass( char ch, int cls )
+{
+  return charClass[ (unsigned char) ch ] & cls;
+}
+
+#ifdef __SSE2__
+/** Return a bit mask with a bit set for each byte of a 16-byte block
+    that matches the given character.
+    @param block bytes to check.
+    @param ch character to look for.
+    @return mask, with the first byte in the low-order bit.
+*/
+static inline unsigned matchMask( __m128i block, char ch )
+{
+  return _mm_movemask_epi8( _mm_cmpeq_epi8( block, _mm_set1_epi8( ch ) ) );
+}
+
+/** Return a bit mask with a bit set for each whitespace byte in a
+    16-byte block.
+    @param block bytes to check.
+    @return mask, with the first byte in the low-order bit.
+*/
+static inline unsigned spaceMask( __m128i block )
+{
+  // Tab through carriage return are a contiguous range, so shift them
+  // down to 0 and do one unsigned comparison for all of them.
+  __m128i ctrl = _mm_sub_epi8( block, _mm_set1_epi8( '\t' ) );
+  __m128i low = _mm_min_epu8( ctrl, _mm_set1_epi8( '\r' - '\t' ) );
+  return _mm_movemask_epi8( _mm_cmpeq_epi8( low, ctrl ) ) |
+    matchMask( block, ' ' );
+}
+#endif
+
+/** Skip whitespace, counting the lines we pass.
+    @param lex lexer to advance.
+*/
+static void skipSpace( Lexer *lex )
+{
+  char const *text = lex->text;
+  size_t pos = lex->pos;
+
+  // Most gaps between tokens are short, so look at a few characters
+  // directly before switching to whole blocks.
+  size_t shortEnd = lex->len - pos < SHORT_RUN ? lex->len : pos + SHORT_RUN;
+  for ( ; pos < shortEnd; pos++ ) {
+    if ( !inClass( text[ pos ], SPACE_CHAR ) ) {
+      lex->pos = pos;
+      return;
+    }
+    if ( text[ pos ] == '\n' )
+      lex->line++;
+  }
+
+#ifdef __SSE2__
+  while ( pos + 16 <= lex->len ) {
+    __m128i block = _mm_loadu_si128( (__m128i const *)( text + pos ) );
+    unsigned space = spaceMask( block );
+    unsigned newlines = matchMask( block, '\n' );
+
+    // Stop at the first character that isn't whitespace, and only count
+    // the newlines before it.
+    if ( space != 0xFFFF ) {
+      int skip = __builtin_ctz( ~space );
+      lex->line += __builtin_popcount( newlines & ( ( 1u << skip ) - 1 ) );
+      lex->pos = pos + skip;
+      return;
+    }
+
+    lex->line += __builtin_popcount( newlines );
+    pos += 16;
+  }
+#endif
+
+  for ( ; pos < lex->len && inClass( text[ pos ], SPACE_CHAR ); pos++ )
+    if ( text[ pos ] == '\n' )
+      lex->line++;
+  lex->pos = pos;
+}
+
+/** Find the end of a non-quoted word.
+    @param lex lexer reading the word.
+    @param pos index of the first character that might be past the word.
+    @return index of the first character past the word.
+*/
+static size_t wordEnd( Lexer const *lex, size_t pos )
+{
+  char const *text = lex->text;
+
+  // Most words are short, so check them a character at a time first.
+  size_t shortEnd = lex->len - pos < SHORT_RUN ? lex->len : pos + SHORT_RUN;
+  for ( ; pos < shortEnd; pos++ )
+    if ( inClass( text[ pos ], WORD_END ) )
+      return pos;
+
+#ifdef __SSE2__
+  while ( pos + 16 <= lex->len ) {
+    __m128i block = _mm_loadu_si128( (__m128i const *)( text + pos ) );
+    unsigned stop = spaceMask( block ) | matchMask( block, '{' ) |
+      matchMask( block, '}' ) | matchMask( block, '"' ) |
+      matchMask( block, '#' );
+    if ( stop )
+      return pos + __builtin_ctz( stop );
+    pos += 16;
+  }
+#endif
+
+  while ( pos < lex->len && !inClass( text[ pos ], WORD_END ) )
+    pos++;
+  return pos;
+}
+
+/** Find the first character in a string literal that needs special
+    handling, a close quote, a backslash or a newline.
+    @param lex lexer reading the string.
+    @param pos index to start looking from.
+    @return index of the first special character, or the length of the
+    source if there isn't one.
+*/
+static size_t stringEnd( Lexer const *lex, size_t pos )
+{
+  char const *text = lex->text;
+
+#ifdef __SSE2__
+  while ( pos + 16 <= lex->len ) {
+    __m128i block = _mm_loadu_si128( (__m128i const *)( text + pos ) );
+    unsigned stop = matchMask( block, '"' ) | matchMask( block, '\\' ) |
+      matchMask( block, '\n' );
+    if ( stop )
+      return pos + __builtin_ctz( stop );
+    pos += 16;
+  }
+#endif
+
+  while ( pos < lex->len && !inClass( text[ pos ], STRING_STOP ) )
+    pos++;
+  return pos;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Tokens
+
+/** Finish reading a string literal that contains escape sequences,
+    decoding it into the lexer's scratch buffer.
+    @param tok token to fill in.
+    @param lex lexer reading the string.
+    @param len number of characters already copied to scratch.
+*/
+static void parseEscapes( Token *tok, Lexer *lex, int len )
+{
+  // Is the next character escaped.
+  bool escape = false;
+
+  // Keep reading until we hit the matching close quote.
+  int ch;
+  while ( ( ch = lex->pos < lex->len ?
+                 (unsigned char) lex->text[ lex->pos++ ] : EOF ) != '"' ||
+          escape ) {
+    // Error conditions
+    if ( ch == EOF || ch == '\n' ) {
+      raiseErrorAt( lex->line, "%s while reading parsing string literal.",
+                    ch == EOF ? "EOF" : "newline" );
+    }
+
+    // On a backslash, we just enable escape mode.
+    if ( !escape && ch == '\\' ) {
+      escape = true;
+    } else {
+      // Interpret escape sequences if we're in escape mode.
+      if ( escape ) {
+        switch ( ch ) {
+        case 'n':
+          ch = '\n';
+          break;
+        case 't':
+          ch = '\t';
+          break;
+        case '"':
+          ch = '"';
+          break;
+        case '\\':
+          ch = '\\';
+          break;
+        default:
+          raiseErrorAt( lex->line, "Invalid escape sequence \"\\%c\"",
+                        ch );
+        }
+        escape = false;
+      }
+
+      // Complain if this string, with its quotes, is too long.
+      if ( len + 2 >= MAX_TOKEN )
+        lexError( lex, "token too long" );
+      lex->scratch[ len++ ] = ch;
+    }
+  }
+
+  tok->text = lex->scratch;
+  tok->len = len;
+}
+
+/** Read a double quoted string literal.  If it has no escape sequences,
+    the token is just a view of the text between the quotes.
+    @param tok token to fill in.
+    @param lex lexer, positioned at the open quote.
+*/
+static void parseString( Token *tok, Lexer *lex )
+{
+  tok->quoted = true;
+
+  size_t start = lex->pos + 1;
+  size_t pos = stringEnd( lex, start );
+
+  // Complain if this string, with its quotes, is too long.
+  if ( pos - start + 1 >= MAX_TOKEN )
+    lexError( lex, "token too long" );
+
+  // The common case, a string we can use right where it is.
+  if ( pos < lex->len && lex->text[ pos ] == '"' ) {
+    tok->text = lex->text + start;
+    tok->len = pos - start;
+    lex->pos = pos + 1;
+    return;
+  }
+
+  // Otherwise, copy what we've seen and go through the rest one
+  // character at a time.
+  memcpy( lex->scratch, lex->text + start, pos - start );
+  lex->pos = pos;
+  parseEscapes( tok, lex, pos - start );
+}
+
+bool parseToken( Token *tok, Lexer *lex )
+{
+  // Use the token that was put back, if there is one.
+  if ( lex->hasPending ) {
+    *tok = lex->pending;
+    lex->hasPending = false;
+    return true;
+  }
+
+  // Skip whitespace and comments.  If we hit the comment character,
+  // skip the whole line.
+  skipSpace( lex );
+  while ( lex->pos < lex->len && lex->text[ lex->pos ] == '#' ) {
+    char const *end = memchr( lex->text + lex->pos, '\n',
+                              lex->len - lex->pos );
+    lex->pos = end ? end - lex->text : lex->len;
+    skipSpace( lex );
+  }
+
+  if ( lex->pos >= lex->len )
+    return false;
+
+  char ch = lex->text[ lex->pos ];
+  if ( ch == '"' ) {
+    parseString( tok, lex );
+    return true;
+  }
+
+  tok->text = lex->text + lex->pos;
+  tok->quoted = false;
+
+  // Handle punctuation.  These are always a single character, even if
+  // there's no space after them.
+  if ( ch == '}' || ch == ';' || ch == ')' ) {
+    tok->len = 1;
+    lex->pos++;
+    return true;
+  }
+
+  // Handle non-quoted words.
+  size_t end = wordEnd( lex, lex->pos + 1 );
+  if ( end - lex->pos > MAX_TOKEN )
+    lexError( lex, "token too long" );
+  tok->len = end - lex->pos;
+  lex->pos = end;
+  return true;
+}
+
+void ungetToken( Token const *tok, Lexer *lex )
+{
+  lex->pending = *tok;
+  lex->hasPending = true;
+}
+
+bool tokenIs( Token const *tok, char const *word )
+{
+  return !tok->quoted && strncmp( tok->text, word, tok->len ) == 0 &&
+    word[ tok->len ] == '\0';
+}
+
+int lexerLine( Lexer const *lex )
+{
+  return lex->line;
+}
+
+char const *lexerSource( Lexer const *lex, size_t *len )
+{
+  *len = lex->len;
+  return lex->text;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Source files
+
+/** Read all of a file that can't be mapped, like a pipe, into a heap
+    block.
+    @param lex lexer to store the text in.
+    @param fd file to read.
+*/
+static void readSource( Lexer *lex, int fd )
+{
+  char *text = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+
+  for ( ;; ) {
+    if ( len + READ_SIZE > cap ) {
+      cap = cap ? cap * 2 : READ_SIZE;
+      text = (char *) realloc( text, cap );
+    }
+
+    ssize_t n = read( fd, text + len, cap - len );
+    if ( n <= 0 )
+      break;
+    len += n;
+  }
+
+  lex->text = text;
+  lex->len = len;
+  lex->mapped = false;
+}
+
+Lexer *openLexer( char const *path )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return NULL;
+
+  Lexer *lex = (Lexer *) malloc( sizeof( Lexer ) );
+  lex->pos = 0;
+  lex->line = 1;
+  lex->hasPending = false;
+
+  // Map regular files.  Anything else, or a file that won't map, gets
+  // read in the usual way.
+  struct stat st;
+  void *map = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 )
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+  if ( map != MAP_FAILED ) {
+    lex->text = (char const *) map;
+    lex->len = st.st_size;
+    lex->mapped = true;
+  } else
+    readSource( lex, fd );
+
+  close( fd );
+  return lex;
+}
+
+Lexer *openLexerText( char const *text, size_t len )
+{
+  Lexer *lex = (Lexer *) malloc( sizeof( Lexer ) );
+  lex->pos = 0;
+  lex->line = 1;
+  lex->hasPending = false;
+
+  // Copy the text to the heap, like a source that can't be mapped.
+  char *copy = (char *) malloc( len ? len : 1 );
+  memcpy( copy, text, len );
+  lex->text = copy;
+  lex->len = len;
+  lex->mapped = false;
+  return lex;
+}
+
+void closeLexer( Lexer *lex )
+{
+  if ( lex->mapped )
+    munmap( (void *) lex->text, lex->len );
+  else
+    free( (void *) lex->text );
+  free( lex );
+}
@@ -0,0 +1,101 @@
+/**
+  @file lex.h
+
+  Tokenizer for program source.  The whole source file is mapped into
+  memory, and tokens are returned as views into it, so most of them
+  never get copied.  Where the processor supports it, whitespace,
+  comments and token boundaries are found with SIMD instructions, 16
+  bytes at a time.
+*/
+
+#ifndef _LEX_H_
+#define _LEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Maximum length of a token in the source file.
+#define MAX_TOKEN 1023
+
+/**
+   Short typename for a lexer, the state for reading tokens from one
+   source file.  Its representation is private to the lexer.
+*/
+typedef struct LexerTag Lexer;
+
+/** A token from the source.  Tokens aren't null-terminated. */
+typedef struct {
+  /** Characters of the token.  For a string literal, this is the text
+      between the quotes, with escape sequences already replaced. */
+  char const *text;
+
+  /** Number of characters in text. */
+  int len;
+
+  /** True if this is a double quoted string literal. */
+  bool quoted;
+} Token;
+
+/** Make a lexer to read tokens from the given file.
+    @param path name of the source file.
+    @return new lexer, or NULL if the file can't be read.  The caller
+    must eventually free this with closeLexer().
+*/
+Lexer *openLexer( char const *path );
+
+/** Make a lexer to read tokens from text in memory.
+    @param text source to read.  The lexer keeps its own copy, so it
+    doesn't need to be null-terminated or to outlast the lexer.
+    @param len number of characters in text.
+    @return new lexer.  The caller must eventually free this with
+    closeLexer().
+*/
+Lexer *openLexerText( char const *text, size_t len );
+
+/** Free a lexer, and unmap its source.  Tokens from the lexer can't be
+    used after this.
+    @param lex lexer to free.
+*/
+void closeLexer( Lexer *lex );
+
+/** Read the next token, a space-delimited word, a double quoted string
+    or closing parentheses, curly brackets or a semi-colon.  The token
+    stays valid until the next token is read, and string literals
+    without escape sequences stay valid as long as the lexer.
+    @param tok storage for the token.
+    @param lex lexer to read from.
+    @return true if a token is successfully read, false at the end of
+    the source.  A malformed token, like a string literal without its
+    closing quote, is reported with raiseError().
+*/
+bool parseToken( Token *tok, Lexer *lex );
+
+/** Put a token back, so it's returned by the next call to
+    parseToken().  Only one token can be put back at a time.
+    @param tok token most recently read from lex.
+    @param lex lexer it was read from.
+*/
+void ungetToken( Token const *tok, Lexer *lex );
+
+/** Return true if a token is the given word.  String literals never
+    match, even if their text does.
+    @param tok token to check.
+    @param word null-terminated word to compare against.
+    @return true if tok is word.
+*/
+bool tokenIs( Token const *tok, char const *word );
+
+/** Return the line the lexer is on, for reporting errors.
+    @param lex lexer to check.
+    @return current line, starting from 1.
+*/
+int lexerLine( Lexer const *lex );
+
+/** Return all the text of the lexer's source.
+    @param lex lexer to check.
+    @param len returns the number of characters in the source.
+    @return the source text, which isn't null-terminated.
+*/
+char const *lexerSource( Lexer const *lex, size_t *len );
+
+#endif
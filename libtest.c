@@ -0,0 +1,323 @@
+/**
+  @file libtest.c
+
+  Test for the embedding interface in interp.h, linked against
+  libinterpreter.a the way another program would be.  It compiles
+  programs from memory, runs them more than once with their output
+  collected in a buffer, passes values in and out through variables,
+  and checks that syntax and run-time errors come back with their line
+  numbers, without stopping the process or spoiling the interpreter.
+
+  Exits unsuccessfully, after reporting every check that fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "interp.h"
+
+// Largest amount of output a test collects.
+#define OUTPUT_SIZE 1024
+
+// Number of checks that failed.
+static int failures = 0;
+
+// Number of checks made.
+static int checked = 0;
+
+/** Output collected from the programs, and its length. */
+static char output[ OUTPUT_SIZE + 1 ];
+static size_t outputLen = 0;
+
+/** Output function, collecting everything printed in output.
+    @param data unused.
+    @param text bytes of output.
+    @param len number of bytes.
+*/
+static void collect( void *data, char const *text, size_t len )
+{
+  if ( len > OUTPUT_SIZE - outputLen )
+    len = OUTPUT_SIZE - outputLen;
+  memcpy( output + outputLen, text, len );
+  outputLen += len;
+  output[ outputLen ] = '\0';
+}
+
+/** Return the output collected so far, and start collecting again.
+    @return the output, which stays valid until the next call.
+*/
+static char const *takeOutput()
+{
+  static char copy[ OUTPUT_SIZE + 1 ];
+  strcpy( copy, output );
+  outputLen = 0;
+  output[ 0 ] = '\0';
+  return copy;
+}
+
+/** Check that a string is what it should be, reporting it if it isn't.
+    @param what description of the check.
+    @param got string to check.
+    @param want what it should be.
+*/
+static void checkString( char const *what, char const *got,
+                         char const *want )
+{
+  checked++;
+  if ( strcmp( got, want ) != 0 ) {
+    printf( "%s: got \"%s\", expected \"%s\"\n", what, got, want );
+    failures++;
+  }
+}
+
+/** Check that a number is what it should be, reporting it if it isn't.
+    @param what description of the check.
+    @param got number to check.
+    @param want what it should be.
+*/
+static void checkInt( char const *what, int got, int want )
+{
+  checked++;
+  if ( got != want ) {
+    printf( "%s: got %d, expected %d\n", what, got, want );
+    failures++;
+  }
+}
+
+/** Compile a null-terminated program.
+    @param interp interpreter to compile it with.
+    @param source text of the program.
+    @return the program, or NULL if it has an error.
+*/
+static Program *compile( Interpreter *interp, char const *source )
+{
+  return compileProgram( interp, source, strlen( source ) );
+}
+
+/** Run a program more than once, in fresh contexts and in the same
+    one, with values passed in and out through variables.
+*/
+static void testReuse()
+{
+  Interpreter *interp = makeInterpreter();
+  setInterpreterOutput( interp, collect, NULL );
+
+  Program *prog = compile( interp,
+    "function series ( n , total ) {\n"
+    "  if ( n < 1 )\n"
+    "    return total ;\n"
+    "  return series ( n - 1 , total + n ) ;\n"
+    "}\n"
+    "runs = runs + 1 ;\n"
+    "total = series ( limit , 0 ) ;\n"
+    "print name .. \" \" .. total .. \"\\n\" ;\n" );
+  checkInt( "compiled", prog != NULL, 1 );
+  checkString( "no compile error", interpreterError( interp ), "" );
+  if ( !prog ) {
+    freeInterpreter( interp );
+    return;
+  }
+
+  // Each run sees the variables set for it.
+  setInterpreterString( interp, "name", "first" );
+  setInterpreterNumber( interp, "limit", 10 );
+  checkInt( "first run", runProgram( interp, prog ), 1 );
+  checkString( "first output", takeOutput(), "first 55.000000\n" );
+  checkString( "first total", getInterpreterVariable( interp, "total" ),
+               "55.000000" );
+
+  // Without a reset, variables carry over from run to run.
+  setInterpreterNumber( interp, "limit", 100000 );
+  checkInt( "second run", runProgram( interp, prog ), 1 );
+  checkString( "second output", takeOutput(), "first 5000050000.000000\n" );
+  checkString( "second runs", getInterpreterVariable( interp, "runs" ),
+               "2.000000" );
+
+  // After a reset, the same program starts from nothing.
+  resetInterpreter( interp );
+  checkString( "reset name", getInterpreterVariable( interp, "name" ), "" );
+  setInterpreterString( interp, "name", "third" );
+  setInterpreterNumber( interp, "limit", 3 );
+  checkInt( "third run", runProgram( interp, prog ), 1 );
+  checkString( "third output", takeOutput(), "third 6.000000\n" );
+  checkString( "third runs", getInterpreterVariable( interp, "runs" ),
+               "1.000000" );
+
+  // Another interpreter can run the same program at the same time.
+  Interpreter *other = makeInterpreter();
+  setInterpreterOutput( other, collect, NULL );
+  setInterpreterString( other, "name", "other" );
+  setInterpreterNumber( other, "limit", 4 );
+  checkInt( "other run", runProgram( other, prog ), 1 );
+  checkString( "other output", takeOutput(), "other 10.000000\n" );
+  checkString( "unchanged total", getInterpreterVariable( interp, "total" ),
+               "6.000000" );
+  freeInterpreter( other );
+
+  freeInterpreter( interp );
+  freeProgram( prog );
+}
+
+/** Run a loop often enough that it's compiled, then run it again. */
+static void testLoops()
+{
+  Interpreter *interp = makeInterpreter();
+  setInterpreterOutput( interp, collect, NULL );
+
+  Program *prog = compile( interp,
+    "i = 0 ;\n"
+    "while ( i < n ) {\n"
+    "  i = i + 1 ;\n"
+    "}\n"
+    "print i ;\n" );
+  for ( int n = 1000; n <= 3000; n += 1000 ) {
+    resetInterpreter( interp );
+    setInterpreterNumber( interp, "n", n );
+    checkInt( "loop run", runProgram( interp, prog ), 1 );
+    char want[ 32 ];
+    snprintf( want, sizeof( want ), "%d.000000", n );
+    checkString( "loop output", takeOutput(), want );
+  }
+
+  freeProgram( prog );
+  freeInterpreter( interp );
+}
+
+/** Check that errors are reported, with their lines, and that the
+    interpreter still works after them. */
+static void testErrors()
+{
+  Interpreter *interp = makeInterpreter();
+  setInterpreterOutput( interp, collect, NULL );
+
+  // A syntax error means there's no program.
+  Program *bad = compile( interp, "x = 1 ;\nprint x\ny = 2 ;\n" );
+  checkInt( "syntax error", bad == NULL, 1 );
+  checkString( "syntax message", interpreterError( interp ),
+               "line 3: syntax error" );
+  checkInt( "syntax line", interpreterErrorLine( interp ), 3 );
+
+  // So does an unterminated string, found by the lexer.
+  bad = compile( interp, "print \"abc ;\n" );
+  checkInt( "string error", bad == NULL, 1 );
+  checkInt( "string line", interpreterErrorLine( interp ), 1 );
+
+  // A run-time error stops the program, deep inside calls, and keeps
+  // what it printed and assigned before.
+  Program *prog = compile( interp,
+    "function down ( n ) {\n"
+    "  return 1 + down ( n + 1 ) ;\n"
+    "}\n"
+    "print \"before\" ;\n"
+    "x = 5 ;\n"
+    "print down ( 0 ) ;\n"
+    "x = 6 ;\n" );
+  checkInt( "deep calls compiled", prog != NULL, 1 );
+  if ( prog ) {
+    checkInt( "deep calls fail", runProgram( interp, prog ), 0 );
+    checkString( "deep calls message", interpreterError( interp ),
+                 "line 2: too many nested calls to down" );
+    checkInt( "deep calls line", interpreterErrorLine( interp ), 2 );
+    checkString( "deep calls output", takeOutput(), "before" );
+    checkString( "deep calls x", getInterpreterVariable( interp, "x" ),
+                 "5" );
+    freeProgram( prog );
+  }
+
+  // The same interpreter can keep going, and a success clears the
+  // error.
+  resetInterpreter( interp );
+  prog = compile( interp, "print \"ok\" ;\nprint undefined ( 1 ) ;\n" );
+  checkInt( "undefined compiled", prog != NULL, 1 );
+  if ( prog ) {
+    checkInt( "undefined fails", runProgram( interp, prog ), 0 );
+    checkString( "undefined message", interpreterError( interp ),
+                 "line 2: undefined function undefined" );
+    checkString( "undefined output", takeOutput(), "ok" );
+    freeProgram( prog );
+  }
+
+  prog = compile( interp, "print \"fine\" ;\n" );
+  checkInt( "after errors", runProgram( interp, prog ), 1 );
+  checkString( "error cleared", interpreterError( interp ), "" );
+  checkInt( "line cleared", interpreterErrorLine( interp ), 0 );
+  checkString( "after output", takeOutput(), "fine" );
+  freeProgram( prog );
+
+  freeInterpreter( interp );
+}
+
+/** Check that names are forgotten once every interpreter and program
+    is freed, and numbered again from the start without mixing up
+    variables. */
+static void testNames()
+{
+  Interpreter *interp = makeInterpreter();
+  Program *prog = compile( interp, "first = 1 ;\nfunction f ( ) { }\n" );
+  runProgram( interp, prog );
+  freeProgram( prog );
+  freeInterpreter( interp );
+
+  interp = makeInterpreter();
+  setInterpreterOutput( interp, collect, NULL );
+  setInterpreterNumber( interp, "second", 2 );
+  prog = compile( interp, "print second .. first .. f ( ) ;\n" );
+  checkInt( "renumbered run", runProgram( interp, prog ), 0 );
+  checkString( "renumbered output", takeOutput(), "" );
+  checkString( "renumbered message", interpreterError( interp ),
+               "line 1: undefined function f" );
+  checkString( "renumbered second",
+               getInterpreterVariable( interp, "second" ), "2.000000" );
+  checkString( "renumbered first", getInterpreterVariable( interp, "first" ),
+               "" );
+  freeProgram( prog );
+  freeInterpreter( interp );
+}
+
+/** Run a program on the calling thread, then free everything the
+    library kept for the thread.
+    @param arg unused.
+    @return NULL
+*/
+static void *runOnThread( void *arg )
+{
+  Interpreter *interp = makeInterpreter();
+  setInterpreterOutput( interp, collect, NULL );
+  Program *prog = compile( interp, "words = \"a\" .. \"b\" ;\n"
+                           "print words .. [ 1 2 ] ;\n" );
+  checkInt( "thread run", runProgram( interp, prog ), 1 );
+  checkString( "thread output", takeOutput(), "ab2.000000" );
+  freeProgram( prog );
+  freeInterpreter( interp );
+  freeInterpreterThread();
+  return NULL;
+}
+
+/** Use the library on threads of their own, each cleaning up after
+    itself, and on this thread again after it's cleaned up too. */
+static void testThreads()
+{
+  for ( int i = 0; i < 2; i++ ) {
+    pthread_t thread;
+    checkInt( "thread started",
+              pthread_create( &thread, NULL, runOnThread, NULL ), 0 );
+    pthread_join( thread, NULL );
+  }
+
+  freeInterpreterThread();
+  runOnThread( NULL );
+}
+
+int main( void )
+{
+  testReuse();
+  testLoops();
+  testErrors();
+  testNames();
+  testThreads();
+
+  printf( "%d checked, %d failed\n", checked, failures );
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
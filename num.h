@@ -0,0 +1,51 @@
+/**
+  @file num.h
+
+  Conversions between numbers and text.  Numbers print the way printf's
+  "%f" prints them, and strings convert to numbers the way scanf's
+  "%lf" reads them.  These do the same jobs without going through the
+  C library's general formatting and scanning code.  Both are exact: the text is identical to
+  "%f" for every double, and parsed numbers are correctly rounded, in
+  the default rounding mode.
+*/
+
+#ifndef _NUM_H_
+#define _NUM_H_
+
+// Most characters formatNumber() writes, not counting the null
+// terminator.  The largest double has 309 digits before the point.
+#define MAX_FORMATTED 317
+
+/** Write a number exactly the way sprintf( buffer, "%f", num ) would,
+    including the sign of negative zero and NaN, and "inf" and "nan".
+    @param num number to format.
+    @param buffer buffer to write to, with room for at least
+    MAX_FORMATTED + 1 characters.
+    @return number of characters written, not counting the null
+    terminator.
+*/
+int formatNumber( double num, char *buffer );
+
+/** Read a number from the start of a string, exactly the way
+    sscanf( text, "%lf%n", num, &len ) would.  That skips white space,
+    then takes the longest prefix that could start a number: decimal
+    or hexadecimal, with an optional point and exponent, or inf,
+    infinity or nan in any case.
+    @param text null-terminated string to read from.
+    @param num returns the number, if there is one.
+    @return number of characters read, including leading white space,
+    or zero if the string doesn't start with a number.
+*/
+int scanNumber( char const *text, double *num );
+
+/** Round a number to the six places after the point that "%f" prints,
+    giving exactly the number scanNumber() would read back from the
+    text formatNumber() writes for it.  Results of arithmetic are
+    rounded this way, since the language has always kept them as that
+    text.
+    @param num number to round.
+    @return the rounded number.  Infinities and NaNs are unchanged.
+*/
+double roundNumber( double num );
+
+#endif
@@ -0,0 +1,226 @@
+/**
+  @file numtest.c
+
+  Conformance test for scanNumber().  For millions of random and
+  edge-case strings, it checks that scanNumber() accepts the same
+  characters sscanf( "%lf%n" ) does, and that the number it returns
+  has exactly the bits strtod() gives for the same text.  Inputs
+  include random decimal strings with long significands and extreme
+  exponents, every kind of double printed in several formats, numbers
+  close to halfway between two doubles, and random junk made from the
+  characters numbers are spelled with.
+
+  It also checks that roundNumber() gives exactly what strtod() reads
+  back from sprintf( "%f" ), for numbers of every size and numbers near
+  halfway between two six-place decimals.
+
+  Exits unsuccessfully, after reporting the first few differences, if
+  anything doesn't match.
+*/
+
+#include <math.h>
+
+#include "num.h"
+#include "testutil.h"
+
+// Number of inputs to check from each random category, unless a count
+// is given on the command line.
+#define DEFAULT_COUNT 200000
+
+// Longest generated input.
+#define MAX_INPUT 64
+
+/** Return true if two results are the same.  A NaN only has to match
+    in sign, since scanf ignores the payload strtod reads from
+    nan(...).
+    @param a first result.
+    @param b second result.
+    @return true if they match.
+*/
+static bool sameResult( double a, double b )
+{
+  if ( isnan( a ) || isnan( b ) )
+    return isnan( a ) && isnan( b ) && signbit( a ) == signbit( b );
+  return toBits( a ) == toBits( b );
+}
+
+/** Check one string against sscanf and strtod.
+    @param text string to check.
+*/
+static void check( char const *text )
+{
+  double expected = 0, actual = 0;
+  int elen = 0;
+  if ( sscanf( text, "%lf%n", &expected, &elen ) != 1 )
+    elen = 0;
+  int alen = scanNumber( text, &actual );
+  bool ok = alen == elen;
+  if ( ok && elen )
+    ok = sameResult( actual, strtod( text, NULL ) );
+
+  if ( countCheck( ok ) )
+    printf( "\"%s\": expected %d characters, %a, got %d, %a\n", text,
+            elen, strtod( text, NULL ), alen, actual );
+}
+
+/** Check roundNumber() on one number, and its negative, against
+    sprintf and strtod.
+    @param num number to check.
+*/
+static void checkRound( double num )
+{
+  for ( int i = 0; i < 2; i++, num = -num ) {
+    char text[ MAX_FORMATTED + 1 ];
+    sprintf( text, "%f", num );
+    double expected = strtod( text, NULL );
+    double actual = roundNumber( num );
+    if ( countCheck( sameResult( expected, actual ) ) )
+      printf( "round %a: expected %a, got %a\n", num, expected, actual );
+  }
+}
+
+/** Write a random decimal number, with a random sign, number of
+    digits, point position and exponent.
+    @param buffer buffer to write to, with room for MAX_INPUT + 1
+    characters.
+*/
+static void randomDecimal( char *buffer )
+{
+  int len = 0;
+  if ( randomBelow( 4 ) == 0 )
+    buffer[ len++ ] = randomBelow( 2 ) ? '-' : '+';
+
+  // Sometimes leading zeros, then up to 30 digits, with a point
+  // somewhere among them.
+  int zeros = randomBelow( 4 ) == 0 ? randomBelow( 8 ) : 0;
+  int digits = 1 + randomBelow( 30 );
+  int point = randomBelow( 3 ) ? randomBelow( zeros + digits + 1 ) : -1;
+  for ( int i = 0; i < zeros + digits; i++ ) {
+    if ( i == point )
+      buffer[ len++ ] = '.';
+    buffer[ len++ ] = i < zeros ? '0' : '0' + randomBelow( 10 );
+  }
+
+  if ( randomBelow( 2 ) )
+    len += sprintf( buffer + len, "e%d", randomBelow( 700 ) - 350 );
+  buffer[ len ] = '\0';
+}
+
+/**
+  Check every category of input, then report the results.
+
+  @param argc the number of command line arguments
+  @param *argv an array of arguments, optionally the count per category
+  @return EXIT_SUCCESS if every input matched
+*/
+int main( int argc, char *argv[] )
+{
+  long count = argc > 1 ? atol( argv[ 1 ] ) : DEFAULT_COUNT;
+
+  // Syntax at the edges of what scanf accepts.
+  static char const *edges[] = {
+    "", " ", "0", "-0", "+0", "1", "1e", "1e+", "1e-", "1E5", "1e5e3",
+    "1.2.3", "1e+-3", "1.", ".5", ".", "-.", "+", "-", ".e1", "0.e3",
+    "00012", "00x1", " \t\n-3", "\v\f5", "0x", "-0x", "0x.", "-0x.",
+    "0x1", "0x1e", "0x1.", "0x.8p1", "0x1p", "0x1p+", "0x1p3.5", "0xp3",
+    "0xg", "0X1P-2", "0x1.fffffffffffffp1023", "0x1.fffffffffffff8p1023",
+    "inf", "INF", "-inf", "in", "infin", "infinity", "+InFiNiTy",
+    "infinityx", "infX", "nan", "NaN", "-nan", "nan(", "nan(abc)",
+    "nan(123)", "nanx", "n", "1e400", "1e-400", "4.9e-324",
+    "2.4703282292062327e-324", "2.4703282292062328e-324",
+    "1.7976931348623157e308", "1.7976931348623158e308",
+    "1.7976931348623159e308", "2.2250738585072011e-308",
+    "2.2250738585072014e-308", "9007199254740993", "9007199254740992.5",
+    "123456789012345678901234567890", "0.000000000000000000000000001",
+    "1e99999999999", "1e-99999999999", "0e99999",
+    "7.2057594037927933e16",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "1.00000000000000011102230246251565404236316680908203126",
+  };
+  for ( int i = 0; i < sizeof( edges ) / sizeof( edges[ 0 ] ); i++ )
+    check( edges[ i ] );
+
+  char buffer[ MAX_INPUT + 1 ];
+
+  // Random decimal strings.
+  for ( long i = 0; i < count; i++ ) {
+    randomDecimal( buffer );
+    check( buffer );
+  }
+
+  // Random doubles, printed in every format with enough digits to get
+  // them back, and with fewer.
+  for ( long i = 0; i < count; i++ ) {
+    uint64_t bits = random64();
+    double num;
+    memcpy( &num, &bits, sizeof( num ) );
+    sprintf( buffer, "%.17g", num );
+    check( buffer );
+    sprintf( buffer, "%.*e", randomBelow( 20 ), num );
+    check( buffer );
+    sprintf( buffer, "%a", num );
+    check( buffer );
+  }
+
+  // Numbers of everyday size.
+  for ( long i = 0; i < count; i++ ) {
+    double num = ldexp( (double) ( random64() >> 11 ),
+                        randomBelow( 100 ) - 80 );
+    sprintf( buffer, "%.*f", randomBelow( 12 ), num );
+    check( buffer );
+    sprintf( buffer, "%.*g", 1 + randomBelow( 17 ), num );
+    check( buffer );
+  }
+
+  // Close to halfway between two neighboring doubles, where rounding
+  // is hardest.
+  for ( long i = 0; i < count; i++ ) {
+    uint64_t bits = random64() & 0x7fefffffffffffffu;
+    double lo;
+    memcpy( &lo, &bits, sizeof( lo ) );
+    double hi = nextafter( lo, INFINITY );
+    long double mid = ( (long double) lo + hi ) / 2;
+    sprintf( buffer, "%.*Le", 16 + randomBelow( 12 ), mid );
+    check( buffer );
+  }
+
+  // Rounding special values, and numbers of every size.
+  checkRound( 0.0 );
+  checkRound( INFINITY );
+  checkRound( NAN );
+  checkRound( 1.0 / 3 );
+  checkRound( 1099511.627776 );
+  for ( long i = 0; i < count / 4; i++ ) {
+    checkRound( fromBits( random64() ) );
+    checkRound( ldexp( (double) ( random64() >> 11 ),
+                       randomBelow( 100 ) - 80 ) );
+    double whole = (double) ( random64() >> randomBelow( 64 ) );
+    checkRound( whole );
+    checkRound( nextafter( whole, 0 ) );
+  }
+
+  // Rounding numbers near halfway between two six-place decimals, and
+  // right at the edge of where rounding doesn't need the text.
+  for ( long i = 0; i < count / 4; i++ ) {
+    double scaled = (double) ( random64() >> randomBelow( 64 ) ) + 0.5;
+    double num = scaled / 1e6;
+    checkRound( num );
+    checkRound( nextafter( num, 0 ) );
+    checkRound( nextafter( num, INFINITY ) );
+    checkRound( ( 1099511627776.0 + randomBelow( 2000 ) - 1000 ) / 1e6 +
+                ( randomBelow( 2 ) ? 0.0000005 : 0 ) );
+  }
+
+  // Random junk, from the characters numbers are made of.
+  static char const alphabet[] = "0123456789.eE+-xXpPaAfFiInNtTyY \t";
+  for ( long i = 0; i < count; i++ ) {
+    int len = 1 + randomBelow( 10 );
+    for ( int k = 0; k < len; k++ )
+      buffer[ k ] = alphabet[ randomBelow( sizeof( alphabet ) - 1 ) ];
+    buffer[ len ] = '\0';
+    check( buffer );
+  }
+
+  return finishChecks();
+}
@@ -0,0 +1,582 @@
+#include "opt.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Give a new expression the source line of the one it replaces.
+    @param expr new expression.
+    @param from expression it replaces.
+    @return expr, so this can wrap the call that made it.
+*/
+static Expr *exprLike( Expr *expr, Expr *from )
+{
+  expr->line = from->line;
+  return expr;
+}
+
+/** Give a new statement the source line of the one it replaces.
+    @param stmt new statement.
+    @param from statement it replaces.
+    @return stmt, so this can wrap the call that made it.
+*/
+static Stmt *stmtLike( Stmt *stmt, Stmt *from )
+{
+  stmt->line = from->line;
+  return stmt;
+}
+
+/** Return the number of nodes in an expression.
+    @param expr expression to count.
+    @return number of nodes in the expression.
+*/
+static int countExpr( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case SUM_EXPR:
+  case DIFF_EXPR:
+  case PROD_EXPR:
+  case QUOT_EXPR:
+  case LESS_EXPR:
+  case EQU_EXPR:
+  case AND_EXPR:
+  case OR_EXPR:
+  case CONCAT_EXPR:
+  case INDEX_EXPR:
+    return 1 + countExpr( binaryLeft( expr ) ) + countExpr( binaryRight( expr ) );
+  case CALL_EXPR:
+  case INVOKE_EXPR: {
+    int n = 1;
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      n += countExpr( callArg( expr, i ) );
+    return n;
+  }
+  default:
+    return 1;
+  }
+}
+
+/** Rebuild a call with new arguments, if any of them changed.
+    @param expr expression of kind CALL_EXPR or INVOKE_EXPR.
+    @param args new arguments, one for each of the call's.
+    @param arena arena for the new expression.
+    @return the new call, or expr if every argument is the same.
+*/
+static Expr *rebuildCall( Expr *expr, Expr **args, Arena *arena )
+{
+  for ( int i = 0; i < callArgCount( expr ); i++ )
+    if ( args[ i ] != callArg( expr, i ) ) {
+      if ( expr->kind == INVOKE_EXPR )
+        return exprLike( makeInvoke( arena, invokedFunction( expr ), args,
+                                     callArgCount( expr ) ), expr );
+      return exprLike( makeCall( arena, callFunction( expr ), args,
+                                 callArgCount( expr ) ), expr );
+    }
+  return expr;
+}
+
+/** Return the number of nodes in a statement.
+    @param stmt statement to count.
+    @return number of nodes in the statement and its expressions.
+*/
+static int countStmt( Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT: {
+    int n = 1;
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      n += countStmt( compoundStmt( stmt, i ) );
+    return n;
+  }
+  case IF_STMT:
+  case WHILE_STMT:
+    return 1 + countExpr( stmtExpr( stmt ) ) + countStmt( stmtBody( stmt ) );
+  case FUNCTION_STMT:
+    return 1 + countStmt( stmtBody( stmt ) );
+  case ASSIGN_KEY_STMT:
+  case LOCAL_KEY_STMT:
+    return 1 + countExpr( assignKey( stmt ) ) + countExpr( stmtExpr( stmt ) );
+  default:
+    return 1 + countExpr( stmtExpr( stmt ) );
+  }
+}
+
+/** Fold the constant parts of an expression.
+    @param expr expression to fold.
+    @param arena arena for any new expressions.
+    @return the folded expression, or expr if nothing changed.
+*/
+static Expr *foldExpr( Expr *expr, Arena *arena )
+{
+  switch ( expr->kind ) {
+  case SUM_EXPR:
+  case DIFF_EXPR:
+  case PROD_EXPR:
+  case QUOT_EXPR:
+  case LESS_EXPR:
+  case EQU_EXPR:
+  case AND_EXPR:
+  case OR_EXPR:
+  case CONCAT_EXPR:
+  case INDEX_EXPR:
+    break;
+  case CALL_EXPR:
+  case INVOKE_EXPR: {
+    // Only the arguments are folded.  Most calls make a vector, which
+    // can't be a literal, and a function the program defines could
+    // print.
+    Expr **args = (Expr **) arenaAlloc( arena, ( callArgCount( expr ) + 1 ) *
+                                        sizeof( Expr * ) );
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      args[ i ] = foldExpr( callArg( expr, i ), arena );
+    return rebuildCall( expr, args, arena );
+  }
+  default:
+    return expr;
+  }
+
+  Expr *left = foldExpr( binaryLeft( expr ), arena );
+  Expr *right = foldExpr( binaryRight( expr ), arena );
+  if ( left != binaryLeft( expr ) || right != binaryRight( expr ) )
+    expr = exprLike( makeBinaryExpr( arena, expr->kind, left, right ), expr );
+
+  // With literals on both sides, evaluate the expression the same way it
+  // would be at run time.  Literals don't need a context, but a
+  // concatenation keeps its result in one until the constant has its
+  // own copy.
+  if ( left->kind == LITERAL_EXPR && right->kind == LITERAL_EXPR ) {
+    Context *scratch = makeContext();
+    Expr *lit = makeConstant( arena, expr->eval( expr, scratch ) );
+    freeContext( scratch );
+    return exprLike( lit, expr );
+  }
+
+  return expr;
+}
+
+/** Make an empty statement, for when a whole statement is removed.
+    @param arena arena to allocate the statement from.
+    @return a compound statement with nothing in it.
+*/
+static Stmt *emptyStmt( Arena *arena )
+{
+  return makeCompound( arena, NULL, 0 );
+}
+
+/** Return true if a statement does nothing at all.
+    @param stmt statement to check.
+    @return true if stmt is an empty compound statement.
+*/
+static bool isEmpty( Stmt *stmt )
+{
+  return stmt->kind == COMPOUND_STMT && compoundLength( stmt ) == 0;
+}
+
+/** Fold the constant parts of a statement, and remove branches that can
+    never run.
+    @param stmt statement to fold.
+    @param arena arena for any new statements and expressions.
+    @return the folded statement, or stmt if nothing changed.
+*/
+static Stmt *foldStmt( Stmt *stmt, Arena *arena )
+{
+  switch ( stmt->kind ) {
+  case PRINT_STMT: {
+    Expr *arg = foldExpr( stmtExpr( stmt ), arena );
+    return arg == stmtExpr( stmt ) ? stmt :
+      stmtLike( makePrint( arena, arg ), stmt );
+  }
+
+  case ASSIGN_STMT: {
+    Expr *expr = foldExpr( stmtExpr( stmt ), arena );
+    return expr == stmtExpr( stmt ) ? stmt :
+      stmtLike( makeAssignment( arena, assignSlot( stmt ), expr ), stmt );
+  }
+
+  case ASSIGN_KEY_STMT: {
+    Expr *key = foldExpr( assignKey( stmt ), arena );
+    Expr *expr = foldExpr( stmtExpr( stmt ), arena );
+    if ( key == assignKey( stmt ) && expr == stmtExpr( stmt ) )
+      return stmt;
+    return stmtLike( makeKeyAssignment( arena, assignSlot( stmt ), key, expr ),
+                     stmt );
+  }
+
+  case RETURN_STMT: {
+    Expr *expr = foldExpr( stmtExpr( stmt ), arena );
+    return expr == stmtExpr( stmt ) ? stmt :
+      stmtLike( makeReturn( arena, expr ), stmt );
+  }
+
+  case LOCAL_ASSIGN_STMT: {
+    Expr *expr = foldExpr( stmtExpr( stmt ), arena );
+    return expr == stmtExpr( stmt ) ? stmt :
+      stmtLike( makeLocalAssignment( arena, assignSlot( stmt ), expr ), stmt );
+  }
+
+  case LOCAL_KEY_STMT: {
+    Expr *key = foldExpr( assignKey( stmt ), arena );
+    Expr *expr = foldExpr( stmtExpr( stmt ), arena );
+    if ( key == assignKey( stmt ) && expr == stmtExpr( stmt ) )
+      return stmt;
+    return stmtLike( makeLocalKeyAssignment( arena, assignSlot( stmt ), key,
+                                             expr ), stmt );
+  }
+
+  case FUNCTION_STMT: {
+    Stmt *body = foldStmt( stmtBody( stmt ), arena );
+    return body == stmtBody( stmt ) ? stmt :
+      stmtLike( makeFunction( arena, definedFunction( stmt ),
+                              functionParams( stmt ), body ), stmt );
+  }
+
+  case COMPOUND_STMT: {
+    // Fold each statement, leaving out the ones that turn out to do
+    // nothing.
+    int len = compoundLength( stmt );
+    Stmt **list = (Stmt **) arenaAlloc( arena, ( len + 1 ) * sizeof( Stmt * ) );
+    int count = 0;
+    bool changed = false;
+    for ( int i = 0; i < len; i++ ) {
+      Stmt *child = foldStmt( compoundStmt( stmt, i ), arena );
+      changed = changed || child != compoundStmt( stmt, i );
+      if ( isEmpty( child ) )
+        changed = true;
+      else
+        list[ count++ ] = child;
+    }
+    return changed ? stmtLike( makeCompound( arena, list, count ), stmt ) : stmt;
+  }
+
+  case IF_STMT:
+  case WHILE_STMT: {
+    Expr *cond = foldExpr( stmtExpr( stmt ), arena );
+
+    // A condition that's always false means the body never runs.  An
+    // if with a condition that's always true is just its body.
+    if ( cond->kind == LITERAL_EXPR ) {
+      Value val = literalValue( cond );
+      if ( !valueIsTrue( &val ) )
+        return emptyStmt( arena );
+      if ( stmt->kind == IF_STMT )
+        return foldStmt( stmtBody( stmt ), arena );
+    }
+
+    Stmt *body = foldStmt( stmtBody( stmt ), arena );
+    if ( cond == stmtExpr( stmt ) && body == stmtBody( stmt ) )
+      return stmt;
+    return stmtLike( stmt->kind == IF_STMT ? makeIf( arena, cond, body ) :
+                     makeWhile( arena, cond, body ), stmt );
+  }
+
+  default:
+    return stmt;
+  }
+}
+
+Stmt *optimizeStmt( Stmt *stmt, Arena *arena, int *removed )
+{
+  Stmt *result = foldStmt( stmt, arena );
+  if ( result != stmt )
+    *removed += countStmt( stmt ) - countStmt( result );
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loop-invariant code motion
+
+/** List of variable slots a loop assigns to. */
+typedef struct {
+  /** Slots in the list, in no particular order. */
+  int *slots;
+
+  /** Number of slots in the list, and its capacity. */
+  int len, cap;
+} SlotList;
+
+/** Add a slot to a list, if it's not already there.
+    @param list list to add to.
+    @param slot slot to add.
+*/
+static void addSlot( SlotList *list, int slot )
+{
+  for ( int i = 0; i < list->len; i++ )
+    if ( list->slots[ i ] == slot )
+      return;
+
+  if ( list->len >= list->cap ) {
+    list->cap = list->cap ? list->cap * 2 : 8;
+    list->slots = (int *) realloc( list->slots, list->cap * sizeof( int ) );
+  }
+  list->slots[ list->len++ ] = slot;
+}
+
+/** Return true if a slot is in a list.
+    @param list list to check.
+    @param slot slot to look for.
+    @return true if slot is in the list.
+*/
+static bool hasSlot( SlotList const *list, int slot )
+{
+  for ( int i = 0; i < list->len; i++ )
+    if ( list->slots[ i ] == slot )
+      return true;
+  return false;
+}
+
+/** Find every variable a statement assigns to, including in the bodies
+    of nested if and while statements.  Storing a key in a map counts
+    as assigning the variable that holds it.
+    @param stmt statement to check.
+    @param writes list to add the slots of the variables to.
+*/
+static void findWrites( Stmt *stmt, SlotList *writes )
+{
+  switch ( stmt->kind ) {
+  case ASSIGN_STMT:
+  case ASSIGN_KEY_STMT:
+    addSlot( writes, assignSlot( stmt ) );
+    break;
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      findWrites( compoundStmt( stmt, i ), writes );
+    break;
+  case IF_STMT:
+  case WHILE_STMT:
+    findWrites( stmtBody( stmt ), writes );
+    break;
+  default:
+    break;
+  }
+}
+
+/** Return true if an expression has operands, so it's more than a
+    literal or a variable.
+    @param expr expression to check.
+    @return true if expr is an operator or a call.
+*/
+static bool hasOperands( Expr *expr )
+{
+  return expr->kind != LITERAL_EXPR && expr->kind != VAR_EXPR;
+}
+
+/** Return true if an expression has the same value on every iteration
+    of a loop, because it doesn't use any of the variables the loop
+    assigns to, and it's safe to evaluate before the loop, even if the
+    loop wouldn't have evaluated it at all.
+    @param expr expression to check.
+    @param writes variables the loop assigns to.
+    @return true if expr is loop invariant.
+*/
+static bool isInvariant( Expr *expr, SlotList const *writes )
+{
+  if ( expr->kind == LITERAL_EXPR )
+    return true;
+  if ( expr->kind == VAR_EXPR )
+    return !hasSlot( writes, variableExprSlot( expr ) );
+  if ( expr->kind == CALL_EXPR ) {
+    // Building a vector can fail, for range( 1e18 ), or take a lot of
+    // memory, so only the builtins that look at a vector are moved.
+    Builtin fn = callFunction( expr );
+    if ( fn == VECTOR_FN || fn == RANGE_FN )
+      return false;
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      if ( !isInvariant( callArg( expr, i ), writes ) )
+        return false;
+    return true;
+  }
+
+  // A function the program defines could print, so calls have to stay
+  // where they are.
+  if ( expr->kind == INVOKE_EXPR )
+    return false;
+  return isInvariant( binaryLeft( expr ), writes ) &&
+    isInvariant( binaryRight( expr ), writes );
+}
+
+/** State for hoisting invariant expressions out of one loop. */
+typedef struct {
+  /** Arena for new statements and expressions. */
+  Arena *arena;
+
+  /** Variables the loop assigns to. */
+  SlotList writes;
+
+  /** Assignments to hidden variables, to run before the loop. */
+  Stmt **pre;
+
+  /** Number of statements in pre, and its capacity. */
+  int len, cap;
+
+  /** Number for the next hidden variable. */
+  int *next;
+
+  /** Incremented for each expression hoisted. */
+  int *hoisted;
+} Hoist;
+
+/** Replace the largest invariant subexpressions of an expression with
+    hidden variables, assigned before the loop.  Invariant expressions
+    can't report an error and don't have side effects, so it's safe to
+    evaluate them early, even if the loop wouldn't have.
+    @param expr expression to rewrite.
+    @param h state for the loop the expression is in.
+    @return the rewritten expression, or expr if nothing changed.
+*/
+static Expr *hoistExpr( Expr *expr, Hoist *h )
+{
+  // Reading a literal or a variable is already as cheap as reading a
+  // hidden variable.
+  if ( !hasOperands( expr ) )
+    return expr;
+
+  if ( isInvariant( expr, &h->writes ) ) {
+    // Names starting with $ can't be written in a program, so these
+    // never collide with the program's variables.
+    char name[ 32 ];
+    snprintf( name, sizeof( name ), "$hoist%d", ( *h->next )++ );
+    int slot = variableSlot( name );
+
+    if ( h->len >= h->cap ) {
+      h->cap = h->cap ? h->cap * 2 : 4;
+      h->pre = (Stmt **) realloc( h->pre, h->cap * sizeof( Stmt * ) );
+    }
+    h->pre[ h->len ] = makeAssignment( h->arena, slot, expr );
+    h->pre[ h->len++ ]->line = expr->line;
+    ( *h->hoisted )++;
+    return exprLike( makeVariable( h->arena, slot ), expr );
+  }
+
+  if ( expr->kind == CALL_EXPR || expr->kind == INVOKE_EXPR ) {
+    Expr **args = (Expr **) arenaAlloc( h->arena, ( callArgCount( expr ) + 1 ) *
+                                        sizeof( Expr * ) );
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      args[ i ] = hoistExpr( callArg( expr, i ), h );
+    return rebuildCall( expr, args, h->arena );
+  }
+
+  Expr *left = hoistExpr( binaryLeft( expr ), h );
+  Expr *right = hoistExpr( binaryRight( expr ), h );
+  if ( left == binaryLeft( expr ) && right == binaryRight( expr ) )
+    return expr;
+  return exprLike( makeBinaryExpr( h->arena, expr->kind, left, right ), expr );
+}
+
+/** Replace invariant subexpressions throughout the body of a loop.
+    @param stmt statement in the loop's body.
+    @param h state for the loop.
+    @return the rewritten statement, or stmt if nothing changed.
+*/
+static Stmt *hoistBody( Stmt *stmt, Hoist *h )
+{
+  switch ( stmt->kind ) {
+  case PRINT_STMT: {
+    Expr *arg = hoistExpr( stmtExpr( stmt ), h );
+    return arg == stmtExpr( stmt ) ? stmt :
+      stmtLike( makePrint( h->arena, arg ), stmt );
+  }
+
+  case ASSIGN_STMT: {
+    Expr *expr = hoistExpr( stmtExpr( stmt ), h );
+    return expr == stmtExpr( stmt ) ? stmt :
+      stmtLike( makeAssignment( h->arena, assignSlot( stmt ), expr ), stmt );
+  }
+
+  case ASSIGN_KEY_STMT: {
+    Expr *key = hoistExpr( assignKey( stmt ), h );
+    Expr *expr = hoistExpr( stmtExpr( stmt ), h );
+    if ( key == assignKey( stmt ) && expr == stmtExpr( stmt ) )
+      return stmt;
+    return stmtLike( makeKeyAssignment( h->arena, assignSlot( stmt ), key,
+                                        expr ), stmt );
+  }
+
+  case COMPOUND_STMT: {
+    int len = compoundLength( stmt );
+    Stmt **list = (Stmt **) arenaAlloc( h->arena, ( len + 1 ) * sizeof( Stmt * ) );
+    bool changed = false;
+    for ( int i = 0; i < len; i++ ) {
+      list[ i ] = hoistBody( compoundStmt( stmt, i ), h );
+      changed = changed || list[ i ] != compoundStmt( stmt, i );
+    }
+    return changed ? stmtLike( makeCompound( h->arena, list, len ), stmt ) : stmt;
+  }
+
+  case IF_STMT:
+  case WHILE_STMT: {
+    Expr *cond = hoistExpr( stmtExpr( stmt ), h );
+    Stmt *body = hoistBody( stmtBody( stmt ), h );
+    if ( cond == stmtExpr( stmt ) && body == stmtBody( stmt ) )
+      return stmt;
+    return stmtLike( stmt->kind == IF_STMT ? makeIf( h->arena, cond, body ) :
+                     makeWhile( h->arena, cond, body ), stmt );
+  }
+
+  default:
+    return stmt;
+  }
+}
+
+/** Hoist invariant expressions out of every while loop in a statement.
+    Inner loops are done first, so an expression that's invariant in
+    both an inner and an outer loop moves all the way out.
+    @param stmt statement to rewrite.
+    @param arena arena for new statements and expressions.
+    @param next number for the next hidden variable.
+    @param hoisted incremented for each expression hoisted.
+    @return the rewritten statement, or stmt if nothing changed.
+*/
+static Stmt *hoistStmt( Stmt *stmt, Arena *arena, int *next, int *hoisted )
+{
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT: {
+    int len = compoundLength( stmt );
+    Stmt **list = (Stmt **) arenaAlloc( arena, ( len + 1 ) * sizeof( Stmt * ) );
+    bool changed = false;
+    for ( int i = 0; i < len; i++ ) {
+      list[ i ] = hoistStmt( compoundStmt( stmt, i ), arena, next, hoisted );
+      changed = changed || list[ i ] != compoundStmt( stmt, i );
+    }
+    return changed ? stmtLike( makeCompound( arena, list, len ), stmt ) : stmt;
+  }
+
+  case IF_STMT: {
+    Stmt *body = hoistStmt( stmtBody( stmt ), arena, next, hoisted );
+    return body == stmtBody( stmt ) ? stmt :
+      stmtLike( makeIf( arena, stmtExpr( stmt ), body ), stmt );
+  }
+
+  case WHILE_STMT: {
+    Stmt *body = hoistStmt( stmtBody( stmt ), arena, next, hoisted );
+
+    Hoist h = { .arena = arena, .next = next, .hoisted = hoisted };
+    findWrites( body, &h.writes );
+    Expr *cond = hoistExpr( stmtExpr( stmt ), &h );
+    body = hoistBody( body, &h );
+    free( h.writes.slots );
+
+    Stmt *loop = stmt;
+    if ( cond != stmtExpr( stmt ) || body != stmtBody( stmt ) )
+      loop = stmtLike( makeWhile( arena, cond, body ), stmt );
+    if ( h.len == 0 )
+      return loop;
+
+    // Run the hoisted assignments, then the loop.
+    Stmt **list = (Stmt **) arenaAlloc( arena, ( h.len + 1 ) * sizeof( Stmt * ) );
+    for ( int i = 0; i < h.len; i++ )
+      list[ i ] = h.pre[ i ];
+    list[ h.len ] = loop;
+    free( h.pre );
+    return stmtLike( makeCompound( arena, list, h.len + 1 ), stmt );
+  }
+
+  default:
+    return stmt;
+  }
+}
+
+Stmt *hoistInvariants( Stmt *stmt, Arena *arena, int *hoisted )
+{
+  // Hidden variables only need to last while this statement runs, so
+  // every statement can reuse the same ones.
+  int next = 0;
+  return hoistStmt( stmt, arena, &next, hoisted );
+}
@@ -0,0 +1,41 @@
+/**
+  @file opt.h
+
+  Optimization passes over parsed statements, run between parsing a
+  statement and executing it.  Optimized statements always behave
+  exactly like the originals, including how their values print.
+*/
+
+#ifndef _OPT_H_
+#define _OPT_H_
+
+#include "expr.h"
+#include "stmt.h"
+
+/** Optimize a statement.  Subexpressions with only literal operands
+    are folded into a single literal, if statements with a constant
+    condition are replaced with their body or removed, and while loops
+    with a constant false condition are removed.
+    @param stmt statement to optimize.  This isn't changed; any parts
+    that need to change are rebuilt.
+    @param arena arena to allocate new parts of the statement from.
+    @param removed incremented by the number of tree nodes the
+    optimizations removed.
+    @return the optimized statement, which may share parts with stmt.
+*/
+Stmt *optimizeStmt( Stmt *stmt, Arena *arena, int *removed );
+
+/** Move loop-invariant code out of while loops.  Each subexpression of
+    a loop's condition or body that doesn't use any variable the loop
+    assigns to is computed once, into a hidden variable, just before
+    the loop, and the loop reads the hidden variable instead.
+    @param stmt statement to optimize.  This isn't changed; any parts
+    that need to change are rebuilt.
+    @param arena arena to allocate new parts of the statement from.
+    @param hoisted incremented by the number of expressions moved out
+    of loops.
+    @return the optimized statement, which may share parts with stmt.
+*/
+Stmt *hoistInvariants( Stmt *stmt, Arena *arena, int *hoisted );
+
+#endif
@@ -0,0 +1,304 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "output.h"
+#include "num.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Size of the buffer print statements format into.
+#define BUFFER_SIZE 65536
+
+// Size of the ring buffer shared with the writer thread.  This must be
+// a power of two.
+#define RING_SIZE ( 1 << 20 )
+
+// How long the writer thread sleeps when it has nothing to do, in
+// nanoseconds.
+#define IDLE_WAIT 50000
+
+/** Buffer that print statements format into, one for each thread.
+    When it fills up, it's either written directly, copied into the
+    ring for the writer thread, or handed to the thread's sink. */
+static __thread struct {
+  char data[ BUFFER_SIZE ];
+
+  // Number of bytes in data.
+  int len;
+
+  // True if we're writing a terminal, so we should flush every line.
+  bool lineMode;
+
+  // True once this thread is ready to print.
+  bool started;
+
+  // Function that takes this thread's output, and its argument, or
+  // NULL for standard output.
+  OutputSink sink;
+  void *sinkData;
+} buffer;
+
+// For registering our atexit() handler just once.
+static pthread_once_t registered = PTHREAD_ONCE_INIT;
+
+/** Single-producer, single-consumer ring buffer, for handing output to
+    the writer thread without any locking.  The interpreter only
+    advances head, and the writer thread only advances tail.  Both are
+    running byte counts, so head - tail is the number of bytes waiting
+    to be written. */
+static struct {
+  char data[ RING_SIZE ];
+
+  // Total number of bytes ever added by the interpreter.
+  size_t head;
+
+  // Total number of bytes ever written by the writer thread.
+  size_t tail;
+
+  // Set when the writer thread should exit, once the ring is empty.
+  bool done;
+
+  // True if the writer thread is running.
+  bool running;
+
+  // The writer thread.
+  pthread_t thread;
+} ring;
+
+/** Write a block of bytes to standard output, retrying on partial
+    writes.
+    @param data bytes to write.
+    @param len number of bytes to write.
+*/
+static void writeAll( char const *data, size_t len )
+{
+  while ( len > 0 ) {
+    ssize_t n = write( STDOUT_FILENO, data, len );
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      // There's nowhere to report an error writing output.
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+/** Sleep for a moment, when one side of the ring is waiting on the other.
+*/
+static void idle()
+{
+  struct timespec ts = { 0, IDLE_WAIT };
+  nanosleep( &ts, NULL );
+}
+
+/** Body of the writer thread.  Writes whatever is in the ring, as
+    contiguous blocks, until it's told to stop.
+    @param arg unused.
+    @return NULL
+*/
+static void *writerMain( void *arg )
+{
+  for ( ;; ) {
+    size_t head = __atomic_load_n( &ring.head, __ATOMIC_ACQUIRE );
+    size_t tail = ring.tail;
+
+    if ( head == tail ) {
+      if ( __atomic_load_n( &ring.done, __ATOMIC_ACQUIRE ) &&
+           __atomic_load_n( &ring.head, __ATOMIC_ACQUIRE ) == tail )
+        return NULL;
+      idle();
+      continue;
+    }
+
+    // Write up to the end of the ring, and get the rest next time.
+    size_t start = tail & ( RING_SIZE - 1 );
+    size_t len = head - tail;
+    if ( len > RING_SIZE - start )
+      len = RING_SIZE - start;
+    writeAll( ring.data + start, len );
+
+    __atomic_store_n( &ring.tail, tail + len, __ATOMIC_RELEASE );
+  }
+}
+
+/** Copy bytes into the ring for the writer thread, waiting for space
+    if it's full.
+    @param data bytes to add.
+    @param len number of bytes to add.
+*/
+static void pushRing( char const *data, size_t len )
+{
+  while ( len > 0 ) {
+    size_t head = ring.head;
+    size_t space;
+    while ( ( space = RING_SIZE -
+              ( head - __atomic_load_n( &ring.tail, __ATOMIC_ACQUIRE ) ) ) == 0 )
+      idle();
+
+    // Copy as much as fits before the end of the ring.
+    size_t start = head & ( RING_SIZE - 1 );
+    size_t n = len;
+    if ( n > space )
+      n = space;
+    if ( n > RING_SIZE - start )
+      n = RING_SIZE - start;
+    memcpy( ring.data + start, data, n );
+
+    __atomic_store_n( &ring.head, head + n, __ATOMIC_RELEASE );
+    data += n;
+    len -= n;
+  }
+}
+
+/** Send a block of output on its way, either to the writer thread or
+    straight to standard output.
+    @param data bytes to send.
+    @param len number of bytes to send.
+*/
+static void emitBytes( char const *data, size_t len )
+{
+  if ( buffer.sink )
+    buffer.sink( buffer.sinkData, data, len );
+  else if ( ring.running )
+    pushRing( data, len );
+  else
+    writeAll( data, len );
+}
+
+/** Send everything in the print buffer on its way, and empty it. */
+static void drainBuffer()
+{
+  if ( buffer.len )
+    emitBytes( buffer.data, buffer.len );
+  buffer.len = 0;
+}
+
+/** atexit() handler, to make sure all output is written, and the
+    writer thread is shut down.  This only flushes the main thread's
+    buffer, since it runs on the thread that calls exit(). */
+static void finishOutput()
+{
+  drainBuffer();
+  if ( ring.running ) {
+    __atomic_store_n( &ring.done, true, __ATOMIC_RELEASE );
+    pthread_join( ring.thread, NULL );
+    ring.running = false;
+  }
+}
+
+/** Register our atexit() handler. */
+static void registerFinish()
+{
+  atexit( finishOutput );
+}
+
+void flushOutputAtExit()
+{
+  pthread_once( &registered, registerFinish );
+}
+
+/** Get ready to buffer output, the first time this thread needs to. */
+static void startOutput()
+{
+  buffer.started = true;
+  buffer.lineMode = !buffer.sink && isatty( STDOUT_FILENO );
+}
+
+void redirectOutput( OutputSink sink, void *data )
+{
+  if ( !buffer.started )
+    startOutput();
+  drainBuffer();
+  buffer.sink = sink;
+  buffer.sinkData = data;
+  buffer.lineMode = !sink && isatty( STDOUT_FILENO );
+}
+
+void startWriterThread()
+{
+  if ( !buffer.started )
+    startOutput();
+
+  // Without a thread, we just write synchronously.
+  if ( pthread_create( &ring.thread, NULL, writerMain, NULL ) == 0 )
+    ring.running = true;
+}
+
+void printText( char const *text, size_t len )
+{
+  if ( !buffer.started )
+    startOutput();
+
+  if ( buffer.len + len > BUFFER_SIZE ) {
+    drainBuffer();
+
+    // Something too big for the buffer can go directly.
+    if ( len > BUFFER_SIZE ) {
+      emitBytes( text, len );
+      return;
+    }
+  }
+
+  memcpy( buffer.data + buffer.len, text, len );
+  buffer.len += len;
+}
+
+void printValue( Value const *val )
+{
+  if ( !buffer.started )
+    startOutput();
+
+  switch ( val->type ) {
+  case NUM_VAL:
+    // Format numbers right into the buffer.
+    if ( buffer.len + MAX_NUMBER + 1 > BUFFER_SIZE )
+      drainBuffer();
+    buffer.len += formatNumber( val->num, buffer.data + buffer.len );
+    break;
+  case STR_VAL:
+    printText( val->as.str->text, val->as.str->len );
+    break;
+  case ROPE_VAL:
+    // A rope's text is already in one piece, so it can be copied
+    // straight out of its buffer.
+    printText( ropeText( val->as.rope ), val->as.rope->len );
+    break;
+  case MAP_VAL:
+    // A map prints as the number of keys it has.
+    if ( buffer.len + MAX_NUMBER + 1 > BUFFER_SIZE )
+      drainBuffer();
+    buffer.len += formatNumber( mapSize( val->as.map ),
+                               buffer.data + buffer.len );
+    break;
+  case VEC_VAL:
+    // So does a vector, as its number of elements.
+    if ( buffer.len + MAX_NUMBER + 1 > BUFFER_SIZE )
+      drainBuffer();
+    buffer.len += formatNumber( val->as.vec->len, buffer.data + buffer.len );
+    break;
+  default:
+    if ( val->as.truth )
+      printText( "t", 1 );
+    break;
+  }
+
+  // On a terminal, behave like stdio and write each line as it's done.
+  if ( buffer.lineMode && memchr( buffer.data, '\n', buffer.len ) )
+    drainBuffer();
+}
+
+void flushOutput()
+{
+  drainBuffer();
+
+  // Wait for the writer thread to catch up.
+  while ( ring.running &&
+          __atomic_load_n( &ring.tail, __ATOMIC_ACQUIRE ) != ring.head )
+    idle();
+}
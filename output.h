@@ -0,0 +1,69 @@
+/**
+  @file output.h
+
+  Buffered output for print statements.  Printed values are formatted
+  straight into a large buffer and written to standard output with
+  a few big write() calls, instead of going through stdio on every
+  print.  Optionally, a background thread does the writing, so the
+  interpreter doesn't have to wait for it.
+
+  Each thread has its own buffer, and can send its output somewhere
+  else, like a file or a block of memory, with redirectOutput().  A
+  program can have the thread that exits flushed by an atexit()
+  handler, with flushOutputAtExit(), so everything it printed is
+  written even if it stops with exit(), like it does for a syntax
+  error.  Otherwise, and on other threads, flushOutput() has to be
+  called before the output is needed.
+*/
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include "expr.h"
+
+/** Function that takes output instead of standard output.
+    @param data pointer given to redirectOutput().
+    @param text bytes of output.
+    @param len number of bytes.
+*/
+typedef void (*OutputSink)( void *data, char const *text, size_t len );
+
+/** Flush output, and stop any writer thread, when the process exits.
+    Only the interpreter program does this.  The embedding library
+    leaves exit handlers alone, since it may be unloaded before the
+    process exits.
+*/
+void flushOutputAtExit();
+
+/** Hand all output off to a background writer thread.  This should be
+    called before anything is printed.
+*/
+void startWriterThread();
+
+/** Send everything printed on this thread to a function instead of
+    standard output.  Anything already printed is flushed first.
+    @param sink function to call with each block of output, or NULL to
+    go back to standard output.
+    @param data pointer to pass to sink.
+*/
+void redirectOutput( OutputSink sink, void *data );
+
+/** Print some text, as is.
+    @param text characters to print.
+    @param len number of characters.
+*/
+void printText( char const *text, size_t len );
+
+/** Print a value, exactly the way printf( "%s" ) would print the text
+    from valueToString().
+    @param val value to print.
+*/
+void printValue( Value const *val );
+
+/** Write everything that's been printed so far on this thread to
+    standard output, or to its sink.  If there's a writer thread, this
+    waits for it to finish.
+*/
+void flushOutput();
+
+#endif
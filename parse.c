@@ -1,4 +1,6 @@
 #include "parse.h"
+#include "num.h"
+#include "error.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -7,168 +9,126 @@
 // statements in a compound statement.
 #define INITIAL_CAPACITY 5
 
-//////////////////////////////////////////////////////////////////////
-// Input tokenization
-
-// Current line we're parsing, starting from 1 like most editors.
-static int lineCount = 1;
-
-/** Print a syntax error message, with a line number and exit. */
-static void syntaxError()
+// Function to call when there's a syntax error, if there is one.
+static void (*errorHandler)( int line ) = NULL;
+
+// Number of statements we're inside of.  Functions can only be defined
+// at the top level.  Like the scope below, this only matters during
+// one call to parseStmt(), so each thread has its own and scripts can
+// be parsed in parallel.
+static __thread int nesting = 0;
+
+/** Names local to the function being parsed.  A name is local if it's
+    a parameter, or if the function assigns to it anywhere in its body,
+    and every other name is a global.  Reads of a name are parsed as
+    globals until the name turns out to be local, so they're
+    collected, and the ones that need it are turned into locals at the
+    end of the body. */
+static __thread struct {
+  // True while we're parsing a function.
+  bool active;
+
+  // Variable slot for the name of each local, indexed by local.
+  int slots[ MAX_LOCALS ];
+  int len;
+
+  // Every variable read in the body, the number of them, and the
+  // capacity of the list.  Like a compound statement's list, this
+  // lives in the arena and is left behind when it grows.
+  Expr **reads;
+  int rlen, rcap;
+} scope;
+
+void onSyntaxError( void (*handler)( int line ) )
 {
-  fprintf( stderr, "line %d: syntax error\n", lineCount );
-  exit( EXIT_FAILURE );
+  errorHandler = handler;
 }
 
-bool parseToken( char *token, FILE *fp )
+/** Report a syntax error, with a line number.  This doesn't return.
+    @param lex lexer that was reading the bad syntax.
+*/
+static void syntaxError( Lexer *lex )
 {
-  int ch;
-
-  // Skip whitespace and comments.
-  while ( isspace( ch = fgetc( fp ) ) || ch == '#' ) {
-    // If we hit the comment characer, skip the whole line.
-    if ( ch == '#' )
-      while ( ( ch = fgetc( fp ) ) != EOF && ch != '\n' )
-        ;
-
-    if ( ch == '\n' )
-      lineCount++;
-  }
-    
-  if ( ch == EOF )
-    return false;
-
-  // Record the character we've read and keep up with the token length.
-  int len = 0;
-  token[ len++ ] = ch;
-
-  // Handle punctuation.  These get special treatment so we can
-  // unget as a single character, without having to read and unget
-  // whitespace characters afterward.
-  if ( ch == '}' || ch == ';' || ch == ')' ) {
-    token[ len++ ] = '\0';
-    return true;
-  }
-
-  // Handle non-quoted words.
-  if ( ch != '"' ) {
-    while ( ( ch = fgetc( fp ) ) != EOF && !isspace( ch ) &&
-            ch != '{' && ch != '}' && ch != '"' && ch != '#' ) {
-      // Complain if the token is too long.
-      if ( len >= MAX_TOKEN ) {
-        fprintf( stderr, "line %d: token too long\n", lineCount );
-        exit( EXIT_FAILURE );
-      }
-
-      token[ len++ ] = ch;
-    }
-
-    // We had to read one character too far to find the end of the token.
-    // put it back.
-    if ( ch != EOF )
-      ungetc( ch, fp );
-
-    token[ len++ ] = '\0';
-    return true;
-  }
-
-  // Most interesting case, handle strings.
-
-  // Is the next character escaped.
-  bool escape = false;
+  if ( errorHandler )
+    errorHandler( lexerLine( lex ) );
+  raiseErrorAt( lexerLine( lex ), "syntax error" );
+}
 
-  // Keep reading until we hit the matching close quote.
-  while ( ( ch = fgetc( fp ) ) != '"' || escape ) {
-    // Error conditions
-    if ( ch == EOF || ch == '\n' ) {
-      fprintf( stderr, "line %d: %s while reading parsing string literal.\n",
-               lineCount, ch == EOF ? "EOF" : "newline" );
-      exit( EXIT_FAILURE );
-    }
-      
-    // On a backslash, we just enable escape mode.
-    if ( !escape && ch == '\\' ) {
-      escape = true;
-    } else {
-      // Interpret escape sequences if we're in escape mode.
-      if ( escape ) {
-        switch ( ch ) {
-        case 'n':
-          ch = '\n';
-          break;
-        case 't':
-          ch = '\t';
-          break;
-        case '"':
-          ch = '"';
-          break;
-        case '\\':
-          ch = '\\';
-          break;
-        default:
-          fprintf( stderr, "line %d: Invalid escape sequence \"\\%c\"\n",
-                   lineCount, ch );
-          exit( EXIT_FAILURE );
-        }
-        escape = false;
-      }
+/** Record the source line an expression came from.
+    @param expr expression to mark.
+    @param lex lexer that's reading the expression.
+    @return expr, so this can wrap the call that made it.
+*/
+static Expr *exprAt( Expr *expr, Lexer *lex )
+{
+  expr->line = lexerLine( lex );
+  return expr;
+}
 
-      // Complain if this string, with the eventual close quote, is too long.
-      if ( len + 1 >= MAX_TOKEN ) {
-        fprintf( stderr, "line %d: token too long\n", lineCount );
-        exit( EXIT_FAILURE );
-      }
-      token[ len++ ] = ch;
-    }
-  }
-    
-  // Store the closing quote and the terminator and return.
-  token[ len++ ] = '"';
-  token[ len++ ] = '\0';
-  return token;
+/** Record the source line a statement starts on.
+    @param stmt statement to mark.
+    @param line line the statement's first token is on.
+    @return stmt, so this can wrap the call that made it.
+*/
+static Stmt *stmtAt( Stmt *stmt, int line )
+{
+  stmt->line = line;
+  return stmt;
 }
 
 /** Called when we expect another token on the input.  This function
-    parses the token and exits with an error if there isn't one.
-    @param storage for the next token, with capacity for at least
-    MAX_TOKEN characters.  This buffer will be modified by the parse
-    function as it reads additional tokens.
-    @param fp file tokens should be read from.
-    @return a copy of the pointer to the tok buffer, so this function
-    can be used as a parameter to other parsing calls.
+    parses the token and reports an error if there isn't one.
+    @param tok storage for the next token.  This will be modified by
+    the parse function as it reads additional tokens.
+    @param lex lexer tokens should be read from.
+    @return a copy of the pointer to tok, so this function can be used
+    as a parameter to other parsing calls.
 */
-static char *expectToken( char *tok, FILE *fp )
+static Token *expectToken( Token *tok, Lexer *lex )
 {
-  if ( !parseToken( tok, fp ) )
-    syntaxError();
+  if ( !parseToken( tok, lex ) )
+    syntaxError( lex );
   return tok;
 }
 
 /** Called when the next token, must be a particular value,
-    target.  Prints an error message and exits if it's not.
+    target.  Reports a syntax error if it's not.
     @param target string that the next token should match.
-    @param fp file tokens should be read from.
+    @param lex lexer tokens should be read from.
 */
-static void requireToken( char const *target, FILE *fp )
+static void requireToken( char const *target, Lexer *lex )
 {
-  char tok[ MAX_TOKEN + 1 ];
-  if ( strcmp( expectToken( tok, fp ), target ) != 0 )
-    syntaxError();
+  Token tok;
+  if ( !tokenIs( expectToken( &tok, lex ), target ) )
+    syntaxError( lex );
+}
+
+/** Copy the text of a token to a null-terminated string.
+    @param tok token to copy.
+    @param str storage for the copy, with room for tok->len + 1
+    characters.
+    @return str, so this can be used as a parameter to other calls.
+*/
+static char *tokenString( Token const *tok, char *str )
+{
+  memcpy( str, tok->text, tok->len );
+  str[ tok->len ] = '\0';
+  return str;
 }
 
 /** Return true if the given token is a legal number in our language (i.e.
-    if it parses with sscanf using %lf
+    if it parses the way sscanf reads %lf
     @param tok token parsed from the input.
     @return true if the given token is a legal numeric value.
 */
-static bool isNumber( char const *tok )
+static bool isNumber( Token const *tok )
 {
   double dummy;
-  int pos;
-  
+  char str[ MAX_TOKEN + 1 ];
+
   // See if the whole token parses as a double
-  return sscanf( tok, "%lf%n", &dummy, &pos ) == 1 &&
-    pos == strlen( tok );
+  return !tok->quoted &&
+    scanNumber( tokenString( tok, str ), &dummy ) == tok->len;
 }
 
 /** Return true if the given string is a legal identifier name
@@ -176,30 +136,87 @@ static bool isNumber( char const *tok )
     @param tok token parsed from the input.
     @return true if the given token is a legal identifier name.
 */
-static bool isIdentifier( char const *tok )
+static bool isIdentifier( Token const *tok )
 {
+  char const *text = tok->text;
+
   // Make sure the first character is legal.
-  if ( !isalpha( tok[ 0 ] ) && tok[ 0 ] != '_' )
+  if ( tok->quoted || ( !isalpha( text[ 0 ] ) && text[ 0 ] != '_' ) )
     return false;
 
   // Then, check the rest.
-  for ( int i = 1; tok[ i ]; i++ )
-    if ( !isalnum( tok[ i ] ) && tok[ i ] != '_' )
+  for ( int i = 1; i < tok->len; i++ )
+    if ( !isalnum( text[ i ] ) && text[ i ] != '_' )
       return false;
 
   // Make sure it's not too long
-  if ( strlen( tok ) > MAX_IDENT_LEN )
+  if ( tok->len > MAX_IDENT_LEN )
     return false;
 
-  // And, make sure it doesn't match a reserved word.
-  if ( strcmp( tok, "if" ) == 0 ||
-       strcmp( tok, "while" ) == 0 ||
-       strcmp( tok, "print" ) == 0 )
+  // And, make sure it doesn't match a reserved word.  Function and
+  // return are only keywords where a statement starts with them (see
+  // parseStatement()), so programs can still use them as names.
+  if ( tokenIs( tok, "if" ) ||
+       tokenIs( tok, "while" ) ||
+       tokenIs( tok, "print" ) )
     return false;
 
   return true;
 }
 
+/** Return the index of a local variable of the function being parsed.
+    @param slot variable slot for the local's name.
+    @return index of the local, or -1 if the name isn't local.
+*/
+static int findLocal( int slot )
+{
+  for ( int i = 0; i < scope.len; i++ )
+    if ( scope.slots[ i ] == slot )
+      return i;
+  return -1;
+}
+
+/** Return the index of a local variable of the function being parsed,
+    making the name local if it isn't yet.
+    @param slot variable slot for the local's name.
+    @param lex lexer reading the function, for reporting an error if
+    it has too many locals.
+    @return index of the local.
+*/
+static int addLocal( int slot, Lexer *lex )
+{
+  int index = findLocal( slot );
+  if ( index >= 0 )
+    return index;
+  if ( scope.len >= MAX_LOCALS )
+    syntaxError( lex );
+  scope.slots[ scope.len ] = slot;
+  return scope.len++;
+}
+
+/** Make an expression for reading a variable.  Inside a function, the
+    read is remembered, in case the name turns out to be local.
+    @param slot variable slot for the name.
+    @param lex lexer reading the expression.
+    @param arena arena to allocate the expression from.
+    @return the new expression.
+*/
+static Expr *readVariable( int slot, Lexer *lex, Arena *arena )
+{
+  Expr *var = exprAt( makeVariable( arena, slot ), lex );
+  if ( scope.active ) {
+    if ( scope.rlen >= scope.rcap ) {
+      scope.rcap *= 2;
+      Expr **bigger = (Expr **) arenaAlloc( arena,
+                                            scope.rcap * sizeof( Expr * ) );
+      memcpy( bigger, scope.reads, scope.rlen * sizeof( Expr * ) );
+      scope.reads = bigger;
+    }
+    scope.reads[ scope.rlen++ ] = var;
+  }
+  return var;
+}
+
 /** Return true if the given string is a binary operator in our language.
     @param tok token parsed from the input.
     @return true if the given token matches one of the binary operator.
@@ -224,11 +241,11 @@ static bool isBinaryOperator( char const *tok )
   @param *tok a pointer to the token
   @return true if the token is an arithmetic operator of high precedence
 */
-static bool isHiArithOperator( char const *tok )
+static bool isHiArithOperator( Token const *tok )
 {
   return 
-    strcmp( tok, "*" ) == 0 ||
-    strcmp( tok, "/" ) == 0;
+    tokenIs( tok, "*" ) ||
+    tokenIs( tok, "/" );
 }
 
 /**
@@ -238,43 +255,129 @@ static bool isHiArithOperator( char const *tok )
   @param *tok a pointer to the token
   @return true if the token is an arithmetic operator of low precedence
 */
-static bool isLowArithOperator( char const *tok )
+static bool isLowArithOperator( Token const *tok )
 {
   return 
-    strcmp( tok, "+" ) == 0 ||
-    strcmp( tok, "-" ) == 0;
+    tokenIs( tok, "+" ) ||
+    tokenIs( tok, "-" );
+}
+static Expr *parseTerm( Token *tok, Lexer *lex, Arena *arena );
+
+/** Parse the elements of a vector literal, after the opening bracket.
+    Each element is a term, so they can be separated by spaces.
+    @param tok storage for tokens read from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the expression from.
+    @return the expression object constructed from the input.
+*/
+static Expr *parseVector( Token *tok, Lexer *lex, Arena *arena )
+{
+  int len = 0;
+  int cap = INITIAL_CAPACITY;
+  Expr **elements = (Expr **) arenaAlloc( arena, cap * sizeof( Expr * ) );
+
+  // Like the statements in a compound statement, the list is left
+  // behind in the arena when it grows.
+  while ( !tokenIs( expectToken( tok, lex ), "]" ) ) {
+    if ( len >= cap ) {
+      cap *= 2;
+      Expr **bigger = (Expr **) arenaAlloc( arena, cap * sizeof( Expr * ) );
+      memcpy( bigger, elements, len * sizeof( Expr * ) );
+      elements = bigger;
+    }
+    elements[ len++ ] = parseTerm( tok, lex, arena );
+  }
+
+  return exprAt( makeCall( arena, VECTOR_FN, elements, len ), lex );
 }
+
+/** Parse the arguments of a call to a function the program defines,
+    after the opening parenthesis.  Arguments are separated by commas.
+    @param fn number of the function.
+    @param tok storage for tokens read from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the expression from.
+    @return the expression object constructed from the input.
+*/
+static Expr *parseInvoke( int fn, Token *tok, Lexer *lex, Arena *arena )
+{
+  int len = 0;
+  int cap = INITIAL_CAPACITY;
+  Expr **args = (Expr **) arenaAlloc( arena, cap * sizeof( Expr * ) );
+
+  if ( !tokenIs( expectToken( tok, lex ), ")" ) ) {
+    for ( ;; ) {
+      if ( len >= cap ) {
+        cap *= 2;
+        Expr **bigger = (Expr **) arenaAlloc( arena, cap * sizeof( Expr * ) );
+        memcpy( bigger, args, len * sizeof( Expr * ) );
+        args = bigger;
+      }
+      args[ len++ ] = parseExpr( tok, lex, arena );
+      if ( tokenIs( expectToken( tok, lex ), ")" ) )
+        break;
+      if ( !tokenIs( tok, "," ) )
+        syntaxError( lex );
+      expectToken( tok, lex );
+    }
+  }
+
+  return exprAt( makeInvoke( arena, fn, args, len ), lex );
+}
+
 /** Parse a building block for a larger expression, either a literal, a
-    variable, or an expression inside parentheses.
+    vector literal, a variable, a call to a built-in function or one
+    the program defines, a lookup in a map or vector, or an expression
+    inside parentheses.
     @param tok next token from the input.
-    @param fp file subsequent tokens are being read from.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the expression from.
     @return the expression object constructed from the input.
 */
-static Expr *parseTerm( char *tok, FILE *fp )
+static Expr *parseTerm( Token *tok, Lexer *lex, Arena *arena )
 {
-  // Create a literal token for a quoted string, without the quotes.
-  if ( tok[ 0 ] == '"' ) {
-    // Same as above, make a dynamically allocated copy of the string inside
-    // the quotes and make a new literal expression containing it.
-    int len = strlen( tok );
-    char *str = (char *) malloc( len - 1 );
-    strncpy( str, tok + 1, len - 2 );
-    str[ len - 2 ] = '\0';
-    return makeLiteral( str );
-  } else if ( isNumber( tok ) ) {
-    // Create a literal token for anything that looks like a number.
-    char *str = (char *) malloc( strlen( tok ) + 1 );
-    return makeLiteral( strcpy( str, tok ) );
-  } else if ( strcmp(tok, "(") == 0) {
-    Expr *paren = parseExpr(expectToken(tok, fp),fp);
-    requireToken(")", fp);
+  // Create a literal token for a quoted string, or for anything that
+  // looks like a number.  The literal keeps its own copy of the text,
+  // so we can make it right from the token.
+  if ( tok->quoted || isNumber( tok ) ) {
+    return exprAt( makeLiteral( arena, tok->text, tok->len ), lex );
+  } else if ( tokenIs(tok, "(") ) {
+    Expr *paren = parseExpr(expectToken(tok, lex),lex, arena);
+    requireToken(")", lex);
     return paren;
+  } else if ( tokenIs( tok, "[" ) ) {
+    return parseVector( tok, lex, arena );
   } else if (isIdentifier(tok)){
-    char name[MAX_IDENT_LEN + 1];
-    strcpy(name, tok);
-    return makeVariable(name);
+    // Resolve the variable to its slot now, so evaluating it
+    // doesn't have to look up the name.  A built-in function's name
+    // followed by parentheses is a call instead, so the names aren't
+    // reserved.
+    char name[ MAX_IDENT_LEN + 1 ];
+    tokenString( tok, name );
+    int fn = findBuiltin( tok->text, tok->len );
+    Expr *term;
+    Token next;
+    if ( !tokenIs( expectToken( &next, lex ), "(" ) ) {
+      ungetToken( &next, lex );
+      term = readVariable( variableSlot( name ), lex, arena );
+    } else if ( fn >= 0 ) {
+      Expr *arg = parseExpr( expectToken( tok, lex ), lex, arena );
+      requireToken( ")", lex );
+      term = exprAt( makeCall( arena, fn, &arg, 1 ), lex );
+    } else
+      term = parseInvoke( functionSlot( name ), tok, lex, arena );
+
+    // Any number of keys in brackets can follow, to look up a value in
+    // a map, or in a map stored in a map.
+    while ( tokenIs( expectToken( &next, lex ), "[" ) ) {
+      Expr *key = parseExpr( expectToken( tok, lex ), lex, arena );
+      requireToken( "]", lex );
+      term = exprAt( makeIndex( arena, term, key ), lex );
+    }
+    ungetToken( &next, lex );
+    return term;
   } else
-    syntaxError();
+    syntaxError( lex );
   
 
   // Not reached.
@@ -285,32 +388,31 @@ static Expr *parseTerm( char *tok, FILE *fp )
   Parse the expression with a high arithmetic operator.
   
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseHiArith( char *tok, FILE *fp ) {
-  Expr *left = parseTerm( tok, fp );
+Expr *parseHiArith( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseTerm( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( isHiArithOperator( expectToken( op, fp ) ) ) {
+  Token op;
+  while ( isHiArithOperator( expectToken( &op, lex ) ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseTerm( expectToken( tok, fp ), fp );
+    Expr *right = parseTerm( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "*" ) == 0 )
-      left = makeProduct( left, right );
-    if ( strcmp( op, "/" ) == 0 )
-      left = makeQuotient( left, right );
+    if ( tokenIs( &op, "*" ) )
+      left = exprAt( makeProduct( arena, left, right ), lex );
+    if ( tokenIs( &op, "/" ) )
+      left = exprAt( makeQuotient( arena, left, right ), lex );
   }
 
   // To end an expression, the next token must be ; or )
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  if (op[0] == '&' || op[0] == '|' || op[0] == '=')
-    ungetc(op[0], fp);
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 
 }
@@ -319,64 +421,86 @@ Expr *parseHiArith( char *tok, FILE *fp ) {
   Parse an expression with the low arithmetic operator.
   
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseLowArith( char *tok, FILE *fp ) {
-  Expr *left = parseHiArith( tok, fp );
+Expr *parseLowArith( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseHiArith( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( isLowArithOperator( expectToken( op, fp ) ) ) {
+  Token op;
+  while ( isLowArithOperator( expectToken( &op, lex ) ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseHiArith( expectToken( tok, fp ), fp );
+    Expr *right = parseHiArith( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "+" ) == 0 )
-      left = makeSum( left, right );
-    if ( strcmp( op, "-" ) == 0 )
-      left = makeDifference( left, right );
+    if ( tokenIs( &op, "+" ) )
+      left = exprAt( makeSum( arena, left, right ), lex );
+    if ( tokenIs( &op, "-" ) )
+      left = exprAt( makeDifference( arena, left, right ), lex );
   }
 
   // To end an expression, the next token must be ; or )
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  if (op[0] == '&' || op[0] == '|' || op[0] == '=')
-    ungetc(op[0], fp);
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 
 }
 
+/**
+  Parse an expression with the concatenation operator.
+
+  @param *tok a pointer to the token
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
+*/
+Expr *parseConcat( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseLowArith( tok, lex, arena );
+
+  // See if there's another oprator after this one.
+  Token op;
+  while ( tokenIs( expectToken( &op, lex ), ".." ) ) {
+    // Parse the right-hand operand.
+    Expr *right = parseLowArith( expectToken( tok, lex ), lex, arena );
+    left = exprAt( makeConcat( arena, left, right ), lex );
+  }
+
+  // Code that called us is going to expect to see this token, so we
+  // need to put it back on the input.
+  ungetToken( &op, lex );
+  return left;
+}
+
 /**
   Parse an expression with the comparison operator.
 
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseComp( char *tok, FILE *fp ) {
-  Expr *left = parseLowArith( tok, fp );
+Expr *parseComp( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseConcat( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( strcmp( expectToken( op, fp ), "<" ) == 0 ) {
+  Token op;
+  while ( tokenIs( expectToken( &op, lex ), "<" ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseLowArith( expectToken( tok, fp ), fp );
+    Expr *right = parseConcat( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "<" ) == 0 )
-      left = makeLess( left, right );
+    if ( tokenIs( &op, "<" ) )
+      left = exprAt( makeLess( arena, left, right ), lex );
   }
 
   // To end an expression, the next token must be ; or )
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  if (op[0] == '&' || op[0] == '|' || op[0] == '=')
-    ungetc(op[0], fp);
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 
 }
@@ -385,30 +509,29 @@ Expr *parseComp( char *tok, FILE *fp ) {
   Parse an expression evaluating equivalency.
 
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseEquals( char *tok, FILE *fp ) {
-  Expr *left = parseComp( tok, fp );
+Expr *parseEquals( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseComp( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( strcmp( expectToken( op, fp ), "==" ) == 0 ) {
+  Token op;
+  while ( tokenIs( expectToken( &op, lex ), "==" ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseComp( expectToken( tok, fp ), fp );
+    Expr *right = parseComp( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "==" ) == 0 )
-      left = makeEquals( left, right );
+    if ( tokenIs( &op, "==" ) )
+      left = exprAt( makeEquals( arena, left, right ), lex );
   }
 
   // To end an expression, the next token must be ; or )
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  if (op[0] == '&' || op[0] == '|' || op[0] == '=')
-    ungetc(op[0], fp);
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 
 }
@@ -417,30 +540,29 @@ Expr *parseEquals( char *tok, FILE *fp ) {
   Parse an expression with the AND operator.
 
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseAnd( char *tok, FILE *fp ) {
-  Expr *left = parseEquals( tok, fp );
+Expr *parseAnd( Token *tok, Lexer *lex, Arena *arena ) {
+  Expr *left = parseEquals( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( strcmp( expectToken( op, fp ), "&&" ) == 0 ) {
+  Token op;
+  while ( tokenIs( expectToken( &op, lex ), "&&" ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseEquals( expectToken( tok, fp ), fp );
+    Expr *right = parseEquals( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "&&" ) == 0 )
-      left = makeAnd( left, right );
+    if ( tokenIs( &op, "&&" ) )
+      left = exprAt( makeAnd( arena, left, right ), lex );
   }
 
   // To end an expression, the next token must be ; or )
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  if (op[0] == '&' || op[0] == '|' || op[0] == '=')
-    ungetc(op[0], fp);
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 
 }
@@ -450,92 +572,233 @@ Expr *parseAnd( char *tok, FILE *fp ) {
   depending on operator precedence.
 
   @param *tok a pointer to the token
-  @param *fp a pointer to the file stream
+  @param *lex a pointer to the lexer
+  @param *arena arena to allocate the expression from
 */
-Expr *parseExpr( char *tok, FILE *fp )
+Expr *parseExpr( Token *tok, Lexer *lex, Arena *arena )
 {
   // Parse the expression, or just the left-hand operatnd of a longer
   // expression.
-  Expr *left = parseAnd( tok, fp );
+  Expr *left = parseAnd( tok, lex, arena );
   
   // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( strcmp( expectToken( op, fp ), "||" ) == 0 ) {
+  Token op;
+  while ( tokenIs( expectToken( &op, lex ), "||" ) ) {
     // Parse the right-hand operand.
-    Expr *right = parseAnd( expectToken( tok, fp ), fp );
+    Expr *right = parseAnd( expectToken( tok, lex ), lex, arena );
 
     // Create the right type of expression, based on what binary
     // operator it is.
-    if ( strcmp( op, "||" ) == 0 )
-      left = makeOr( left, right );
+    if ( tokenIs( &op, "||" ) )
+      left = exprAt( makeOr( arena, left, right ), lex );
   }
 
-  // To end an expression, the next token must be ; or )
-  if ( strcmp( op, ";" ) != 0 && strcmp( op, ")" ) != 0 )
-    syntaxError();
+  // To end an expression, the next token must be ; or ), or ] after
+  // a key, or , between arguments.
+  if ( !tokenIs( &op, ";" ) && !tokenIs( &op, ")" ) &&
+       !tokenIs( &op, "]" ) && !tokenIs( &op, "," ) )
+    syntaxError( lex );
 
   // Code that called us is going to expect to see this token, so we
   // need to put it back on the input.
-  ungetc( op[ 0 ], fp );
+  ungetToken( &op, lex );
   return left;
 }
 
-Stmt *parseStmt( char *tok, FILE *fp )
+static Stmt *parseStatement( Token *tok, Lexer *lex, Arena *arena );
+
+/** Parse a statement that's part of another one.
+    @param tok next token from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the statement from.
+    @return the statement object constructed from the input.
+*/
+static Stmt *parseInner( Token *tok, Lexer *lex, Arena *arena )
+{
+  nesting++;
+  Stmt *stmt = parseStatement( tok, lex, arena );
+  nesting--;
+  return stmt;
+}
+
+/** Parse a function definition, after the function keyword.  The
+    parameters are names separated by commas, and the body is a
+    compound statement.
+    @param tok storage for tokens read from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the statement from.
+    @return the statement object constructed from the input.
+*/
+static Stmt *parseFunction( Token *tok, Lexer *lex, Arena *arena )
+{
+  // Calls to a built-in function can't be told apart from calls to one
+  // with the same name, so those names aren't allowed.
+  char name[ MAX_IDENT_LEN + 1 ];
+  if ( !isIdentifier( expectToken( tok, lex ) ) ||
+       findBuiltin( tok->text, tok->len ) >= 0 )
+    syntaxError( lex );
+  int fn = functionSlot( tokenString( tok, name ) );
+
+  scope.active = true;
+  scope.len = 0;
+  scope.rlen = 0;
+  scope.rcap = INITIAL_CAPACITY;
+  scope.reads = (Expr **) arenaAlloc( arena, scope.rcap * sizeof( Expr * ) );
+  requireToken( "(", lex );
+  if ( !tokenIs( expectToken( tok, lex ), ")" ) ) {
+    for ( ;; ) {
+      if ( !isIdentifier( tok ) )
+        syntaxError( lex );
+      int slot = variableSlot( tokenString( tok, name ) );
+      if ( findLocal( slot ) >= 0 )
+        syntaxError( lex );
+      addLocal( slot, lex );
+      if ( tokenIs( expectToken( tok, lex ), ")" ) )
+        break;
+      if ( !tokenIs( tok, "," ) )
+        syntaxError( lex );
+      expectToken( tok, lex );
+    }
+  }
+  int params = scope.len;
+
+  if ( !tokenIs( expectToken( tok, lex ), "{" ) )
+    syntaxError( lex );
+  Stmt *body = parseInner( tok, lex, arena );
+
+  // Now we know every local, so reads of them can find them.
+  for ( int i = 0; i < scope.rlen; i++ ) {
+    int index = findLocal( variableExprSlot( scope.reads[ i ] ) );
+    if ( index >= 0 )
+      localizeVariable( scope.reads[ i ], index );
+  }
+  scope.active = false;
+
+  return makeFunction( arena, fn, params, body );
+}
+
+/** Parse any statement, at the top level or inside another one.
+    @param tok next token from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the statement from.
+    @return the statement object constructed from the input.
+*/
+static Stmt *parseStatement( Token *tok, Lexer *lex, Arena *arena )
 {
+  int line = lexerLine( lex );
+
   // Handle compound statements
-  if ( strcmp( tok, "{" ) == 0 ) {
+  if ( tokenIs( tok, "{" ) ) {
     int len = 0;
     int cap = INITIAL_CAPACITY;
-    Stmt **stmtList = (Stmt **) malloc( cap * sizeof( Stmt * ) );
+    Stmt **stmtList = (Stmt **) arenaAlloc( arena, cap * sizeof( Stmt * ) );
 
     // Keep parsing statements until we hit the closing curly bracket.
-    while ( strcmp( expectToken( tok, fp ), "}" ) != 0 ) {
+    // The list lives in the arena too, so when it grows we just leave
+    // the old copy behind.
+    while ( !tokenIs( expectToken( tok, lex ), "}" ) ) {
       if ( len >= cap ) {
         cap *= 2;
-        stmtList = (Stmt **) realloc( stmtList, cap * sizeof( Stmt * ) );
+        Stmt **bigger = (Stmt **) arenaAlloc( arena, cap * sizeof( Stmt * ) );
+        memcpy( bigger, stmtList, len * sizeof( Stmt * ) );
+        stmtList = bigger;
       }
-      stmtList[ len++ ] = parseStmt( tok, fp );
+      stmtList[ len++ ] = parseInner( tok, lex, arena );
     }
 
-    return makeCompound( stmtList, len );
+    return stmtAt( makeCompound( arena, stmtList, len ), line );
+  }
+
+  // A statement starting with function or return is a definition or a
+  // return, unless it's assigning to a variable with that name.  A
+  // bracket after return starts a vector to return, not a key.
+  if ( tokenIs( tok, "function" ) || tokenIs( tok, "return" ) ) {
+    Token next;
+    bool function = tokenIs( tok, "function" );
+    bool assigned = tokenIs( expectToken( &next, lex ), "=" ) ||
+      ( function && tokenIs( &next, "[" ) );
+    ungetToken( &next, lex );
+
+    if ( !assigned && function ) {
+      if ( nesting > 0 || scope.active )
+        syntaxError( lex );
+      return stmtAt( parseFunction( tok, lex, arena ), line );
+    }
+
+    if ( !assigned ) {
+      if ( !scope.active )
+        syntaxError( lex );
+      Expr *expr = parseExpr( expectToken( tok, lex ), lex, arena );
+      requireToken( ";", lex );
+      return stmtAt( makeReturn( arena, expr ), line );
+    }
   }
 
   if (isIdentifier(tok)) {
     char name[ MAX_IDENT_LEN + 1 ];
-    strcpy(name, tok);
-    //printf("assinment\n");
-    requireToken("=", fp);
-    Expr *lval = parseExpr(expectToken(tok, fp), fp);
-    requireToken(";", fp);
-    return makeAssignment( name, lval );
+    int slot = variableSlot(tokenString(tok, name));
+
+    // An assignment to a map gives the key in brackets.
+    Expr *key = NULL;
+    if ( tokenIs( expectToken( tok, lex ), "[" ) ) {
+      key = parseExpr( expectToken( tok, lex ), lex, arena );
+      requireToken( "]", lex );
+      expectToken( tok, lex );
+    }
+    if ( !tokenIs( tok, "=" ) )
+      syntaxError( lex );
+
+    Expr *lval = parseExpr(expectToken(tok, lex), lex, arena);
+    requireToken(";", lex);
+
+    // Inside a function, anything assigned is local.
+    if ( scope.active ) {
+      int index = addLocal( slot, lex );
+      if ( key )
+        return stmtAt( makeLocalKeyAssignment( arena, index, key, lval ),
+                       line );
+      return stmtAt( makeLocalAssignment( arena, index, lval ), line );
+    }
+    if ( key )
+      return stmtAt( makeKeyAssignment( arena, slot, key, lval ), line );
+    return stmtAt( makeAssignment( arena, slot, lval ), line );
 
   }
 
-  if (strcmp(tok, "if") == 0) {
-    requireToken("(", fp);
-    Expr *cond = parseExpr(expectToken(tok, fp), fp);
-    requireToken(")", fp);
-    Stmt *body = parseStmt(expectToken(tok, fp), fp);
-    return makeIf(cond, body);
+  if (tokenIs(tok, "if")) {
+    requireToken("(", lex);
+    Expr *cond = parseExpr(expectToken(tok, lex), lex, arena);
+    requireToken(")", lex);
+    Stmt *body = parseInner( expectToken( tok, lex ), lex, arena );
+    return stmtAt( makeIf(arena, cond, body), line );
   }
 
-  if (strcmp(tok, "while") == 0) {
-    requireToken("(", fp);
-    Expr *cond = parseExpr(expectToken(tok, fp), fp);
-    requireToken(")", fp);
-    Stmt *body = parseStmt(expectToken(tok, fp), fp);
-    return makeWhile(cond, body);
+  if (tokenIs(tok, "while")) {
+    requireToken("(", lex);
+    Expr *cond = parseExpr(expectToken(tok, lex), lex, arena);
+    requireToken(")", lex);
+    Stmt *body = parseInner( expectToken( tok, lex ), lex, arena );
+    return stmtAt( makeWhile(arena, cond, body), line );
   }
 
   // Figure out what type of statement this is based on the next token.
-  if ( strcmp( tok, "print" ) == 0 ) {
+  if ( tokenIs( tok, "print" ) ) {
     // Parse the one argument to print, and create a print expression.
-    Expr *arg = parseExpr( expectToken( tok, fp ), fp );
-    requireToken( ";", fp );
-    return makePrint( arg );
+    Expr *arg = parseExpr( expectToken( tok, lex ), lex, arena );
+    requireToken( ";", lex );
+    return stmtAt( makePrint( arena, arg ), line );
   } else
-    syntaxError();
+    syntaxError( lex );
 
   // Never reached.
   return NULL;
 }
+
+Stmt *parseStmt( Token *tok, Lexer *lex, Arena *arena )
+{
+  // A syntax error can jump out of the middle of a statement, so the
+  // last one may have left us inside a function.
+  nesting = 0;
+  scope.active = false;
+  return parseStatement( tok, lex, arena );
+}
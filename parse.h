@@ -2,7 +2,7 @@
   @file parse.h
   @author Arthur Vargas (ahvargas@ncsu.edu)
 
-  Parser and tokenizer functions.
+  Parser functions.  Tokens come from the lexer in lex.h.
 */
 
 #ifndef _PARSE_H_
@@ -13,40 +13,36 @@
 
 #include "expr.h"
 #include "stmt.h"
-
-//////////////////////////////////////////////////////////////////////
-// Input totkenization
-
-// Maximum length of a token in the source file.
-#define MAX_TOKEN 1023
-
-/** Read the next token from the given file, a space-delimtied word, a
-    double quoted string or closing parentheses, crly brackets or a
-    semi-colon..
-    @param tok storage for the token, with room for a string of up to
-     MAX_TOKEN characters.
-    @param fp file to read tokens from.
-    @return true if the token is successfully read.
-*/
-bool parseToken( char *token, FILE *fp );
+#include "lex.h"
 
 /** Parse with one token worth of look-ahead, return the Expr
     object representing the next legal expression from the input.
     @param tok next token from the input, already read before
     calling this function.
-    @param fp file subsequent tokens are being read from.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the expression from.
     @return the Expr object constructed from the input.
 */
-Expr *parseExpr( char *tok, FILE *fp );
+Expr *parseExpr( Token *tok, Lexer *lex, Arena *arena );
 
 /** Parse with one token worth of look-ahead, return the Stmt
     object representing the next legal statement from the input.
     @param tok next token from the input, already read before
     calling this function.
-    @param fp file subsequent tokens are being read from.
-    @return the Stmt object constructed from the input.
+    @param lex lexer subsequent tokens are being read from.
+    @param arena arena to allocate the statement from.  Resetting
+    the arena frees the statement, and everything it contains.
+    @return the Stmt object constructed from the input.  A syntax
+    error is reported with raiseError(), so if there's an error trap,
+    parsing can start again with a fresh lexer.
+*/
+Stmt *parseStmt( Token *tok, Lexer *lex, Arena *arena );
+
+/** Set a function for the parser to call when it finds a syntax error,
+    just before it reports the error.
+    @param handler function to call, with the line the error is on.
 */
-Stmt *parseStmt( char *tok, FILE *fp );
+void onSyntaxError( void (*handler)( int line ) );
 
 #endif
 
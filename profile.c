@@ -0,0 +1,329 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Added to the source file name to get the JSON report's name.
+#define PROFILE_SUFFIX ".profile.json"
+
+// Initial capacity for the table of lines.
+#define INITIAL_CAPACITY 64
+
+// Most characters of a source line shown in the report.
+#define MAX_SHOWN 40
+
+/** Everything measured for one line of the source. */
+typedef struct {
+  // Number of times statements on this line started.
+  uint64_t count;
+
+  // Time spent in statements on this line, with and without the
+  // statements inside them, in clock ticks.
+  uint64_t inclusive;
+  uint64_t exclusive;
+
+  // Number of statements on this line running right now.  Inclusive
+  // time is only added when this gets back to zero, so a loop and its
+  // body on the same line don't count the same time twice.
+  int active;
+} LineProfile;
+
+/** Representation for a profiled statement, derived from Stmt.  It
+    copies the kind and line of the statement it wraps. */
+typedef struct {
+  void (*execute)( Stmt *stmt, Context *ctxt );
+  StmtKind kind;
+  int line;
+
+  /** Statement we're measuring. */
+  Stmt *inner;
+} ProfiledStmt;
+
+/** Everything the profiler keeps while the program runs. */
+static struct {
+  // Name of the JSON report, and our copy of the program's source.
+  char *reportName;
+  char *source;
+  size_t sourceLen;
+
+  // Measurements for each line, indexed by line number.
+  LineProfile *lines;
+  int cap;
+
+  // Ticks spent in profiled statements inside the one running now.
+  uint64_t childTime;
+
+  // Clock and tick count when profiling started, for converting ticks
+  // to nanoseconds at the end.
+  uint64_t startNanos;
+  uint64_t startTicks;
+} prof;
+
+/** Return the time from a monotonic clock.
+    @return current time in nanoseconds.
+*/
+static uint64_t nanos()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/** Return a cheap timestamp, in ticks of whatever clock is fastest to
+    read.  On x86-64 that's the time stamp counter, elsewhere it's the
+    monotonic clock.
+    @return current tick count.
+*/
+static inline uint64_t ticks()
+{
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return nanos();
+#endif
+}
+
+/** Return the measurements for a line, growing the table if needed.
+    @param line line number.
+    @return measurements for line.
+*/
+static LineProfile *lineProfile( int line )
+{
+  if ( line >= prof.cap ) {
+    int oldCap = prof.cap;
+    while ( line >= prof.cap )
+      prof.cap = prof.cap ? prof.cap * 2 : INITIAL_CAPACITY;
+    prof.lines = (LineProfile *) realloc( prof.lines,
+                                          prof.cap * sizeof( LineProfile ) );
+    memset( prof.lines + oldCap, 0,
+            ( prof.cap - oldCap ) * sizeof( LineProfile ) );
+  }
+  return &prof.lines[ line ];
+}
+
+// Function to execute a profiled statement.
+static void executeProfiled( Stmt *stmt, Context *ctxt )
+{
+  // Cast the this pointer to a more specific type.
+  ProfiledStmt *this = (ProfiledStmt *)stmt;
+
+  LineProfile *lp = lineProfile( this->line );
+  lp->count++;
+  lp->active++;
+
+  // Time the statement, keeping the time of profiled statements inside
+  // it separate from what was measured before it started.
+  uint64_t outerChildren = prof.childTime;
+  prof.childTime = 0;
+  uint64_t start = ticks();
+
+  this->inner->execute( this->inner, ctxt );
+
+  uint64_t elapsed = ticks() - start;
+
+  // The table may have moved while the statement ran.
+  lp = &prof.lines[ this->line ];
+  lp->active--;
+  lp->exclusive += elapsed - prof.childTime;
+  if ( lp->active == 0 )
+    lp->inclusive += elapsed;
+  prof.childTime = outerChildren + elapsed;
+}
+
+/** Wrap a statement so it's measured.
+    @param stmt statement to measure.
+    @param arena arena to allocate the wrapper from.
+    @return the wrapper.
+*/
+static Stmt *makeProfiled( Stmt *stmt, Arena *arena )
+{
+  ProfiledStmt *this = (ProfiledStmt *) arenaAlloc( arena,
+                                                    sizeof( ProfiledStmt ) );
+  this->execute = executeProfiled;
+  this->kind = stmt->kind;
+  this->line = stmt->line;
+  this->inner = stmt;
+
+  // Make sure the table is big enough before the statement runs.
+  lineProfile( stmt->line );
+  return (Stmt *) this;
+}
+
+Stmt *profileStmt( Stmt *stmt, Arena *arena )
+{
+  Stmt *copy = stmt;
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT: {
+    // A block just runs its statements, so only they are measured.
+    int len = compoundLength( stmt );
+    Stmt **list = (Stmt **) arenaAlloc( arena, ( len + 1 ) * sizeof( Stmt * ) );
+    for ( int i = 0; i < len; i++ )
+      list[ i ] = profileStmt( compoundStmt( stmt, i ), arena );
+    copy = makeCompound( arena, list, len );
+    copy->line = stmt->line;
+    return copy;
+  }
+
+  case IF_STMT:
+    copy = makeIf( arena, stmtExpr( stmt ),
+                   profileStmt( stmtBody( stmt ), arena ) );
+    copy->line = stmt->line;
+    break;
+
+  case WHILE_STMT:
+    copy = makeWhile( arena, stmtExpr( stmt ),
+                      profileStmt( stmtBody( stmt ), arena ) );
+    copy->line = stmt->line;
+    break;
+
+  case FUNCTION_STMT:
+    // The body stays the way the definition set it up, so a call is
+    // measured as part of the statement that makes it.
+    break;
+
+  default:
+    break;
+  }
+
+  // Statements the optimizer made up don't belong to any line.
+  if ( copy->line == 0 )
+    return copy;
+  return makeProfiled( copy, arena );
+}
+
+/** Find the text of a line of the source.
+    @param line line number, starting from 1.
+    @param len returns the number of characters on the line.
+    @return start of the line, or NULL if the source is shorter.
+*/
+static char const *sourceLine( int line, int *len )
+{
+  char const *p = prof.source;
+  char const *end = prof.source + prof.sourceLen;
+  for ( int i = 1; i < line && p < end; i++ ) {
+    char const *nl = memchr( p, '\n', end - p );
+    p = nl ? nl + 1 : end;
+  }
+  if ( p >= end )
+    return NULL;
+
+  char const *nl = memchr( p, '\n', end - p );
+  *len = ( nl ? nl : end ) - p;
+  return p;
+}
+
+/** Comparison function for sorting lines by exclusive time, longest
+    first, then by line number. */
+static int compareLines( void const *a, void const *b )
+{
+  LineProfile const *la = &prof.lines[ *(int const *) a ];
+  LineProfile const *lb = &prof.lines[ *(int const *) b ];
+  if ( la->exclusive != lb->exclusive )
+    return la->exclusive < lb->exclusive ? 1 : -1;
+  return *(int const *) a - *(int const *) b;
+}
+
+/** Write a string as a JSON string literal.
+    @param fp stream to write to.
+    @param text text to write.
+    @param len number of characters in text.
+*/
+static void writeJsonString( FILE *fp, char const *text, int len )
+{
+  fputc( '"', fp );
+  for ( int i = 0; i < len; i++ ) {
+    unsigned char ch = text[ i ];
+    if ( ch == '"' || ch == '\\' )
+      fprintf( fp, "\\%c", ch );
+    else if ( ch < 0x20 )
+      fprintf( fp, "\\u%04x", ch );
+    else
+      fputc( ch, fp );
+  }
+  fputc( '"', fp );
+}
+
+/** atexit() handler, to write both reports and free everything. */
+static void finishProfile()
+{
+  // Work out how long a tick is, from the whole run.
+  uint64_t ns = nanos() - prof.startNanos;
+  uint64_t tk = ticks() - prof.startTicks;
+  double scale = tk ? (double) ns / tk : 1.0;
+
+  // Lines that ran, busiest first.
+  int *order = (int *) malloc( ( prof.cap + 1 ) * sizeof( int ) );
+  int count = 0;
+  for ( int line = 1; line < prof.cap; line++ )
+    if ( prof.lines[ line ].count )
+      order[ count++ ] = line;
+  qsort( order, count, sizeof( int ), compareLines );
+
+  fprintf( stderr, "%6s %12s %12s %12s  %s\n", "line", "count",
+           "incl ms", "excl ms", "source" );
+  for ( int i = 0; i < count; i++ ) {
+    LineProfile const *lp = &prof.lines[ order[ i ] ];
+    int len = 0;
+    char const *text = sourceLine( order[ i ], &len );
+    while ( len > 0 && ( *text == ' ' || *text == '\t' ) ) {
+      text++;
+      len--;
+    }
+    if ( len > MAX_SHOWN )
+      len = MAX_SHOWN;
+    fprintf( stderr, "%6d %12llu %12.3f %12.3f  %.*s\n", order[ i ],
+             (unsigned long long) lp->count, lp->inclusive * scale / 1e6,
+             lp->exclusive * scale / 1e6, len, text ? text : "" );
+  }
+
+  FILE *fp = fopen( prof.reportName, "w" );
+  if ( fp ) {
+    fprintf( fp, "{\n  \"total_ns\": %llu,\n  \"lines\": [",
+             (unsigned long long) ns );
+    for ( int i = 0; i < count; i++ ) {
+      LineProfile const *lp = &prof.lines[ order[ i ] ];
+      int len = 0;
+      char const *text = sourceLine( order[ i ], &len );
+      fprintf( fp, "%s\n    { \"line\": %d, \"count\": %llu, "
+               "\"inclusive_ns\": %.0f, \"exclusive_ns\": %.0f, "
+               "\"source\": ", i ? "," : "", order[ i ],
+               (unsigned long long) lp->count, lp->inclusive * scale,
+               lp->exclusive * scale );
+      writeJsonString( fp, text ? text : "", len );
+      fprintf( fp, " }" );
+    }
+    fprintf( fp, "\n  ]\n}\n" );
+    fclose( fp );
+  } else
+    fprintf( stderr, "Can't write profile: %s\n", prof.reportName );
+
+  free( order );
+  free( prof.lines );
+  free( prof.source );
+  free( prof.reportName );
+}
+
+void startProfile( char const *path, char const *source, size_t len )
+{
+  prof.reportName = (char *) malloc( strlen( path ) +
+                                     sizeof( PROFILE_SUFFIX ) );
+  strcpy( prof.reportName, path );
+  strcat( prof.reportName, PROFILE_SUFFIX );
+
+  prof.source = (char *) malloc( len + 1 );
+  memcpy( prof.source, source, len );
+  prof.sourceLen = len;
+
+  prof.startNanos = nanos();
+  prof.startTicks = ticks();
+  atexit( finishProfile );
+}
@@ -0,0 +1,45 @@
+/**
+  @file profile.h
+
+  Line-level execution profiler.  Statements are wrapped in nodes that
+  count how often each source line runs and time it, both inclusive
+  of the statements inside it and exclusive of them.  When the program
+  exits, a report sorted by exclusive time is written to standard
+  error, and the same numbers are written as JSON to a file next to
+  the source.
+
+  Only wrapped statements are measured, so a run without profiling
+  pays nothing for it.  Wrapped statements only run in the tree-walking
+  interpreter.
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stddef.h>
+
+#include "stmt.h"
+
+/** Start profiling a program.  The report is written by an atexit()
+    handler, so it's written even if the program stops with exit(),
+    like it does for a syntax error.
+    @param path name of the program's source file.  The JSON report is
+    written to this name with ".profile.json" added.
+    @param source text of the program, for showing each line in the
+    report.  The profiler keeps its own copy.
+    @param len number of characters in source.
+*/
+void startProfile( char const *path, char const *source, size_t len );
+
+/** Return a copy of a statement that records its time and execution
+    count, and that of every statement inside it, by source line.  The
+    copy should only be run, with its execute function, not inspected
+    by other passes.  Statements in the body of a function aren't
+    wrapped, so the time for a call counts toward the line making it.
+    @param stmt statement to profile.
+    @param arena arena to allocate the copy from.
+    @return the profiled copy of stmt.
+*/
+Stmt *profileStmt( Stmt *stmt, Arena *arena );
+
+#endif
@@ -1,5 +1,7 @@
 #include "stmt.h"
 #include "expr.h"
+#include "output.h"
+#include "jit.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,7 +11,8 @@
 // Representation for a print statement, derived from Stmt.
 typedef struct {
   void (*execute)( Stmt *stmt, Context *ctxt );
-  void (*destroy)( Stmt *stmt );
+  StmtKind kind;
+  int line;
 
   /** Argument expression we're supposed to evaluate and print. */
   Expr *arg;
@@ -17,11 +20,17 @@ typedef struct {
 
 typedef struct {
   void (*execute)( Stmt *stmt, Context *ctxt );
-  void (*destroy)( Stmt *stmt );
+  StmtKind kind;
+  int line;
 
-  /** Argument expression we're supposed to evaluate and print. */
-  char vname[MAX_IDENT_LEN + 1];
+  /** Slot of the variable we assign to. */
+  int slot;
+
+  /** Expression we evaluate to get the new value. */
   Expr *lval;
+
+  /** For an assignment to a map, expression for the key, or NULL. */
+  Expr *key;
 } AssignStmt;
 
 // Function to execute a print statemenchar const *vnamet.
@@ -30,31 +39,31 @@ static void executePrint( Stmt *stmt, Context *ctxt )
   // Cast the this pointer to a more specific type.
   PrintStmt *this = (PrintStmt *)stmt;
 
-  // Evaluate our argument, print the result, then free it.
-  char *result = this->arg->eval( this->arg, ctxt );
-  printf( "%s", result );
-  free( result );
+  // Evaluate our argument, then print it.  This is the only place
+  // numbers need to get turned into text.
+  Value result = this->arg->eval( this->arg, ctxt );
+  printValue( &result );
 }
 
-// Function to free a print statement.
-static void destroyPrint( Stmt *stmt )
+// Print function for an argument that makes temporaries, releasing
+// them once they're printed.
+static void executePrintTemps( Stmt *stmt, Context *ctxt )
 {
-  // Cast the this pointer to a more specific type.
-  PrintStmt *this = (PrintStmt *)stmt;
-
-  // Free our subexpression then the print statement itself.
-  this->arg->destroy( this->arg );
-  free( this );
+  int mark = temporaryMark( ctxt );
+  executePrint( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
 }
 
-Stmt *makePrint( Expr *arg )
+Stmt *makePrint( Arena *arena, Expr *arg )
 {
   // Allocate space for the PrintStmt object
-  PrintStmt *this = (PrintStmt *) malloc( sizeof( PrintStmt ) );
+  PrintStmt *this = (PrintStmt *) arenaAlloc( arena, sizeof( PrintStmt ) );
 
-  // Remember our virutal functions.
-  this->execute = executePrint;
-  this->destroy = destroyPrint;
+  // Remember our virutal functions.  Only statements that need to
+  // release temporaries pay for it.
+  this->execute = makesTemporaries( arg ) ? executePrintTemps : executePrint;
+  this->kind = PRINT_STMT;
+  this->line = 0;
 
   // Remember our argument subexpression.
   this->arg = arg;
@@ -69,36 +78,64 @@ static void executeAssign( Stmt *stmt, Context *ctxt )
   // Cast the this pointer to a more specific type.
   AssignStmt *this = (AssignStmt *)stmt;
 
-  // Evaluate our argument, print the result, then free it.
-  char *result = this->lval->eval( this->lval, ctxt );
-  setVariable( ctxt, this->vname, result );
-  free( result );
+  // Evaluate our argument and store the result in the variable.
+  Value result = this->lval->eval( this->lval, ctxt );
+  setSlot( ctxt, this->slot, result );
 }
 
-// Function to free an assignment statement.
-static void destroyAssign( Stmt *stmt )
+// Assignment function for an expression that makes temporaries.  The
+// variable holds its own reference to the result, so the temporaries
+// can be released right away.
+static void executeAssignTemps( Stmt *stmt, Context *ctxt )
 {
+  int mark = temporaryMark( ctxt );
+  executeAssign( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
 
-  //printf("in destroy assign\n");
+Stmt *makeAssignment( Arena *arena, int slot, Expr *expr ) {
+  AssignStmt *this = (AssignStmt *) arenaAlloc( arena, sizeof ( AssignStmt ) );
 
-  // Cast the this pointer to a more specific type.
+  this->execute = makesTemporaries( expr ) ? executeAssignTemps : executeAssign;
+  this->kind = ASSIGN_STMT;
+  this->line = 0;
+
+  this->lval = expr;
+  this->slot = slot;
+  this->key = NULL;
+  return (Stmt *) this;
+}
+
+// Function to execute an assignment to a key of a map.
+static void executeAssignKey( Stmt *stmt, Context *ctxt )
+{
   AssignStmt *this = (AssignStmt *)stmt;
 
-  // Free our subexpression then the print statement itself.
-  this->lval->destroy( this->lval );
-  //printf("after free\n");
-  free( this );
-  //printf("out of destroy\n");
+  Value key = this->key->eval( this->key, ctxt );
+  Value result = this->lval->eval( this->lval, ctxt );
+  setSlotKey( ctxt, this->slot, &key, result );
 }
 
-Stmt *makeAssignment( char const *vname, Expr *expr ) {
-  AssignStmt *this = (AssignStmt *) malloc( sizeof ( AssignStmt ) );
+// Assignment function for a key or value that makes temporaries.
+static void executeAssignKeyTemps( Stmt *stmt, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeAssignKey( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
 
-  this->execute = executeAssign;
-  this->destroy = destroyAssign;
+Stmt *makeKeyAssignment( Arena *arena, int slot, Expr *key, Expr *expr )
+{
+  AssignStmt *this = (AssignStmt *) arenaAlloc( arena, sizeof ( AssignStmt ) );
+
+  this->execute = makesTemporaries( key ) || makesTemporaries( expr ) ?
+    executeAssignKeyTemps : executeAssignKey;
+  this->kind = ASSIGN_KEY_STMT;
+  this->line = 0;
 
   this->lval = expr;
-  strcpy(this->vname,vname);
+  this->slot = slot;
+  this->key = key;
   return (Stmt *) this;
 }
 //////////////////////////////////////////////////////////////////////
@@ -107,7 +144,8 @@ Stmt *makeAssignment( char const *vname, Expr *expr ) {
 // Representation for a compound statement, derived from Stmt.
 typedef struct {
   void (*execute)( Stmt *stmt, Context *ctxt );
-  void (*destroy)( Stmt *stmt );
+  StmtKind kind;
+  int line;
 
   /** List of statements in the compound. */
   Stmt **stmtList;
@@ -127,29 +165,15 @@ static void executeCompound( Stmt *stmt, Context *ctxt )
     this->stmtList[ i ]->execute( this->stmtList[ i ], ctxt );
 }
 
-// Function to free a compound statement.
-static void destroyCompound( Stmt *stmt )
-{
-  // Cast the this pointer to a more specific type.
-  CompoundStmt *this = (CompoundStmt *)stmt;
-
-  // Free the list of statements inside this compond.
-  for ( int i = 0; i < this->len; i++ )
-    this->stmtList[ i ]->destroy( this->stmtList[ i ] );
-
-  // Then, free the compound statement itself.
-  free( this->stmtList );
-  free( this );
-}
-
-Stmt *makeCompound( Stmt **stmtList, int len )
+Stmt *makeCompound( Arena *arena, Stmt **stmtList, int len )
 {
   // Allocate space for the CompoundStmt object
-  CompoundStmt *this = (CompoundStmt *) malloc( sizeof( CompoundStmt ) );
+  CompoundStmt *this = (CompoundStmt *) arenaAlloc( arena, sizeof( CompoundStmt ) );
 
   // Remember our virutal functions.
   this->execute = executeCompound;
-  this->destroy = destroyCompound;
+  this->kind = COMPOUND_STMT;
+  this->line = 0;
 
   // Remember the list of statements in the compound.
   this->stmtList = stmtList;
@@ -161,7 +185,8 @@ Stmt *makeCompound( Stmt **stmtList, int len )
 
 typedef struct {
   void (*execute)( Stmt *stmt, Context *ctxt );
-  void (*destroy)( Stmt *stmt );
+  StmtKind kind;
+  int line;
 
   /** List of statements in the compound. */
   Expr *cond;
@@ -174,33 +199,31 @@ static void executeIf( Stmt *stmt, Context *ctxt )
   // Cast the this pointer to a more specific type.
   IfStmt *this = (IfStmt *)stmt;
 
-  // Evaluate our argument, print the result, then free it.
-  char *result = this->cond->eval( this->cond, ctxt );
-  if (strcmp(result, "") != 0) {
+  // Test our condition, and run the body if it's true.
+  if ( this->cond->test( this->cond, ctxt ) ) {
     this->body->execute(this->body, ctxt);
   }
-
-  free( result );
 }
 
-// function to free the if statement
-static void destroyIf( Stmt *stmt )
+// If function for a condition that makes temporaries, releasing them
+// before running the body.
+static void executeIfTemps( Stmt *stmt, Context *ctxt )
 {
-  // Cast the this pointer to a more specific type.
   IfStmt *this = (IfStmt *)stmt;
 
-  this->cond->destroy(this->cond);
-  this->body->destroy(this->body);
-
-  // Then, free the compound statement itself.
-  free( this );
+  int mark = temporaryMark( ctxt );
+  bool holds = this->cond->test( this->cond, ctxt );
+  releaseTemporaries( ctxt, mark );
+  if ( holds )
+    this->body->execute( this->body, ctxt );
 }
 
-Stmt *makeIf( Expr *cond, Stmt *body ) {
-  IfStmt * this = (IfStmt *) malloc (sizeof(IfStmt));
+Stmt *makeIf( Arena *arena, Expr *cond, Stmt *body ) {
+  IfStmt * this = (IfStmt *) arenaAlloc (arena, sizeof(IfStmt));
 
-  this->execute = executeIf;
-  this->destroy = destroyIf;
+  this->execute = makesTemporaries( cond ) ? executeIfTemps : executeIf;
+  this->kind = IF_STMT;
+  this->line = 0;
 
   this->cond = cond;
   this->body = body;
@@ -208,32 +231,411 @@ Stmt *makeIf( Expr *cond, Stmt *body ) {
   return (Stmt *)this;
 }
 
+// Representation for a while statement.  It starts out like an if
+// statement, so they can share accessors.
+typedef struct {
+  void (*execute)( Stmt *stmt, Context *ctxt );
+  StmtKind kind;
+  int line;
+
+  Expr *cond;
+  Stmt *body;
+
+  /** Number of iterations run in the interpreter, up to the point
+      where the loop is compiled. */
+  int iterations;
+
+  /** Native code for the loop, once it's compiled. */
+  JitLoop *loop;
+} WhileStmt;
+
 // function to execute a while statement
 static void executeWhile( Stmt *stmt, Context *ctxt )
 {
   // Cast the this pointer to a more specific type.
-  IfStmt *this = (IfStmt *)stmt;
-
-  // Evaluate our argument, print the result, then free it.
-  char *result = this->cond->eval( this->cond, ctxt );
-  while (strcmp(result, "") != 0) {
+  WhileStmt *this = (WhileStmt *)stmt;
+
+  // Once we have native code, it runs the whole loop, unless the loop
+  // is working on vectors this time.
+  if ( this->loop && runLoop( this->loop, ctxt ) )
+    return;
+
+  // Keep running the body as long as our condition is true.
+  // Arithmetic on vectors makes temporaries even though the condition
+  // doesn't, so they're released after each iteration.
+  int mark = temporaryMark( ctxt );
+  while ( this->cond->test( this->cond, ctxt ) ) {
     this->body->execute(this->body, ctxt);
-    free(result);
-    result = this->cond->eval( this->cond, ctxt );
+    releaseTemporaries( ctxt, mark );
+
+    // When the loop gets hot, try compiling it, and let the native
+    // code pick up where we left off.
+    if ( this->iterations < JIT_THRESHOLD &&
+         ++this->iterations == JIT_THRESHOLD ) {
+      this->loop = compileLoop( stmt );
+      if ( this->loop && runLoop( this->loop, ctxt ) )
+        return;
+    }
   }
+}
 
-  free( result );
+// While function for a condition that makes temporaries, releasing
+// them (and any the body made) after each test.  These loops aren't
+// compiled, since the native code would have to call back into the
+// interpreter for the test anyway.
+static void executeWhileTemps( Stmt *stmt, Context *ctxt )
+{
+  WhileStmt *this = (WhileStmt *)stmt;
+
+  int mark = temporaryMark( ctxt );
+  for ( ;; ) {
+    bool holds = this->cond->test( this->cond, ctxt );
+    releaseTemporaries( ctxt, mark );
+    if ( !holds )
+      break;
+    this->body->execute( this->body, ctxt );
+  }
 }
 
-Stmt *makeWhile( Expr *cond, Stmt *body ) {
-  IfStmt * this = (IfStmt *) malloc (sizeof(IfStmt));
+Stmt *makeWhile( Arena *arena, Expr *cond, Stmt *body ) {
+  WhileStmt * this = (WhileStmt *) arenaAlloc (arena, sizeof(WhileStmt));
 
-  this->execute = executeWhile;
-  this->destroy = destroyIf;
+  this->execute = makesTemporaries( cond ) ? executeWhileTemps : executeWhile;
+  this->kind = WHILE_STMT;
+  this->line = 0;
 
   this->cond = cond;
   this->body = body;
+  this->iterations = 0;
+  this->loop = NULL;
 
   return (Stmt *)this;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Local assignment
+
+// Function to execute an assignment to a local variable.
+static void executeLocalAssign( Stmt *stmt, Context *ctxt )
+{
+  AssignStmt *this = (AssignStmt *)stmt;
+
+  Value result = this->lval->eval( this->lval, ctxt );
+  setLocal( ctxt, this->slot, result );
+}
+
+// Assignment function for an expression that makes temporaries.
+static void executeLocalAssignTemps( Stmt *stmt, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeLocalAssign( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+Stmt *makeLocalAssignment( Arena *arena, int index, Expr *expr )
+{
+  AssignStmt *this = (AssignStmt *) arenaAlloc( arena, sizeof ( AssignStmt ) );
+
+  this->execute = makesTemporaries( expr ) ? executeLocalAssignTemps :
+    executeLocalAssign;
+  this->kind = LOCAL_ASSIGN_STMT;
+  this->line = 0;
+
+  this->lval = expr;
+  this->slot = index;
+  this->key = NULL;
+  return (Stmt *) this;
+}
+
+// Function to execute an assignment to a key of a map in a local.
+static void executeLocalKey( Stmt *stmt, Context *ctxt )
+{
+  AssignStmt *this = (AssignStmt *)stmt;
+
+  Value key = this->key->eval( this->key, ctxt );
+  Value result = this->lval->eval( this->lval, ctxt );
+  setLocalKey( ctxt, this->slot, &key, result );
+}
+
+// Assignment function for a key or value that makes temporaries.
+static void executeLocalKeyTemps( Stmt *stmt, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeLocalKey( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+Stmt *makeLocalKeyAssignment( Arena *arena, int index, Expr *key,
+                              Expr *expr )
+{
+  AssignStmt *this = (AssignStmt *) arenaAlloc( arena, sizeof ( AssignStmt ) );
+
+  this->execute = makesTemporaries( key ) || makesTemporaries( expr ) ?
+    executeLocalKeyTemps : executeLocalKey;
+  this->kind = LOCAL_KEY_STMT;
+  this->line = 0;
+
+  this->lval = expr;
+  this->slot = index;
+  this->key = key;
+  return (Stmt *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return
+
+// A return statement has the same representation as a print
+// statement, an expression to evaluate.
+typedef PrintStmt ReturnStmt;
+
+// Function to execute a return statement.
+static void executeReturn( Stmt *stmt, Context *ctxt )
+{
+  ReturnStmt *this = (ReturnStmt *)stmt;
+  returnValue( ctxt, this->arg->eval( this->arg, ctxt ) );
+}
+
+// Return function for an expression that makes temporaries.  The
+// context holds its own reference to the result, so they can be
+// released right away.
+static void executeReturnTemps( Stmt *stmt, Context *ctxt )
+{
+  int mark = temporaryMark( ctxt );
+  executeReturn( stmt, ctxt );
+  releaseTemporaries( ctxt, mark );
+}
+
+// Return function for a call, which leaves the call to be made in
+// place of the one that's running.  The arguments are on the stack,
+// so their temporaries can be released too.
+static void executeTailCall( Stmt *stmt, Context *ctxt )
+{
+  ReturnStmt *this = (ReturnStmt *)stmt;
+
+  int mark = temporaryMark( ctxt );
+  returnCall( ctxt, this->arg );
+  releaseTemporaries( ctxt, mark );
+}
+
+Stmt *makeReturn( Arena *arena, Expr *expr )
+{
+  ReturnStmt *this = (ReturnStmt *) arenaAlloc( arena, sizeof( ReturnStmt ) );
+
+  if ( expr->kind == INVOKE_EXPR )
+    this->execute = executeTailCall;
+  else
+    this->execute = makesTemporaries( expr ) ? executeReturnTemps :
+      executeReturn;
+  this->kind = RETURN_STMT;
+  this->line = 0;
+
+  this->arg = expr;
+  return (Stmt *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Function
+
+// Representation for a function definition.
+typedef struct {
+  void (*execute)( Stmt *stmt, Context *ctxt );
+  StmtKind kind;
+  int line;
+
+  /** Number of the function we define. */
+  int fn;
+
+  /** Body of the function. */
+  Stmt *body;
+
+  /** Definition we give the context. */
+  Function def;
+} FunctionStmt;
+
+// Compound function for the body of a function, which stops once a
+// return statement has run.
+static void executeBlock( Stmt *stmt, Context *ctxt )
+{
+  CompoundStmt *this = (CompoundStmt *)stmt;
+
+  for ( int i = 0; i < this->len && !isReturning( ctxt ); i++ )
+    this->stmtList[ i ]->execute( this->stmtList[ i ], ctxt );
+}
+
+// While function for a loop in the body of a function, which stops
+// once a return statement has run.  Temporaries are released after
+// each test, and after the body for the last time.
+static void executeLoop( Stmt *stmt, Context *ctxt )
+{
+  WhileStmt *this = (WhileStmt *)stmt;
+
+  int mark = temporaryMark( ctxt );
+  while ( !isReturning( ctxt ) ) {
+    bool holds = this->cond->test( this->cond, ctxt );
+    releaseTemporaries( ctxt, mark );
+    if ( !holds )
+      break;
+    this->body->execute( this->body, ctxt );
+  }
+  releaseTemporaries( ctxt, mark );
+}
+
+/** Return the number of locals an expression uses.
+    @param expr expression to look at.
+    @return one more than the largest index of a local in expr, or
+    zero if it doesn't use any.
+*/
+static int exprLocals( Expr *expr )
+{
+  int n = 0;
+  switch ( expr->kind ) {
+  case LITERAL_EXPR:
+  case VAR_EXPR:
+    break;
+  case LOCAL_EXPR:
+    n = variableExprSlot( expr ) + 1;
+    break;
+  case CALL_EXPR:
+  case INVOKE_EXPR:
+    for ( int i = 0; i < callArgCount( expr ); i++ ) {
+      int m = exprLocals( callArg( expr, i ) );
+      n = m > n ? m : n;
+    }
+    break;
+  default:
+    n = exprLocals( binaryLeft( expr ) );
+    int m = exprLocals( binaryRight( expr ) );
+    n = m > n ? m : n;
+  }
+  return n;
+}
+
+/** Get the statements of a function's body ready to run in a call,
+    switching compound statements and loops to versions that stop at
+    a return.
+    @param stmt statement in the body.
+    @return the number of locals stmt uses.
+*/
+static int prepareBody( Stmt *stmt )
+{
+  int n = 0, m = 0;
+  switch ( stmt->kind ) {
+  case COMPOUND_STMT:
+    stmt->execute = executeBlock;
+    for ( int i = 0; i < compoundLength( stmt ); i++ ) {
+      m = prepareBody( compoundStmt( stmt, i ) );
+      n = m > n ? m : n;
+    }
+    return n;
+  case WHILE_STMT:
+    stmt->execute = executeLoop;
+    // Fall through, for the condition and body.
+  case IF_STMT:
+    n = exprLocals( stmtExpr( stmt ) );
+    m = prepareBody( stmtBody( stmt ) );
+    return m > n ? m : n;
+  case FUNCTION_STMT:
+    return 0;
+  case LOCAL_KEY_STMT:
+    m = exprLocals( assignKey( stmt ) );
+    // Fall through, for the variable and value.
+  case LOCAL_ASSIGN_STMT:
+    n = assignSlot( stmt ) + 1;
+    m = m > n ? m : n;
+    n = exprLocals( stmtExpr( stmt ) );
+    return m > n ? m : n;
+  case ASSIGN_KEY_STMT:
+    m = exprLocals( assignKey( stmt ) );
+    // Fall through, for the value.
+  default:
+    n = exprLocals( stmtExpr( stmt ) );
+    return m > n ? m : n;
+  }
+}
+
+// Function to execute a function definition, which hands the
+// definition to the context.
+static void executeFunction( Stmt *stmt, Context *ctxt )
+{
+  FunctionStmt *this = (FunctionStmt *)stmt;
+  defineFunction( ctxt, this->fn, &this->def );
+}
+
+Stmt *makeFunction( Arena *arena, int fn, int params, Stmt *body )
+{
+  FunctionStmt *this = (FunctionStmt *) arenaAlloc( arena,
+                                                    sizeof( FunctionStmt ) );
+  this->execute = executeFunction;
+  this->kind = FUNCTION_STMT;
+  this->line = 0;
+
+  this->fn = fn;
+  this->body = body;
+
+  // Every local gets a record in the frame, even if the body only
+  // reads it.
+  int locals = prepareBody( body );
+  this->def.run = body->execute;
+  this->def.body = body;
+  this->def.params = params;
+  this->def.locals = locals > params ? locals : params;
+  return (Stmt *) this;
+}
+
+int definedFunction( Stmt *stmt )
+{
+  return ((FunctionStmt *)stmt)->fn;
+}
+
+int functionParams( Stmt *stmt )
+{
+  return ((FunctionStmt *)stmt)->def.params;
+}
+
+int functionLocals( Stmt *stmt )
+{
+  return ((FunctionStmt *)stmt)->def.locals;
+}
+
+Expr *stmtExpr( Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case PRINT_STMT:
+  case RETURN_STMT:
+    return ((PrintStmt *)stmt)->arg;
+  case ASSIGN_STMT:
+  case ASSIGN_KEY_STMT:
+  case LOCAL_ASSIGN_STMT:
+  case LOCAL_KEY_STMT:
+    return ((AssignStmt *)stmt)->lval;
+  default:
+    return ((IfStmt *)stmt)->cond;
+  }
+}
+
+int assignSlot( Stmt *stmt )
+{
+  return ((AssignStmt *)stmt)->slot;
+}
+
+Expr *assignKey( Stmt *stmt )
+{
+  return ((AssignStmt *)stmt)->key;
+}
+
+Stmt *stmtBody( Stmt *stmt )
+{
+  if ( stmt->kind == FUNCTION_STMT )
+    return ((FunctionStmt *)stmt)->body;
+  return ((IfStmt *)stmt)->body;
+}
+
+int compoundLength( Stmt *stmt )
+{
+  return ((CompoundStmt *)stmt)->len;
+}
+
+Stmt *compoundStmt( Stmt *stmt, int i )
+{
+  return ((CompoundStmt *)stmt)->stmtList[ i ];
+}
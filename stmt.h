@@ -16,12 +16,30 @@
 /** A short name to use for the statement interface. */
 typedef struct StmtTag Stmt;
 
+/** Kinds of statement, so passes over the tree can tell what type of
+    statement they're looking at. */
+typedef enum {
+  PRINT_STMT,
+  ASSIGN_STMT,
+  COMPOUND_STMT,
+  IF_STMT,
+  WHILE_STMT,
+  ASSIGN_KEY_STMT,
+  FUNCTION_STMT,
+  RETURN_STMT,
+  LOCAL_ASSIGN_STMT,
+  LOCAL_KEY_STMT
+} StmtKind;
+
 /** Representation for the Stat interface, a superclass for all types
-    of statements.  Classes implementing this have these two fields as
+    of statements.  Classes implementing this have these fields as
     their first members.  They will set execute to point to
     appropriate functions to execute the type of statement their
-    class represents, and they will set destroy to point to a function
-    that frees memory for their type of statement.
+    class represents, and the kind field says what class the statement
+    is.
+
+    Like expressions, statements are allocated from an arena, so the
+    tree for a whole statement is freed by resetting the arena.
 */
 struct StmtTag {
   /** Pointer to a function to execute the given staement.
@@ -30,59 +48,171 @@ struct StmtTag {
    */
   void (*execute)( Stmt *stmt, Context *ctxt );
 
-  /** Free memory for this statement, including any other statements and
-      expressions it contains.
-      @param stmt statement to free.
-  */
-  void (*destroy)( Stmt *stmt );
+  /** What type of statement this is. */
+  StmtKind kind;
+
+  /** Line of the source the statement starts on, or zero if it
+      doesn't come from the source. */
+  int line;
 };
 
 /** Make a statement that evaluates the given argument and prints it
     to the terminal.
-    @param arg expression to evaluate and print.  The print statement
-    is be responsible for freeing when it is destoryed.
+    @param arena arena to allocate the statement from.
+    @param arg expression to evaluate and print.
     @return a new print statement.
  */
-Stmt *makePrint( Expr *arg );
+Stmt *makePrint( Arena *arena, Expr *arg );
 
 /** Make a compound statement, representing the sequence of statements
-    @param stmtList list of statements making up this compound. The
-    compound statement will be responsible for freeing this list and
-    the statements it contains when it is destroyed.
+    @param arena arena to allocate the statement from.
+    @param stmtList list of statements making up this compound.  This
+    should live as long as the compound, normally by being allocated
+    from the same arena.
     @param len number of statements in stmtList.
     @return a new statement that executes all the statements in
     stmtList, in order.
  */
-Stmt *makeCompound( Stmt **stmtList, int len );
+Stmt *makeCompound( Arena *arena, Stmt **stmtList, int len );
 
-/** Make an assignment statement, representing the sequence of statements
-    @param stmtList list of statements making up this assignment. The
-    assignment statement will be responsible for freeing this list and
-    the statements it contains when it is destroyed.
-    @param len number of statements in stmtList.
-    @return a new statement that executes all the statements in
-    stmtList, in order.
+/** Make an assignment statement, that evaluates an expression and
+    stores the result in a variable.
+    @param arena arena to allocate the statement from.
+    @param slot slot of the variable to assign, from variableSlot().
+    @param expr expression to evaluate.
+    @return a new assignment statement.
  */
-Stmt *makeAssignment( char const *vname, Expr *expr );
+Stmt *makeAssignment( Arena *arena, int slot, Expr *expr );
 
-/** Make an if statement, representing the sequence of statements
-    @param stmtList list of statements making up this if statement. The
-    if statement will be responsible for freeing this list and
-    the statements it contains when it is destroyed.
-    @param len number of statements in stmtList.
-    @return a new statement that executes all the statements in
-    stmtList, in order.
+/** Make an assignment to one key of a map, that evaluates a key and a
+    value and stores the value under the key in the map held by a
+    variable.
+    @param arena arena to allocate the statement from.
+    @param slot slot of the variable holding the map, from
+    variableSlot().
+    @param key expression for the key.
+    @param expr expression for the value to store.
+    @return a new assignment statement.
  */
-Stmt *makeIf( Expr *cond, Stmt *body );
+Stmt *makeKeyAssignment( Arena *arena, int slot, Expr *key, Expr *expr );
 
-/** Make a while statement, representing the sequence of statements
-    @param stmtList list of statements making up this while statement. The
-    while statement will be responsible for freeing this list and
-    the statements it contains when it is destroyed.
-    @param len number of statements in stmtList.
-    @return a new statement that executes all the statements in
-    stmtList, in order.
+/** Make an if statement, that runs its body if its condition is true.
+    @param arena arena to allocate the statement from.
+    @param cond condition to evaluate.
+    @param body statement to run if cond is true.
+    @return a new if statement.
+ */
+Stmt *makeIf( Arena *arena, Expr *cond, Stmt *body );
+
+/** Make a while statement, that runs its body as long as its condition
+    is true.
+    @param arena arena to allocate the statement from.
+    @param cond condition to evaluate before each iteration.
+    @param body statement to run while cond is true.
+    @return a new while statement.
+ */
+Stmt *makeWhile( Arena *arena, Expr *cond, Stmt *body );
+
+/** Make a statement that defines a function, so calls to it can run
+    its body.  The body is set up to stop at a return statement, and
+    loops in it are never compiled, since the body has to last longer
+    than the top-level statement a compiled loop belongs to.
+    @param arena arena to allocate the statement from.  The body has
+    to last as long as the function can be called, so this should
+    be too.
+    @param fn number of the function, from functionSlot().
+    @param params number of parameters, which are the first locals.
+    @param body statement to run for a call.
+    @return a new function definition.
+ */
+Stmt *makeFunction( Arena *arena, int fn, int params, Stmt *body );
+
+/** Make a statement that returns from the function it's in.  If its
+    expression is a call, that call replaces the one that's running.
+    @param arena arena to allocate the statement from.
+    @param expr expression for the value to return.
+    @return a new return statement.
+ */
+Stmt *makeReturn( Arena *arena, Expr *expr );
+
+/** Make an assignment to a local variable of the function that's
+    running.
+    @param arena arena to allocate the statement from.
+    @param index index of the local, counting the parameters first.
+    @param expr expression to evaluate.
+    @return a new assignment statement.
  */
-Stmt *makeWhile( Expr *cond, Stmt *body );
+Stmt *makeLocalAssignment( Arena *arena, int index, Expr *expr );
+
+/** Make an assignment to one key of a map held by a local variable.
+    @param arena arena to allocate the statement from.
+    @param index index of the local.
+    @param key expression for the key.
+    @param expr expression for the value to store.
+    @return a new assignment statement.
+ */
+Stmt *makeLocalKeyAssignment( Arena *arena, int index, Expr *key,
+                              Expr *expr );
+
+/** Return the expression a print, assignment, if, while or return
+    statement evaluates.  For if and while, this is the condition.  For
+    an assignment to a key, it's the value.
+    @param stmt statement of any kind but COMPOUND_STMT or
+    FUNCTION_STMT.
+    @return the statement's expression.
+*/
+Expr *stmtExpr( Stmt *stmt );
+
+/** Return the slot an assignment statement stores to.
+    @param stmt statement of kind ASSIGN_STMT or ASSIGN_KEY_STMT, or
+    LOCAL_ASSIGN_STMT or LOCAL_KEY_STMT for the index of the local.
+    @return slot of the assigned variable.
+*/
+int assignSlot( Stmt *stmt );
+
+/** Return the key an assignment to a map stores under.
+    @param stmt statement of kind ASSIGN_KEY_STMT or LOCAL_KEY_STMT.
+    @return the key expression.
+*/
+Expr *assignKey( Stmt *stmt );
+
+/** Return the body of an if, while or function statement.
+    @param stmt statement of kind IF_STMT, WHILE_STMT or FUNCTION_STMT.
+    @return the body statement.
+*/
+Stmt *stmtBody( Stmt *stmt );
+
+/** Return the function a function statement defines.
+    @param stmt statement of kind FUNCTION_STMT.
+    @return number of the function.
+*/
+int definedFunction( Stmt *stmt );
+
+/** Return the number of parameters a function statement's function
+    takes.
+    @param stmt statement of kind FUNCTION_STMT.
+    @return number of parameters.
+*/
+int functionParams( Stmt *stmt );
+
+/** Return the number of locals a function statement's function
+    needs, counting its parameters.
+    @param stmt statement of kind FUNCTION_STMT.
+    @return number of locals in a frame for the function.
+*/
+int functionLocals( Stmt *stmt );
+
+/** Return the number of statements in a compound statement.
+    @param stmt statement of kind COMPOUND_STMT.
+    @return length of its statement list.
+*/
+int compoundLength( Stmt *stmt );
+
+/** Return one of the statements in a compound statement.
+    @param stmt statement of kind COMPOUND_STMT.
+    @param i index of the statement to return.
+    @return the i-th statement in the compound.
+*/
+Stmt *compoundStmt( Stmt *stmt, int i );
 
 #endif
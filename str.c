@@ -0,0 +1,290 @@
+#include "str.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// Initial number of buckets in the intern table.  This must be a
+// power of two.
+#define INITIAL_BUCKETS 64
+
+/** Table of every live string, a hash table with chaining so strings
+    can be removed when their last reference goes away.  Reference
+    counts aren't atomic, so each thread has its own table, and a
+    string can't be shared between threads. */
+static __thread struct {
+  // Array of bucket lists, indexed by hash.
+  String **buckets;
+
+  // Number of buckets, always a power of two.
+  int capacity;
+
+  // Number of strings in the table.
+  int len;
+
+  // The empty string, once something has asked for it.  This keeps
+  // the reference emptyString() hands out copies of.
+  String *empty;
+} table;
+
+unsigned int hashString( char const *text, int len )
+{
+  unsigned int h = 2166136261u;
+  for ( int i = 0; i < len; i++ ) {
+    h ^= (unsigned char) text[ i ];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/** Double the number of buckets in the intern table, moving every
+    string to its new bucket.
+*/
+static void growTable()
+{
+  int cap = table.capacity * 2;
+  String **buckets = (String **) calloc( cap, sizeof( String * ) );
+
+  for ( int i = 0; i < table.capacity; i++ ) {
+    String *str = table.buckets[ i ];
+    while ( str ) {
+      String *next = str->next;
+      String **head = &buckets[ str->hash & ( cap - 1 ) ];
+      str->next = *head;
+      *head = str;
+      str = next;
+    }
+  }
+
+  free( table.buckets );
+  table.buckets = buckets;
+  table.capacity = cap;
+}
+
+String *internString( char const *text, int len )
+{
+  if ( !table.buckets ) {
+    table.capacity = INITIAL_BUCKETS;
+    table.buckets = (String **) calloc( table.capacity, sizeof( String * ) );
+  }
+
+  // See if we already have this string.
+  unsigned int hash = hashString( text, len );
+  String **head = &table.buckets[ hash & ( table.capacity - 1 ) ];
+  for ( String *str = *head; str; str = str->next )
+    if ( str->hash == hash && str->len == len &&
+         memcmp( str->text, text, len ) == 0 )
+      return retainString( str );
+
+  // Make a new one, and add it to the table.
+  String *str = (String *) malloc( sizeof( String ) + len + 1 );
+  str->refs = 1;
+  str->len = len;
+  str->hash = hash;
+  memcpy( str->text, text, len );
+  str->text[ len ] = '\0';
+
+  str->next = *head;
+  *head = str;
+  if ( ++table.len > table.capacity )
+    growTable();
+
+  return str;
+}
+
+String *emptyString( void )
+{
+  if ( !table.empty )
+    table.empty = internString( "", 0 );
+  return table.empty;
+}
+
+String *retainString( String *str )
+{
+  str->refs++;
+  return str;
+}
+
+void releaseString( String *str )
+{
+  if ( --str->refs > 0 )
+    return;
+
+  // Unlink the string from its bucket, then free it.
+  String **link = &table.buckets[ str->hash & ( table.capacity - 1 ) ];
+  while ( *link != str )
+    link = &( *link )->next;
+  *link = str->next;
+  table.len--;
+
+  free( str );
+}
+
+void freeStrings( void )
+{
+  for ( int i = 0; i < table.capacity; i++ )
+    while ( table.buckets[ i ] ) {
+      String *str = table.buckets[ i ];
+      table.buckets[ i ] = str->next;
+      free( str );
+    }
+
+  free( table.buckets );
+  table.buckets = NULL;
+  table.capacity = 0;
+  table.len = 0;
+  table.empty = NULL;
+}
+
+bool stringEquals( String const *a, String const *b )
+{
+  if ( a == b )
+    return true;
+
+  // Interned strings with different addresses can't have the same
+  // text, but check anyway, in case that ever changes.
+  return a->hash == b->hash && a->len == b->len &&
+    memcmp( a->text, b->text, a->len ) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Rope
+
+// Smallest capacity for a new rope buffer.
+#define MIN_ROPE_CAPACITY 16
+
+/** Storage shared by ropes.  The text is always null terminated at
+    len, so the rope that reaches the end can be used as a C string. */
+struct RopeBufferTag {
+  // Number of ropes using this buffer.
+  int refs;
+
+  // Number of characters written to the buffer.
+  int len;
+
+  // Number of characters the buffer has room for, not counting the
+  // null terminator.
+  int cap;
+
+  // The characters.
+  char *data;
+};
+
+/** Make a rope for a prefix of a buffer.
+    @param buf buffer the rope uses.  The rope makes its own reference.
+    @param len length of the rope.
+    @return the new rope, with one reference.
+*/
+static Rope *makeRope( RopeBuffer *buf, int len )
+{
+  Rope *rope = (Rope *) malloc( sizeof( Rope ) );
+  rope->refs = 1;
+  rope->len = len;
+  rope->buf = buf;
+  rope->flat = NULL;
+  buf->refs++;
+  return rope;
+}
+
+/** Make sure a buffer has room for more characters, at least doubling
+    its capacity if it has to grow, so growing is amortized constant
+    time per character.
+    @param buf buffer to grow.
+    @param len number of characters that have to fit after the first
+    buf->len.
+*/
+static void reserveRope( RopeBuffer *buf, int len )
+{
+  if ( len <= buf->cap - buf->len )
+    return;
+
+  // Lengths are ints, like they are for every other string.
+  if ( len >= INT_MAX - buf->len ) {
+    raiseError( "string too long" );
+  }
+
+  int cap = buf->cap < INT_MAX / 2 ? buf->cap * 2 : INT_MAX - 1;
+  if ( cap < buf->len + len )
+    cap = buf->len + len;
+  if ( cap < MIN_ROPE_CAPACITY )
+    cap = MIN_ROPE_CAPACITY;
+  buf->data = (char *) realloc( buf->data, cap + 1 );
+  buf->cap = cap;
+}
+
+Rope *joinText( char const *a, int alen, char const *b, int blen )
+{
+  RopeBuffer *buf = (RopeBuffer *) malloc( sizeof( RopeBuffer ) );
+  buf->refs = 0;
+  buf->len = 0;
+  buf->cap = 0;
+  buf->data = NULL;
+
+  reserveRope( buf, alen );
+  memcpy( buf->data, a, alen );
+  buf->len = alen;
+  reserveRope( buf, blen );
+  memcpy( buf->data + alen, b, blen );
+  buf->len += blen;
+  buf->data[ buf->len ] = '\0';
+  return makeRope( buf, buf->len );
+}
+
+Rope *appendRope( Rope *rope, char const *text, int len )
+{
+  RopeBuffer *buf = rope->buf;
+
+  // Anything past the end of the rope belongs to some other rope,
+  // unless this is the only rope using the buffer.  In that case, it
+  // can be overwritten.
+  if ( rope->len != buf->len && buf->refs > 1 )
+    return joinText( buf->data, rope->len, text, len );
+  buf->len = rope->len;
+
+  // The text may be part of this buffer, which can move as it grows.
+  if ( text >= buf->data && text < buf->data + buf->len ) {
+    int offset = text - buf->data;
+    reserveRope( buf, len );
+    text = buf->data + offset;
+  } else {
+    reserveRope( buf, len );
+  }
+
+  memcpy( buf->data + buf->len, text, len );
+  buf->len += len;
+  buf->data[ buf->len ] = '\0';
+  return makeRope( buf, buf->len );
+}
+
+char const *ropeText( Rope const *rope )
+{
+  return rope->buf->data;
+}
+
+String *flattenRope( Rope *rope )
+{
+  if ( !rope->flat )
+    rope->flat = internString( rope->buf->data, rope->len );
+  return rope->flat;
+}
+
+Rope *retainRope( Rope *rope )
+{
+  rope->refs++;
+  return rope;
+}
+
+void releaseRope( Rope *rope )
+{
+  if ( --rope->refs > 0 )
+    return;
+
+  if ( rope->flat )
+    releaseString( rope->flat );
+  RopeBuffer *buf = rope->buf;
+  if ( --buf->refs == 0 ) {
+    free( buf->data );
+    free( buf );
+  }
+  free( rope );
+}
@@ -0,0 +1,176 @@
+/**
+  @file str.h
+
+  Immutable, reference-counted strings.  Every string is interned, so
+  there's only ever one copy of a given text, and copying a string
+  from one place to another just bumps its reference count.  Each
+  thread has its own intern table, so strings can't be shared between
+  threads.
+
+  Strings built by concatenation are ropes instead, which can be
+  appended to in amortized constant time.  A rope only becomes an
+  interned string when something needs one.
+*/
+
+#ifndef _STR_H_
+#define _STR_H_
+
+#include <stdbool.h>
+
+/** Short typename for the String structure. */
+typedef struct StringTag String;
+
+/** Representation for an interned string.  Client code can read these
+    fields, but must never change them. */
+struct StringTag {
+  /** Number of references to this string. */
+  int refs;
+
+  /** Length of the text, not counting the null terminator. */
+  int len;
+
+  /** Hash of the text, from hashString(). */
+  unsigned int hash;
+
+  /** Next string in the same bucket of the intern table. */
+  String *next;
+
+  /** The text of the string, null terminated. */
+  char text[];
+};
+
+/** Compute a hash code for the given text (FNV-1a).
+    @param text characters to hash.
+    @param len number of characters in text.
+    @return hash code for the text.
+*/
+unsigned int hashString( char const *text, int len );
+
+/** Return the interned string with the given text, making it if there
+    isn't one already.
+    @param text characters of the string.
+    @param len number of characters in text.
+    @return a new reference to the string.  The caller must eventually
+    give it up with releaseString().
+*/
+String *internString( char const *text, int len );
+
+/** Return the empty string, the value of undefined variables.  This is
+    interned the first time it's needed on each thread, and kept until
+    freeStrings().
+    @return the empty string.  This is a borrowed reference, so the
+    caller must retain it to keep it.
+*/
+String *emptyString( void );
+
+/** Add a reference to a string.
+    @param str string to reference.
+    @return str, for convenience.
+*/
+String *retainString( String *str );
+
+/** Give up a reference to a string.  The string is freed when its last
+    reference is released.
+    @param str string to release.
+*/
+void releaseString( String *str );
+
+/** Return true if two strings have the same text.  Since strings are
+    interned, this is usually just a pointer comparison.
+    @param a first string to compare.
+    @param b second string to compare.
+    @return true if a and b have the same text.
+*/
+bool stringEquals( String const *a, String const *b );
+
+/** Free every string interned on this thread, even ones that are still
+    referenced.  This is for a thread that's done with strings, just
+    before it exits.  If the thread goes on to intern more, it starts
+    with an empty table.
+*/
+void freeStrings( void );
+
+//////////////////////////////////////////////////////////////////////
+// Rope
+
+/** Short typename for the Rope structure. */
+typedef struct RopeTag Rope;
+
+/** Growable storage shared by ropes.  Its representation is private
+    to the rope code. */
+typedef struct RopeBufferTag RopeBuffer;
+
+/** A string being built up by concatenation.  A rope is a prefix of a
+    buffer that can grow, and several ropes can share the same buffer.
+    Appending to the rope that reaches the end of its buffer (the usual
+    case, when a loop keeps extending the same variable) just adds the
+    new text at the end, so building a string a piece at a time takes
+    linear time.  Ropes are immutable, like strings: appending makes a
+    new rope, and the old one keeps its text.  Client code can read
+    these fields, but must never change them. */
+struct RopeTag {
+  /** Number of references to this rope. */
+  int refs;
+
+  /** Length of the text, never zero. */
+  int len;
+
+  /** Buffer holding the text, in its first len characters. */
+  RopeBuffer *buf;
+
+  /** Interned copy of the text, made the first time it's needed by
+      flattenRope(), or NULL. */
+  String *flat;
+};
+
+/** Make a rope holding one piece of text followed by another.
+    @param a characters of the first piece.
+    @param alen number of characters in a.
+    @param b characters of the second piece.
+    @param blen number of characters in b.
+    @return a new rope, with one reference.  The caller must eventually
+    give it up with releaseRope().
+*/
+Rope *joinText( char const *a, int alen, char const *b, int blen );
+
+/** Make a rope holding the text of an existing rope followed by more
+    text.  This is amortized constant time per character appended, as
+    long as nothing else has been appended to the rope's buffer since
+    the rope was made.  The text may come from the rope itself.
+    @param rope rope to append to.  It doesn't change.
+    @param text characters to append.
+    @param len number of characters in text.
+    @return a new rope, with one reference.  The caller must eventually
+    give it up with releaseRope().
+*/
+Rope *appendRope( Rope *rope, char const *text, int len );
+
+/** Return the text of a rope.  This isn't null terminated.
+    @param rope rope to look at.
+    @return its first character.  The next len - 1 characters follow
+    it.  This is only good until something is appended to a rope that
+    shares the same buffer.
+*/
+char const *ropeText( Rope const *rope );
+
+/** Return the text of a rope as an interned string, making it the
+    first time it's needed.
+    @param rope rope to flatten.
+    @return the string.  This belongs to the rope, and is good for as
+    long as the rope is.
+*/
+String *flattenRope( Rope *rope );
+
+/** Add a reference to a rope.
+    @param rope rope to reference.
+    @return rope, for convenience.
+*/
+Rope *retainRope( Rope *rope );
+
+/** Give up a reference to a rope.  The rope is freed when its last
+    reference is released, and its buffer when no rope uses it.
+    @param rope rope to release.
+*/
+void releaseRope( Rope *rope );
+
+#endif
@@ -16,8 +16,8 @@ runtest() {
 
   rm -f output.txt stderr.txt
 
-  echo "Test $TEST_NO: ./interpreter prog_$TESTNO.txt > output.txt 2> stderr.txt"
-  ./interpreter prog_$TESTNO.txt > output.txt 2> stderr.txt
+  echo "Test $TEST_NO: ./interpreter --engine=$ENGINE $OPTIONS prog_$TESTNO.txt > output.txt 2> stderr.txt"
+  ./interpreter --engine=$ENGINE $OPTIONS prog_$TESTNO.txt > output.txt 2> stderr.txt
   STATUS=$?
 
   # Make sure the program exited with the right exit status.
@@ -43,10 +43,16 @@ runtest() {
       return 1
   fi
 
-  echo "Test $TESTNO PASS"
+  echo "Test $TESTNO ($ENGINE${OPTIONS:+ $OPTIONS}) PASS"
   return 0
 }
 
+# Run every test case under each execution engine, with and without
+# moving invariant code out of loops and compiling hot loops, since
+# they all need to behave the same.
+for OPTIONS in "" --hoist --no-jit; do
+for ENGINE in tree vm closure; do
+
 # Run successfule test cases
 runtest 01 0
 runtest 02 0
@@ -68,6 +74,83 @@ runtest 17 1
 runtest 18 1
 runtest 19 1
 runtest 20 1
+runtest 21 0
+runtest 22 0
+runtest 23 0
+runtest 24 0
+runtest 25 1
+runtest 26 1
+runtest 27 0
+runtest 28 0
+runtest 29 0
+runtest 30 0
+
+done
+done
+
+# Run every test case again as one batch, on a few threads, and make
+# sure it prints exactly what running them one at a time does, in
+# order, with each error labeled with its program.
+for ENGINE in tree vm closure; do
+  rm -f batch_output.txt batch_stderr.txt
+  for PROG in prog_*.txt; do
+    ./interpreter --engine=$ENGINE $PROG >> batch_output.txt 2> stderr.txt
+    sed "s/^/$PROG: /" stderr.txt >> batch_stderr.txt
+  done
+
+  ./interpreter --batch --jobs=4 --engine=$ENGINE prog_*.txt > output.txt 2> stderr.txt
+  if cmp -s batch_output.txt output.txt && cmp -s batch_stderr.txt stderr.txt; then
+    echo "Test batch ($ENGINE) PASS"
+  else
+    echo "**** Batch test ($ENGINE) FAILED"
+    FAIL=1
+  fi
+  rm -f batch_output.txt batch_stderr.txt
+done
+
+# Programs with the same file name can't share an output directory,
+# so a batch that would mix them up runs nothing and fails.
+rm -rf batch_dir
+mkdir -p batch_dir/a batch_dir/b batch_dir/out
+cp prog_01.txt batch_dir/a/main.txt
+cp prog_02.txt batch_dir/b/main.txt
+./interpreter --batch --output-dir=batch_dir/out batch_dir/a/main.txt batch_dir/b/main.txt > output.txt 2> stderr.txt
+if [ $? -eq 1 ] && [ -z "$(ls batch_dir/out)" ] && grep -q "would both write" stderr.txt; then
+  echo "Test batch output names PASS"
+else
+  echo "**** Batch output names test FAILED"
+  FAIL=1
+fi
+rm -rf batch_dir
+
+# Check the number formatter prints exactly what printf would.
+make fmttest && ./fmttest
+if [ $? -ne 0 ]; then
+  echo "**** Number formatting test FAILED"
+  FAIL=1
+fi
+
+# Check the number parser reads exactly what scanf would.
+make numtest && ./numtest
+if [ $? -ne 0 ]; then
+  echo "**** Number parsing test FAILED"
+  FAIL=1
+fi
+
+# Check the vector kernels give exactly what plain C arithmetic does.
+make vectest && ./vectest
+if [ $? -ne 0 ]; then
+  echo "**** Vector arithmetic test FAILED"
+  FAIL=1
+fi
+
+# Check the embedding library's interface, and that the shared
+# library builds too.
+make libtest libinterpreter.so && ./libtest
+if [ $? -ne 0 ]; then
+  echo "**** Library test FAILED"
+  FAIL=1
+fi
 
 if [ $FAIL -ne 0 ]; then
   echo "FAILING TESTS!"
@@ -0,0 +1,97 @@
+/**
+  @file testutil.h
+
+  Setup shared by the randomized conformance tests, fmttest, numtest
+  and vectest: a repeatable random number generator, conversions
+  between doubles and their bits, and counters for the checks made and
+  the ones that failed.  Each test is a single program, so everything
+  here is static.
+*/
+
+#ifndef _TESTUTIL_H_
+#define _TESTUTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Most differences to report before giving up.
+#define MAX_REPORTED 10
+
+// Number of checks that failed.
+static long failures = 0;
+
+// Number of checks made.
+static long checked = 0;
+
+// State for the random number generator.
+static uint64_t seed = 0x2545f4914f6cdd1du;
+
+/** Return 64 random bits, from a xorshift generator, so a test is the
+    same on every run.
+    @return next random number.
+*/
+static inline uint64_t random64( void )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+/** Return a random number below a limit.
+    @param limit one more than the largest number to return.
+    @return random number from 0 to limit - 1.
+*/
+static inline int randomBelow( int limit )
+{
+  return random64() % limit;
+}
+
+/** Return the bits of a double.
+    @param num double to look at.
+    @return its bits.
+*/
+static inline uint64_t toBits( double num )
+{
+  uint64_t bits;
+  memcpy( &bits, &num, sizeof( bits ) );
+  return bits;
+}
+
+/** Return a double with the given bits.
+    @param bits bits to use.
+    @return the double.
+*/
+static inline double fromBits( uint64_t bits )
+{
+  double num;
+  memcpy( &num, &bits, sizeof( num ) );
+  return num;
+}
+
+/** Count one check.
+    @param ok true if it passed.
+    @return true if it failed and is among the first few failures,
+    which the caller should report.
+*/
+static inline bool countCheck( bool ok )
+{
+  checked++;
+  if ( ok )
+    return false;
+  return failures++ < MAX_REPORTED;
+}
+
+/** Print how many checks were made and how many failed.
+    @return exit status for the test, EXIT_SUCCESS if nothing failed.
+*/
+static inline int finishChecks( void )
+{
+  printf( "%ld checked, %ld failed\n", checked, failures );
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
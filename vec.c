@@ -0,0 +1,473 @@
+#include "vec.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+#include <immintrin.h>
+#define HAVE_AVX2 1
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+// Number of partial results a reduction keeps, one per lane of two
+// AVX2 registers.
+#define LANES 8
+
+// Smallest capacity for a vector that's grown by appending.
+#define VECTOR_CAPACITY 8
+
+// Number of freed vectors kept for reuse.  A loop that makes a new
+// vector every time around can reuse the one it let go of last time,
+// instead of getting (and faulting in) fresh memory for it.
+#define VECTOR_CACHE 4
+
+//////////////////////////////////////////////////////////////////////
+// Vector
+
+/** Report a vector that can't be made.  This doesn't return.
+*/
+static void tooLong( void )
+{
+  raiseError( "vector too long" );
+}
+
+// Freed vectors kept for reuse, and the number of them.  Each thread
+// keeps its own, so they don't need a lock.
+static __thread Vector *cache[ VECTOR_CACHE ];
+static __thread int cached;
+
+Vector *makeVector( long len )
+{
+  if ( len > INT_MAX )
+    tooLong();
+
+  // Reuse a freed vector if one has enough room, but not so much that
+  // most of it would be wasted.
+  Vector *vec = NULL;
+  for ( int i = 0; !vec && i < cached; i++ )
+    if ( cache[ i ]->cap >= len &&
+         cache[ i ]->cap <= 2 * len + VECTOR_CAPACITY ) {
+      vec = cache[ i ];
+      cache[ i ] = cache[ --cached ];
+    }
+
+  if ( !vec ) {
+    vec = (Vector *) malloc( sizeof( Vector ) );
+    vec->data = (double *) malloc( ( len ? len : 1 ) * sizeof( double ) );
+    if ( !vec->data )
+      tooLong();
+    vec->cap = len;
+  }
+  vec->refs = 1;
+  vec->len = len;
+  vec->temp = false;
+  return vec;
+}
+
+Vector *copyVector( Vector const *vec )
+{
+  Vector *copy = makeVector( vec->len + 1L );
+  memcpy( copy->data, vec->data, vec->len * sizeof( double ) );
+  copy->len = vec->len;
+  return copy;
+}
+
+Vector *retainVector( Vector *vec )
+{
+  vec->refs++;
+  return vec;
+}
+
+void releaseVector( Vector *vec )
+{
+  if ( --vec->refs > 0 )
+    return;
+  if ( cached < VECTOR_CACHE )
+    cache[ cached++ ] = vec;
+  else {
+    free( vec->data );
+    free( vec );
+  }
+}
+
+void freeVectorCache( void )
+{
+  while ( cached > 0 ) {
+    Vector *vec = cache[ --cached ];
+    free( vec->data );
+    free( vec );
+  }
+}
+
+void appendVector( Vector *vec, double num )
+{
+  if ( vec->len >= vec->cap ) {
+    // Lengths are ints, like they are for strings.
+    if ( vec->len == INT_MAX )
+      tooLong();
+    int cap = vec->cap < INT_MAX / 2 ? vec->cap * 2 : INT_MAX;
+    if ( cap < VECTOR_CAPACITY )
+      cap = VECTOR_CAPACITY;
+    double *data = (double *) realloc( vec->data, cap * sizeof( double ) );
+    if ( !data )
+      tooLong();
+    vec->data = data;
+    vec->cap = cap;
+  }
+  vec->data[ vec->len++ ] = num;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Kernels
+
+/** Function that applies an operator element by element.  An operand
+    that's a single number is passed as an array of four copies of it,
+    with a mask of zero, so every index into it lands on a copy.
+    @param dst array for the results.
+    @param a left operand.
+    @param amask mask applied to indexes into a, -1 for an array or 0
+    for a single number.
+    @param b right operand.
+    @param bmask mask applied to indexes into b.
+    @param len number of elements.
+*/
+typedef void (*OpKernel)( double *dst, double const *a, long amask,
+                          double const *b, long bmask, int len );
+
+/** Function that runs the lanes of a reduction.  Lane k gets every
+    element with an index of k modulo LANES, in order.
+    @param a numbers to reduce.
+    @param len number of elements, a multiple of LANES.
+    @param lanes partial results, already holding the starting value
+    for the reduction.
+*/
+typedef void (*ReduceKernel)( double const *a, int len, double *lanes );
+
+/** Kinds of reduction. */
+typedef enum {
+  REDUCE_SUM,
+  REDUCE_MIN,
+  REDUCE_MAX,
+  REDUCE_COUNT
+} Reduction;
+
+/** A complete set of kernels, all for the same instruction set. */
+typedef struct {
+  /** Name of the instruction set. */
+  char const *name;
+
+  /** Returns true if the CPU can run these kernels. */
+  bool (*supported)( void );
+
+  /** Kernel for each operator, indexed by VecOp. */
+  OpKernel op[ VEC_LESS + 1 ];
+
+  /** Kernel for each reduction, indexed by Reduction. */
+  ReduceKernel reduce[ REDUCE_COUNT ];
+} KernelSet;
+
+// Operators and reduction steps on one pair of numbers, for the plain
+// C kernels and for the elements left over at the end of an array.
+#define SCALAR_ADD( x, y ) ( ( x ) + ( y ) )
+#define SCALAR_SUB( x, y ) ( ( x ) - ( y ) )
+#define SCALAR_MUL( x, y ) ( ( x ) * ( y ) )
+#define SCALAR_DIV( x, y ) ( ( x ) / ( y ) )
+#define SCALAR_LESS( x, y ) ( ( x ) < ( y ) ? 1.0 : 0.0 )
+#define SCALAR_MIN( x, y ) ( ( x ) < ( y ) ? ( x ) : ( y ) )
+#define SCALAR_MAX( x, y ) ( ( x ) > ( y ) ? ( x ) : ( y ) )
+
+/** Define a plain C kernel for an operator. */
+#define SCALAR_OP_KERNEL( name, OP )                                    \
+  static void name( double *dst, double const *a, long amask,           \
+                    double const *b, long bmask, int len )              \
+  {                                                                     \
+    for ( long i = 0; i < len; i++ )                                    \
+      dst[ i ] = OP( a[ i & amask ], b[ i & bmask ] );                  \
+  }
+
+/** Define a plain C kernel for a reduction. */
+#define SCALAR_REDUCE_KERNEL( name, OP )                                \
+  static void name( double const *a, int len, double *lanes )          \
+  {                                                                     \
+    for ( long i = 0; i < len; i += LANES )                             \
+      for ( int k = 0; k < LANES; k++ )                                 \
+        lanes[ k ] = OP( lanes[ k ], a[ i + k ] );                      \
+  }
+
+SCALAR_OP_KERNEL( scalarAdd, SCALAR_ADD )
+SCALAR_OP_KERNEL( scalarSub, SCALAR_SUB )
+SCALAR_OP_KERNEL( scalarMul, SCALAR_MUL )
+SCALAR_OP_KERNEL( scalarDiv, SCALAR_DIV )
+SCALAR_OP_KERNEL( scalarLess, SCALAR_LESS )
+SCALAR_REDUCE_KERNEL( scalarSum, SCALAR_ADD )
+SCALAR_REDUCE_KERNEL( scalarMin, SCALAR_MIN )
+SCALAR_REDUCE_KERNEL( scalarMax, SCALAR_MAX )
+
+/** Plain C code runs anywhere.
+    @return true.
+*/
+static bool alwaysSupported( void )
+{
+  return true;
+}
+
+#if defined( __SSE2__ )
+
+// SSE2 versions of the operators.  Each instruction gives exactly what
+// the C operator does for doubles, and the comparison's mask of all
+// ones or all zeros picks 1.0 or 0.0.
+#define SSE2_ADD( x, y ) _mm_add_pd( x, y )
+#define SSE2_SUB( x, y ) _mm_sub_pd( x, y )
+#define SSE2_MUL( x, y ) _mm_mul_pd( x, y )
+#define SSE2_DIV( x, y ) _mm_div_pd( x, y )
+#define SSE2_LESS( x, y ) _mm_and_pd( _mm_cmplt_pd( x, y ), _mm_set1_pd( 1.0 ) )
+#define SSE2_MIN( x, y ) _mm_min_pd( x, y )
+#define SSE2_MAX( x, y ) _mm_max_pd( x, y )
+
+/** Define an SSE2 kernel for an operator, two elements at a time. */
+#define SSE2_OP_KERNEL( name, OP, SOP )                                 \
+  static void name( double *dst, double const *a, long amask,           \
+                    double const *b, long bmask, int len )              \
+  {                                                                     \
+    long i = 0;                                                         \
+    for ( ; i + 2 <= len; i += 2 )                                      \
+      _mm_storeu_pd( dst + i, OP( _mm_loadu_pd( a + ( i & amask ) ),    \
+                                  _mm_loadu_pd( b + ( i & bmask ) ) ) ); \
+    for ( ; i < len; i++ )                                              \
+      dst[ i ] = SOP( a[ i & amask ], b[ i & bmask ] );                 \
+  }
+
+/** Define an SSE2 kernel for a reduction, with the eight lanes in
+    four registers. */
+#define SSE2_REDUCE_KERNEL( name, OP )                                  \
+  static void name( double const *a, int len, double *lanes )          \
+  {                                                                     \
+    __m128d r0 = _mm_loadu_pd( lanes ), r1 = _mm_loadu_pd( lanes + 2 ); \
+    __m128d r2 = _mm_loadu_pd( lanes + 4 ), r3 = _mm_loadu_pd( lanes + 6 ); \
+    for ( long i = 0; i < len; i += LANES ) {                           \
+      r0 = OP( r0, _mm_loadu_pd( a + i ) );                             \
+      r1 = OP( r1, _mm_loadu_pd( a + i + 2 ) );                         \
+      r2 = OP( r2, _mm_loadu_pd( a + i + 4 ) );                         \
+      r3 = OP( r3, _mm_loadu_pd( a + i + 6 ) );                         \
+    }                                                                   \
+    _mm_storeu_pd( lanes, r0 );                                         \
+    _mm_storeu_pd( lanes + 2, r1 );                                     \
+    _mm_storeu_pd( lanes + 4, r2 );                                     \
+    _mm_storeu_pd( lanes + 6, r3 );                                     \
+  }
+
+SSE2_OP_KERNEL( sse2Add, SSE2_ADD, SCALAR_ADD )
+SSE2_OP_KERNEL( sse2Sub, SSE2_SUB, SCALAR_SUB )
+SSE2_OP_KERNEL( sse2Mul, SSE2_MUL, SCALAR_MUL )
+SSE2_OP_KERNEL( sse2Div, SSE2_DIV, SCALAR_DIV )
+SSE2_OP_KERNEL( sse2Less, SSE2_LESS, SCALAR_LESS )
+SSE2_REDUCE_KERNEL( sse2Sum, SSE2_ADD )
+SSE2_REDUCE_KERNEL( sse2Min, SSE2_MIN )
+SSE2_REDUCE_KERNEL( sse2Max, SSE2_MAX )
+
+#endif
+
+#ifdef HAVE_AVX2
+
+// AVX2 kernels are compiled for AVX2 even if the rest of the program
+// isn't, and only used if the CPU turns out to have it.
+#define AVX2 __attribute__(( target( "avx2" ) ))
+
+#define AVX2_ADD( x, y ) _mm256_add_pd( x, y )
+#define AVX2_SUB( x, y ) _mm256_sub_pd( x, y )
+#define AVX2_MUL( x, y ) _mm256_mul_pd( x, y )
+#define AVX2_DIV( x, y ) _mm256_div_pd( x, y )
+#define AVX2_LESS( x, y ) \
+  _mm256_and_pd( _mm256_cmp_pd( x, y, _CMP_LT_OQ ), _mm256_set1_pd( 1.0 ) )
+#define AVX2_MIN( x, y ) _mm256_min_pd( x, y )
+#define AVX2_MAX( x, y ) _mm256_max_pd( x, y )
+
+/** Define an AVX2 kernel for an operator, eight elements at a time. */
+#define AVX2_OP_KERNEL( name, OP, SOP )                                 \
+  AVX2 static void name( double *dst, double const *a, long amask,      \
+                         double const *b, long bmask, int len )         \
+  {                                                                     \
+    long i = 0;                                                         \
+    for ( ; i + 8 <= len; i += 8 ) {                                    \
+      __m256d x0 = _mm256_loadu_pd( a + ( i & amask ) );                \
+      __m256d x1 = _mm256_loadu_pd( a + ( ( i + 4 ) & amask ) );        \
+      __m256d y0 = _mm256_loadu_pd( b + ( i & bmask ) );                \
+      __m256d y1 = _mm256_loadu_pd( b + ( ( i + 4 ) & bmask ) );        \
+      _mm256_storeu_pd( dst + i, OP( x0, y0 ) );                        \
+      _mm256_storeu_pd( dst + i + 4, OP( x1, y1 ) );                    \
+    }                                                                   \
+    for ( ; i < len; i++ )                                              \
+      dst[ i ] = SOP( a[ i & amask ], b[ i & bmask ] );                 \
+  }
+
+/** Define an AVX2 kernel for a reduction, with the eight lanes in two
+    registers. */
+#define AVX2_REDUCE_KERNEL( name, OP )                                  \
+  AVX2 static void name( double const *a, int len, double *lanes )     \
+  {                                                                     \
+    __m256d r0 = _mm256_loadu_pd( lanes );                              \
+    __m256d r1 = _mm256_loadu_pd( lanes + 4 );                          \
+    for ( long i = 0; i < len; i += LANES ) {                           \
+      r0 = OP( r0, _mm256_loadu_pd( a + i ) );                          \
+      r1 = OP( r1, _mm256_loadu_pd( a + i + 4 ) );                      \
+    }                                                                   \
+    _mm256_storeu_pd( lanes, r0 );                                      \
+    _mm256_storeu_pd( lanes + 4, r1 );                                  \
+  }
+
+AVX2_OP_KERNEL( avx2Add, AVX2_ADD, SCALAR_ADD )
+AVX2_OP_KERNEL( avx2Sub, AVX2_SUB, SCALAR_SUB )
+AVX2_OP_KERNEL( avx2Mul, AVX2_MUL, SCALAR_MUL )
+AVX2_OP_KERNEL( avx2Div, AVX2_DIV, SCALAR_DIV )
+AVX2_OP_KERNEL( avx2Less, AVX2_LESS, SCALAR_LESS )
+AVX2_REDUCE_KERNEL( avx2Sum, AVX2_ADD )
+AVX2_REDUCE_KERNEL( avx2Min, AVX2_MIN )
+AVX2_REDUCE_KERNEL( avx2Max, AVX2_MAX )
+
+/** Check whether the CPU (and the operating system) support AVX2.
+    @return true if the AVX2 kernels can run.
+*/
+static bool avx2Supported( void )
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports( "avx2" );
+}
+
+#endif
+
+/** Every set of kernels, best first. */
+static KernelSet const kernelSets[] = {
+#ifdef HAVE_AVX2
+  { "avx2", avx2Supported,
+    { avx2Add, avx2Sub, avx2Mul, avx2Div, avx2Less },
+    { avx2Sum, avx2Min, avx2Max } },
+#endif
+#if defined( __SSE2__ )
+  { "sse2", alwaysSupported,
+    { sse2Add, sse2Sub, sse2Mul, sse2Div, sse2Less },
+    { sse2Sum, sse2Min, sse2Max } },
+#endif
+  { "scalar", alwaysSupported,
+    { scalarAdd, scalarSub, scalarMul, scalarDiv, scalarLess },
+    { scalarSum, scalarMin, scalarMax } },
+};
+
+// Kernels in use, or NULL if they haven't been chosen yet.
+static KernelSet const *kernels;
+
+/** Return the kernels to use, choosing the best the CPU supports the
+    first time.
+    @return the kernels.
+*/
+static KernelSet const *currentKernels( void )
+{
+  // Threads racing to choose will all choose the same ones.
+  KernelSet const *set = __atomic_load_n( &kernels, __ATOMIC_ACQUIRE );
+  if ( !set ) {
+    int i = 0;
+    while ( !kernelSets[ i ].supported() )
+      i++;
+    set = &kernelSets[ i ];
+    __atomic_store_n( &kernels, set, __ATOMIC_RELEASE );
+  }
+  return set;
+}
+
+char const *vectorKernels( void )
+{
+  return currentKernels()->name;
+}
+
+bool selectVectorKernels( char const *name )
+{
+  for ( int i = 0; i < sizeof( kernelSets ) / sizeof( kernelSets[ 0 ] ); i++ )
+    if ( strcmp( kernelSets[ i ].name, name ) == 0 ) {
+      if ( !kernelSets[ i ].supported() )
+        return false;
+      __atomic_store_n( &kernels, &kernelSets[ i ], __ATOMIC_RELEASE );
+      return true;
+    }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Operators and reductions
+
+void applyVectorOp( VecOp op, double *dst, double const *a, int astep,
+                    double const *b, int bstep, int len )
+{
+  // Single numbers get copied out to a full register's worth, so the
+  // kernels can load them like any other operand.
+  double asplat[ 4 ], bsplat[ 4 ];
+  if ( !astep ) {
+    asplat[ 0 ] = asplat[ 1 ] = asplat[ 2 ] = asplat[ 3 ] = *a;
+    a = asplat;
+  }
+  if ( !bstep ) {
+    bsplat[ 0 ] = bsplat[ 1 ] = bsplat[ 2 ] = bsplat[ 3 ] = *b;
+    b = bsplat;
+  }
+  currentKernels()->op[ op ]( dst, a, astep ? -1 : 0, b, bstep ? -1 : 0,
+                              len );
+}
+
+/** Combine two partial results of a reduction.
+    @param kind kind of reduction.
+    @param x first partial result.
+    @param y second partial result.
+    @return the combination.
+*/
+static double combine( Reduction kind, double x, double y )
+{
+  if ( kind == REDUCE_SUM )
+    return SCALAR_ADD( x, y );
+  if ( kind == REDUCE_MIN )
+    return SCALAR_MIN( x, y );
+  return SCALAR_MAX( x, y );
+}
+
+/** Reduce an array of numbers, in the order described for
+    sumVector().
+    @param kind kind of reduction.
+    @param a numbers to reduce.
+    @param len number of elements.
+    @param start starting value for each lane.
+    @return the result.
+*/
+static double reduce( Reduction kind, double const *a, int len, double start )
+{
+  double c[ LANES ];
+  for ( int k = 0; k < LANES; k++ )
+    c[ k ] = start;
+
+  int whole = len - len % LANES;
+  currentKernels()->reduce[ kind ]( a, whole, c );
+
+  double result =
+    combine( kind,
+             combine( kind, combine( kind, c[ 0 ], c[ 4 ] ),
+                      combine( kind, c[ 2 ], c[ 6 ] ) ),
+             combine( kind, combine( kind, c[ 1 ], c[ 5 ] ),
+                      combine( kind, c[ 3 ], c[ 7 ] ) ) );
+  for ( int i = whole; i < len; i++ )
+    result = combine( kind, result, a[ i ] );
+  return result;
+}
+
+double sumVector( double const *a, int len )
+{
+  return reduce( REDUCE_SUM, a, len, 0.0 );
+}
+
+double minVector( double const *a, int len )
+{
+  return reduce( REDUCE_MIN, a, len, INFINITY );
+}
+
+double maxVector( double const *a, int len )
+{
+  return reduce( REDUCE_MAX, a, len, -INFINITY );
+}
@@ -0,0 +1,151 @@
+/**
+  @file vec.h
+
+  Dense vectors of doubles, and the kernels that do arithmetic on
+  them.  Element-by-element operators and reductions each have a
+  version for AVX2, one for SSE2 and a plain C one, and the best one
+  the CPU supports is picked the first time it's needed.  Every version
+  gives bit-for-bit the same results, including for reductions, which
+  always add up elements in the same order.  The only exception is
+  which NaN comes out when two of them meet, which C leaves open.
+*/
+
+#ifndef _VEC_H_
+#define _VEC_H_
+
+#include <stdbool.h>
+
+/** Short typename for the Vector structure. */
+typedef struct VectorTag Vector;
+
+/** Representation for a vector.  Vectors are reference counted, like
+    strings, but they can be changed in place by whatever holds the
+    only reference.  Client code can read these fields, and can change
+    the elements of a vector nothing else refers to. */
+struct VectorTag {
+  /** Number of references to this vector. */
+  int refs;
+
+  /** Number of elements. */
+  int len;
+
+  /** Number of elements there's room for. */
+  int cap;
+
+  /** True while the vector is held by a context as a temporary, so
+      the result of an operator can reuse it if nothing else refers to
+      it. */
+  bool temp;
+
+  /** The elements. */
+  double *data;
+};
+
+/** Element-by-element operators. */
+typedef enum {
+  VEC_ADD,
+  VEC_SUB,
+  VEC_MUL,
+  VEC_DIV,
+  /** Gives 1 where the left element is less than the right, else 0. */
+  VEC_LESS
+} VecOp;
+
+/** Make a vector with the given number of elements, which aren't
+    initialized.  Exits with an error message if there are more than
+    fit in an int, or there isn't memory for them.
+    @param len number of elements.
+    @return a new vector, with one reference.  The caller must
+    eventually give it up with releaseVector().
+*/
+Vector *makeVector( long len );
+
+/** Make a copy of a vector, with room for one more element.
+    @param vec vector to copy.
+    @return a new vector, with one reference.
+*/
+Vector *copyVector( Vector const *vec );
+
+/** Add a reference to a vector.
+    @param vec vector to reference.
+    @return vec, for convenience.
+*/
+Vector *retainVector( Vector *vec );
+
+/** Give up a reference to a vector.  The vector is freed when its last
+    reference is released.
+    @param vec vector to release.
+*/
+void releaseVector( Vector *vec );
+
+/** Free the vectors this thread keeps for reuse.  This is for a thread
+    that's done with vectors, just before it exits.
+*/
+void freeVectorCache( void );
+
+/** Add an element to the end of a vector nothing else refers to.  This
+    takes amortized constant time.
+    @param vec vector to extend.
+    @param num value of the new element.
+*/
+void appendVector( Vector *vec, double num );
+
+/** Apply an operator to each pair of elements, dst[ i ] = a[ i ] op
+    b[ i ].  Either operand can be a single number instead, used with
+    every element of the other, and dst may be the same array as either
+    operand.
+    @param op operator to apply.
+    @param dst array for the results.
+    @param a left operand.
+    @param astep 1 if a is an array of len elements, 0 if it's a
+    single number.
+    @param b right operand.
+    @param bstep 1 if b is an array of len elements, 0 if it's a
+    single number.
+    @param len number of elements.
+*/
+void applyVectorOp( VecOp op, double *dst, double const *a, int astep,
+                    double const *b, int bstep, int len );
+
+/** Return the sum of an array of numbers.  Elements are added up in
+    eight interleaved partial sums, combined in a fixed order, then
+    the last few elements are added one at a time.  That's the same
+    order on every CPU, so the result never depends on which kernels
+    are in use.
+    @param a numbers to add.
+    @param len number of elements.
+    @return their sum, or zero if there aren't any.
+*/
+double sumVector( double const *a, int len );
+
+/** Return the smallest of an array of numbers, in the same order as
+    sumVector(), using a < b ? a : b for each step.
+    @param a numbers to look at.
+    @param len number of elements.
+    @return the smallest, or infinity if there aren't any.
+*/
+double minVector( double const *a, int len );
+
+/** Return the largest of an array of numbers, in the same order as
+    sumVector(), using a > b ? a : b for each step.
+    @param a numbers to look at.
+    @param len number of elements.
+    @return the largest, or negative infinity if there aren't any.
+*/
+double maxVector( double const *a, int len );
+
+/** Return the name of the kernels in use, choosing them if they
+    haven't been chosen yet.
+    @return "avx2", "sse2" or "scalar".
+*/
+char const *vectorKernels( void );
+
+/** Use a particular set of kernels from now on, for comparing them in
+    tests and benchmarks.
+    @param name "avx2", "sse2" or "scalar".
+    @return false if there's no such set, or the CPU doesn't support
+    it.
+*/
+bool selectVectorKernels( char const *name );
+
+#endif
@@ -0,0 +1,237 @@
+/**
+  @file vectest.c
+
+  Conformance test for the vector kernels.  For random arrays of every
+  length up to a few hundred, it checks that each set of kernels the
+  CPU supports gives exactly the bits of plain C arithmetic, element by
+  element, and that reductions give exactly the bits of adding up the
+  elements in the order sumVector() documents, apart from which NaN
+  comes out when two of them meet.  Inputs mix ordinary
+  numbers with zeros of both signs, infinities, NaNs, subnormals and
+  random bit patterns, and arrays start at every alignment, with
+  either operand a single number or the same array as the result.
+
+  Exits unsuccessfully, after reporting the first few differences, if
+  anything doesn't match.
+*/
+
+#include <math.h>
+
+#include "vec.h"
+#include "testutil.h"
+
+// Number of random cases to check with each set of kernels, unless a
+// count is given on the command line.
+#define DEFAULT_COUNT 20000
+
+// Longest generated array.
+#define MAX_LEN 300
+
+// Room for an array at any alignment.
+#define MAX_ARRAY ( MAX_LEN + 4 )
+
+// Number of partial results reductions work with.
+#define LANES 8
+
+/** Return a random element, usually an ordinary number, but sometimes
+    one that's hard to get right.
+    @return the number.
+*/
+static double randomElement( void )
+{
+  switch ( randomBelow( 12 ) ) {
+  case 0:
+    return randomBelow( 2 ) ? 0.0 : -0.0;
+  case 1:
+    return randomBelow( 2 ) ? INFINITY : -INFINITY;
+  case 2:
+    // A NaN with a random sign and payload.
+    return fromBits( 0x7ff8000000000000u | ( random64() >> 13 ) |
+                     ( random64() & 0x8000000000000000u ) );
+  case 3:
+    return fromBits( random64() & 0x800fffffffffffffu );
+  case 4:
+    return fromBits( random64() );
+  case 5:
+    return randomBelow( 7 ) - 3;
+  default:
+    return ldexp( (double) ( random64() >> 11 ), randomBelow( 80 ) - 60 ) *
+      ( randomBelow( 2 ) ? 1 : -1 );
+  }
+}
+
+/** Fill an array with random elements.
+    @param a array to fill.
+    @param len number of elements.
+*/
+static void fill( double *a, int len )
+{
+  for ( int i = 0; i < len; i++ )
+    a[ i ] = randomElement();
+}
+
+/** Apply an operator to two numbers, the way plain C does.
+    @param op operator to apply.
+    @param x left operand.
+    @param y right operand.
+    @return the result.
+*/
+static double expectOp( VecOp op, double x, double y )
+{
+  switch ( op ) {
+  case VEC_ADD:
+    return x + y;
+  case VEC_SUB:
+    return x - y;
+  case VEC_MUL:
+    return x * y;
+  case VEC_DIV:
+    return x / y;
+  default:
+    return x < y ? 1.0 : 0.0;
+  }
+}
+
+/** Combine two partial results of a reduction.
+    @param kind 0 for a sum, 1 for the smallest, 2 for the largest.
+    @param x first partial result.
+    @param y second partial result.
+    @return the combination.
+*/
+static double combine( int kind, double x, double y )
+{
+  if ( kind == 0 )
+    return x + y;
+  if ( kind == 1 )
+    return x < y ? x : y;
+  return x > y ? x : y;
+}
+
+/** Reduce an array in the order sumVector() documents.
+    @param kind 0 for a sum, 1 for the smallest, 2 for the largest.
+    @param a numbers to reduce.
+    @param len number of elements.
+    @return the result.
+*/
+static double expectReduce( int kind, double const *a, int len )
+{
+  static double const starts[] = { 0.0, INFINITY, -INFINITY };
+  double c[ LANES ];
+  for ( int k = 0; k < LANES; k++ )
+    c[ k ] = starts[ kind ];
+  int whole = len - len % LANES;
+  for ( int i = 0; i < whole; i++ )
+    c[ i % LANES ] = combine( kind, c[ i % LANES ], a[ i ] );
+
+  double result =
+    combine( kind,
+             combine( kind, combine( kind, c[ 0 ], c[ 4 ] ),
+                      combine( kind, c[ 2 ], c[ 6 ] ) ),
+             combine( kind, combine( kind, c[ 1 ], c[ 5 ] ),
+                      combine( kind, c[ 3 ], c[ 7 ] ) ) );
+  for ( int i = whole; i < len; i++ )
+    result = combine( kind, result, a[ i ] );
+  return result;
+}
+
+/** Return true if two results are the same.  When two NaNs meet in
+    arithmetic, C doesn't say which one comes out, and compilers swap
+    the operands of + and * freely, so any NaN matches any other.
+    @param a first result.
+    @param b second result.
+    @return true if they match.
+*/
+static bool sameResult( double a, double b )
+{
+  if ( isnan( a ) || isnan( b ) )
+    return isnan( a ) && isnan( b );
+  return toBits( a ) == toBits( b );
+}
+
+/** Count one result, and report it if it doesn't match.
+    @param what description of what was checked.
+    @param len length of the array it was checked on.
+    @param i element that was checked.
+    @param expected the right result.
+    @param actual the result the kernels gave.
+*/
+static void check( char const *what, int len, int i, double expected,
+                   double actual )
+{
+  if ( countCheck( sameResult( expected, actual ) ) )
+    printf( "%s %s, length %d, element %d: expected %a, got %a\n",
+            vectorKernels(), what, len, i, expected, actual );
+}
+
+/** Check one operator on random arrays, with the kernels in use.
+    @param op operator to check.
+*/
+static void checkOp( VecOp op )
+{
+  static char const *const names[] = { "add", "sub", "mul", "div", "less" };
+  double abuf[ MAX_ARRAY ], bbuf[ MAX_ARRAY ], dbuf[ MAX_ARRAY ];
+  double expected[ MAX_LEN ];
+
+  int len = randomBelow( MAX_LEN + 1 );
+  double *a = abuf + randomBelow( 4 );
+  double *b = bbuf + randomBelow( 4 );
+  double *dst = dbuf + randomBelow( 4 );
+  fill( a, len ? len : 1 );
+  fill( b, len ? len : 1 );
+
+  // Either operand can be a single number, and the result can go over
+  // either operand.
+  int astep = randomBelow( 4 ) != 0, bstep = randomBelow( 4 ) != 0;
+  for ( int i = 0; i < len; i++ )
+    expected[ i ] = expectOp( op, a[ i * astep ], b[ i * bstep ] );
+  int where = randomBelow( 3 );
+  if ( where == 1 && astep )
+    dst = a;
+  else if ( where == 2 && bstep )
+    dst = b;
+
+  applyVectorOp( op, dst, a, astep, b, bstep, len );
+  for ( int i = 0; i < len; i++ )
+    check( names[ op ], len, i, expected[ i ], dst[ i ] );
+}
+
+/** Check the reductions on a random array, with the kernels in use. */
+static void checkReductions( void )
+{
+  double buf[ MAX_ARRAY ];
+  int len = randomBelow( MAX_LEN + 1 );
+  double *a = buf + randomBelow( 4 );
+  fill( a, len );
+
+  // Without special values now and then, every sum would be a NaN.
+  if ( randomBelow( 2 ) )
+    for ( int i = 0; i < len; i++ )
+      if ( isnan( a[ i ] ) || isinf( a[ i ] ) )
+        a[ i ] = i;
+
+  check( "sum", len, -1, expectReduce( 0, a, len ), sumVector( a, len ) );
+  check( "min", len, -1, expectReduce( 1, a, len ), minVector( a, len ) );
+  check( "max", len, -1, expectReduce( 2, a, len ), maxVector( a, len ) );
+}
+
+int main( int argc, char *argv[] )
+{
+  long count = argc > 1 ? atol( argv[ 1 ] ) : DEFAULT_COUNT;
+
+  static char const *const sets[] = { "scalar", "sse2", "avx2" };
+  for ( int s = 0; s < sizeof( sets ) / sizeof( sets[ 0 ] ); s++ ) {
+    if ( !selectVectorKernels( sets[ s ] ) ) {
+      printf( "%s not supported\n", sets[ s ] );
+      continue;
+    }
+
+    // Use the same inputs for every set of kernels.
+    seed = 0x2545f4914f6cdd1du;
+    for ( long i = 0; i < count; i++ ) {
+      checkOp( (VecOp) randomBelow( VEC_LESS + 1 ) );
+      checkReductions();
+    }
+  }
+
+  return finishChecks();
+}
@@ -0,0 +1,717 @@
+#include "vm.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Initial capacity for the instruction and constant lists.
+#define INITIAL_CAPACITY 16
+
+// Deepest stack that's kept on the C stack while code runs.  Deeper
+// ones, like for a long vector literal, go on the heap.
+#define MAX_LOCAL_STACK 64
+
+/** Instructions for the virtual machine.  Each opcode is stored as an
+    int in the instruction list, followed by its operand if it has one. */
+typedef enum {
+  /** Push a constant, operand is its index in the constant list. */
+  OP_LIT,
+  /** Push the value of a variable, operand is its slot. */
+  OP_LOAD,
+  /** Pop a value and store it in a variable, operand is its slot. */
+  OP_STORE,
+  /** Pop a value and a key, and store the value under the key in the
+      map held by a variable, operand is its slot. */
+  OP_STORE_KEY,
+  /** Pop two values and push the result of an arithmetic operation.
+      If either one is a vector, the result is a temporary vector. */
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  /** Replace the top value with the result of arithmetic with a
+      number, operand is the index of the constant holding it.  This is
+      the usual form when the right operand is a literal, like i + 1,
+      and it saves pushing the literal. */
+  OP_ADD_NUM,
+  OP_SUB_NUM,
+  OP_MUL_NUM,
+  OP_DIV_NUM,
+  /** Pop two values and push the result of a comparison. */
+  OP_LESS,
+  OP_EQU,
+  /** Pop two values and push their concatenation, a temporary held by
+      the context. */
+  OP_CONCAT,
+  /** Pop a key and a map, and push the value stored under the key. */
+  OP_INDEX,
+  /** Call a built-in function.  The first operand is the function and
+      the second is the number of arguments, which are popped and
+      replaced with the result. */
+  OP_CALL,
+  /** Call a function the program defines.  The operands are the
+      function, the number of arguments, which are popped and replaced
+      with the result, and the line the call is on. */
+  OP_INVOKE,
+  /** Release the temporaries made since the code started running.
+      This only appears where nothing is on the stack. */
+  OP_RELEASE,
+  /** Replace the top value with a boolean for whether it's true, the
+      result of the last operand of a logical operator. */
+  OP_TEST,
+  /** If the top value is false, replace it with false and jump to the
+      operand.  Otherwise, pop it.  This skips the right operand of &&. */
+  OP_AND_JUMP,
+  /** If the top value is true, replace it with true and jump to the
+      operand.  Otherwise, pop it.  This skips the right operand of ||. */
+  OP_OR_JUMP,
+  /** Continue at the instruction given by the operand. */
+  OP_JUMP,
+  /** Release the temporaries made since the code started running, then
+      continue at the operand.  This is the jump back to the top of a
+      loop, so arithmetic on vectors doesn't pile up temporaries. */
+  OP_LOOP,
+  /** Pop a value and jump to the operand if it's false. */
+  OP_JUMP_FALSE,
+  /** Pop a value and jump to the operand if it's true. */
+  OP_JUMP_TRUE,
+  /** Pop two values and jump to the operand unless the first is less
+      than the second.  This is OP_LESS followed by OP_JUMP_FALSE, the
+      usual test at the top of a loop. */
+  OP_JUMP_NOT_LESS,
+  /** Pop two values and jump to the operand if the first is less than
+      the second. */
+  OP_JUMP_LESS,
+  /** Pop a value and jump to the second operand unless it's less than
+      the number in the constant given by the first.  This is
+      OP_JUMP_NOT_LESS for a literal on the right, like i < 100. */
+  OP_JUMP_NOT_LESS_NUM,
+  /** Pop a value and jump to the second operand if it's less than the
+      number in the constant given by the first. */
+  OP_JUMP_LESS_NUM,
+  /** Pop a value and print it. */
+  OP_PRINT,
+  /** Stop running. */
+  OP_HALT
+} OpCode;
+
+/** Hidden representation for compiled code. */
+struct CodeTag {
+  // List of instructions and their operands.
+  int *ops;
+
+  // Number of ints in the instruction list, and its capacity.
+  int len, cap;
+
+  // Constants used by OP_LIT.  The code holds a reference to the
+  // string in each of these.
+  Value *consts;
+
+  // Number of constants, and capacity of the constant list.
+  int clen, ccap;
+
+  // Stack depth at the current point during compilation.
+  int depth;
+
+  // Largest stack depth the code will need.
+  int maxDepth;
+};
+
+/** Add an int to the end of the instruction list.
+    @param code code to add to.
+    @param val opcode or operand to add.
+    @return index where val was stored.
+*/
+static int emit( Code *code, int val )
+{
+  if ( code->len >= code->cap ) {
+    code->cap *= 2;
+    code->ops = (int *) realloc( code->ops, code->cap * sizeof( int ) );
+  }
+  code->ops[ code->len ] = val;
+  return code->len++;
+}
+
+/** Record the effect an instruction has on the stack depth.
+    @param code code being compiled.
+    @param change number of values the instruction pushes, minus the
+    number it pops.
+*/
+static void adjustDepth( Code *code, int change )
+{
+  code->depth += change;
+  if ( code->depth > code->maxDepth )
+    code->maxDepth = code->depth;
+}
+
+/** Add a literal's value to the constant list.
+    @param code code to add the constant to.
+    @param val value of the constant.
+    @return index of the new constant.
+*/
+static int addConstant( Code *code, Value val )
+{
+  if ( code->clen >= code->ccap ) {
+    code->ccap *= 2;
+    code->consts = (Value *) realloc( code->consts,
+                                      code->ccap * sizeof( Value ) );
+  }
+
+  // The literal's value already has its number parsed.
+  retainValue( &val );
+
+  code->consts[ code->clen ] = val;
+  return code->clen++;
+}
+
+/** Return the constant for a literal that already has its number, so
+    an instruction can use it directly.
+    @param code code to add the constant to.
+    @param expr expression that might be such a literal.
+    @return index of the constant, or -1 if expr isn't one.
+*/
+static int numberConstant( Code *code, Expr *expr )
+{
+  if ( expr->kind != LITERAL_EXPR )
+    return -1;
+  Value val = literalValue( expr );
+  if ( val.type != NUM_VAL && !( val.type == STR_VAL && val.hasNum ) )
+    return -1;
+  return addConstant( code, val );
+}
+
+/** Emit instructions to evaluate an expression and push its value.
+    @param code code to add to.
+    @param expr expression to compile.
+*/
+static void compileExpr( Code *code, Expr *expr )
+{
+  if ( expr->kind == LITERAL_EXPR ) {
+    emit( code, OP_LIT );
+    emit( code, addConstant( code, literalValue( expr ) ) );
+    adjustDepth( code, 1 );
+    return;
+  }
+
+  if ( expr->kind == VAR_EXPR ) {
+    emit( code, OP_LOAD );
+    emit( code, variableExprSlot( expr ) );
+    adjustDepth( code, 1 );
+    return;
+  }
+
+  // Logical operators only evaluate their right operand if the left
+  // one doesn't decide the result.
+  if ( expr->kind == AND_EXPR || expr->kind == OR_EXPR ) {
+    compileExpr( code, binaryLeft( expr ) );
+    emit( code, expr->kind == AND_EXPR ? OP_AND_JUMP : OP_OR_JUMP );
+    int skip = emit( code, 0 );
+    adjustDepth( code, -1 );
+    compileExpr( code, binaryRight( expr ) );
+    emit( code, OP_TEST );
+    code->ops[ skip ] = code->len;
+    return;
+  }
+
+  // Calls evaluate their arguments left to right, then replace them
+  // with the result.
+  if ( expr->kind == CALL_EXPR ) {
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      compileExpr( code, callArg( expr, i ) );
+    emit( code, OP_CALL );
+    emit( code, callFunction( expr ) );
+    emit( code, callArgCount( expr ) );
+    adjustDepth( code, 1 - callArgCount( expr ) );
+    return;
+  }
+
+  if ( expr->kind == INVOKE_EXPR ) {
+    for ( int i = 0; i < callArgCount( expr ); i++ )
+      compileExpr( code, callArg( expr, i ) );
+    emit( code, OP_INVOKE );
+    emit( code, invokedFunction( expr ) );
+    emit( code, callArgCount( expr ) );
+    emit( code, expr->line );
+    adjustDepth( code, 1 - callArgCount( expr ) );
+    return;
+  }
+
+  // Everything else is a binary operator, evaluating both operands
+  // left to right.  Arithmetic with a literal doesn't need to push it.
+  compileExpr( code, binaryLeft( expr ) );
+  static OpCode const numberOps[] = {
+    [ SUM_EXPR ] = OP_ADD_NUM, [ DIFF_EXPR ] = OP_SUB_NUM,
+    [ PROD_EXPR ] = OP_MUL_NUM, [ QUOT_EXPR ] = OP_DIV_NUM
+  };
+  if ( expr->kind >= SUM_EXPR && expr->kind <= QUOT_EXPR ) {
+    int k = numberConstant( code, binaryRight( expr ) );
+    if ( k >= 0 ) {
+      emit( code, numberOps[ expr->kind ] );
+      emit( code, k );
+      return;
+    }
+  }
+  compileExpr( code, binaryRight( expr ) );
+
+  static OpCode const binaryOps[] = {
+    [ SUM_EXPR ] = OP_ADD, [ DIFF_EXPR ] = OP_SUB,
+    [ PROD_EXPR ] = OP_MUL, [ QUOT_EXPR ] = OP_DIV,
+    [ LESS_EXPR ] = OP_LESS, [ EQU_EXPR ] = OP_EQU,
+    [ CONCAT_EXPR ] = OP_CONCAT, [ INDEX_EXPR ] = OP_INDEX
+  };
+  emit( code, binaryOps[ expr->kind ] );
+  adjustDepth( code, -1 );
+}
+
+/** Emit a jump instruction whose target isn't known yet, adding it to
+    a chain of jumps that all go to the same place.  Until the chain is
+    patched, each jump's operand holds the index of the previous jump's
+    operand, or -1 for the first one.
+    @param code code to add to.
+    @param op jump instruction to emit.
+    @param chain chain of jumps to add this one to.
+*/
+static void chainJump( Code *code, OpCode op, int *chain )
+{
+  emit( code, op );
+  *chain = emit( code, *chain );
+}
+
+/** Point every jump in a chain at the given instruction.
+    @param code code containing the jumps.
+    @param chain chain of jumps to patch.
+    @param target index of the instruction they should jump to.
+*/
+static void patchChain( Code *code, int chain, int target )
+{
+  while ( chain >= 0 ) {
+    int next = code->ops[ chain ];
+    code->ops[ chain ] = target;
+    chain = next;
+  }
+}
+
+/** Emit instructions to evaluate a condition and jump if its truth
+    matches the one given.  Conditions branch directly, without making
+    a boolean value, and logical operators skip their right operand if
+    the left one decides the result.
+    @param code code to add to.
+    @param cond condition to compile.
+    @param when jump if the condition is true, or if it's false.
+    @param chain chain of jumps to add the new jumps to, to be patched
+    once we know where they should go.
+*/
+static void compileJump( Code *code, Expr *cond, bool when, int *chain )
+{
+  switch ( cond->kind ) {
+  case AND_EXPR:
+  case OR_EXPR: {
+    // If the left operand alone decides the result, jump or skip the
+    // right operand; otherwise, the right operand decides.
+    bool decides = cond->kind == OR_EXPR;
+    if ( decides == when ) {
+      compileJump( code, binaryLeft( cond ), when, chain );
+      compileJump( code, binaryRight( cond ), when, chain );
+    } else {
+      int skip = -1;
+      compileJump( code, binaryLeft( cond ), decides, &skip );
+      compileJump( code, binaryRight( cond ), when, chain );
+      patchChain( code, skip, code->len );
+    }
+    break;
+  }
+
+  case LESS_EXPR: {
+    compileExpr( code, binaryLeft( cond ) );
+    int k = numberConstant( code, binaryRight( cond ) );
+    if ( k >= 0 ) {
+      emit( code, when ? OP_JUMP_LESS_NUM : OP_JUMP_NOT_LESS_NUM );
+      emit( code, k );
+      *chain = emit( code, *chain );
+      adjustDepth( code, -1 );
+      break;
+    }
+    compileExpr( code, binaryRight( cond ) );
+    chainJump( code, when ? OP_JUMP_LESS : OP_JUMP_NOT_LESS, chain );
+    adjustDepth( code, -2 );
+    break;
+  }
+
+  default:
+    compileExpr( code, cond );
+    chainJump( code, when ? OP_JUMP_TRUE : OP_JUMP_FALSE, chain );
+    adjustDepth( code, -1 );
+    break;
+  }
+}
+
+/** Emit an instruction to release the temporaries made by a condition,
+    if it makes any.  This goes on both paths out of the condition.
+    @param code code to add to.
+    @param cond condition that was just tested.
+*/
+static void compileRelease( Code *code, Expr *cond )
+{
+  if ( makesTemporaries( cond ) )
+    emit( code, OP_RELEASE );
+}
+
+/** Emit instructions to execute a statement.
+    @param code code to add to.
+    @param stmt statement to compile.
+*/
+static void compileBody( Code *code, Stmt *stmt )
+{
+  switch ( stmt->kind ) {
+  case PRINT_STMT:
+    compileExpr( code, stmtExpr( stmt ) );
+    emit( code, OP_PRINT );
+    adjustDepth( code, -1 );
+    if ( makesTemporaries( stmtExpr( stmt ) ) )
+      emit( code, OP_RELEASE );
+    break;
+
+  case ASSIGN_STMT:
+    compileExpr( code, stmtExpr( stmt ) );
+    emit( code, OP_STORE );
+    emit( code, assignSlot( stmt ) );
+    adjustDepth( code, -1 );
+    if ( makesTemporaries( stmtExpr( stmt ) ) )
+      emit( code, OP_RELEASE );
+    break;
+
+  case ASSIGN_KEY_STMT:
+    compileExpr( code, assignKey( stmt ) );
+    compileExpr( code, stmtExpr( stmt ) );
+    emit( code, OP_STORE_KEY );
+    emit( code, assignSlot( stmt ) );
+    adjustDepth( code, -2 );
+    if ( makesTemporaries( assignKey( stmt ) ) ||
+         makesTemporaries( stmtExpr( stmt ) ) )
+      emit( code, OP_RELEASE );
+    break;
+
+  case COMPOUND_STMT:
+    for ( int i = 0; i < compoundLength( stmt ); i++ )
+      compileBody( code, compoundStmt( stmt, i ) );
+    break;
+
+  case IF_STMT: {
+    int exit = -1;
+    compileJump( code, stmtExpr( stmt ), false, &exit );
+    compileRelease( code, stmtExpr( stmt ) );
+
+    compileBody( code, stmtBody( stmt ) );
+    patchChain( code, exit, code->len );
+    compileRelease( code, stmtExpr( stmt ) );
+    break;
+  }
+
+  case WHILE_STMT: {
+    int top = code->len;
+    int exit = -1;
+    compileJump( code, stmtExpr( stmt ), false, &exit );
+    compileRelease( code, stmtExpr( stmt ) );
+
+    compileBody( code, stmtBody( stmt ) );
+    emit( code, OP_LOOP );
+    emit( code, top );
+    patchChain( code, exit, code->len );
+    compileRelease( code, stmtExpr( stmt ) );
+    break;
+  }
+
+  default:
+    // Function definitions are run by the tree-walking interpreter,
+    // and the statements in a function's body only run there.
+    break;
+  }
+}
+
+Code *compileStmt( Stmt *stmt )
+{
+  Code *code = (Code *) malloc( sizeof( Code ) );
+  code->len = 0;
+  code->cap = INITIAL_CAPACITY;
+  code->ops = (int *) malloc( code->cap * sizeof( int ) );
+  code->clen = 0;
+  code->ccap = INITIAL_CAPACITY;
+  code->consts = (Value *) malloc( code->ccap * sizeof( Value ) );
+  code->depth = 0;
+  code->maxDepth = 0;
+
+  compileBody( code, stmt );
+  emit( code, OP_HALT );
+  return code;
+}
+
+void runCode( Code *code, Context *ctxt )
+{
+  // Stack for the values of expressions.  The compiler worked out how
+  // deep it can get, so we never need to check for overflow.
+  Value local[ MAX_LOCAL_STACK ];
+  Value *stack = code->maxDepth < MAX_LOCAL_STACK ? local :
+    (Value *) malloc( ( code->maxDepth + 1 ) * sizeof( Value ) );
+  Value *sp = stack;
+  int const *ops = code->ops;
+  Value const *consts = code->consts;
+  Value const *k;
+  int pc = 0;
+
+  // Temporaries made before we started belong to whoever ran us.
+  int mark = temporaryMark( ctxt );
+
+  for ( ;; ) {
+    switch ( ops[ pc++ ] ) {
+    case OP_LIT:
+      *sp++ = consts[ ops[ pc++ ] ];
+      break;
+
+    case OP_LOAD:
+      *sp++ = getSlot( ctxt, ops[ pc++ ] );
+      break;
+
+    case OP_STORE:
+      setSlot( ctxt, ops[ pc++ ], *--sp );
+      break;
+
+    case OP_STORE_KEY:
+      sp -= 2;
+      setSlotKey( ctxt, ops[ pc++ ], sp, sp[ 1 ] );
+      break;
+
+    case OP_ADD:
+      sp--;
+      if ( sp[ -1 ].type == NUM_VAL && sp->type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num + sp->num );
+      else if ( hasVector( sp - 1, sp ) )
+        sp[ -1 ] = vectorArith( ctxt, VEC_ADD, sp - 1, sp );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) + toNumber( sp ) );
+      break;
+
+    case OP_SUB:
+      sp--;
+      if ( sp[ -1 ].type == NUM_VAL && sp->type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num - sp->num );
+      else if ( hasVector( sp - 1, sp ) )
+        sp[ -1 ] = vectorArith( ctxt, VEC_SUB, sp - 1, sp );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) - toNumber( sp ) );
+      break;
+
+    case OP_MUL:
+      sp--;
+      if ( sp[ -1 ].type == NUM_VAL && sp->type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num * sp->num );
+      else if ( hasVector( sp - 1, sp ) )
+        sp[ -1 ] = vectorArith( ctxt, VEC_MUL, sp - 1, sp );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) * toNumber( sp ) );
+      break;
+
+    case OP_DIV:
+      sp--;
+      if ( sp[ -1 ].type == NUM_VAL && sp->type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num / sp->num );
+      else if ( hasVector( sp - 1, sp ) )
+        sp[ -1 ] = vectorArith( ctxt, VEC_DIV, sp - 1, sp );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) / toNumber( sp ) );
+      break;
+
+    case OP_ADD_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      if ( sp[ -1 ].type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num + k->num );
+      else if ( sp[ -1 ].type == VEC_VAL )
+        sp[ -1 ] = vectorArith( ctxt, VEC_ADD, sp - 1, k );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) + k->num );
+      break;
+
+    case OP_SUB_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      if ( sp[ -1 ].type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num - k->num );
+      else if ( sp[ -1 ].type == VEC_VAL )
+        sp[ -1 ] = vectorArith( ctxt, VEC_SUB, sp - 1, k );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) - k->num );
+      break;
+
+    case OP_MUL_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      if ( sp[ -1 ].type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num * k->num );
+      else if ( sp[ -1 ].type == VEC_VAL )
+        sp[ -1 ] = vectorArith( ctxt, VEC_MUL, sp - 1, k );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) * k->num );
+      break;
+
+    case OP_DIV_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      if ( sp[ -1 ].type == NUM_VAL )
+        sp[ -1 ].num = roundNumber( sp[ -1 ].num / k->num );
+      else if ( sp[ -1 ].type == VEC_VAL )
+        sp[ -1 ] = vectorArith( ctxt, VEC_DIV, sp - 1, k );
+      else
+        sp[ -1 ] = makeArithValue( toNumber( sp - 1 ) / k->num );
+      break;
+
+    case OP_LESS:
+      sp--;
+      if ( hasVector( sp - 1, sp ) )
+        sp[ -1 ] = vectorArith( ctxt, VEC_LESS, sp - 1, sp );
+      else
+        sp[ -1 ] = makeBoolValue( toNumber( sp - 1 ) < toNumber( sp ) );
+      break;
+
+    case OP_EQU:
+      sp--;
+      sp[ -1 ] = makeBoolValue( valueEquals( sp - 1, sp ) );
+      break;
+
+    case OP_CONCAT:
+      sp--;
+      sp[ -1 ] = concatValues( ctxt, sp - 1, sp );
+      break;
+
+    case OP_INDEX:
+      sp--;
+      sp[ -1 ] = lookupKey( sp - 1, sp );
+      break;
+
+    case OP_CALL: {
+      Builtin fn = ops[ pc++ ];
+      int argc = ops[ pc++ ];
+      sp -= argc;
+      *sp = callBuiltin( ctxt, fn, sp, argc );
+      sp++;
+      break;
+    }
+
+    case OP_INVOKE: {
+      int fn = ops[ pc++ ];
+      int argc = ops[ pc++ ];
+      sp -= argc;
+      for ( int i = 0; i < argc; i++ )
+        pushArgument( ctxt, sp[ i ] );
+      *sp++ = invokeFunction( ctxt, fn, argc, ops[ pc++ ] );
+      break;
+    }
+
+    case OP_RELEASE:
+      releaseTemporaries( ctxt, mark );
+      break;
+
+    case OP_TEST:
+      sp[ -1 ] = makeBoolValue( isTrue( sp - 1 ) );
+      break;
+
+    case OP_AND_JUMP:
+      if ( isTrue( sp - 1 ) ) {
+        sp--;
+        pc++;
+      } else {
+        sp[ -1 ] = makeBoolValue( false );
+        pc = ops[ pc ];
+      }
+      break;
+
+    case OP_OR_JUMP:
+      if ( isTrue( sp - 1 ) ) {
+        sp[ -1 ] = makeBoolValue( true );
+        pc = ops[ pc ];
+      } else {
+        sp--;
+        pc++;
+      }
+      break;
+
+    case OP_JUMP:
+      pc = ops[ pc ];
+      break;
+
+    case OP_LOOP:
+      releaseTemporaries( ctxt, mark );
+      pc = ops[ pc ];
+      break;
+
+    case OP_JUMP_FALSE:
+      if ( isTrue( --sp ) )
+        pc++;
+      else
+        pc = ops[ pc ];
+      break;
+
+    case OP_JUMP_TRUE:
+      if ( isTrue( --sp ) )
+        pc = ops[ pc ];
+      else
+        pc++;
+      break;
+
+    case OP_JUMP_NOT_LESS:
+      // Comparing a vector makes a vector, which is always true.
+      sp -= 2;
+      if ( sp->type == NUM_VAL && sp[ 1 ].type == NUM_VAL ?
+           sp->num < sp[ 1 ].num :
+           hasVector( sp, sp + 1 ) || toNumber( sp ) < toNumber( sp + 1 ) )
+        pc++;
+      else
+        pc = ops[ pc ];
+      break;
+
+    case OP_JUMP_LESS:
+      sp -= 2;
+      if ( sp->type == NUM_VAL && sp[ 1 ].type == NUM_VAL ?
+           sp->num < sp[ 1 ].num :
+           hasVector( sp, sp + 1 ) || toNumber( sp ) < toNumber( sp + 1 ) )
+        pc = ops[ pc ];
+      else
+        pc++;
+      break;
+
+    case OP_JUMP_NOT_LESS_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      sp--;
+      if ( sp->type == NUM_VAL ? sp->num < k->num :
+           sp->type == VEC_VAL || toNumber( sp ) < k->num )
+        pc++;
+      else
+        pc = ops[ pc ];
+      break;
+
+    case OP_JUMP_LESS_NUM:
+      k = &consts[ ops[ pc++ ] ];
+      sp--;
+      if ( sp->type == NUM_VAL ? sp->num < k->num :
+           sp->type == VEC_VAL || toNumber( sp ) < k->num )
+        pc = ops[ pc ];
+      else
+        pc++;
+      break;
+
+    case OP_PRINT:
+      sp--;
+      printValue( sp );
+      break;
+
+    case OP_HALT:
+      releaseTemporaries( ctxt, mark );
+      if ( stack != local )
+        free( stack );
+      return;
+    }
+  }
+}
+
+void freeCode( Code *code )
+{
+  for ( int i = 0; i < code->clen; i++ )
+    releaseValue( &code->consts[ i ] );
+  free( code->consts );
+  free( code->ops );
+  free( code );
+}
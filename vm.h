@@ -0,0 +1,49 @@
+/**
+  @file vm.h
+
+  Bytecode compiler and stack-based virtual machine, an alternative to
+  executing statements by walking the tree.
+
+  On loops of arithmetic and comparisons, run with --no-jit, the VM
+  is about 1.2 to 2 times as fast as the tree walker, in the default
+  build or at -O2.  Both engines share the same values, variable
+  slots and rounding of results, which is where most of the remaining
+  time goes, so it's nowhere near the several-fold gain that was
+  hoped for.  That comes from compiling hot loops to native code
+  instead, which only the tree walker does (see jit.h).
+*/
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "expr.h"
+#include "stmt.h"
+
+/**
+   Short typename for a compiled statement.  Its representation is
+   private to the virtual machine.
+*/
+typedef struct CodeTag Code;
+
+/** Compile the given statement into bytecode.  The compiled code
+    doesn't refer back to the statement, so the statement can be
+    destroyed as soon as this returns.
+    @param stmt statement to compile.
+    @return new compiled code.  The caller must eventually free this
+    with freeCode().
+*/
+Code *compileStmt( Stmt *stmt );
+
+/** Run the given compiled code, the same way the statement it was
+    compiled from would have executed.
+    @param code code to run.
+    @param ctxt current values of all variables.
+*/
+void runCode( Code *code, Context *ctxt );
+
+/** Free all the memory associated with compiled code.
+    @param code code to free.
+*/
+void freeCode( Code *code );
+
+#endif